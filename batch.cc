@@ -0,0 +1,326 @@
+#include "batch.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <system_error>
+#include <thread>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_replace.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "command_stats.h"
+#include "disk_copy.h"
+#include "image_source.h"
+#include "uring_reader.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Output path for `input`, which is `relative` below the directory being
+// processed: `relative` with its extension replaced, under `output_dir` (or
+// next to `input` if there is no output_dir).
+std::string DerivedOutput(const fs::path& input, fs::path relative,
+                          const Command command,
+                          const std::string_view output_dir) {
+  relative.replace_extension(command == Command::CREATE ? ".dc42" : ".img");
+  if (output_dir.empty()) {
+    return (input.parent_path() / relative.filename()).string();
+  }
+  return (fs::path(std::string(output_dir)) / relative).string();
+}
+
+absl::Status CheckBatchCommand(const Command command) {
+  if (command != Command::CREATE && command != Command::EXTRACT &&
+      command != Command::FINGERPRINT && command != Command::USAGE &&
+      command != Command::VERIFY) {
+    return absl::InvalidArgumentError(
+        "batch runs only `create`, `extract`, `fingerprint`, `usage` or "
+        "`verify`");
+  }
+  return absl::OkStatus();
+}
+
+// Whether `command` writes an output file for each image.
+bool WritesOutput(const Command command) {
+  return command == Command::CREATE || command == Command::EXTRACT;
+}
+
+// Whether `output` names the file `input`, so that writing it would
+// truncate the image being read (e.g. `create` over x.dc42, whose derived
+// output is x.dc42 again).
+bool SameFile(const std::string& input, const std::string& output) {
+  std::error_code ec;
+  if (fs::equivalent(input, output, ec)) return true;
+  return fs::absolute(input, ec).lexically_normal() ==
+         fs::absolute(output, ec).lexically_normal();
+}
+
+absl::Status RunOne(const Command command, const BatchEntry& entry,
+                    const BatchOptions& options, CommandStats* const stats,
+                    std::string& detail) {
+  if (WritesOutput(command)) {
+    if (SameFile(entry.input, entry.output)) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Output '", entry.output, "' is the input; give --output_dir or "
+          "an output in the manifest"));
+    }
+    const fs::path parent = fs::path(entry.output).parent_path();
+    std::error_code ec;
+    if (!parent.empty()) fs::create_directories(parent, ec);
+    if (ec) {
+      return absl::ResourceExhaustedError(absl::StrCat(
+          "Could not create directory '", parent.string(), "': ",
+          ec.message()));
+    }
+  }
+  switch (command) {
+    case Command::CREATE:
+      return CreateCommand(entry.input, entry.output, false, stats);
+    case Command::EXTRACT:
+      return ExtractCommand(entry.input, entry.output,
+                            options.ignore_data_checksum, options.kernel_copy,
+                            options.sparse, false, stats)
+          .status();
+    case Command::FINGERPRINT:
+      return FingerprintCommand(entry.input, options.fingerprint_index,
+                                options.fingerprint_blocks, false)
+          .status();
+    case Command::USAGE: {
+      auto usage = UsageCommand(entry.input, "", false);
+      if (!usage.ok()) {
+        return usage.status();
+      }
+      detail = usage->DebugString();
+      return absl::OkStatus();
+    }
+    case Command::VERIFY:
+      return VerifyCommand(entry.input, options.skip_first_tag, false,
+                           options.verify_index, stats);
+    default:
+      return CheckBatchCommand(command);
+  }
+}
+
+// As VerifyCommand on each of `entries`, `entries.size()` images at a time,
+// reading their headers and then their data and tag sections through
+// `reader`. The reads of all the images overlap, so each is charged the
+// time until its last chunk arrived, less its own checksum time.
+void VerifyWithUring(UringReader& reader,
+                     const absl::Span<const BatchEntry> entries,
+                     const BatchOptions& options,
+                     const absl::Span<BatchResult> results) {
+  std::vector<int> fds(entries.size(), -1);
+  absl::Cleanup close_fds = [&fds] {
+    for (const int fd : fds) {
+      if (fd >= 0) close(fd);
+    }
+  };
+  std::vector<std::array<char, DiskCopyHeader::kHeaderLength>> header_bytes(
+      entries.size());
+  std::vector<size_t> pending;
+  std::vector<UringReader::Range> ranges;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    results[i].entry = entries[i];
+    results[i].stats.Enter(Phase::OPEN);
+    fds[i] = open(entries[i].input.c_str(), O_RDONLY);
+    results[i].stats.Stop();
+    if (fds[i] < 0) {
+      results[i].status = absl::NotFoundError(absl::StrCat(
+          "Could not open disk_copy '", entries[i].input, "'"));
+      continue;
+    }
+    results[i].stats.Count(Phase::OPEN, 0);
+    pending.push_back(i);
+    ranges.push_back({fds[i], 0, DiskCopyHeader::kHeaderLength});
+  }
+  absl::Time start = absl::Now();
+  auto header_statuses = reader.Read(
+      ranges, [&](size_t r, const char* chunk, size_t chunk_size) {
+        memcpy(header_bytes[pending[r]].data(), chunk, chunk_size);
+        return absl::OkStatus();
+      });
+  const absl::Duration header_wall = absl::Now() - start;
+
+  std::vector<size_t> verifying;
+  std::vector<DiskCopyHeader::ChecksumVerifier> verifiers;
+  ranges.clear();
+  for (size_t r = 0; r < pending.size(); ++r) {
+    const size_t i = pending[r];
+    results[i].stats.AddWall(Phase::HEADER, header_wall);
+    if (!header_statuses[r].ok()) {
+      results[i].status = absl::OutOfRangeError(absl::StrCat(
+          "Could not read ", DiskCopyHeader::kHeaderLength, " bytes"));
+      continue;
+    }
+    MemoryImageSource source(header_bytes[i]);
+    auto header = DiskCopyHeader::ReadFromDisk(source);
+    if (!header.ok()) {
+      results[i].status = header.status();
+      continue;
+    }
+    results[i].stats.Count(Phase::HEADER, DiskCopyHeader::kHeaderLength);
+    verifying.push_back(i);
+    verifiers.emplace_back(*header, options.skip_first_tag);
+    ranges.push_back({fds[i], DiskCopyHeader::kHeaderLength,
+                      verifiers.back().Remaining()});
+  }
+  start = absl::Now();
+  std::vector<absl::Time> last_chunk(verifying.size(), start);
+  auto statuses = reader.Read(
+      ranges, [&](size_t r, const char* chunk, size_t chunk_size) {
+        CommandStats& stats = results[verifying[r]].stats;
+        stats.Count(Phase::READ, chunk_size);
+        const absl::Time arrived = absl::Now();
+        auto status = verifiers[r].Update(chunk, chunk_size);
+        last_chunk[r] = absl::Now();
+        stats.Count(Phase::CHECKSUM, chunk_size);
+        stats.AddWall(Phase::CHECKSUM, last_chunk[r] - arrived);
+        return status;
+      });
+  for (size_t r = 0; r < verifying.size(); ++r) {
+    BatchResult& result = results[verifying[r]];
+    result.stats.AddWall(Phase::READ,
+                         last_chunk[r] - start -
+                             result.stats.phase(Phase::CHECKSUM).wall);
+    result.status =
+        statuses[r].ok() ? verifiers[r].Results().Overall() : statuses[r];
+  }
+}
+
+}  // namespace
+
+absl::StatusOr<std::vector<BatchEntry>> ReadBatchManifest(
+    const std::string_view manifest_path, const Command command,
+    const std::string_view output_dir) {
+  auto command_status = CheckBatchCommand(command);
+  if (!command_status.ok()) {
+    return command_status;
+  }
+  std::ifstream manifest{std::string(manifest_path)};
+  if (!manifest.good()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open manifest '", manifest_path, "'"));
+  }
+  std::vector<BatchEntry> entries;
+  std::string line;
+  while (std::getline(manifest, line)) {
+    std::string_view l = absl::StripTrailingAsciiWhitespace(line);
+    if (l.empty() || l[0] == '#') continue;
+    std::vector<std::string_view> fields =
+        absl::StrSplit(l, absl::MaxSplits('\t', 1));
+    BatchEntry entry{std::string(fields[0]),
+                     fields.size() > 1 ? std::string(fields[1]) : ""};
+    if (entry.output.empty() && WritesOutput(command)) {
+      const fs::path input(entry.input);
+      entry.output =
+          DerivedOutput(input, input.filename(), command, output_dir);
+    }
+    entries.push_back(std::move(entry));
+  }
+  if (manifest.bad()) {
+    return absl::DataLossError(
+        absl::StrCat("Error reading manifest '", manifest_path, "'"));
+  }
+  return entries;
+}
+
+absl::StatusOr<std::vector<BatchEntry>> FindBatchImages(
+    const std::string_view root, const std::string_view suffix,
+    const Command command, const std::string_view output_dir) {
+  auto command_status = CheckBatchCommand(command);
+  if (!command_status.ok()) {
+    return command_status;
+  }
+  std::vector<BatchEntry> entries;
+  std::error_code ec;
+  const fs::path root_path{std::string(root)};
+  for (auto it = fs::recursive_directory_iterator(root_path, ec);
+       !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+    if (!it->is_regular_file(ec)) continue;
+    const fs::path& path = it->path();
+    if (!absl::EndsWith(path.filename().string(), suffix)) continue;
+    BatchEntry entry{path.string(), ""};
+    if (WritesOutput(command)) {
+      entry.output = DerivedOutput(path, path.lexically_relative(root_path),
+                                   command, output_dir);
+    }
+    entries.push_back(std::move(entry));
+  }
+  if (ec) {
+    return absl::NotFoundError(absl::StrCat("Could not list directory '",
+                                            root, "': ", ec.message()));
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const BatchEntry& a, const BatchEntry& b) {
+              return a.input < b.input;
+            });
+  return entries;
+}
+
+std::vector<BatchResult> RunBatch(const Command command,
+                                  const std::vector<BatchEntry>& entries,
+                                  const BatchOptions& options) {
+  std::vector<BatchResult> results(entries.size());
+  if (entries.empty()) return results;
+  // The io_uring path does not keep checksum indexes.
+  if (command == Command::VERIFY && options.io_uring &&
+      !options.verify_index.write && !options.verify_index.incremental) {
+    UringReader::Options uring_options;
+    uring_options.queue_depth = options.io_uring_depth;
+    auto reader = UringReader::Create(uring_options);
+    if (reader.ok()) {
+      const size_t group = std::max(options.jobs, 1);
+      for (size_t first = 0; first < entries.size(); first += group) {
+        const size_t n = std::min(group, entries.size() - first);
+        VerifyWithUring(**reader,
+                        absl::MakeConstSpan(entries).subspan(first, n),
+                        options, absl::MakeSpan(results).subspan(first, n));
+      }
+      return results;
+    }
+  }
+  std::atomic<size_t> next{0};
+  auto worker = [&]() {
+    for (size_t i = next++; i < entries.size(); i = next++) {
+      results[i].entry = entries[i];
+      results[i].status =
+          RunOne(command, entries[i], options, &results[i].stats,
+                 results[i].detail);
+    }
+  };
+  const size_t jobs =
+      std::clamp<size_t>(std::max(options.jobs, 1), 1, entries.size());
+  std::vector<std::thread> workers;
+  for (size_t j = 1; j < jobs; ++j) workers.emplace_back(worker);
+  worker();
+  for (auto& w : workers) w.join();
+  return results;
+}
+
+void WriteBatchReport(const std::vector<BatchResult>& results,
+                      std::ostream& out) {
+  for (const BatchResult& r : results) {
+    out << r.entry.input << '\t'
+        << (r.status.ok() ? "OK" : absl::StatusCodeToString(r.status.code()))
+        << '\t'
+        << absl::StrReplaceAll(r.status.ok() ? std::string_view(r.detail)
+                                               : r.status.message(),
+                               {{"\t", " "}, {"\n", " "}})
+        << '\n';
+  }
+}
@@ -0,0 +1,87 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+// Running create, extract, fingerprint, usage or verify over many images
+// with a pool of worker threads, e.g. for an archive-wide integrity sweep.
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "command_stats.h"
+#include "disk_copy_commands.h"
+
+// One image to process. For `verify`, `fingerprint` and `usage`, only
+// `input` is used. For `extract`, `input` is the DC42 file and `output` the
+// raw image; for `create` the other way around.
+struct BatchEntry {
+  std::string input;
+  std::string output;
+};
+
+struct BatchResult {
+  BatchEntry entry;
+  absl::Status status;
+  // The phases of create, extract or verify on this image (see
+  // command_stats.h); empty for fingerprint and usage.
+  CommandStats stats;
+  // For usage: the volume's statistics, as VolumeUsage::DebugString().
+  std::string detail;
+};
+
+struct BatchOptions {
+  // Number of images processed at once; each worker has at most one image
+  // open, so this also bounds the I/O in flight.
+  int jobs = 1;
+  bool ignore_data_checksum = false;
+  bool kernel_copy = true;
+  // For extract: the holes to leave in the raw images.
+  SparseMode sparse = SparseMode::NONE;
+  // For verify: leave the first 12 tag bytes out of the tag checksum.
+  bool skip_first_tag = true;
+  // For verify: read all the images of a run of `jobs` of them at once
+  // through io_uring, with up to `io_uring_depth` reads in flight, rather
+  // than one synchronous read per worker. Falls back to the workers where
+  // io_uring is unavailable.
+  bool io_uring = false;
+  unsigned io_uring_depth = 64;
+  // For verify: what to do with each image's checksum index. Either option
+  // turns off io_uring.
+  VerifyIndexOptions verify_index;
+  // For fingerprint: the index every image is appended to, and what is
+  // hashed.
+  std::string fingerprint_index;
+  FingerprintBlocks fingerprint_blocks = FingerprintBlocks::SECTOR;
+};
+
+// Reads a manifest with one image per line. A line holds the input path,
+// optionally followed by a tab and the output path; blank lines and lines
+// starting with '#' are skipped. For extract and create, a missing output
+// path is derived from the input file name, placed in `output_dir`.
+absl::StatusOr<std::vector<BatchEntry>> ReadBatchManifest(
+    std::string_view manifest_path, Command command,
+    std::string_view output_dir);
+
+// Finds the regular files under `root` whose names end in `suffix`, sorted
+// by path. For extract and create, outputs mirror the tree below `root`
+// under `output_dir`.
+absl::StatusOr<std::vector<BatchEntry>> FindBatchImages(
+    std::string_view root, std::string_view suffix, Command command,
+    std::string_view output_dir);
+
+// Runs `command` (CREATE, EXTRACT, FINGERPRINT, USAGE or VERIFY) on every
+// entry, with the same result for each as running the command on its own.
+// Results are in the order of `entries`.
+std::vector<BatchResult> RunBatch(Command command,
+                                  const std::vector<BatchEntry>& entries,
+                                  const BatchOptions& options);
+
+// Writes one tab-separated line per result: the input path, "OK" or the
+// status code name, and the error message, or the detail of a success.
+void WriteBatchReport(const std::vector<BatchResult>& results,
+                      std::ostream& out);
+
+#endif  // __BATCH_H__
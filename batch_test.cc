@@ -0,0 +1,219 @@
+#include "batch.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "command_stats.h"
+#include "disk_copy.h"
+#include "fingerprint.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test_images.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+class BatchTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    root_ = testing::TempDir() + "/batch_test";
+    fs::remove_all(root_);
+    fs::create_directories(root_ + "/raw/sub");
+    WriteFile(root_ + "/raw/a.img", TestHFSImage(1600, 'a', "Test"));
+    WriteFile(root_ + "/raw/sub/b.img", TestHFSImage(1600, 'b', "Test"));
+  }
+
+  std::string root_;
+};
+
+}  // namespace
+
+TEST_F(BatchTest, CreateVerifyExtractRoundTrip) {
+  auto raw = FindBatchImages(root_ + "/raw", ".img", Command::CREATE,
+                             root_ + "/dc42");
+  ASSERT_TRUE(raw.ok()) << raw.status();
+  ASSERT_EQ(2, raw->size());
+  EXPECT_EQ(root_ + "/dc42/sub/b.dc42", (*raw)[1].output);
+
+  BatchOptions options;
+  options.jobs = 4;
+  for (const auto& r : RunBatch(Command::CREATE, *raw, options)) {
+    EXPECT_TRUE(r.status.ok()) << r.entry.input << ": " << r.status;
+    EXPECT_EQ(1600 * 512, r.stats.phase(Phase::CHECKSUM).bytes);
+    EXPECT_EQ(2, r.stats.phase(Phase::OPEN).calls);
+  }
+
+  auto dc42 = FindBatchImages(root_ + "/dc42", ".dc42", Command::EXTRACT,
+                              root_ + "/out");
+  ASSERT_TRUE(dc42.ok()) << dc42.status();
+  ASSERT_EQ(2, dc42->size());
+  BatchStats verify_stats;
+  for (const auto& r : RunBatch(Command::VERIFY, *dc42, options)) {
+    EXPECT_TRUE(r.status.ok()) << r.entry.input << ": " << r.status;
+    verify_stats.Add(r.stats);
+  }
+  EXPECT_EQ(2, verify_stats.images());
+  EXPECT_EQ(2 * 1600 * 512,
+            verify_stats.totals().phase(Phase::CHECKSUM).bytes);
+  EXPECT_EQ(2 * DiskCopyHeader::kHeaderLength,
+            verify_stats.totals().phase(Phase::HEADER).bytes);
+  for (const auto& r : RunBatch(Command::EXTRACT, *dc42, options)) {
+    EXPECT_TRUE(r.status.ok()) << r.entry.input << ": " << r.status;
+  }
+  EXPECT_EQ(ReadFile(root_ + "/raw/a.img"), ReadFile(root_ + "/out/a.img"));
+  EXPECT_EQ(ReadFile(root_ + "/raw/sub/b.img"),
+            ReadFile(root_ + "/out/sub/b.img"));
+}
+
+TEST_F(BatchTest, ManifestReportsEachImage) {
+  const std::string manifest = root_ + "/manifest.txt";
+  std::ofstream(manifest) << "# images to encode\n"
+                          << root_ << "/raw/a.img\t" << root_ << "/a.dc42\n"
+                          << "\n"
+                          << root_ << "/missing.img\n";
+  auto entries = ReadBatchManifest(manifest, Command::CREATE, root_ + "/gen");
+  ASSERT_TRUE(entries.ok()) << entries.status();
+  ASSERT_EQ(2, entries->size());
+  EXPECT_EQ(root_ + "/a.dc42", (*entries)[0].output);
+  EXPECT_EQ(root_ + "/gen/missing.dc42", (*entries)[1].output);
+
+  auto results = RunBatch(Command::CREATE, *entries, BatchOptions());
+  ASSERT_EQ(2, results.size());
+  EXPECT_TRUE(results[0].status.ok()) << results[0].status;
+  EXPECT_FALSE(results[1].status.ok());
+
+  std::ostringstream report;
+  WriteBatchReport(results, report);
+  EXPECT_THAT(report.str(),
+              testing::StartsWith(root_ + "/raw/a.img\tOK\t\n" + root_ +
+                                  "/missing.img\tNOT_FOUND\t"));
+}
+
+TEST_F(BatchTest, FingerprintAppendsEveryImage) {
+  auto raw = FindBatchImages(root_ + "/raw", ".img", Command::CREATE,
+                             root_ + "/dc42");
+  ASSERT_TRUE(raw.ok()) << raw.status();
+  BatchOptions options;
+  options.jobs = 4;
+  for (const auto& r : RunBatch(Command::CREATE, *raw, options)) {
+    ASSERT_TRUE(r.status.ok()) << r.entry.input << ": " << r.status;
+  }
+
+  auto dc42 = FindBatchImages(root_ + "/dc42", ".dc42", Command::FINGERPRINT,
+                              "");
+  ASSERT_TRUE(dc42.ok()) << dc42.status();
+  ASSERT_EQ(2, dc42->size());
+  EXPECT_EQ("", (*dc42)[0].output);
+  options.fingerprint_index = root_ + "/index.dcfp";
+  for (const auto& r : RunBatch(Command::FINGERPRINT, *dc42, options)) {
+    EXPECT_TRUE(r.status.ok()) << r.entry.input << ": " << r.status;
+  }
+
+  auto index = FingerprintIndex::Load(options.fingerprint_index);
+  ASSERT_TRUE(index.ok()) << index.status();
+  ASSERT_EQ(2, index->Images().size());
+  EXPECT_EQ(root_ + "/dc42/a.dc42", index->Images()[0].path);
+  EXPECT_EQ(1600, index->Images()[0].block_count);
+  EXPECT_TRUE(index->DuplicateImages().empty());
+  // Only the MDB block is the same in both.
+  EXPECT_EQ(1, index->SharedBlocks(index->Images()[0]));
+}
+
+TEST_F(BatchTest, IoUringVerifyMatchesWorkers) {
+  auto raw = FindBatchImages(root_ + "/raw", ".img", Command::CREATE,
+                             root_ + "/dc42");
+  ASSERT_TRUE(raw.ok()) << raw.status();
+  for (const auto& r : RunBatch(Command::CREATE, *raw, BatchOptions())) {
+    ASSERT_TRUE(r.status.ok()) << r.entry.input << ": " << r.status;
+  }
+  {
+    // Damage one byte of the data of b.
+    std::fstream b(root_ + "/dc42/sub/b.dc42",
+                   std::ios::binary | std::ios::in | std::ios::out);
+    b.seekp(5000);
+    b.put('x');
+  }
+  std::ofstream(root_ + "/dc42/short.dc42", std::ios::binary) << "DC42";
+  auto dc42 = FindBatchImages(root_ + "/dc42", ".dc42", Command::VERIFY, "");
+  ASSERT_TRUE(dc42.ok()) << dc42.status();
+  dc42->push_back(BatchEntry{root_ + "/missing.dc42", ""});
+
+  BatchOptions options;
+  options.jobs = 2;
+  const auto workers = RunBatch(Command::VERIFY, *dc42, options);
+  options.io_uring = true;
+  options.io_uring_depth = 4;
+  const auto uring = RunBatch(Command::VERIFY, *dc42, options);
+  ASSERT_EQ(4, uring.size());
+  EXPECT_TRUE(uring[0].status.ok()) << uring[0].status;
+  EXPECT_FALSE(uring[2].status.ok());
+  for (size_t i = 0; i < uring.size(); ++i) {
+    EXPECT_EQ(workers[i].entry.input, uring[i].entry.input);
+    EXPECT_EQ(workers[i].status, uring[i].status) << uring[i].entry.input;
+    EXPECT_EQ(workers[i].stats.phase(Phase::CHECKSUM).bytes,
+              uring[i].stats.phase(Phase::CHECKSUM).bytes);
+  }
+}
+
+TEST_F(BatchTest, UsageReportsEachVolume) {
+  auto raw = FindBatchImages(root_ + "/raw", ".img", Command::CREATE,
+                             root_ + "/dc42");
+  ASSERT_TRUE(raw.ok()) << raw.status();
+  BatchOptions options;
+  options.jobs = 4;
+  for (const auto& r : RunBatch(Command::CREATE, *raw, options)) {
+    ASSERT_TRUE(r.status.ok()) << r.entry.input << ": " << r.status;
+  }
+
+  auto dc42 = FindBatchImages(root_ + "/dc42", ".dc42", Command::USAGE, "");
+  ASSERT_TRUE(dc42.ok()) << dc42.status();
+  ASSERT_EQ(2, dc42->size());
+  const std::vector<BatchResult> results =
+      RunBatch(Command::USAGE, *dc42, options);
+  // The MDB puts the bitmap at block 0, where each byte of fill has three
+  // bits set.
+  for (const auto& r : results) {
+    EXPECT_TRUE(r.status.ok()) << r.entry.input << ": " << r.status;
+    EXPECT_THAT(r.detail, testing::StartsWith(
+                              "used 598 of 1594 blocks of 512 bytes; free "
+                              "996 (MDB 0)"));
+  }
+  std::ostringstream report;
+  WriteBatchReport(results, report);
+  EXPECT_THAT(report.str(),
+              testing::StartsWith(root_ + "/dc42/a.dc42\tOK\tused 598 of "));
+}
+
+TEST_F(BatchTest, RefusesToOverwriteTheInput) {
+  // Creating from files named *.dc42, next to themselves, derives outputs
+  // equal to the inputs.
+  fs::create_directories(root_ + "/same");
+  WriteFile(root_ + "/same/c.dc42", TestHFSImage(1600, 'c', "Test"));
+  const std::string original = ReadFile(root_ + "/same/c.dc42");
+  auto entries =
+      FindBatchImages(root_ + "/same", ".dc42", Command::CREATE, "");
+  ASSERT_TRUE(entries.ok()) << entries.status();
+  ASSERT_EQ(1, entries->size());
+  EXPECT_EQ((*entries)[0].input, (*entries)[0].output);
+
+  const std::string manifest = root_ + "/manifest.txt";
+  std::ofstream(manifest) << root_ << "/same/c.dc42\t" << root_
+                          << "/same/../same/c.dc42\n";
+  auto listed = ReadBatchManifest(manifest, Command::EXTRACT, "");
+  ASSERT_TRUE(listed.ok()) << listed.status();
+
+  for (const auto& [command, batch] :
+       {std::make_pair(Command::CREATE, *entries),
+        std::make_pair(Command::EXTRACT, *listed)}) {
+    const std::vector<BatchResult> results =
+        RunBatch(command, batch, BatchOptions());
+    ASSERT_EQ(1, results.size());
+    EXPECT_EQ(absl::StatusCode::kInvalidArgument,
+              results[0].status.code());
+  }
+  EXPECT_EQ(original, ReadFile(root_ + "/same/c.dc42"));
+}
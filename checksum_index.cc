@@ -0,0 +1,173 @@
+#include "checksum_index.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "endian.h"
+
+namespace {
+
+constexpr uint32_t kIndexMagic = 0x44435358;  // 'DCSX'
+constexpr size_t kFixedBytes = 36;
+
+}  // namespace
+
+std::string ChecksumIndexPath(const std::string_view disk_copy) {
+  return absl::StrCat(disk_copy, ".sums");
+}
+
+// static
+absl::StatusOr<ChecksumIndex> ChecksumIndex::Read(const std::string_view path) {
+  std::ifstream in{std::string(path), std::ios::binary};
+  if (!in.good()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open checksum index '", path, "'"));
+  }
+  const std::vector<char> file((std::istreambuf_iterator<char>(in)),
+                               std::istreambuf_iterator<char>());
+  if (in.bad()) {
+    return absl::DataLossError(
+        absl::StrCat("Error reading checksum index '", path, "'"));
+  }
+  const char* p = file.data();
+  if (file.size() < kFixedBytes || BigEndian4(p) != kIndexMagic ||
+      file.size() != kFixedBytes + 4 * uint64_t{BigEndian4(p + 32)}) {
+    return absl::DataLossError(
+        absl::StrCat("Checksum index '", path, "' is malformed"));
+  }
+  ChecksumIndex index;
+  index.chunk_size = BigEndian4(p + 4);
+  index.data_size = BigEndian4(p + 8);
+  index.data_checksum = BigEndian4(p + 12);
+  index.file_size = BigEndian8(p + 16);
+  index.mtime_ns = static_cast<int64_t>(BigEndian8(p + 24));
+  const uint32_t n = BigEndian4(p + 32);
+  index.running_sums.reserve(n);
+  for (uint32_t i = 0; i < n; ++i) {
+    index.running_sums.push_back(BigEndian4(p + kFixedBytes + 4 * i));
+  }
+  return index;
+}
+
+absl::Status ChecksumIndex::Write(const std::string_view path) const {
+  std::vector<char> file(kFixedBytes + 4 * running_sums.size());
+  char* p = file.data();
+  WriteBigEndian4(kIndexMagic, p);
+  WriteBigEndian4(chunk_size, p + 4);
+  WriteBigEndian4(data_size, p + 8);
+  WriteBigEndian4(data_checksum, p + 12);
+  WriteBigEndian8(file_size, p + 16);
+  WriteBigEndian8(static_cast<uint64_t>(mtime_ns), p + 24);
+  WriteBigEndian4(running_sums.size(), p + 32);
+  for (size_t i = 0; i < running_sums.size(); ++i) {
+    WriteBigEndian4(running_sums[i], p + kFixedBytes + 4 * i);
+  }
+  // A reader never sees a partly written index.
+  const std::string temporary = absl::StrCat(path, ".tmp");
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if (!out.write(file.data(), file.size()) || !out.flush()) {
+      return absl::ResourceExhaustedError(
+          absl::StrCat("Could not write checksum index '", temporary, "'"));
+    }
+  }
+  if (rename(temporary.c_str(), std::string(path).c_str()) != 0) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not replace checksum index '", path,
+                     "': ", strerror(errno)));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status StatForIndex(const std::string_view path, uint64_t& file_size,
+                          int64_t& mtime_ns) {
+  struct stat st;
+  if (stat(std::string(path).c_str(), &st) != 0) {
+    return absl::NotFoundError(absl::StrCat("Could not stat '", path, "'"));
+  }
+  file_size = st.st_size;
+#ifdef __APPLE__
+  const struct timespec& mtime = st.st_mtimespec;
+#else
+  const struct timespec& mtime = st.st_mtim;
+#endif
+  mtime_ns = int64_t{mtime.tv_sec} * 1000000000 + mtime.tv_nsec;
+  return absl::OkStatus();
+}
+
+ChecksumIndexer::ChecksumIndexer(const uint32_t data_size,
+                                 const ChecksumIndex* const previous)
+    : data_size_(data_size),
+      previous_(previous != nullptr && previous->data_size == data_size &&
+                        previous->chunk_size == ChecksumIndex::kChunkBytes &&
+                        previous->running_sums.size() ==
+                            (data_size + ChecksumIndex::kChunkBytes - 1) /
+                                ChecksumIndex::kChunkBytes
+                    ? previous
+                    : nullptr),
+      chunk_size_(ChecksumIndex::kChunkBytes) {
+  running_sums_.reserve((data_size + chunk_size_ - 1) / chunk_size_);
+}
+
+absl::Status ChecksumIndexer::Update(const char* chunk, size_t chunk_size) {
+  chunk_size = std::min<uint64_t>(chunk_size, data_size_ - position_);
+  while (chunk_size > 0) {
+    const size_t n = std::min<size_t>(chunk_size, chunk_size_ - in_chunk_);
+    auto status = sum_.UpdateSumFromBlock(chunk, n);
+    if (!status.ok()) return status;
+    if (diverged_) {
+      status = chunk_sum_.UpdateSumFromBlock(chunk, n);
+      if (!status.ok()) return status;
+    }
+    chunk += n;
+    chunk_size -= n;
+    in_chunk_ += n;
+    position_ += n;
+    if (in_chunk_ == chunk_size_ || position_ == data_size_) FinishChunk();
+  }
+  return absl::OkStatus();
+}
+
+void ChecksumIndexer::FinishChunk() {
+  const uint32_t i = running_sums_.size();
+  running_sums_.push_back(sum_.Sum());
+  in_chunk_ = 0;
+  if (previous_ == nullptr) return;
+  const uint32_t expected = previous_->running_sums[i];
+  // Until the sums diverge, the whole sum is also this chunk's sum from the
+  // index's starting point.
+  if ((diverged_ ? chunk_sum_.Sum() : sum_.Sum()) != expected) {
+    changed_chunks_.push_back(i);
+  }
+  diverged_ = sum_.Sum() != expected;
+  if (diverged_) chunk_sum_ = DiskCopyChecksum(expected);
+}
+
+std::string DescribeChangedChunks(const std::vector<uint32_t>& changed_chunks,
+                                  const uint32_t chunk_size) {
+  constexpr size_t kMaxListed = 10;
+  const uint32_t sectors = chunk_size / 512;
+  std::vector<std::string> listed;
+  for (size_t i = 0; i < std::min(kMaxListed, changed_chunks.size()); ++i) {
+    const uint64_t first = uint64_t{changed_chunks[i]} * sectors;
+    listed.push_back(absl::StrFormat("%d (sectors %d-%d)", changed_chunks[i],
+                                     first, first + sectors - 1));
+  }
+  std::string description =
+      absl::StrCat(changed_chunks.size() == 1 ? "chunk " : "chunks ",
+                   absl::StrJoin(listed, ", "));
+  if (changed_chunks.size() > kMaxListed) {
+    absl::StrAppend(&description, " and ",
+                    changed_chunks.size() - kMaxListed, " more");
+  }
+  return description;
+}
@@ -0,0 +1,110 @@
+#ifndef __CHECKSUM_INDEX_H__
+#define __CHECKSUM_INDEX_H__
+
+// A small sidecar file next to a DC42 image recording the running data
+// checksum at the end of each 8 KiB chunk of its data section, so that a
+// later verify can say which chunks changed, not just that the checksum
+// does not match, and can skip an image that has not changed since.
+//
+// The DC42 checksum cannot be combined from independently summed spans
+// (see DiskCopyChecksum), so the index keeps the sum *through* each chunk:
+// chunk i is intact exactly when summing it, starting from the recorded
+// sum through chunk i - 1, gives the recorded sum through chunk i. Each
+// chunk is checked on its own, in the same pass that computes the image's
+// checksum.
+//
+// File layout (big-endian):
+//
+// offset  size  contents
+// 0       4     'DCSX'
+// 4       4     chunk size in bytes
+// 8       4     data section size
+// 12      4     data checksum in the image header when indexed
+// 16      8     image file size
+// 24      8     image modification time, in nanoseconds since the epoch
+// 32      4     number of chunks, n
+// 36      4*n   running data checksum through each chunk
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "disk_copy.h"
+
+// The sidecar of the DC42 file `disk_copy`: `disk_copy`.sums.
+std::string ChecksumIndexPath(std::string_view disk_copy);
+
+struct ChecksumIndex {
+  static constexpr uint32_t kChunkBytes = 8192;
+
+  uint32_t chunk_size = kChunkBytes;
+  uint32_t data_size = 0;
+  uint32_t data_checksum = 0;
+  uint64_t file_size = 0;
+  int64_t mtime_ns = 0;
+  // running_sums[i] is the checksum of chunks 0 to i.
+  std::vector<uint32_t> running_sums;
+
+  // Reads the index at `path`; NotFound if there is none, DataLoss if it is
+  // damaged.
+  static absl::StatusOr<ChecksumIndex> Read(std::string_view path);
+  // Replaces the index at `path`, through a temporary file renamed over it.
+  absl::Status Write(std::string_view path) const;
+};
+
+// The size and modification time of the file at `path`, as an index
+// records them.
+absl::Status StatForIndex(std::string_view path, uint64_t& file_size,
+                          int64_t& mtime_ns);
+
+// Sums a data section arriving in chunks of any size, recording the
+// running sum at each chunk boundary and, given the index of the same
+// data, noting each chunk whose contents no longer agree with it.
+class ChecksumIndexer {
+ public:
+  // `previous` may be null, or must outlive the indexer; an index of a
+  // different data size or chunk size is not compared.
+  ChecksumIndexer(uint32_t data_size, const ChecksumIndex* previous);
+
+  // Takes the next `chunk_size` bytes of the data section. Fails only on an
+  // odd chunk of data, as DiskCopyChecksum does.
+  absl::Status Update(const char* chunk, size_t chunk_size);
+
+  // The running sums through each chunk, once all of the data has passed.
+  const std::vector<uint32_t>& running_sums() const { return running_sums_; }
+  // The chunks that differ from `previous`, in order.
+  const std::vector<uint32_t>& changed_chunks() const {
+    return changed_chunks_;
+  }
+
+ private:
+  // Records the chunk just completed.
+  void FinishChunk();
+
+  const uint32_t data_size_;
+  // Null unless `previous` describes the same chunks.
+  const ChecksumIndex* const previous_;
+  const uint32_t chunk_size_;
+  uint64_t position_ = 0;
+  uint32_t in_chunk_ = 0;
+  // The whole sum so far. Once it has diverged from `previous`, also the
+  // sum of the current chunk alone, starting from the previous index's sum
+  // before it.
+  DiskCopyChecksum sum_;
+  DiskCopyChecksum chunk_sum_;
+  bool diverged_ = false;
+  std::vector<uint32_t> running_sums_;
+  std::vector<uint32_t> changed_chunks_;
+};
+
+// Describes `changed_chunks` of `chunk_size` bytes as sector ranges, for an
+// error message: "chunks 3 (sectors 48-63), 17 (sectors 272-287)", listing
+// at most 10.
+std::string DescribeChangedChunks(const std::vector<uint32_t>& changed_chunks,
+                                  uint32_t chunk_size);
+
+#endif  // __CHECKSUM_INDEX_H__
@@ -0,0 +1,121 @@
+#include "checksum_index.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "disk_copy.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using testing::ElementsAre;
+using testing::HasSubstr;
+using testing::IsEmpty;
+
+constexpr uint32_t kChunk = ChecksumIndex::kChunkBytes;
+
+// Data of `size` bytes, different in every word.
+std::string TestData(size_t size) {
+  std::string data(size, 0);
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = static_cast<char>(i * 7 + i / 251);
+  }
+  return data;
+}
+
+// Indexes `data`, passing it in pieces of `piece` bytes.
+ChecksumIndexer IndexData(const std::string& data, size_t piece,
+                          const ChecksumIndex* previous) {
+  ChecksumIndexer indexer(data.size(), previous);
+  for (size_t i = 0; i < data.size(); i += piece) {
+    EXPECT_TRUE(
+        indexer.Update(data.data() + i, std::min(piece, data.size() - i))
+            .ok());
+  }
+  return indexer;
+}
+
+ChecksumIndex IndexOf(const std::string& data) {
+  ChecksumIndex index;
+  index.data_size = data.size();
+  index.running_sums = IndexData(data, data.size(), nullptr).running_sums();
+  return index;
+}
+
+TEST(ChecksumIndexer, RunningSumsEndInTheDataChecksum) {
+  const std::string data = TestData(10 * kChunk + 1024);
+  const ChecksumIndexer indexer = IndexData(data, 3000, nullptr);
+  ASSERT_EQ(11, indexer.running_sums().size());
+  DiskCopyChecksum sum;
+  ASSERT_TRUE(sum.UpdateSumFromBlock(data.data(), data.size()).ok());
+  EXPECT_EQ(sum.Sum(), indexer.running_sums().back());
+  DiskCopyChecksum first;
+  ASSERT_TRUE(first.UpdateSumFromBlock(data.data(), kChunk).ok());
+  EXPECT_EQ(first.Sum(), indexer.running_sums().front());
+}
+
+TEST(ChecksumIndexer, FindsEachChangedChunk) {
+  std::string data = TestData(16 * kChunk);
+  const ChecksumIndex index = IndexOf(data);
+  EXPECT_THAT(IndexData(data, 4096, &index).changed_chunks(), IsEmpty());
+
+  // Once the running sum has diverged, later chunks are still checked on
+  // their own.
+  data[3 * kChunk + 10] ^= 1;
+  data[9 * kChunk + kChunk - 1] ^= 0x40;
+  EXPECT_THAT(IndexData(data, 5000, &index).changed_chunks(),
+              ElementsAre(3, 9));
+  data[15 * kChunk] ^= 2;
+  EXPECT_THAT(IndexData(data, data.size(), &index).changed_chunks(),
+              ElementsAre(3, 9, 15));
+}
+
+TEST(ChecksumIndexer, IgnoresAnIndexOfOtherData) {
+  const std::string data = TestData(4 * kChunk);
+  ChecksumIndex index = IndexOf(TestData(5 * kChunk));
+  EXPECT_THAT(IndexData(data, kChunk, &index).changed_chunks(), IsEmpty());
+  index = IndexOf(data);
+  index.chunk_size = 4096;
+  EXPECT_THAT(IndexData(data, kChunk, &index).changed_chunks(), IsEmpty());
+}
+
+TEST(ChecksumIndex, WriteThenRead) {
+  const std::string path = testing::TempDir() + "/index_test.sums";
+  ChecksumIndex index = IndexOf(TestData(3 * kChunk + 512));
+  index.data_checksum = 0x12345678;
+  index.file_size = 3 * kChunk + 512 + 84;
+  index.mtime_ns = 1700000000123456789;
+  ASSERT_TRUE(index.Write(path).ok());
+
+  auto read = ChecksumIndex::Read(path);
+  ASSERT_TRUE(read.ok()) << read.status();
+  EXPECT_EQ(kChunk, read->chunk_size);
+  EXPECT_EQ(index.data_size, read->data_size);
+  EXPECT_EQ(0x12345678, read->data_checksum);
+  EXPECT_EQ(index.file_size, read->file_size);
+  EXPECT_EQ(index.mtime_ns, read->mtime_ns);
+  EXPECT_EQ(index.running_sums, read->running_sums);
+}
+
+TEST(ChecksumIndex, ReadReportsMissingAndDamagedFiles) {
+  const std::string path = testing::TempDir() + "/damaged_test.sums";
+  EXPECT_EQ(absl::StatusCode::kNotFound,
+            ChecksumIndex::Read(path + ".missing").status().code());
+  ASSERT_TRUE(IndexOf(TestData(2 * kChunk)).Write(path).ok());
+  std::ofstream(path, std::ios::binary | std::ios::app) << "xx";
+  EXPECT_EQ(absl::StatusCode::kDataLoss,
+            ChecksumIndex::Read(path).status().code());
+}
+
+TEST(DescribeChangedChunks, NamesSectorsAndElidesTheRest) {
+  EXPECT_EQ("chunk 3 (sectors 48-63)", DescribeChangedChunks({3}, kChunk));
+  const std::string many = DescribeChangedChunks(
+      {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, kChunk);
+  EXPECT_THAT(many, HasSubstr("chunks 0 (sectors 0-15), 1 (sectors 16-31)"));
+  EXPECT_THAT(many, HasSubstr("9 (sectors 144-159) and 2 more"));
+}
+
+}  // namespace
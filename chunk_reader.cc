@@ -0,0 +1,188 @@
+#include "chunk_reader.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+
+namespace {
+
+// One of the two buffers passed back and forth between the reader thread
+// and the consumer.
+struct ChunkBuffer {
+  std::vector<char> bytes;
+  size_t size = 0;
+  bool full = false;  // Read, but not yet consumed.
+};
+
+size_t ComputePipelineChunkSize() {
+  long cache_bytes = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  cache_bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+  size_t chunk = kPipelineChunkSize;
+  while (chunk < kMaxPipelineChunkSize &&
+         static_cast<long>(chunk) * 4 <= cache_bytes) {
+    chunk *= 2;
+  }
+  return chunk;
+}
+
+}  // namespace
+
+size_t PipelineChunkSize() {
+  static const size_t chunk_size = ComputePipelineChunkSize();
+  return chunk_size;
+}
+
+absl::Status ReadChunksPipelined(
+    std::istream& s, const uint64_t byte_count,
+    absl::FunctionRef<absl::Status(const char* chunk, size_t chunk_size)>
+        consume) {
+  if (byte_count == 0) return absl::OkStatus();
+
+  const size_t buffer_size =
+      std::min<uint64_t>(byte_count, PipelineChunkSize());
+  absl::Mutex mu;
+  ChunkBuffer buffers[2];
+  for (auto& b : buffers) b.bytes.resize(buffer_size);
+  // All guarded by mu.
+  absl::Status read_status;
+  bool reader_done = false;
+  bool cancelled = false;
+
+  std::thread reader([&]() {
+    uint64_t bytes_read = 0;
+    for (int i = 0; bytes_read < byte_count; i ^= 1) {
+      ChunkBuffer& b = buffers[i];
+      {
+        absl::MutexLock lock(&mu);
+        auto writable = [&]() { return !b.full || cancelled; };
+        mu.Await(absl::Condition(&writable));
+        if (cancelled) break;
+      }
+      // The consumer does not touch `b` until it is marked full.
+      const uint64_t remaining = byte_count - bytes_read;
+      const size_t chunk_size =
+          std::min<uint64_t>(remaining, buffer_size);
+      const bool ok = static_cast<bool>(s.read(b.bytes.data(), chunk_size));
+      absl::MutexLock lock(&mu);
+      if (!ok) {
+        read_status = absl::OutOfRangeError(absl::StrFormat(
+            "Failed to read %d bytes after %d bytes read, %d bytes remaining",
+            chunk_size, bytes_read, remaining));
+        break;
+      }
+      b.size = chunk_size;
+      b.full = true;
+      bytes_read += chunk_size;
+    }
+    absl::MutexLock lock(&mu);
+    reader_done = true;
+  });
+
+  absl::Status consume_status;
+  for (int i = 0;; i ^= 1) {
+    ChunkBuffer& b = buffers[i];
+    {
+      absl::MutexLock lock(&mu);
+      auto readable = [&]() { return b.full || reader_done; };
+      mu.Await(absl::Condition(&readable));
+      if (!b.full) break;  // Reader finished or failed.
+    }
+    consume_status = consume(b.bytes.data(), b.size);
+    absl::MutexLock lock(&mu);
+    b.full = false;
+    if (!consume_status.ok()) {
+      cancelled = true;
+      break;
+    }
+  }
+  reader.join();
+  if (!consume_status.ok()) return consume_status;
+  return read_status;
+}
+
+absl::Status PipeChunks(
+    absl::FunctionRef<absl::Status(
+        absl::FunctionRef<absl::Status(const char* chunk, size_t chunk_size)>
+            emit)>
+        produce,
+    absl::FunctionRef<absl::Status(const char* chunk, size_t chunk_size)>
+        consume,
+    const size_t buffer_count) {
+  const size_t buffer_size = PipelineChunkSize();
+  absl::Mutex mu;
+  std::vector<ChunkBuffer> buffers(std::max<size_t>(buffer_count, 2));
+  for (auto& b : buffers) b.bytes.resize(buffer_size);
+  // All guarded by mu.
+  absl::Status produce_status;
+  bool producer_done = false;
+  bool cancelled = false;
+
+  std::thread producer([&]() {
+    size_t i = 0;
+    size_t fill = 0;  // Bytes in buffers[i], which the consumer leaves alone.
+    // Waits for buffers[i] to be free; false once the consumer has failed.
+    auto wait_writable = [&]() {
+      absl::MutexLock lock(&mu);
+      auto writable = [&]() { return !buffers[i].full || cancelled; };
+      mu.Await(absl::Condition(&writable));
+      return !cancelled;
+    };
+    auto hand_over = [&]() {
+      absl::MutexLock lock(&mu);
+      buffers[i].size = fill;
+      buffers[i].full = true;
+      i = (i + 1) % buffers.size();
+      fill = 0;
+    };
+    bool writable = wait_writable();
+    auto emit = [&](const char* chunk, size_t chunk_size) {
+      while (chunk_size > 0) {
+        if (!writable) return absl::CancelledError("The consumer failed");
+        const size_t n = std::min(chunk_size, buffer_size - fill);
+        memcpy(buffers[i].bytes.data() + fill, chunk, n);
+        fill += n;
+        chunk += n;
+        chunk_size -= n;
+        if (fill == buffer_size) {
+          hand_over();
+          writable = wait_writable();
+        }
+      }
+      return absl::OkStatus();
+    };
+    absl::Status status = produce(emit);
+    if (status.ok() && writable && fill > 0) hand_over();
+    absl::MutexLock lock(&mu);
+    produce_status = std::move(status);
+    producer_done = true;
+  });
+
+  absl::Status consume_status;
+  for (size_t i = 0;; i = (i + 1) % buffers.size()) {
+    ChunkBuffer& b = buffers[i];
+    {
+      absl::MutexLock lock(&mu);
+      auto readable = [&]() { return b.full || producer_done; };
+      mu.Await(absl::Condition(&readable));
+      if (!b.full) break;  // Producer finished or failed.
+    }
+    consume_status = consume(b.bytes.data(), b.size);
+    absl::MutexLock lock(&mu);
+    b.full = false;
+    if (!consume_status.ok()) {
+      cancelled = true;
+      break;
+    }
+  }
+  producer.join();
+  if (!consume_status.ok()) return consume_status;
+  return produce_status;
+}
@@ -0,0 +1,56 @@
+#ifndef __CHUNK_READER_H__
+#define __CHUNK_READER_H__
+
+// Sequential reading of large image sections, overlapping the read of the
+// next chunk with processing of the current one.
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+
+// Bounds on the size of each chunk handed to the consumer.
+inline constexpr size_t kPipelineChunkSize = 64 * 1024;
+inline constexpr size_t kMaxPipelineChunkSize = 4 * 1024 * 1024;
+
+// The chunk size ReadChunksPipelined uses (the last chunk may be shorter):
+// half the L2 cache, so that the chunk being consumed and the one being read
+// both stay in it, rounded down to a power of two and clamped to the bounds
+// above. Floppy images take a few chunks whatever the size; hard disk images
+// take far fewer thread handoffs with large ones.
+size_t PipelineChunkSize();
+
+// Reads `byte_count` bytes from the current position of `s`, calling
+// `consume(chunk, chunk_size)` on the calling thread for each chunk, in file
+// order. A background thread reads the next chunk while `consume` runs, so a
+// checksum (which is inherently sequential) and the I/O feeding it use
+// separate cores.
+//
+// Returns the first read error or the first non-OK status from `consume`;
+// no further chunks are consumed after an error.
+absl::Status ReadChunksPipelined(
+    std::istream& s, uint64_t byte_count,
+    absl::FunctionRef<absl::Status(const char* chunk, size_t chunk_size)>
+        consume);
+
+// Runs `produce` on a second thread, passing it an `emit` function that
+// takes chunks of any size, in order, and copies them into `buffer_count`
+// buffers of PipelineChunkSize() bytes. `consume` is called on the calling
+// thread with each buffer as it fills, and with the last, partial one.
+// `emit` waits while every buffer is full, so a fast producer stays a
+// bounded distance ahead of the consumer.
+//
+// Returns the first error from `produce` or `consume`. After an error from
+// `consume`, `emit` returns kCancelled, so the producer can stop early.
+absl::Status PipeChunks(
+    absl::FunctionRef<absl::Status(
+        absl::FunctionRef<absl::Status(const char* chunk, size_t chunk_size)>
+            emit)>
+        produce,
+    absl::FunctionRef<absl::Status(const char* chunk, size_t chunk_size)>
+        consume,
+    size_t buffer_count = 4);
+
+#endif  // __CHUNK_READER_H__
@@ -0,0 +1,132 @@
+#include "chunk_reader.h"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+std::string Pattern(size_t size) {
+  std::string s(size, '\0');
+  for (size_t i = 0; i < size; ++i) s[i] = static_cast<char>(i * 7 + i / 251);
+  return s;
+}
+
+}  // namespace
+
+TEST(ReadChunksPipelined, DeliversBytesInOrder) {
+  const std::string data = Pattern(3 * PipelineChunkSize() + 10);
+  std::istringstream in(data);
+  std::string seen;
+  auto status = ReadChunksPipelined(
+      in, data.size(), [&seen](const char* chunk, size_t size) {
+        EXPECT_LE(size, PipelineChunkSize());
+        seen.append(chunk, size);
+        return absl::OkStatus();
+      });
+  EXPECT_TRUE(status.ok()) << status;
+  EXPECT_EQ(data, seen);
+}
+
+TEST(ReadChunksPipelined, ShortInputIsAnError) {
+  const std::string data = Pattern(PipelineChunkSize() + 10);
+  std::istringstream in(data);
+  size_t seen = 0;
+  auto status = ReadChunksPipelined(
+      in, data.size() + 1, [&seen](const char*, size_t size) {
+        seen += size;
+        return absl::OkStatus();
+      });
+  EXPECT_EQ(absl::StatusCode::kOutOfRange, status.code());
+  EXPECT_EQ(PipelineChunkSize(), seen);
+}
+
+TEST(ReadChunksPipelined, ConsumerErrorStopsReading) {
+  const std::string data = Pattern(8 * PipelineChunkSize());
+  std::istringstream in(data);
+  int calls = 0;
+  auto status =
+      ReadChunksPipelined(in, data.size(), [&calls](const char*, size_t) {
+        ++calls;
+        return absl::DataLossError("stop");
+      });
+  EXPECT_EQ(absl::StatusCode::kDataLoss, status.code());
+  EXPECT_EQ(1, calls);
+}
+
+TEST(PipelineChunkSize, IsAPowerOfTwoWithinBounds) {
+  const size_t size = PipelineChunkSize();
+  EXPECT_GE(size, kPipelineChunkSize);
+  EXPECT_LE(size, kMaxPipelineChunkSize);
+  EXPECT_EQ(0, size & (size - 1));
+  EXPECT_EQ(size, PipelineChunkSize());
+}
+
+TEST(PipeChunks, RegroupsChunksInOrder) {
+  const std::string data = Pattern(3 * PipelineChunkSize() + 1234);
+  std::string seen;
+  std::vector<size_t> sizes;
+  auto status = PipeChunks(
+      [&data](auto emit) {
+        for (size_t i = 0; i < data.size(); i += 1000) {
+          auto status =
+              emit(data.data() + i, std::min<size_t>(1000, data.size() - i));
+          if (!status.ok()) return status;
+        }
+        return absl::OkStatus();
+      },
+      [&](const char* chunk, size_t size) {
+        seen.append(chunk, size);
+        sizes.push_back(size);
+        return absl::OkStatus();
+      });
+  EXPECT_TRUE(status.ok()) << status;
+  EXPECT_EQ(data, seen);
+  EXPECT_THAT(sizes, testing::ElementsAre(PipelineChunkSize(),
+                                          PipelineChunkSize(),
+                                          PipelineChunkSize(), 1234));
+}
+
+TEST(PipeChunks, ProducerErrorAfterData) {
+  size_t seen = 0;
+  auto status = PipeChunks(
+      [](auto emit) {
+        const std::string data = Pattern(100);
+        auto status = emit(data.data(), data.size());
+        if (!status.ok()) return status;
+        return absl::DataLossError("corrupt");
+      },
+      [&seen](const char*, size_t size) {
+        seen += size;
+        return absl::OkStatus();
+      });
+  EXPECT_EQ(absl::StatusCode::kDataLoss, status.code());
+  // The partial buffer is not handed over after an error.
+  EXPECT_EQ(0, seen);
+}
+
+TEST(PipeChunks, ConsumerErrorCancelsProducer) {
+  absl::Status last_emit;
+  int calls = 0;
+  auto status = PipeChunks(
+      [&last_emit](auto emit) {
+        const std::string data = Pattern(PipelineChunkSize());
+        for (int i = 0; i < 100; ++i) {
+          last_emit = emit(data.data(), data.size());
+          if (!last_emit.ok()) return last_emit;
+        }
+        return absl::OkStatus();
+      },
+      [&calls](const char*, size_t) {
+        ++calls;
+        return absl::ResourceExhaustedError("disk full");
+      },
+      2);
+  EXPECT_EQ(absl::StatusCode::kResourceExhausted, status.code());
+  EXPECT_EQ(1, calls);
+  EXPECT_EQ(absl::StatusCode::kCancelled, last_emit.code());
+}
@@ -0,0 +1,218 @@
+#include "command_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+
+namespace {
+
+constexpr Phase kPhases[kPhaseCount] = {Phase::OPEN, Phase::HEADER,
+                                        Phase::READ, Phase::CHECKSUM,
+                                        Phase::WRITE};
+
+double MegabytesPerSecond(const uint64_t bytes, const absl::Duration wall) {
+  const double seconds = absl::ToDoubleSeconds(wall);
+  return seconds > 0 ? bytes / seconds / 1e6 : 0;
+}
+
+// A double as JSON, which has no infinities or NaN.
+std::string JsonNumber(const double value) {
+  return std::isfinite(value) ? absl::StrFormat("%.6g", value) : "0";
+}
+
+// `fields` as a JSON object; the values are JSON already.
+std::string JsonObject(
+    std::initializer_list<std::pair<absl::string_view, std::string>>
+        fields) {
+  std::string json = "{";
+  for (const auto& [name, value] : fields) {
+    if (json.size() > 1) json += ", ";
+    absl::StrAppend(&json, "\"", name, "\": ", value);
+  }
+  return json + "}";
+}
+
+}  // namespace
+
+absl::string_view PhaseName(const Phase phase) {
+  switch (phase) {
+    case Phase::OPEN:
+      return "open";
+    case Phase::HEADER:
+      return "header";
+    case Phase::READ:
+      return "read";
+    case Phase::CHECKSUM:
+      return "checksum";
+    case Phase::WRITE:
+      return "write";
+  }
+  return "unknown";
+}
+
+double PhaseStats::MegabytesPerSecond() const {
+  return ::MegabytesPerSecond(bytes, wall);
+}
+
+void CommandStats::Enter(const Phase phase) {
+  const absl::Time now = absl::Now();
+  if (current_.has_value()) AddWall(*current_, now - entered_);
+  current_ = phase;
+  entered_ = now;
+}
+
+void CommandStats::Stop() {
+  if (current_.has_value()) AddWall(*current_, absl::Now() - entered_);
+  current_.reset();
+}
+
+void CommandStats::Count(const Phase phase, const uint64_t bytes) {
+  PhaseStats& p = phases_[static_cast<size_t>(phase)];
+  p.bytes += bytes;
+  ++p.calls;
+}
+
+void CommandStats::AddWall(const Phase phase, const absl::Duration wall) {
+  phases_[static_cast<size_t>(phase)].wall += wall;
+}
+
+void CommandStats::Merge(const CommandStats& other) {
+  for (size_t i = 0; i < kPhaseCount; ++i) {
+    phases_[i].wall += other.phases_[i].wall;
+    phases_[i].bytes += other.phases_[i].bytes;
+    phases_[i].calls += other.phases_[i].calls;
+  }
+}
+
+absl::Duration CommandStats::Wall() const {
+  absl::Duration wall;
+  for (const PhaseStats& p : phases_) wall += p.wall;
+  return wall;
+}
+
+double CommandStats::MegabytesPerSecond() const {
+  return ::MegabytesPerSecond(phase(Phase::CHECKSUM).bytes, Wall());
+}
+
+std::string CommandStats::ToText() const {
+  std::string text;
+  for (const Phase phase : kPhases) {
+    const PhaseStats& p = this->phase(phase);
+    if (p.calls == 0 && p.wall == absl::ZeroDuration()) continue;
+    absl::StrAppendFormat(&text, "%-8s %10.3f ms %12d bytes %8d calls",
+                          PhaseName(phase),
+                          absl::ToDoubleMilliseconds(p.wall), p.bytes,
+                          p.calls);
+    if (p.bytes > 0) {
+      absl::StrAppendFormat(&text, " %10.1f MB/s", p.MegabytesPerSecond());
+    }
+    text += '\n';
+  }
+  absl::StrAppendFormat(&text,
+                        "%-8s %10.3f ms %12d bytes %19s %10.1f MB/s\n",
+                        "total", absl::ToDoubleMilliseconds(Wall()),
+                        phase(Phase::CHECKSUM).bytes, "",
+                        MegabytesPerSecond());
+  return text;
+}
+
+std::string CommandStats::ToJson() const {
+  std::string phases = "{";
+  for (const Phase phase : kPhases) {
+    const PhaseStats& p = this->phase(phase);
+    if (phases.size() > 1) phases += ", ";
+    absl::StrAppend(
+        &phases, "\"", PhaseName(phase), "\": ",
+        JsonObject(
+            {{"wall_seconds", JsonNumber(absl::ToDoubleSeconds(p.wall))},
+             {"bytes", absl::StrCat(p.bytes)},
+             {"calls", absl::StrCat(p.calls)},
+             {"mb_per_second", JsonNumber(p.MegabytesPerSecond())}}));
+  }
+  phases += "}";
+  return JsonObject(
+      {{"wall_seconds", JsonNumber(absl::ToDoubleSeconds(Wall()))},
+       {"mb_per_second", JsonNumber(MegabytesPerSecond())},
+       {"phases", phases}});
+}
+
+void Log2Histogram::Add(const double value) {
+  size_t bucket = 0;
+  while (bucket + 1 < kBuckets && value > UpperBound(bucket)) ++bucket;
+  ++buckets_[bucket];
+  ++count_;
+  sum_ += value;
+}
+
+double Log2Histogram::UpperBound(const size_t bucket) const {
+  return std::ldexp(first_bound_, bucket);
+}
+
+std::string Log2Histogram::ToJson() const {
+  size_t used = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    if (buckets_[i] > 0) used = i + 1;
+  }
+  // The last bucket has no upper bound, so it is only ever "+Inf".
+  used = std::min(used, kBuckets - 1);
+  std::string buckets = "[";
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < used; ++i) {
+    cumulative += buckets_[i];
+    absl::StrAppend(&buckets, i > 0 ? ", " : "",
+                    JsonObject({{"le", JsonNumber(UpperBound(i))},
+                                {"count", absl::StrCat(cumulative)}}));
+  }
+  absl::StrAppend(&buckets, used > 0 ? ", " : "",
+                  JsonObject({{"le", "\"+Inf\""},
+                              {"count", absl::StrCat(count_)}}),
+                  "]");
+  return JsonObject({{"count", absl::StrCat(count_)},
+                     {"sum", JsonNumber(sum_)},
+                     {"buckets", buckets}});
+}
+
+// Phases take from a microsecond to days; throughput from a few KB/s (a
+// network share) to GB/s (the page cache).
+BatchStats::BatchStats()
+    : phase_seconds_{Log2Histogram(1e-6), Log2Histogram(1e-6),
+                     Log2Histogram(1e-6), Log2Histogram(1e-6),
+                     Log2Histogram(1e-6)},
+      image_seconds_(1e-6),
+      image_mb_per_second_(1.0 / 256) {}
+
+void BatchStats::Add(const CommandStats& image) {
+  ++images_;
+  totals_.Merge(image);
+  for (const Phase phase : kPhases) {
+    phase_seconds_[static_cast<size_t>(phase)].Add(
+        absl::ToDoubleSeconds(image.phase(phase).wall));
+  }
+  image_seconds_.Add(absl::ToDoubleSeconds(image.Wall()));
+  image_mb_per_second_.Add(image.MegabytesPerSecond());
+}
+
+std::string BatchStats::ToText() const {
+  return absl::StrCat(images_, " images\n", totals_.ToText());
+}
+
+std::string BatchStats::ToJson() const {
+  std::string phases = "{";
+  for (const Phase phase : kPhases) {
+    absl::StrAppend(&phases, phases.size() > 1 ? ", " : "", "\"",
+                    PhaseName(phase),
+                    "\": ", this->phase_seconds(phase).ToJson());
+  }
+  phases += "}";
+  return JsonObject(
+      {{"images", absl::StrCat(images_)},
+       {"totals", totals_.ToJson()},
+       {"phase_seconds", phases},
+       {"image_seconds", image_seconds_.ToJson()},
+       {"image_mb_per_second", image_mb_per_second_.ToJson()}});
+}
@@ -0,0 +1,140 @@
+#ifndef __COMMAND_STATS_H__
+#define __COMMAND_STATS_H__
+
+// Where the time of a create, extract or verify goes: wall time, bytes and
+// I/O calls for each phase, as reported by --stats and --stats_json, and
+// histograms of them over the images of a batch.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+
+// The phases of a command. OPEN is opening (and mapping) the files, HEADER
+// reading and parsing or building the DC42 header, READ waiting for image
+// bytes, CHECKSUM summing them and WRITE writing the output.
+enum class Phase { OPEN, HEADER, READ, CHECKSUM, WRITE };
+
+inline constexpr size_t kPhaseCount = 5;
+
+absl::string_view PhaseName(Phase phase);
+
+struct PhaseStats {
+  absl::Duration wall;
+  uint64_t bytes = 0;
+  // The opens, reads and writes issued. Each chunk of the image counts as a
+  // read; for a mapped file that is a view, paid for in page faults, rather
+  // than a system call.
+  uint64_t calls = 0;
+
+  // bytes / wall in MB (10^6 bytes) per second, or 0 if no time was spent.
+  double MegabytesPerSecond() const;
+};
+
+// The phase stats of one command. Wall time is charged to one phase at a
+// time, so the phases add up to the whole command. Not thread-safe.
+class CommandStats {
+ public:
+  // Charges the time since the previous Enter to the phase entered then,
+  // and starts timing `phase`.
+  void Enter(Phase phase);
+  // Charges the time since the previous Enter, and stops timing.
+  void Stop();
+  // Counts one call of `phase` moving `bytes`.
+  void Count(Phase phase, uint64_t bytes);
+  // Charges `wall` to `phase` directly, for callers timing work on several
+  // images at once.
+  void AddWall(Phase phase, absl::Duration wall);
+  // Adds the phases of `other`.
+  void Merge(const CommandStats& other);
+
+  const PhaseStats& phase(Phase p) const {
+    return phases_[static_cast<size_t>(p)];
+  }
+  // The sum over all phases.
+  absl::Duration Wall() const;
+  // Bytes checksummed per second of Wall(); every command sums each image
+  // byte once.
+  double MegabytesPerSecond() const;
+
+  // One line per phase that was used: name, milliseconds, bytes, calls and
+  // MB/s, then the total.
+  std::string ToText() const;
+  // {"wall_seconds": ..., "mb_per_second": ..., "phases": {"open": {
+  // "wall_seconds": ..., "bytes": ..., "calls": ..., "mb_per_second": ...},
+  // ...}}, with every phase.
+  std::string ToJson() const;
+
+ private:
+  std::array<PhaseStats, kPhaseCount> phases_;
+  std::optional<Phase> current_;
+  absl::Time entered_;
+};
+
+// A histogram with exponential buckets: bucket i counts the values of at
+// most first_bound * 2^i (and more than the bound before it); the last
+// bucket takes everything larger.
+class Log2Histogram {
+ public:
+  static constexpr size_t kBuckets = 40;
+
+  explicit Log2Histogram(double first_bound) : first_bound_(first_bound) {}
+
+  void Add(double value);
+
+  uint64_t count() const { return count_; }
+  double sum() const { return sum_; }
+  double UpperBound(size_t bucket) const;
+  uint64_t bucket_count(size_t bucket) const { return buckets_[bucket]; }
+
+  // {"count": ..., "sum": ..., "buckets": [{"le": bound, "count": n}, ...]}
+  // with cumulative counts, as Prometheus histograms have, up to the highest
+  // bucket used, then "le": "+Inf".
+  std::string ToJson() const;
+
+ private:
+  double first_bound_;
+  uint64_t count_ = 0;
+  double sum_ = 0;
+  std::array<uint64_t, kBuckets> buckets_{};
+};
+
+// The stats of the images of a batch: the phases summed over all of them
+// (so with several jobs, more wall time than the batch took), and histograms
+// of the seconds each image spent in each phase, in total, and of its MB/s.
+class BatchStats {
+ public:
+  BatchStats();
+
+  void Add(const CommandStats& image);
+
+  size_t images() const { return images_; }
+  const CommandStats& totals() const { return totals_; }
+  const Log2Histogram& phase_seconds(Phase p) const {
+    return phase_seconds_[static_cast<size_t>(p)];
+  }
+  const Log2Histogram& image_seconds() const { return image_seconds_; }
+  const Log2Histogram& image_mb_per_second() const {
+    return image_mb_per_second_;
+  }
+
+  // The number of images and the totals, as CommandStats::ToText.
+  std::string ToText() const;
+  // {"images": n, "totals": <CommandStats::ToJson>, "phase_seconds":
+  // {"open": <histogram>, ...}, "image_seconds": <histogram>,
+  // "image_mb_per_second": <histogram>}
+  std::string ToJson() const;
+
+ private:
+  size_t images_ = 0;
+  CommandStats totals_;
+  std::array<Log2Histogram, kPhaseCount> phase_seconds_;
+  Log2Histogram image_seconds_;
+  Log2Histogram image_mb_per_second_;
+};
+
+#endif  // __COMMAND_STATS_H__
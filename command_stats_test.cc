@@ -0,0 +1,115 @@
+#include "command_stats.h"
+
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using testing::HasSubstr;
+
+TEST(CommandStats, PhasesAddUpToTheWall) {
+  CommandStats stats;
+  stats.Enter(Phase::OPEN);
+  stats.Count(Phase::OPEN, 0);
+  stats.Enter(Phase::READ);
+  stats.Count(Phase::READ, 1000);
+  stats.Enter(Phase::CHECKSUM);
+  stats.Count(Phase::CHECKSUM, 600);
+  stats.Count(Phase::CHECKSUM, 400);
+  stats.Stop();
+  // Stopped: no more time is charged.
+  const absl::Duration wall = stats.Wall();
+  stats.Stop();
+  EXPECT_EQ(wall, stats.Wall());
+
+  EXPECT_EQ(1, stats.phase(Phase::OPEN).calls);
+  EXPECT_EQ(1000, stats.phase(Phase::READ).bytes);
+  EXPECT_EQ(2, stats.phase(Phase::CHECKSUM).calls);
+  EXPECT_EQ(0, stats.phase(Phase::WRITE).calls);
+  EXPECT_EQ(stats.phase(Phase::OPEN).wall + stats.phase(Phase::READ).wall +
+                stats.phase(Phase::CHECKSUM).wall,
+            stats.Wall());
+}
+
+TEST(CommandStats, ThroughputAndOutput) {
+  CommandStats stats;
+  stats.AddWall(Phase::READ, absl::Milliseconds(500));
+  stats.Count(Phase::READ, 3'000'000);
+  stats.AddWall(Phase::CHECKSUM, absl::Milliseconds(1500));
+  stats.Count(Phase::CHECKSUM, 3'000'000);
+  EXPECT_DOUBLE_EQ(6, stats.phase(Phase::READ).MegabytesPerSecond());
+  EXPECT_DOUBLE_EQ(2, stats.phase(Phase::CHECKSUM).MegabytesPerSecond());
+  EXPECT_DOUBLE_EQ(1.5, stats.MegabytesPerSecond());
+  EXPECT_DOUBLE_EQ(0, stats.phase(Phase::WRITE).MegabytesPerSecond());
+
+  const std::string text = stats.ToText();
+  EXPECT_THAT(text, HasSubstr("read"));
+  EXPECT_THAT(text, HasSubstr("6.0 MB/s"));
+  EXPECT_THAT(text, testing::Not(HasSubstr("write")));
+  EXPECT_THAT(text, HasSubstr("total"));
+
+  const std::string json = stats.ToJson();
+  EXPECT_THAT(json, testing::StartsWith(
+                        "{\"wall_seconds\": 2, \"mb_per_second\": 1.5, "));
+  EXPECT_THAT(json, HasSubstr("\"read\": {\"wall_seconds\": 0.5, \"bytes\": "
+                              "3000000, \"calls\": 1, \"mb_per_second\": 6}"));
+  EXPECT_THAT(json, HasSubstr("\"write\": {\"wall_seconds\": 0, \"bytes\": "
+                              "0, \"calls\": 0, \"mb_per_second\": 0}"));
+}
+
+TEST(Log2Histogram, BucketsAreCumulativeInJson) {
+  Log2Histogram h(1);
+  for (const double v : {0.5, 1.0, 1.5, 3.0, 4.0, 100.0}) h.Add(v);
+  EXPECT_EQ(6, h.count());
+  EXPECT_DOUBLE_EQ(110, h.sum());
+  EXPECT_EQ(2, h.bucket_count(0));  // <= 1
+  EXPECT_EQ(1, h.bucket_count(1));  // <= 2
+  EXPECT_EQ(2, h.bucket_count(2));  // <= 4
+  EXPECT_EQ(1, h.bucket_count(7));  // <= 128
+  EXPECT_EQ(
+      "{\"count\": 6, \"sum\": 110, \"buckets\": [{\"le\": 1, \"count\": 2}, "
+      "{\"le\": 2, \"count\": 3}, {\"le\": 4, \"count\": 5}, "
+      "{\"le\": 8, \"count\": 5}, {\"le\": 16, \"count\": 5}, "
+      "{\"le\": 32, \"count\": 5}, {\"le\": 64, \"count\": 5}, "
+      "{\"le\": 128, \"count\": 6}, {\"le\": \"+Inf\", \"count\": 6}]}",
+      h.ToJson());
+
+  // Values beyond the last bound land in the last bucket.
+  Log2Histogram huge(1);
+  huge.Add(1e300);
+  EXPECT_EQ(1, huge.bucket_count(Log2Histogram::kBuckets - 1));
+  EXPECT_THAT(huge.ToJson(), HasSubstr("{\"le\": \"+Inf\", \"count\": 1}"));
+  EXPECT_EQ("{\"count\": 0, \"sum\": 0, \"buckets\": [{\"le\": \"+Inf\", "
+            "\"count\": 0}]}",
+            Log2Histogram(1).ToJson());
+}
+
+TEST(BatchStats, SumsAndHistograms) {
+  BatchStats batch;
+  for (const int ms : {1, 2, 300}) {
+    CommandStats image;
+    image.AddWall(Phase::READ, absl::Milliseconds(ms));
+    image.Count(Phase::READ, 1'000'000);
+    image.Count(Phase::CHECKSUM, 1'000'000);
+    batch.Add(image);
+  }
+  EXPECT_EQ(3, batch.images());
+  EXPECT_EQ(absl::Milliseconds(303), batch.totals().Wall());
+  EXPECT_EQ(3'000'000, batch.totals().phase(Phase::CHECKSUM).bytes);
+  EXPECT_EQ(3, batch.phase_seconds(Phase::READ).count());
+  EXPECT_EQ(3, batch.phase_seconds(Phase::WRITE).count());
+  EXPECT_EQ(3, batch.image_seconds().count());
+  EXPECT_DOUBLE_EQ(1000 + 500 + 1e6 / 0.3 / 1e6,
+                   batch.image_mb_per_second().sum());
+
+  EXPECT_THAT(batch.ToText(), testing::StartsWith("3 images\n"));
+  const std::string json = batch.ToJson();
+  EXPECT_THAT(json, testing::StartsWith("{\"images\": 3, \"totals\": {"));
+  EXPECT_THAT(json, HasSubstr("\"phase_seconds\": {\"open\": {\"count\": 3"));
+  EXPECT_THAT(json, HasSubstr("\"image_seconds\": {\"count\": 3, "));
+  EXPECT_THAT(json, HasSubstr("\"image_mb_per_second\": {\"count\": 3, "));
+}
+
+}  // namespace
@@ -0,0 +1,158 @@
+#include "dart.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "absl/strings/str_cat.h"
+#include "endian.h"
+#include "lzhuf.h"
+
+// static
+absl::StatusOr<DartHeader> DartHeader::ReadFromDisk(ImageSource& s) {
+  char fixed_scratch[4];
+  auto fixed = s.Read(0, 4, fixed_scratch);
+  if (!fixed.ok()) {
+    return absl::OutOfRangeError("Could not read DART header");
+  }
+  const uint8_t compression = (*fixed)[0];
+  const uint8_t disk_type = (*fixed)[1];
+  const uint16_t disk_kilobytes = BigEndian2(fixed->data() + 2);
+  if (compression > static_cast<uint8_t>(Compression::kNone)) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("Unknown DART compression %d", compression));
+  }
+  if (disk_type < 1 || disk_type > 3) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("Unknown DART disk type %d", disk_type));
+  }
+  if (disk_kilobytes != 400 && disk_kilobytes != 800 &&
+      disk_kilobytes != 720 && disk_kilobytes != 1440) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("Unknown DART disk size %dk", disk_kilobytes));
+  }
+  const size_t entries = disk_kilobytes == 1440 ? 72 : 40;
+  char lengths_scratch[72 * 2];
+  auto lengths = s.Read(4, entries * 2, lengths_scratch);
+  if (!lengths.ok()) {
+    return absl::OutOfRangeError("Could not read DART block lengths");
+  }
+  std::vector<uint16_t> block_lengths(entries);
+  for (size_t i = 0; i < entries; ++i) {
+    block_lengths[i] = BigEndian2(lengths->data() + 2 * i);
+  }
+  DartHeader header(static_cast<Compression>(compression), disk_type,
+                    disk_kilobytes, std::move(block_lengths));
+  for (uint32_t i = 0; i < header.BlockCount(); ++i) {
+    if (header.StoredBlockSize(i) == 0) {
+      return absl::InvalidArgumentError(
+          absl::StrFormat("DART block %d has length 0", i));
+    }
+  }
+  return header;
+}
+
+uint32_t DartHeader::StoredBlockSize(const uint32_t i) const {
+  if (IsUncompressed(i)) return kBlockBytes;
+  const uint16_t length = block_lengths_[i];
+  return compression_ == Compression::kRLE ? 2 * length : length;
+}
+
+std::string DartHeader::DebugString() const {
+  static constexpr const char* kCompressions[] = {"RLE", "LZH", "none"};
+  static constexpr const char* kDiskTypes[] = {"", "Macintosh", "Lisa",
+                                               "Apple II"};
+  std::string s = absl::StrFormat(
+      "DART compression: %s\ndisk type: %s\ndisk size: %dk (%d blocks)\n",
+      kCompressions[static_cast<int>(compression_)], kDiskTypes[disk_type_],
+      disk_kilobytes_, BlockCount());
+  uint64_t stored = HeaderLength();
+  for (uint32_t i = 0; i < BlockCount(); ++i) stored += StoredBlockSize(i);
+  absl::StrAppendFormat(&s, "file size: %d bytes\n", stored);
+  return s;
+}
+
+namespace {
+
+// Decodes DART "fast" compression: a signed 16-bit count n, then either n
+// literal words (n > 0) or one word to be repeated -n times (n < 0).
+absl::Status DecodeRLE(const absl::Span<const char> in,
+                       const absl::Span<char> out) {
+  size_t i = 0;
+  size_t o = 0;
+  while (o < out.size()) {
+    if (in.size() - i < 2) {
+      return absl::DataLossError(absl::StrFormat(
+          "RLE input of %d bytes ended after %d of %d output bytes",
+          in.size(), o, out.size()));
+    }
+    const int16_t count = static_cast<int16_t>(BigEndian2(in.data() + i));
+    i += 2;
+    if (count == 0) {
+      return absl::DataLossError(
+          absl::StrFormat("RLE count of 0 at input byte %d", i - 2));
+    }
+    const size_t run_bytes = 2 * std::abs(static_cast<int>(count));
+    const size_t in_bytes = count > 0 ? run_bytes : 2;
+    if (run_bytes > out.size() - o || in_bytes > in.size() - i) {
+      return absl::DataLossError(absl::StrFormat(
+          "RLE run of %d bytes at input byte %d overruns the block",
+          run_bytes, i - 2));
+    }
+    if (count > 0) {
+      memcpy(out.data() + o, in.data() + i, run_bytes);
+    } else {
+      for (size_t k = 0; k < run_bytes; k += 2) {
+        out[o + k] = in[i];
+        out[o + k + 1] = in[i + 1];
+      }
+    }
+    i += in_bytes;
+    o += run_bytes;
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::Status DecodeDart(ImageSource& s, const DartHeader& header,
+                        const ImageSource::ChunkConsumer consume_data,
+                        const ImageSource::ChunkConsumer consume_tags) {
+  // The largest stored block is an RLE block of 0xfffe words.
+  std::vector<char> scratch(2 * 0xfffe);
+  std::vector<char> block(DartHeader::kBlockBytes);
+  uint64_t offset = header.HeaderLength();
+  for (uint32_t i = 0; i < header.BlockCount(); ++i) {
+    const uint32_t stored_size = header.StoredBlockSize(i);
+    auto stored = s.Read(offset, stored_size, scratch.data());
+    if (!stored.ok()) {
+      return absl::OutOfRangeError(absl::StrFormat(
+          "Could not read DART block %d (%d bytes at %d): %s", i, stored_size,
+          offset, stored.status().message()));
+    }
+    offset += stored_size;
+    absl::Span<const char> decoded;
+    absl::Status status;
+    if (header.IsUncompressed(i)) {
+      decoded = *stored;
+    } else {
+      status = header.GetCompression() == DartHeader::Compression::kRLE
+                   ? DecodeRLE(*stored, absl::MakeSpan(block))
+                   : LzhufDecode(*stored, absl::MakeSpan(block));
+      decoded = block;
+    }
+    if (!status.ok()) {
+      return absl::DataLossError(
+          absl::StrCat("DART block ", i, ": ", status.message()));
+    }
+    status = consume_data(decoded.data(), DartHeader::kBlockDataBytes);
+    if (!status.ok()) {
+      return status;
+    }
+    status = consume_tags(decoded.data() + DartHeader::kBlockDataBytes,
+                          DartHeader::kBlockTagBytes);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
@@ -0,0 +1,99 @@
+#ifndef __DART_H__
+#define __DART_H__
+
+// Apple's DART (Disk Archive/Retrieval Tool) 1.5 compressed floppy images.
+//
+// A DART file is a header followed by the disk in blocks of 40 sectors, each
+// compressed separately. A decompressed block holds the 40 sectors' data
+// (20480 bytes) followed by their tags (40 * 12 = 480 bytes).
+//
+// Header (big-endian):
+// offset  size  contents
+// 0       1     compression: 0 = "fast" (RLE), 1 = "best" (LZH), 2 = none
+// 1       1     disk type: 1 = Macintosh, 2 = Lisa, 3 = Apple II
+// 2       2     disk size in kilobytes: 400, 800, 720 or 1440
+// 4       2*n   compressed length of each block; n = 72 for 1440k disks, 40
+//               otherwise, of which only disk size / 20 are used. RLE
+//               lengths are in 16-bit words, LZH lengths in bytes; 0xFFFF
+//               means the block is stored uncompressed.
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "image_source.h"
+
+class DartHeader {
+ public:
+  template <typename Sink>
+  friend void AbslStringify(Sink& sink, const DartHeader& h) {
+    absl::Format(&sink, "%s", h.DebugString());
+  }
+
+  enum class Compression : uint8_t { kRLE = 0, kLZH = 1, kNone = 2 };
+
+  // Sectors per block, and the decompressed size of a block.
+  static constexpr uint32_t kSectorsPerBlock = 40;
+  static constexpr uint32_t kBlockDataBytes = kSectorsPerBlock * 512;
+  static constexpr uint32_t kBlockTagBytes = kSectorsPerBlock * 12;
+  static constexpr uint32_t kBlockBytes = kBlockDataBytes + kBlockTagBytes;
+
+  // Marks a block stored without compression.
+  static constexpr uint16_t kUncompressedBlock = 0xffff;
+
+  // Reads and checks the header at the start of a DART file.
+  static absl::StatusOr<DartHeader> ReadFromDisk(ImageSource& s);
+
+  // Human-readable description of the file header.
+  std::string DebugString() const;
+
+  Compression GetCompression() const { return compression_; }
+  // 1 = Macintosh, 2 = Lisa, 3 = Apple II.
+  uint8_t DiskType() const { return disk_type_; }
+  uint32_t DiskKilobytes() const { return disk_kilobytes_; }
+
+  // Number of blocks of the disk.
+  uint32_t BlockCount() const { return disk_kilobytes_ / 20; }
+  // Size of the header; the first block follows it.
+  uint64_t HeaderLength() const { return 4 + 2 * block_lengths_.size(); }
+  // Size in bytes of all sector data, and of all tags.
+  uint32_t DataSize() const { return BlockCount() * kBlockDataBytes; }
+  uint32_t TagSize() const { return BlockCount() * kBlockTagBytes; }
+
+  // Whether block `i` (< BlockCount()) is stored without compression.
+  bool IsUncompressed(uint32_t i) const {
+    return compression_ == Compression::kNone ||
+           block_lengths_[i] == kUncompressedBlock;
+  }
+  // Bytes that block `i` (< BlockCount()) occupies in the file.
+  uint32_t StoredBlockSize(uint32_t i) const;
+
+ private:
+  DartHeader(Compression compression, uint8_t disk_type,
+             uint16_t disk_kilobytes, std::vector<uint16_t> block_lengths)
+      : compression_(compression),
+        disk_type_(disk_type),
+        disk_kilobytes_(disk_kilobytes),
+        block_lengths_(std::move(block_lengths)) {}
+
+  Compression compression_;
+  uint8_t disk_type_;
+  uint16_t disk_kilobytes_;
+  // As stored: all 40 or 72 entries.
+  std::vector<uint16_t> block_lengths_;
+};
+
+// Decompresses the DART file `s`, described by `header`, one block at a
+// time: for each block in order, calls `consume_data` on its sector data and
+// then `consume_tags` on its tags. Memory use is bounded by the size of one
+// block. Returns the first error from reading, decompressing, or either
+// consumer.
+absl::Status DecodeDart(ImageSource& s, const DartHeader& header,
+                        ImageSource::ChunkConsumer consume_data,
+                        ImageSource::ChunkConsumer consume_tags);
+
+#endif  // __DART_H__
@@ -0,0 +1,200 @@
+#include "dart.h"
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "endian.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "image_source.h"
+#include "lzhuf.h"
+
+namespace {
+
+// DART "fast" compression of `block`: runs of two or more equal words as
+// repeats, everything else as literals.
+std::vector<char> EncodeRLE(const std::vector<char>& block) {
+  std::vector<char> out;
+  const size_t words = block.size() / 2;
+  auto word = [&block](size_t w) { return BigEndian2(block.data() + 2 * w); };
+  auto put = [&out](uint16_t value) {
+    char bytes[2];
+    WriteBigEndian2(value, bytes);
+    out.insert(out.end(), bytes, bytes + 2);
+  };
+  for (size_t w = 0; w < words;) {
+    size_t run = 1;
+    while (w + run < words && run < 0x7fff && word(w + run) == word(w)) ++run;
+    if (run >= 2) {
+      put(static_cast<uint16_t>(-static_cast<int16_t>(run)));
+      put(word(w));
+      w += run;
+      continue;
+    }
+    size_t literal = 1;
+    while (w + literal < words && literal < 0x7fff &&
+           (w + literal + 1 >= words ||
+            word(w + literal + 1) != word(w + literal))) {
+      ++literal;
+    }
+    put(literal);
+    for (size_t i = 0; i < literal; ++i) put(word(w + i));
+    w += literal;
+  }
+  return out;
+}
+
+// A disk of `kilobytes` with runs of zeros and random sectors, split into
+// DART blocks.
+std::vector<std::vector<char>> DiskBlocks(uint16_t kilobytes) {
+  std::mt19937 rng(kilobytes);
+  std::vector<std::vector<char>> blocks(kilobytes / 20);
+  for (auto& block : blocks) {
+    block.assign(DartHeader::kBlockBytes, 0);
+    for (size_t i = 0; i < block.size(); ++i) {
+      if ((i / 512) % 3 == 0) block[i] = static_cast<char>(rng());
+    }
+  }
+  return blocks;
+}
+
+// A DART file of `blocks` with `compression`; blocks listed in
+// `uncompressed` are stored as is.
+std::vector<char> DartFile(const std::vector<std::vector<char>>& blocks,
+                           uint8_t compression, uint16_t kilobytes,
+                           const std::vector<size_t>& uncompressed = {}) {
+  const size_t entries = kilobytes == 1440 ? 72 : 40;
+  std::vector<char> file(4 + 2 * entries, 0);
+  file[0] = compression;
+  file[1] = 1;
+  WriteBigEndian2(kilobytes, file.data() + 2);
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    std::vector<char> stored;
+    uint16_t length = DartHeader::kUncompressedBlock;
+    const bool raw = compression == 2 ||
+                     std::find(uncompressed.begin(), uncompressed.end(), i) !=
+                         uncompressed.end();
+    if (raw) {
+      stored = blocks[i];
+    } else if (compression == 0) {
+      stored = EncodeRLE(blocks[i]);
+      length = stored.size() / 2;
+    } else {
+      stored = LzhufEncode(blocks[i]);
+      length = stored.size();
+    }
+    WriteBigEndian2(length, file.data() + 4 + 2 * i);
+    file.insert(file.end(), stored.begin(), stored.end());
+  }
+  return file;
+}
+
+void ExpectDecodes(const std::vector<char>& file,
+                   const std::vector<std::vector<char>>& blocks) {
+  MemoryImageSource source(file);
+  auto header = DartHeader::ReadFromDisk(source);
+  ASSERT_TRUE(header.ok()) << header.status();
+  EXPECT_EQ(blocks.size(), header->BlockCount());
+  std::vector<char> data;
+  std::vector<char> tags;
+  auto status = DecodeDart(
+      source, *header,
+      [&data](const char* chunk, size_t size) {
+        data.insert(data.end(), chunk, chunk + size);
+        return absl::OkStatus();
+      },
+      [&tags](const char* chunk, size_t size) {
+        tags.insert(tags.end(), chunk, chunk + size);
+        return absl::OkStatus();
+      });
+  ASSERT_TRUE(status.ok()) << status;
+  ASSERT_EQ(header->DataSize(), data.size());
+  ASSERT_EQ(header->TagSize(), tags.size());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const char* block = blocks[i].data();
+    EXPECT_TRUE(std::equal(block, block + DartHeader::kBlockDataBytes,
+                           data.begin() + i * DartHeader::kBlockDataBytes))
+        << "data of block " << i;
+    EXPECT_TRUE(std::equal(block + DartHeader::kBlockDataBytes,
+                           block + DartHeader::kBlockBytes,
+                           tags.begin() + i * DartHeader::kBlockTagBytes))
+        << "tags of block " << i;
+  }
+}
+
+TEST(Dart, DecodeRLE) {
+  const auto blocks = DiskBlocks(800);
+  ExpectDecodes(DartFile(blocks, 0, 800, {3}), blocks);
+}
+
+TEST(Dart, DecodeLZH) {
+  const auto blocks = DiskBlocks(400);
+  ExpectDecodes(DartFile(blocks, 1, 400, {0}), blocks);
+}
+
+TEST(Dart, DecodeUncompressed1440k) {
+  const auto blocks = DiskBlocks(1440);
+  const std::vector<char> file = DartFile(blocks, 2, 1440);
+  EXPECT_EQ(4 + 72 * 2 + 72 * DartHeader::kBlockBytes, file.size());
+  ExpectDecodes(file, blocks);
+}
+
+TEST(Dart, DecodeFromStream) {
+  const auto blocks = DiskBlocks(400);
+  const std::vector<char> file = DartFile(blocks, 0, 400);
+  std::istringstream stream(std::string(file.data(), file.size()));
+  StreamImageSource source(stream);
+  auto header = DartHeader::ReadFromDisk(source);
+  ASSERT_TRUE(header.ok()) << header.status();
+  size_t data_bytes = 0;
+  auto status = DecodeDart(
+      source, *header,
+      [&data_bytes](const char*, size_t size) {
+        data_bytes += size;
+        return absl::OkStatus();
+      },
+      [](const char*, size_t) { return absl::OkStatus(); });
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(400 * 1024, data_bytes);
+}
+
+TEST(Dart, RejectsBadHeader) {
+  std::vector<char> file = DartFile(DiskBlocks(400), 0, 400);
+  file[0] = 3;
+  MemoryImageSource bad_compression(file);
+  EXPECT_FALSE(DartHeader::ReadFromDisk(bad_compression).ok());
+  file[0] = 0;
+  WriteBigEndian2(500, file.data() + 2);
+  MemoryImageSource bad_size(file);
+  EXPECT_FALSE(DartHeader::ReadFromDisk(bad_size).ok());
+}
+
+TEST(Dart, CorruptBlock) {
+  const auto blocks = DiskBlocks(400);
+  std::vector<char> file = DartFile(blocks, 0, 400);
+  // Make the first block's first run claim more words than the block holds.
+  WriteBigEndian2(0x7fff, file.data() + 4 + 2 * 40);
+  MemoryImageSource source(file);
+  auto header = DartHeader::ReadFromDisk(source);
+  ASSERT_TRUE(header.ok()) << header.status();
+  auto ok = [](const char*, size_t) { return absl::OkStatus(); };
+  EXPECT_EQ(absl::StatusCode::kDataLoss,
+            DecodeDart(source, *header, ok, ok).code());
+}
+
+TEST(Dart, TruncatedFile) {
+  const auto blocks = DiskBlocks(400);
+  std::vector<char> file = DartFile(blocks, 1, 400);
+  file.resize(file.size() - 100);
+  MemoryImageSource source(file);
+  auto header = DartHeader::ReadFromDisk(source);
+  ASSERT_TRUE(header.ok()) << header.status();
+  auto ok = [](const char*, size_t) { return absl::OkStatus(); };
+  EXPECT_EQ(absl::StatusCode::kOutOfRange,
+            DecodeDart(source, *header, ok, ok).code());
+}
+
+}  // namespace
@@ -1,12 +1,26 @@
 #ifndef __DISK_COPY_H__
 #define __DISK_COPY_H__
 
+#include <algorithm>
 #include <cstdint>
+#include <optional>
 #include <string>
+#include <string_view>
 
+#include "absl/functional/any_invocable.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_format.h"
+#include "absl/types/span.h"
+#include "image_source.h"
 
+// The Disk Copy 4.2 checksum: for each big-endian 16-bit word, add it to the
+// 32-bit sum and rotate the sum right one bit.
+//
+// The carry out of bit 31 of the addition is discarded, so the contribution
+// of a span of words depends on the sum it starts from; checksums of
+// independent spans cannot be merged afterwards. A single image is therefore
+// summed in order; UpdateSumFromSource sums mapped and in-memory sources in
+// place, and overlaps the reads of a stream with the summation.
 class DiskCopyChecksum {
  public:
   explicit DiskCopyChecksum(uint32_t initial_sum = 0) : sum_(initial_sum) {}
@@ -14,20 +28,41 @@ class DiskCopyChecksum {
   uint32_t UpdateSum(uint16_t new_word);
   uint32_t Sum() const { return sum_; }
 
-  // Updates sum by reading `byte_count` bytes from `s`. Will return an
-  // error if an I/O error is detected, or if byte_count is not even.
-  absl::Status UpdateSumFromFile(std::ifstream& s, uint32_t byte_count);
+  // Updates sum from `byte_count` bytes of `s` starting at `offset`; mapped
+  // and in-memory sources are summed in place. Will return an error if an
+  // I/O error is detected, or if byte_count is not even.
+  absl::Status UpdateSumFromSource(ImageSource& s, uint64_t offset,
+                                   uint64_t byte_count);
 
   // Updates sum from a buffer in memory. The buffer must be an even number
   // of bytes; that is the only source of an error.
-  absl::Status UpdateSumFromBlock(const char* buf, uint32_t byte_count);
+  absl::Status UpdateSumFromBlock(const char* buf, size_t byte_count);
+
+  // The add-and-rotate step can be undone: RevertSum(w) after UpdateSum(w)
+  // restores the previous sum, and RevertSumFromBlock(buf, n) undoes
+  // UpdateSumFromBlock(buf, n). This is what lets a patch reuse the sum in
+  // the header instead of summing the data before the patch again.
+  uint32_t RevertSum(uint16_t old_word);
+  absl::Status RevertSumFromBlock(const char* buf, size_t byte_count);
 
  private:
   uint32_t sum_;
 };
 
+// New contents for bytes [offset, offset + bytes.size()) of a data section.
+// Both must be even, as the data checksum is over 16-bit words.
+struct DataPatch {
+  uint32_t offset;
+  absl::Span<const char> bytes;
+};
+
 class DiskCopyHeader {
  public:
+  // Size of the header; the data section starts at this offset.
+  static constexpr size_t kHeaderLength = 84;
+  // Tag bytes per 512-byte sector.
+  static constexpr size_t kTagBytesPerSector = 12;
+
   template <typename Sink>
   friend void AbslStringify(Sink& sink, const DiskCopyHeader& h) {
     absl::Format(&sink, "%s", h.DebugString());
@@ -36,62 +71,173 @@ class DiskCopyHeader {
   // Human-readable description of the file header.
   std::string DebugString() const;
 
-  // Read header from a (binary-format) file stream; seeks to the start of
-  // the stream, leaving s positioned at the start of the data.
-  static absl::StatusOr<DiskCopyHeader> ReadFromDisk(std::ifstream& s);
+  // Read header from the first kHeaderLength bytes of an image.
+  static absl::StatusOr<DiskCopyHeader> ReadFromDisk(ImageSource& s);
 
   // Writes header to (binary-format) file stream; it DOES NOT seek the
   // stream before writing.
   absl::Status WriteToDisk(std::ofstream& s);
 
+  // Writes the kHeaderLength bytes of the header to `header_bytes`.
+  void WriteToBuffer(char header_bytes[kHeaderLength]) const;
+
+  // Rewrites only the data checksum field of a header previously written at
+  // the start of s, e.g. after streaming the data with a placeholder sum.
+  // Leaves s positioned at its end.
+  absl::Status WriteDataChecksumToDisk(std::ofstream& s);
+
   // Create a header for an HFS floppy with the specified volume name.
   // Returns an error if the name is too long.
   // data_block_count is the size in HFS (512-byte) disk blocks.
-  // Returns an error if data_block_count does not appear to be a 400k, 800k,
-  // 720k or 1440k floppy.
+  // A 400k, 800k, 720k or 1440k floppy gets its own disk format code; any
+  // larger count (an HD20 or other hard disk, up to the 4 GiB that the
+  // 32-bit data size can describe) is recorded as 1440k with format byte
+  // 0x22, as other tools writing hard disk images do. Returns an error for
+  // any other count.
   static absl::StatusOr<DiskCopyHeader> CreateForHFS(
       absl::string_view name, uint32_t data_block_count, uint32_t data_checksum,
       uint32_t tag_byte_count = 0, uint32_t tag_checksum = 0);
 
+  // Create a header (with a zero data checksum) for the raw HFS image that
+  // starts with `hfs_prefix`, which must hold at least the first
+  // HFSMasterDirectoryBlock::kPrefixBytes of the image. The volume name and
+  // size come from the image's MDB.
+  static absl::StatusOr<DiskCopyHeader> CreateForHFSImage(
+      absl::Span<const char> hfs_prefix);
+
   // Verify the data checksum of an image:
-  // Read the data words from ifstream s, based on the header contents.
+  // Read the data words from s, based on the header contents.
   // Compute the data checksum, and compare it to header_data_checksum_.
   // If the data can be read and the computed checksum matches,
   // return OK; otherwise an error.
   //
   // Note that the file should contain an integer number of 16-bit data words,
   // i.e. the data byte count should be a multiple of 2.
-  absl::Status VerifyDataChecksum(std::ifstream& s);
+  absl::Status VerifyDataChecksum(ImageSource& s);
 
   // Verify the Tag checksum as with VerifyDataChecksum; however, if the
   // header indicates no tag bits are present, always return OK without
   // reading any data.
-  absl::Status VerifyTagChecksum(std::ifstream& s);
+  //
+  // By Disk Copy convention the tag checksum omits the first 12 tag bytes
+  // (the tag of sector 0); `skip_first_tag` = false includes them.
+  absl::Status VerifyTagChecksum(ImageSource& s, bool skip_first_tag = true);
+
+  // Results of VerifyChecksums: OK, or an error describing the mismatch.
+  struct ChecksumResults {
+    absl::Status data;
+    absl::Status tag;
+
+    // OK if both checksums match; otherwise an error describing every
+    // mismatch.
+    absl::Status Overall() const;
+  };
+
+  // Sums the data and tag sections, which follow the header directly, from
+  // consecutive chunks supplied by the caller, as VerifyChecksums does; for
+  // readers other than ImageSource, such as the io_uring batch reader.
+  class ChecksumVerifier {
+   public:
+    ChecksumVerifier(const DiskCopyHeader& header, bool skip_first_tag);
+
+    // Takes the next `chunk_size` bytes after the header. Fails only on an
+    // odd split between data and tags, which a valid header never has.
+    absl::Status Update(const char* chunk, size_t chunk_size);
+    // As above, also passing the data bytes of the chunk to `observe_data`.
+    absl::Status Update(const char* chunk, size_t chunk_size,
+                        ImageSource::ChunkConsumer observe_data);
+
+    // The bytes still expected: the rest of the data and tag sections.
+    uint64_t Remaining() const { return end_ - position_; }
+    // The results once Remaining() is 0.
+    ChecksumResults Results() const;
+
+   private:
+    const uint32_t expected_data_;
+    const uint32_t expected_tag_;
+    const bool has_tags_;
+    // Offsets from the start of the data section.
+    const uint64_t tag_start_;
+    const uint64_t tag_sum_start_;
+    const uint64_t end_;
+    uint64_t position_ = 0;
+    DiskCopyChecksum data_sum_;
+    DiskCopyChecksum tag_sum_;
+  };
+
+  // Verify the data and tag checksums together, in one sequential read of
+  // the data and tag sections. Returns an error only if the sections cannot
+  // be read; checksum mismatches are reported in the results.
+  absl::StatusOr<ChecksumResults> VerifyChecksums(ImageSource& s,
+                                                  bool skip_first_tag = true);
+  // As above, also passing the data section, in order, to `observe_data` as
+  // it is summed, so that it can be examined (e.g. hashed) without being
+  // read again. An error from `observe_data` ends the pass.
+  absl::StatusOr<ChecksumResults> VerifyChecksums(
+      ImageSource& s, bool skip_first_tag,
+      ImageSource::ChunkConsumer observe_data);
+
+  // Returns the data checksum the image in `s` will have once `patches`,
+  // sorted by offset and not overlapping, are written over its data
+  // section. Each step's carry depends on every earlier word, so the data
+  // after the first patch is always summed again.
+  //
+  // Normally the whole section is summed forward, with the old words and
+  // with the new, reading it once; if the old words do not sum to the
+  // header's checksum, the image is already damaged and this fails with
+  // DataLoss rather than give it a valid checksum. With
+  // `trust_header_checksum`, a first patch in the back half is handled by
+  // unwinding the header's checksum back to it and summing forward from
+  // there: the rest is read twice, less than the whole section, and the
+  // data before the patch is not read, but the result is only correct if
+  // the header's checksum matches the current data, which is not checked.
+  absl::StatusOr<uint32_t> PatchedDataChecksum(
+      ImageSource& s, absl::Span<const DataPatch> patches,
+      bool trust_header_checksum = false) const;
 
   // Checks header for validity; if header appears valid, returns the total
   // file size (in bytes) it represents.
-  absl::StatusOr<uint32_t> Validate() const;
+  absl::StatusOr<uint64_t> Validate() const;
 
   // Total Disk Copy file size, in bytes, for the image file described by the
-  // header.
-  uint32_t TotalFileSize() const;
+  // header. The data and tag sizes are each 32 bits, so the total may not
+  // be.
+  uint64_t TotalFileSize() const;
+
+  // Image name stored in the header (usually the volume name).
+  std::string_view Name() const {
+    return std::string_view(name_bytes_,
+                            std::min(name_length_, kMaxNameLength));
+  }
+  // The disk format and format byte codes, as stored (see disk_format_ and
+  // format_byte_ below).
+  uint8_t DiskFormatCode() const { return disk_format_; }
+  uint8_t FormatByteCode() const { return format_byte_; }
 
   // Size of data section in bytes.
   uint32_t DataSize() const { return data_size_; }
   // Checksum expected from header.
   uint32_t ExpectedDataChecksum() const { return header_data_checksum_; }
+  void SetDataChecksum(uint32_t checksum) { header_data_checksum_ = checksum; }
+  // Returns an error unless `computed_checksum` is the expected data checksum.
+  absl::Status CheckDataChecksum(uint32_t computed_checksum) const;
 
   // Size of tag section in bytes.
   uint32_t TagSize() const { return tag_size_; }
   // Checksum expected from header.
   uint32_t ExpectedTagChecksum() const { return header_tag_checksum_; }
+  void SetTagChecksum(uint32_t checksum) { header_tag_checksum_ = checksum; }
 
  private:
-  static constexpr size_t kHeaderLength = 84;
   static constexpr size_t kMaxNameLength = 63;
+  static constexpr size_t kDataChecksumOffset = 72;
   static constexpr uint16_t kPrivate = 0x100;  // magic number
 
   explicit DiskCopyHeader(const char header_bytes[kHeaderLength]);
+  // The header's data checksum with the words from `offset` to the end of
+  // the data section in `s` unwound: the sum of the words before `offset`.
+  absl::StatusOr<uint32_t> UnwoundDataChecksum(ImageSource& s,
+                                               uint32_t offset) const;
   DiskCopyHeader(const std::string_view name, uint32_t data_size,
                  uint32_t tag_size, uint32_t header_data_checksum,
                  uint32_t header_tag_checksum, uint8_t disk_format,
@@ -218,4 +364,124 @@ class DiskCopyHeader {
   // file; this may indicate something special.
 };
 
+// Where DiskCopyReader and DiskCopyWriter pass bytes on: a view of part of
+// a fed chunk (or, for a 16-bit word split between two chunks, of a copy
+// of that word), valid only during the call.
+using DiskCopyChunkSink =
+    absl::AnyInvocable<absl::Status(const char* chunk, size_t chunk_size)>;
+
+// The parts of a DC42 file, in file order.
+enum class DiskCopySection { HEADER, DATA, TAGS, END };
+
+// Splits a DC42 file pushed to it in chunks of any size into its sections,
+// summing the data and tags on the way, for callers that read with buffers
+// of their own (a socket, io_uring, a decompressor) rather than through an
+// ImageSource. The header is collected and validated; the data and tag
+// bytes go on to `data_sink` and `tag_sink` without being copied.
+class DiskCopyReader {
+ public:
+  DiskCopyReader(DiskCopyChunkSink data_sink, DiskCopyChunkSink tag_sink,
+                 bool skip_first_tag = true);
+
+  // Takes the next bytes of the file. Fails if the header is invalid, if a
+  // sink fails, or on bytes past the end of the tags.
+  absl::Status Feed(absl::Span<const char> chunk);
+
+  // The section the next byte fed belongs to.
+  DiskCopySection section() const;
+  // The header, once it has been fed; null before.
+  const DiskCopyHeader* header() const {
+    return header_.has_value() ? &*header_ : nullptr;
+  }
+  // The checksum results once the whole file has been fed; DataLoss if it
+  // has not.
+  absl::StatusOr<DiskCopyHeader::ChecksumResults> Finish() const;
+
+ private:
+  // Takes the next even number of bytes after the header.
+  absl::Status FeedSections(const char* chunk, size_t chunk_size);
+
+  DiskCopyChunkSink data_sink_;
+  DiskCopyChunkSink tag_sink_;
+  const bool skip_first_tag_;
+  char header_bytes_[DiskCopyHeader::kHeaderLength];
+  size_t header_filled_ = 0;
+  std::optional<DiskCopyHeader> header_;
+  std::optional<DiskCopyHeader::ChecksumVerifier> verifier_;
+  // The first byte of a word whose second byte is in the next chunk.
+  char pending_byte_;
+  bool has_pending_byte_ = false;
+};
+
+// Assembles a DC42 file from its data and then its tags, pushed in chunks
+// of any size, passing the file on to `sink` in order: `header` first, as
+// given, then the fed chunks themselves. Both checksums depend on every
+// byte, so Finish returns the header with them filled in, to write over
+// the first DiskCopyHeader::kHeaderLength bytes (or, for output that cannot
+// seek, to send ahead of output held back until then).
+class DiskCopyWriter {
+ public:
+  DiskCopyWriter(const DiskCopyHeader& header, DiskCopyChunkSink sink);
+
+  // Takes the next bytes of the data section, then of the tags. Fails if
+  // the sink fails or on bytes past the header's tag size.
+  absl::Status Feed(absl::Span<const char> chunk);
+
+  // The section the next byte fed belongs to.
+  DiskCopySection section() const;
+  // The header with both checksums, once all the data and tags have been
+  // fed; DataLoss if they have not. By Disk Copy convention the tags of
+  // sector 0 are not summed.
+  absl::StatusOr<DiskCopyHeader> Finish();
+
+ private:
+  // Sends the header to the sink, if that has not been done yet.
+  absl::Status SendHeader();
+  // Takes the next even number of bytes.
+  absl::Status FeedSections(const char* chunk, size_t chunk_size);
+
+  DiskCopyHeader header_;
+  DiskCopyChunkSink sink_;
+  bool header_sent_ = false;
+  // Offset from the start of the data section.
+  uint64_t position_ = 0;
+  DiskCopyChecksum data_sum_;
+  DiskCopyChecksum tag_sum_;
+  char pending_byte_;
+  bool has_pending_byte_ = false;
+};
+
+// Encoding, decoding and verifying whole images held in memory, such as
+// images received over the network. None of these allocate; output goes to
+// buffers provided by the caller.
+
+// Encodes the raw HFS image `hfs_image` as a DC42 file in `disk_copy`, and
+// returns the number of bytes written. The DC42 file is at most
+// DiskCopyHeader::kHeaderLength + hfs_image.size() bytes, or exactly
+// CreateForHFSImage(hfs_image)->TotalFileSize().
+absl::StatusOr<size_t> EncodeDiskCopy(absl::Span<const char> hfs_image,
+                                      absl::Span<char> disk_copy);
+
+// Decodes the data section of the DC42 file `disk_copy` into `hfs_image`,
+// and returns the number of bytes written: the header's DataSize(), at most
+// disk_copy.size() - DiskCopyHeader::kHeaderLength. Unless
+// `ignore_data_checksum`, returns an error if the data checksum does not
+// match (after writing hfs_image).
+absl::StatusOr<uint32_t> DecodeDiskCopy(absl::Span<const char> disk_copy,
+                                        absl::Span<char> hfs_image,
+                                        bool ignore_data_checksum = false);
+
+// Verifies the data and tag checksums of the DC42 file `disk_copy`, as
+// DiskCopyHeader::VerifyChecksums. Returns an error describing every
+// mismatched checksum.
+absl::Status VerifyDiskCopy(absl::Span<const char> disk_copy,
+                            bool skip_first_tag = true);
+
+// Writes `patches` (as for DiskCopyHeader::PatchedDataChecksum) over the
+// data section of the DC42 file `disk_copy`, and updates the header's data
+// checksum to match. Fails, writing nothing, if the old checksum does not
+// match the data.
+absl::Status PatchDiskCopy(absl::Span<char> disk_copy,
+                           absl::Span<const DataPatch> patches);
+
 #endif  // __DISK_COPY_H__
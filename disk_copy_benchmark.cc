@@ -0,0 +1,262 @@
+// Benchmarks for the checksum, header parsing and the end-to-end commands.
+// Throughput is reported as bytes_per_second; run with e.g.
+//   bazel run -c opt :disk_copy_benchmark -- --benchmark_filter=Checksum
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "disk_copy.h"
+#include "disk_copy_commands.h"
+#include "endian.h"
+#include "hfs_basic.h"
+#include "image_source.h"
+#include "mfs_tags.h"
+#include "volume_usage.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+std::vector<char> RandomBytes(size_t size) {
+  std::mt19937 rng(size);
+  std::vector<char> bytes(size);
+  for (char& c : bytes) c = static_cast<char>(rng());
+  return bytes;
+}
+
+// A raw HFS image of `blocks` 512-byte blocks, with just enough of an MDB
+// for `create`.
+std::vector<char> HFSImage(uint32_t blocks) {
+  std::vector<char> image = RandomBytes(blocks * 512);
+  char* mdb = image.data() + 1024;
+  memset(mdb, 0, 512);
+  WriteBigEndian2(0x4244, mdb);            // signature
+  WriteBigEndian2(blocks - 6, mdb + 18);   // number of allocation blocks
+  WriteBigEndian4(512, mdb + 20);          // allocation block size
+  WriteBigEndian2(4, mdb + 28);            // first allocation block
+  mdb[36] = 5;
+  memcpy(mdb + 37, "Bench", 5);
+  return image;
+}
+
+// A DC42 file around `data`, with a valid header and data checksum. Written
+// by hand so that sizes CreateForHFS does not accept can be measured too.
+std::vector<char> DC42Image(const std::vector<char>& data) {
+  std::vector<char> file(DiskCopyHeader::kHeaderLength);
+  file[0] = 5;
+  memcpy(file.data() + 1, "Bench", 5);
+  WriteBigEndian4(data.size(), file.data() + 64);
+  DiskCopyChecksum sum;
+  (void)sum.UpdateSumFromBlock(data.data(), data.size());
+  WriteBigEndian4(sum.Sum(), file.data() + 72);
+  file[80] = 3;
+  file[81] = 0x22;
+  WriteBigEndian2(0x100, file.data() + 82);
+  file.insert(file.end(), data.begin(), data.end());
+  return file;
+}
+
+// A file in the temporary directory holding `bytes`, removed when the
+// benchmark using it finishes, along with the outputs named by Output().
+class TempFile {
+ public:
+  TempFile(const std::string& name, const std::vector<char>& bytes)
+      : path_((fs::temp_directory_path() / ("disk_copy_benchmark_" + name))
+                  .string()) {
+    std::ofstream(path_, std::ios::binary).write(bytes.data(), bytes.size());
+  }
+  TempFile(const TempFile&) = delete;
+  TempFile& operator=(const TempFile&) = delete;
+  ~TempFile() {
+    std::error_code ec;
+    fs::remove(path_, ec);
+    for (const std::string& output : outputs_) fs::remove(output, ec);
+  }
+
+  const std::string& path() const { return path_; }
+  // The path of the file plus `suffix`, for a command's output.
+  std::string Output(const std::string& suffix) {
+    outputs_.push_back(path_ + suffix);
+    return outputs_.back();
+  }
+
+ private:
+  const std::string path_;
+  std::vector<std::string> outputs_;
+};
+
+void BM_ChecksumUpdateSum(benchmark::State& state) {
+  const std::vector<char> bytes = RandomBytes(state.range(0));
+  for (auto _ : state) {
+    DiskCopyChecksum sum;
+    for (size_t i = 0; i < bytes.size(); i += 2) {
+      sum.UpdateSum(BigEndian2(bytes.data() + i));
+    }
+    benchmark::DoNotOptimize(sum.Sum());
+  }
+  state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_ChecksumUpdateSum)->Range(512, 1 << 20);
+
+void BM_ChecksumUpdateSumFromBlock(benchmark::State& state) {
+  const std::vector<char> bytes = RandomBytes(state.range(0));
+  for (auto _ : state) {
+    DiskCopyChecksum sum;
+    benchmark::DoNotOptimize(
+        sum.UpdateSumFromBlock(bytes.data(), bytes.size()));
+    benchmark::DoNotOptimize(sum.Sum());
+  }
+  state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_ChecksumUpdateSumFromBlock)->Range(512, 1 << 20);
+
+void BM_HeaderParseAndValidate(benchmark::State& state) {
+  const std::vector<char> file = DC42Image(HFSImage(1600));
+  MemoryImageSource source(file);
+  for (auto _ : state) {
+    auto header = DiskCopyHeader::ReadFromDisk(source);
+    benchmark::DoNotOptimize(header->Validate());
+  }
+  state.SetBytesProcessed(state.iterations() * DiskCopyHeader::kHeaderLength);
+}
+BENCHMARK(BM_HeaderParseAndValidate);
+
+void BM_MDBParse(benchmark::State& state) {
+  const std::vector<char> image = HFSImage(1600);
+  MemoryImageSource source(image);
+  for (auto _ : state) {
+    auto mdb = HFSMasterDirectoryBlock::ReadFromDisk(source);
+    benchmark::DoNotOptimize(mdb->Valid());
+    benchmark::DoNotOptimize(mdb->VolumeName());
+  }
+  state.SetBytesProcessed(state.iterations() * 512);
+}
+BENCHMARK(BM_MDBParse);
+
+// Word conversion, a field at a time and a run at a time.
+void BM_BigEndian2(benchmark::State& state) {
+  const std::vector<char> bytes = RandomBytes(state.range(0));
+  std::vector<uint16_t> words(bytes.size() / 2);
+  for (auto _ : state) {
+    for (size_t i = 0; i < words.size(); ++i) {
+      words[i] = BigEndian2(bytes.data() + 2 * i);
+    }
+    benchmark::DoNotOptimize(words.data());
+  }
+  state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_BigEndian2)->Range(512, 1 << 16);
+
+void BM_ReadBigEndian2Array(benchmark::State& state) {
+  const std::vector<char> bytes = RandomBytes(state.range(0));
+  std::vector<uint16_t> words(bytes.size() / 2);
+  for (auto _ : state) {
+    ReadBigEndian2Array(bytes.data(), absl::MakeSpan(words));
+    benchmark::DoNotOptimize(words.data());
+  }
+  state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_ReadBigEndian2Array)->Range(512, 1 << 16);
+
+void BM_ReadBigEndian4Array(benchmark::State& state) {
+  const std::vector<char> bytes = RandomBytes(state.range(0));
+  std::vector<uint32_t> words(bytes.size() / 4);
+  for (auto _ : state) {
+    ReadBigEndian4Array(bytes.data(), absl::MakeSpan(words));
+    benchmark::DoNotOptimize(words.data());
+  }
+  state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_ReadBigEndian4Array)->Range(512, 1 << 16);
+
+// Tags for `blocks` sectors: a few files laid out in runs, with the odd
+// trashed or invalid tag.
+std::vector<char> MfsTagSection(uint32_t blocks) {
+  std::vector<char> tags(size_t{blocks} * kMfsTagBytes);
+  std::mt19937 rng(blocks);
+  for (uint32_t i = 0; i < blocks; ++i) {
+    char* tag = tags.data() + size_t{i} * kMfsTagBytes;
+    const uint32_t r = rng();
+    uint16_t flags = kMfsTagUserFile | (i / 64 % 2 ? kMfsTagResourceFork : 0);
+    if (r % 97 == 0) flags |= kMfsTagInvalid;
+    WriteBigEndian4(i / 128 + 1, tag);
+    WriteBigEndian2(flags, tag + 4);
+    WriteBigEndian2(i % 64, tag + 6);
+    WriteBigEndian4(r % 89 == 0 ? kMfsTagTrashed : r >> 16, tag + 8);
+  }
+  return tags;
+}
+
+void BM_DecodeMfsTags(benchmark::State& state) {
+  const std::vector<char> tags = MfsTagSection(state.range(0));
+  for (auto _ : state) {
+    auto decoded = DecodeMfsTags(tags);
+    benchmark::DoNotOptimize(decoded->forks.data());
+  }
+  state.SetBytesProcessed(state.iterations() * tags.size());
+}
+BENCHMARK(BM_DecodeMfsTags)->Arg(800)->Arg(1600)->Arg(1 << 16);
+
+// Usage counted from a random bitmap of `blocks` allocation blocks; 65535
+// is the most an HFS volume has.
+void BM_CountVolumeUsage(benchmark::State& state) {
+  const std::vector<char> bitmap = RandomBytes((state.range(0) + 7) / 8);
+  for (auto _ : state) {
+    auto usage = CountVolumeUsage(bitmap, state.range(0));
+    benchmark::DoNotOptimize(usage->largest_free_run);
+  }
+  state.SetBytesProcessed(state.iterations() * bitmap.size());
+}
+BENCHMARK(BM_CountVolumeUsage)->Arg(1594)->Arg(65535);
+
+// End-to-end commands over image files; the argument is the size in 512-byte
+// blocks (800 = 400k, 1600 = 800k, 2880 = 1440k; larger ones are hard-disk
+// sized).
+void BM_CreateCommand(benchmark::State& state) {
+  TempFile input("create.img", HFSImage(state.range(0)));
+  const std::string output = input.Output(".dc42");
+  for (auto _ : state) {
+    auto status = CreateCommand(input.path(), output, false);
+    if (!status.ok()) state.SkipWithError(status.ToString().c_str());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0) * 512);
+}
+BENCHMARK(BM_CreateCommand)->Arg(800)->Arg(1600)->Arg(2880);
+
+void BM_ExtractCommand(benchmark::State& state) {
+  TempFile input("extract.dc42", DC42Image(HFSImage(state.range(0))));
+  const std::string output = input.Output(".img");
+  for (auto _ : state) {
+    auto status =
+        ExtractCommand(input.path(), output, false, state.range(1) != 0,
+                       SparseMode::NONE, false);
+    if (!status.ok()) state.SkipWithError(status.status().ToString().c_str());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0) * 512);
+}
+// Second argument: 1 to let the kernel copy the data.
+BENCHMARK(BM_ExtractCommand)
+    ->ArgsProduct({{800, 1600, 2880, 40960, 409600}, {0, 1}});
+
+void BM_VerifyCommand(benchmark::State& state) {
+  TempFile input("verify.dc42", DC42Image(HFSImage(state.range(0))));
+  for (auto _ : state) {
+    auto status = VerifyCommand(input.path(), true, false);
+    if (!status.ok()) state.SkipWithError(status.ToString().c_str());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0) * 512);
+}
+BENCHMARK(BM_VerifyCommand)
+    ->Arg(800)
+    ->Arg(1600)
+    ->Arg(2880)
+    ->Arg(40960)
+    ->Arg(409600);
+
+}  // namespace
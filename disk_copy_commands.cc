@@ -0,0 +1,1370 @@
+#include "disk_copy_commands.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "checksum_index.h"
+#include "chunk_reader.h"
+#include "command_stats.h"
+#include "dart.h"
+#include "disk_copy.h"
+#include "disk_copy_image.h"
+#include "disk_copy_overlay.h"
+#include "file_copy.h"
+#include "fingerprint.h"
+#include "hfs_basic.h"
+#include "hfs_catalog.h"
+#include "image_source.h"
+#include "mac_file.h"
+#include "ndif.h"
+#include "resource_fork.h"
+#include "sparse_writer.h"
+#include "volume_usage.h"
+
+using std::cerr;
+using std::string_view;
+
+namespace {
+
+// Opens `path` for writing, or returns standard output for
+// kStandardStreamPath. `file` holds the opened file.
+absl::StatusOr<std::ostream*> OpenOutput(const string_view path,
+                                         std::ofstream& file,
+                                         const string_view flag_name) {
+  if (path == kStandardStreamPath) return &std::cout;
+  file.open(std::string(path), std::ios::binary);
+  if (!file.good()) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not open ", flag_name, " '", path, "'"));
+  }
+  return &file;
+}
+
+// Copies the data section of `input` to `output_image` through a user-space
+// buffer, summing it on the way.
+absl::Status BufferedExtract(ImageSource& input, const string_view output_image,
+                             const uint32_t data_size, DiskCopyChecksum& sum,
+                             CommandStats& stats) {
+  stats.Enter(Phase::OPEN);
+  std::ofstream output_file;
+  auto output = OpenOutput(output_image, output_file, "output_image");
+  if (!output.ok()) {
+    return output.status();
+  }
+  stats.Count(Phase::OPEN, 0);
+  std::ostream& output_hfs = **output;
+  uint64_t bytes_written = 0;
+  stats.Enter(Phase::READ);
+  auto status = input.ReadChunks(
+      DiskCopyHeader::kHeaderLength, data_size,
+      [&](const char* chunk, size_t chunk_size) {
+        stats.Count(Phase::READ, chunk_size);
+        stats.Enter(Phase::CHECKSUM);
+        // The header was validated, which should mean the only possible error
+        // has already been checked (sum is computed over 16-bit words, so an
+        // odd number of bytes is an error; chunks are even-sized except
+        // perhaps the last, and the data size is even).
+        absl::Status sum_status = sum.UpdateSumFromBlock(chunk, chunk_size);
+        if (!sum_status.ok()) {
+          return sum_status;
+        }
+        stats.Count(Phase::CHECKSUM, chunk_size);
+        stats.Enter(Phase::WRITE);
+        if (!output_hfs.write(chunk, chunk_size)) {
+          return absl::ResourceExhaustedError(absl::StrFormat(
+              "Could not write %d bytes of HFS image output at %d",
+              chunk_size, bytes_written));
+        }
+        stats.Count(Phase::WRITE, chunk_size);
+        bytes_written += chunk_size;
+        stats.Enter(Phase::READ);
+        return absl::OkStatus();
+      });
+  stats.Enter(Phase::WRITE);
+  if (status.ok() && !output_hfs.flush()) {
+    return absl::ResourceExhaustedError("Could not write HFS image output");
+  }
+  return status;
+}
+
+// Copies the data section of `input` to a new `output_image` file, summing
+// it on the way, and leaving holes in the file (see SparseImageWriter).
+// Returns the number of bytes written rather than left as holes.
+absl::StatusOr<uint64_t> SparseExtract(ImageSource& input,
+                                       const string_view output_image,
+                                       const uint32_t data_size,
+                                       const bool skip_unallocated,
+                                       DiskCopyChecksum& sum,
+                                       CommandStats& stats) {
+  if (output_image == kStandardStreamPath) {
+    return absl::InvalidArgumentError(
+        "--sparse needs an --output_image file, not standard output");
+  }
+  stats.Enter(Phase::OPEN);
+  const int out_fd =
+      open(std::string(output_image).c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+           0666);
+  if (out_fd < 0) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not open output_image '", output_image, "'"));
+  }
+  absl::Cleanup close_out = [out_fd] { close(out_fd); };
+  stats.Count(Phase::OPEN, 0);
+  SparseImageWriter writer(out_fd, skip_unallocated);
+  stats.Enter(Phase::READ);
+  auto status = input.ReadChunks(
+      DiskCopyHeader::kHeaderLength, data_size,
+      [&](const char* chunk, size_t chunk_size) {
+        stats.Count(Phase::READ, chunk_size);
+        stats.Enter(Phase::CHECKSUM);
+        absl::Status sum_status = sum.UpdateSumFromBlock(chunk, chunk_size);
+        if (!sum_status.ok()) {
+          return sum_status;
+        }
+        stats.Count(Phase::CHECKSUM, chunk_size);
+        stats.Enter(Phase::WRITE);
+        auto write_status = writer.Write(chunk, chunk_size);
+        stats.Enter(Phase::READ);
+        return write_status;
+      });
+  stats.Enter(Phase::WRITE);
+  if (status.ok()) status = writer.Finish();
+  if (!status.ok()) {
+    return status;
+  }
+  stats.Count(Phase::WRITE, writer.bytes_written());
+  return writer.bytes_written();
+}
+
+// Sums the data section in place in the memory-backed `input`, then has the
+// kernel copy it from the `disk_copy` file into `output_image`. Whatever the
+// kernel cannot copy is written straight from `input`'s memory.
+absl::Status KernelExtract(ImageSource& input, const string_view disk_copy,
+                           const string_view output_image,
+                           const uint32_t data_size, DiskCopyChecksum& sum,
+                           CommandStats& stats) {
+  stats.Enter(Phase::CHECKSUM);
+  auto sum_status =
+      sum.UpdateSumFromSource(input, DiskCopyHeader::kHeaderLength, data_size);
+  if (!sum_status.ok()) {
+    return sum_status;
+  }
+  stats.Count(Phase::CHECKSUM, data_size);
+  stats.Enter(Phase::OPEN);
+  const int in_fd = open(std::string(disk_copy).c_str(), O_RDONLY);
+  if (in_fd < 0) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open disk_copy '", disk_copy, "'"));
+  }
+  absl::Cleanup close_in = [in_fd] { close(in_fd); };
+  stats.Count(Phase::OPEN, 0);
+  const int out_fd =
+      open(std::string(output_image).c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+           0666);
+  if (out_fd < 0) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not open output_image '", output_image, "'"));
+  }
+  absl::Cleanup close_out = [out_fd] { close(out_fd); };
+  stats.Count(Phase::OPEN, 0);
+  stats.Enter(Phase::WRITE);
+  auto copied = KernelCopyRange(in_fd, DiskCopyHeader::kHeaderLength, out_fd,
+                                0, data_size);
+  if (!copied.ok()) {
+    return copied.status();
+  }
+  stats.Count(Phase::WRITE, *copied);
+  if (*copied == data_size) return absl::OkStatus();
+  if (lseek(out_fd, *copied, SEEK_SET) < 0) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not seek output_image '", output_image, "'"));
+  }
+  return input.ReadChunks(DiskCopyHeader::kHeaderLength + *copied,
+                          data_size - *copied,
+                          [&](const char* chunk, size_t chunk_size) {
+                            stats.Count(Phase::WRITE, chunk_size);
+                            return WriteFully(out_fd, chunk, chunk_size);
+                          });
+}
+
+// Writes an image decoded from another format as a raw image and/or a DC42
+// file, either of which may be omitted (to just test the decoding). The
+// DC42 header depends on the whole image, so it is written last, over the
+// placeholder DiskCopyWriter starts the file with.
+class DecodedImageWriter {
+ public:
+  DecodedImageWriter(const string_view output_image,
+                     const string_view disk_copy)
+      : output_image_(output_image), disk_copy_(disk_copy) {}
+
+  // Opens the outputs for an image of `data_size` bytes of data and
+  // `tag_size` bytes of tags.
+  absl::Status Open(const uint64_t data_size, const uint32_t tag_size) {
+    if (!output_image_.empty()) {
+      raw_.open(std::string(output_image_), std::ios::binary);
+      if (!raw_.good()) {
+        return absl::ResourceExhaustedError(absl::StrCat(
+            "Could not open output_image '", output_image_, "'"));
+      }
+    }
+    if (disk_copy_.empty()) return absl::OkStatus();
+    // Fail now, rather than after decoding, if DC42 cannot hold the image.
+    if (data_size % 512 != 0 || data_size / 512 > UINT32_MAX) {
+      return absl::InvalidArgumentError(absl::StrFormat(
+          "Image of %d bytes is not a whole number of disk blocks",
+          data_size));
+    }
+    auto dch = DiskCopyHeader::CreateForHFS("", data_size / 512, 0, tag_size);
+    if (!dch.ok()) {
+      return dch.status();
+    }
+    dc42_.open(std::string(disk_copy_), std::ios::binary);
+    if (!dc42_.good()) {
+      return absl::ResourceExhaustedError(
+          absl::StrCat("Could not open disk_copy '", disk_copy_, "'"));
+    }
+    dc42_writer_.emplace(*dch, [this](const char* chunk, size_t chunk_size) {
+      if (!dc42_.write(chunk, chunk_size)) {
+        return absl::ResourceExhaustedError(
+            absl::StrCat("Could not write disk_copy '", disk_copy_, "'"));
+      }
+      return absl::OkStatus();
+    });
+    return absl::OkStatus();
+  }
+
+  absl::Status Data(const char* chunk, const size_t chunk_size) {
+    if (bytes_written_ == 0 && !disk_copy_.empty()) {
+      // The first chunk normally holds the MDB; if not, the DC42 file gets
+      // the fallback name.
+      MemoryImageSource prefix(absl::MakeConstSpan(chunk, chunk_size));
+      auto hfsmdb = HFSMasterDirectoryBlock::ReadFromDisk(prefix);
+      if (hfsmdb.ok() && hfsmdb->Valid().ok()) {
+        auto name = hfsmdb->VolumeName();
+        if (name.ok()) volume_name_ = *name;
+      }
+    }
+    if (!output_image_.empty() && !raw_.write(chunk, chunk_size)) {
+      return absl::ResourceExhaustedError(
+          absl::StrFormat("Could not write %d bytes of output at %d",
+                          chunk_size, bytes_written_));
+    }
+    if (dc42_writer_.has_value()) {
+      auto status = dc42_writer_->Feed({chunk, chunk_size});
+      if (!status.ok()) return status;
+    }
+    bytes_written_ += chunk_size;
+    return absl::OkStatus();
+  }
+
+  // Takes the tags, after all of the data.
+  absl::Status Tags(const char* chunk, const size_t chunk_size) {
+    if (!dc42_writer_.has_value()) return absl::OkStatus();
+    return dc42_writer_->Feed({chunk, chunk_size});
+  }
+
+  // Completes the DC42 file, named `fallback_name` unless the data is an
+  // HFS volume, and flushes both outputs.
+  absl::Status Finish(const string_view fallback_name) {
+    if (!output_image_.empty() && !raw_.flush()) {
+      return absl::ResourceExhaustedError(
+          absl::StrCat("Could not write output_image '", output_image_, "'"));
+    }
+    if (!dc42_writer_.has_value()) return absl::OkStatus();
+    auto sums = dc42_writer_->Finish();
+    if (!sums.ok()) {
+      return sums.status();
+    }
+    auto dch = DiskCopyHeader::CreateForHFS(
+        volume_name_.empty() ? fallback_name : volume_name_,
+        sums->DataSize() / 512, sums->ExpectedDataChecksum(), sums->TagSize(),
+        sums->ExpectedTagChecksum());
+    if (!dch.ok()) {
+      return dch.status();
+    }
+    if (!dc42_.seekp(0)) {
+      return absl::ResourceExhaustedError(
+          absl::StrCat("Could not write disk_copy '", disk_copy_, "'"));
+    }
+    auto status = dch->WriteToDisk(dc42_);
+    if (!status.ok()) {
+      return status;
+    }
+    if (!dc42_.flush()) {
+      return absl::ResourceExhaustedError(
+          absl::StrCat("Could not write disk_copy '", disk_copy_, "'"));
+    }
+    return absl::OkStatus();
+  }
+
+ private:
+  const string_view output_image_;
+  const string_view disk_copy_;
+  std::ofstream raw_;
+  std::ofstream dc42_;
+  std::optional<DiskCopyWriter> dc42_writer_;
+  std::string volume_name_;
+  uint64_t bytes_written_ = 0;
+};
+
+// Decodes an image into `writer`. `decode` runs on a second thread, passing
+// the data and tags it decodes to its two consumers; the data goes through
+// a few bounded buffers to this thread, which sums and writes it, so the
+// decoding and the writing overlap. The tags, which follow all the data in
+// a DC42 file, are collected and handed over at the end.
+absl::Status DecodeInto(
+    DecodedImageWriter& writer,
+    absl::FunctionRef<absl::Status(ImageSource::ChunkConsumer consume_data,
+                                   ImageSource::ChunkConsumer consume_tags)>
+        decode) {
+  std::vector<char> tags;
+  auto status = PipeChunks(
+      [&](ImageSource::ChunkConsumer emit) {
+        return decode(emit, [&tags](const char* chunk, size_t chunk_size) {
+          tags.insert(tags.end(), chunk, chunk + chunk_size);
+          return absl::OkStatus();
+        });
+      },
+      [&writer](const char* chunk, size_t chunk_size) {
+        return writer.Data(chunk, chunk_size);
+      });
+  if (!status.ok()) {
+    return status;
+  }
+  return writer.Tags(tags.data(), tags.size());
+}
+
+// Reads the file holding the resource fork of the NDIF image `ndif`:
+// `ndif_resources` if given, otherwise the first of these that exists:
+// `ndif`/..namedfork/rsrc (macOS) and the AppleDouble file ._`ndif`.
+absl::StatusOr<std::vector<char>> ReadNdifResources(
+    const string_view ndif, const string_view ndif_resources) {
+  std::vector<std::string> candidates;
+  if (!ndif_resources.empty()) {
+    candidates.emplace_back(ndif_resources);
+  } else {
+    const std::filesystem::path path{std::string(ndif)};
+    candidates.push_back((path / "..namedfork" / "rsrc").string());
+    candidates.push_back(
+        (path.parent_path() / ("._" + path.filename().string())).string());
+  }
+  for (const std::string& candidate : candidates) {
+    auto source = OpenImageSource(candidate);
+    if (!source.ok()) continue;
+    std::vector<char> bytes;
+    auto status = (*source)->ReadChunks(
+        0, (*source)->Size(), [&bytes](const char* chunk, size_t chunk_size) {
+          bytes.insert(bytes.end(), chunk, chunk + chunk_size);
+          return absl::OkStatus();
+        });
+    if (!status.ok()) {
+      return status;
+    }
+    return bytes;
+  }
+  return absl::NotFoundError(absl::StrCat(
+      "Could not find the resource fork of ndif '", ndif,
+      "'; name it with --ndif_resources"));
+}
+
+// Opens for random access the data section of the DC42 file `disk_copy` or,
+// if that is empty, the raw image `input_image`.
+absl::StatusOr<std::unique_ptr<DiskCopyImage>> OpenSectorImage(
+    const string_view disk_copy, const string_view input_image) {
+  if (disk_copy.empty() == input_image.empty()) {
+    return absl::InvalidArgumentError(
+        "Requires exactly one of --disk_copy and --input_image");
+  }
+  const string_view path = disk_copy.empty() ? input_image : disk_copy;
+  auto source = OpenImageSource(path);
+  if (!source.ok()) {
+    return absl::NotFoundError(absl::StrCat("Could not open '", path, "'"));
+  }
+  DiskCopyImage::Options options;
+  return disk_copy.empty()
+             ? DiskCopyImage::OpenRaw(std::move(*source), options)
+             : DiskCopyImage::OpenDiskCopy(std::move(*source), options);
+}
+
+// A four-character code, with unprintable characters as '?'.
+std::string FourCharCode(const uint32_t code) {
+  std::string s(4, '?');
+  for (int i = 0; i < 4; ++i) {
+    const char c = code >> (24 - 8 * i);
+    if (c >= 0x20 && c < 0x7f) s[i] = c;
+  }
+  return s;
+}
+
+// Writes `fork` to `out`, returning an error if the write fails.
+absl::Status WriteFork(const HFSCatalog& catalog, DiskCopyImage& image,
+                       const HFSCatalog::Fork& fork, std::ofstream& out,
+                       const string_view out_name) {
+  return catalog.ReadFork(
+      image, fork, [&](const char* chunk, const size_t chunk_size) {
+        if (!out.write(chunk, chunk_size)) {
+          return absl::ResourceExhaustedError(
+              absl::StrCat("Could not write '", out_name, "'"));
+        }
+        return absl::OkStatus();
+      });
+}
+
+absl::Status WritePadding(std::ofstream& out, const size_t bytes,
+                          const string_view out_name) {
+  const char zeros[kMacBinaryHeaderBytes] = {};
+  if (!out.write(zeros, bytes)) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not write '", out_name, "'"));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<Command> ParseCommand(const string_view c) {
+  if (c == "batch") {
+    return Command::BATCH;
+  } else if (c == "commit") {
+    return Command::COMMIT;
+  } else if (c == "convert") {
+    return Command::CONVERT;
+  } else if (c == "create") {
+    return Command::CREATE;
+  } else if (c == "dedupe") {
+    return Command::DEDUPE;
+  } else if (c == "extract") {
+    return Command::EXTRACT;
+  } else if (c == "extract_file") {
+    return Command::EXTRACT_FILE;
+  } else if (c == "fingerprint") {
+    return Command::FINGERPRINT;
+  } else if (c == "list") {
+    return Command::LIST;
+  } else if (c == "ndif") {
+    return Command::NDIF;
+  } else if (c == "overlay") {
+    return Command::OVERLAY;
+  } else if (c == "patch") {
+    return Command::PATCH;
+  } else if (c == "scan") {
+    return Command::SCAN;
+  } else if (c == "serve") {
+    return Command::SERVE;
+  } else if (c == "undart") {
+    return Command::UNDART;
+  } else if (c == "usage") {
+    return Command::USAGE;
+  } else if (c == "verify") {
+    return Command::VERIFY;
+  }
+  return absl::InvalidArgumentError(
+      absl::StrCat("Unrecognized command `", c, "`"));
+}
+
+absl::Status CreateCommand(const string_view input_image,
+                           const string_view disk_copy, const bool verbose,
+                           CommandStats* const stats) {
+  if (input_image.empty() || disk_copy.empty()) {
+    return absl::InvalidArgumentError(
+        "Create requires --input_image and --disk_copy.");
+  }
+  CommandStats unused_stats;
+  CommandStats& st = stats != nullptr ? *stats : unused_stats;
+  absl::Cleanup stop_stats = [&st] { st.Stop(); };
+  st.Enter(Phase::OPEN);
+  auto input = OpenImageSource(input_image);
+  if (!input.ok()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open input_image '", input_image, "'"));
+  }
+  st.Count(Phase::OPEN, 0);
+  // The input is read exactly once, front to back, so it need not be
+  // seekable: the MDB comes from the first few blocks, which are kept and
+  // copied along with the rest.
+  st.Enter(Phase::READ);
+  char prefix_scratch[HFSMasterDirectoryBlock::kPrefixBytes];
+  auto prefix = (*input)->Read(0, HFSMasterDirectoryBlock::kPrefixBytes,
+                               prefix_scratch);
+  if (!prefix.ok()) {
+    return prefix.status();
+  }
+  st.Count(Phase::READ, prefix->size());
+  // Write the header with a placeholder checksum, stream the data while
+  // summing it, then patch in the real checksum.
+  st.Enter(Phase::HEADER);
+  auto dch = DiskCopyHeader::CreateForHFSImage(*prefix);
+  if (!dch.ok()) {
+    return dch.status();
+  }
+  // Standard output may be a pipe, so the description goes elsewhere.
+  std::FILE* const message_out =
+      disk_copy == kStandardStreamPath ? stderr : stdout;
+  if (verbose) absl::FPrintF(message_out, "Creating header: %v\n", *dch);
+  const uint64_t data_size = dch->DataSize();
+  st.Enter(Phase::OPEN);
+  std::ofstream output_file;
+  auto output = OpenOutput(disk_copy, output_file, "disk_copy");
+  if (!output.ok()) {
+    return output.status();
+  }
+  st.Count(Phase::OPEN, 0);
+  // A file gets the header with a placeholder checksum, then the data as it
+  // is summed, then the real checksum. Standard output cannot seek back, so
+  // there the data is held until the header can be written; a DC42 data
+  // section is at most 4 GiB, and usually a floppy's 1.4 MB.
+  const bool hold_data = disk_copy == kStandardStreamPath;
+  std::vector<char> held;
+  if (hold_data) {
+    held.reserve(data_size);
+  } else {
+    st.Enter(Phase::WRITE);
+    auto header_status = dch->WriteToDisk(output_file);
+    if (!header_status.ok()) {
+      return header_status;
+    }
+    st.Count(Phase::WRITE, DiskCopyHeader::kHeaderLength);
+  }
+
+  DiskCopyChecksum sum(0);
+  uint64_t bytes_copied = 0;
+  auto copy_chunk = [&](const char* chunk, size_t chunk_size) {
+    st.Enter(Phase::CHECKSUM);
+    absl::Status sum_status = sum.UpdateSumFromBlock(chunk, chunk_size);
+    if (!sum_status.ok()) {
+      return sum_status;
+    }
+    st.Count(Phase::CHECKSUM, chunk_size);
+    st.Enter(Phase::WRITE);
+    if (hold_data) {
+      held.insert(held.end(), chunk, chunk + chunk_size);
+    } else if (!output_file.write(chunk, chunk_size)) {
+      return absl::ResourceExhaustedError(
+          absl::StrFormat("Could not write %d bytes of Disk Copy output at %d",
+                          chunk_size, bytes_copied));
+    } else {
+      st.Count(Phase::WRITE, chunk_size);
+    }
+    bytes_copied += chunk_size;
+    st.Enter(Phase::READ);
+    return absl::OkStatus();
+  };
+  auto copy_status = copy_chunk(prefix->data(), prefix->size());
+  if (copy_status.ok()) {
+    copy_status = (*input)->ReadChunks(
+        prefix->size(), data_size - prefix->size(),
+        [&](const char* chunk, size_t chunk_size) {
+          st.Count(Phase::READ, chunk_size);
+          return copy_chunk(chunk, chunk_size);
+        });
+  }
+  if (!copy_status.ok()) {
+    return copy_status;
+  }
+  st.Enter(Phase::WRITE);
+  dch->SetDataChecksum(sum.Sum());
+  if (!hold_data) {
+    st.Count(Phase::WRITE, sizeof(uint32_t));
+    return dch->WriteDataChecksumToDisk(output_file);
+  }
+  char header_bytes[DiskCopyHeader::kHeaderLength];
+  dch->WriteToBuffer(header_bytes);
+  std::ostream& out = **output;
+  if (!out.write(header_bytes, sizeof(header_bytes)) ||
+      !out.write(held.data(), held.size()) || !out.flush()) {
+    return absl::ResourceExhaustedError("Could not write Disk Copy output");
+  }
+  st.Count(Phase::WRITE, sizeof(header_bytes) + held.size());
+  return absl::OkStatus();
+}
+
+absl::StatusOr<uint32_t> ExtractCommand(const string_view disk_copy,
+                                        const string_view output_image,
+                                        const bool ignore_data_checksum,
+                                        const bool kernel_copy,
+                                        const SparseMode sparse,
+                                        const bool verbose,
+                                        CommandStats* const stats) {
+  if (disk_copy.empty() || output_image.empty()) {
+    return absl::InvalidArgumentError(
+        "Extract requires --disk_copy and --output_image");
+  }
+  CommandStats unused_stats;
+  CommandStats& st = stats != nullptr ? *stats : unused_stats;
+  absl::Cleanup stop_stats = [&st] { st.Stop(); };
+  st.Enter(Phase::OPEN);
+  auto input = OpenImageSource(disk_copy);
+  if (!input.ok()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open disk_copy '", disk_copy, "'"));
+  }
+  st.Count(Phase::OPEN, 0);
+  st.Enter(Phase::HEADER);
+  auto header = DiskCopyHeader::ReadFromDisk(**input);
+  if (!header.ok()) {
+    return header.status();
+  }
+  auto header_valid = header->Validate();
+  if (!header_valid.ok()) {
+    return header_valid.status();
+  }
+  st.Count(Phase::HEADER, DiskCopyHeader::kHeaderLength);
+  // The data section follows the header.
+  const uint32_t total_bytes_to_read = header->DataSize();
+
+  // Compute the Disk Copy data checksum as the data is copied. The kernel
+  // can only copy between regular files, which are the mapped sources.
+  DiskCopyChecksum sum(0);
+  absl::Status copy_status;
+  if (sparse != SparseMode::NONE) {
+    auto written =
+        SparseExtract(**input, output_image, total_bytes_to_read,
+                      sparse == SparseMode::UNALLOCATED, sum, st);
+    copy_status = written.status();
+    if (written.ok() && verbose) {
+      cerr << "Wrote " << *written << " bytes; left "
+           << total_bytes_to_read - *written << " as holes" << std::endl;
+    }
+  } else if (kernel_copy && (*input)->Contiguous().has_value() &&
+             output_image != kStandardStreamPath) {
+    copy_status = KernelExtract(**input, disk_copy, output_image,
+                                total_bytes_to_read, sum, st);
+  } else {
+    copy_status =
+        BufferedExtract(**input, output_image, total_bytes_to_read, sum, st);
+  }
+  if (!copy_status.ok()) {
+    return copy_status;
+  }
+  st.Enter(Phase::CHECKSUM);
+  auto checksum_status = header->CheckDataChecksum(sum.Sum());
+  if (!checksum_status.ok()) {
+    if (verbose) cerr << checksum_status.message() << std::endl;
+    if (!ignore_data_checksum) {
+      return checksum_status;
+    }
+    if (verbose) {
+      cerr << "Ignoring mismatch because of --ignore_data_checksum"
+           << std::endl;
+    }
+  }
+  return total_bytes_to_read;
+}
+
+absl::StatusOr<uint32_t> UndartCommand(const string_view dart,
+                                       const string_view output_image,
+                                       const string_view disk_copy,
+                                       const bool verbose) {
+  if (dart.empty()) {
+    return absl::InvalidArgumentError("Undart requires --dart");
+  }
+  auto input = OpenImageSource(dart);
+  if (!input.ok()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open dart '", dart, "'"));
+  }
+  auto header = DartHeader::ReadFromDisk(**input);
+  if (!header.ok()) {
+    return header.status();
+  }
+  if (verbose) absl::PrintF("Read DART header: %v\n", *header);
+  DecodedImageWriter writer(output_image, disk_copy);
+  auto open_status = writer.Open(header->DataSize(), header->TagSize());
+  if (!open_status.ok()) {
+    return open_status;
+  }
+  auto decode_status = DecodeInto(
+      writer, [&](ImageSource::ChunkConsumer consume_data,
+                  ImageSource::ChunkConsumer consume_tags) {
+        return DecodeDart(**input, *header, consume_data, consume_tags);
+      });
+  if (!decode_status.ok()) {
+    return decode_status;
+  }
+  auto finish_status = writer.Finish("-not a Macintosh disk-");
+  if (!finish_status.ok()) {
+    return finish_status;
+  }
+  return header->DataSize();
+}
+
+absl::StatusOr<uint64_t> NdifCommand(const string_view ndif,
+                                     const string_view ndif_resources,
+                                     const string_view output_image,
+                                     const string_view disk_copy,
+                                     const bool verbose) {
+  if (ndif.empty()) {
+    return absl::InvalidArgumentError("Ndif requires --ndif");
+  }
+  auto resource_file = ReadNdifResources(ndif, ndif_resources);
+  if (!resource_file.ok()) {
+    return resource_file.status();
+  }
+  auto fork = ResourceForkOf(*resource_file);
+  if (!fork.ok()) {
+    return fork.status();
+  }
+  auto bcem = FindResource(*fork, ResourceType("bcem"));
+  if (!bcem.ok()) {
+    return bcem.status();
+  }
+  auto data_fork = OpenImageSource(ndif);
+  if (!data_fork.ok()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open ndif '", ndif, "'"));
+  }
+  auto image = NdifImageSource::Open(std::move(*data_fork), *bcem);
+  if (!image.ok()) {
+    return image.status();
+  }
+  if (verbose) {
+    absl::PrintF("NDIF image '%s': %d sectors in %d chunks\n",
+                 (*image)->Name(), (*image)->SectorCount(),
+                 (*image)->Chunks().size());
+  }
+  DecodedImageWriter writer(output_image, disk_copy);
+  auto open_status = writer.Open((*image)->Size(), 0);
+  if (!open_status.ok()) {
+    return open_status;
+  }
+  auto decode_status = DecodeInto(
+      writer, [&image](ImageSource::ChunkConsumer consume_data,
+                       ImageSource::ChunkConsumer) {
+        return (*image)->ReadChunks(0, (*image)->Size(), consume_data);
+      });
+  if (!decode_status.ok()) {
+    return decode_status;
+  }
+  auto finish_status = writer.Finish((*image)->Name());
+  if (!finish_status.ok()) {
+    return finish_status;
+  }
+  return (*image)->Size();
+}
+
+namespace {
+
+// Tells the format of the image `input` from its contents (see
+// ConvertCommand).
+absl::StatusOr<InputFormat> DetectInputFormat(
+    const string_view input, const string_view ndif_resources) {
+  if (input == kStandardStreamPath) {
+    return absl::InvalidArgumentError(
+        "Name the format of standard input with --input_format");
+  }
+  auto source = OpenImageSource(input);
+  if (!source.ok()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open input_image '", input, "'"));
+  }
+  if (DartHeader::ReadFromDisk(**source).ok()) return InputFormat::DART;
+  auto hfsmdb = HFSMasterDirectoryBlock::ReadFromDisk(**source);
+  if (hfsmdb.ok() && hfsmdb->Valid().ok()) return InputFormat::RAW;
+  if (ReadNdifResources(input, ndif_resources).ok()) return InputFormat::NDIF;
+  return absl::InvalidArgumentError(absl::StrCat(
+      "Could not tell the format of input_image '", input,
+      "'; name it with --input_format"));
+}
+
+}  // namespace
+
+absl::StatusOr<uint64_t> ConvertCommand(const string_view input,
+                                        InputFormat format,
+                                        const string_view ndif_resources,
+                                        const string_view output_image,
+                                        const string_view disk_copy,
+                                        const bool verbose) {
+  if (input.empty() || disk_copy.empty()) {
+    return absl::InvalidArgumentError(
+        "Convert requires --input_image and --disk_copy");
+  }
+  if (format == InputFormat::AUTO) {
+    auto detected = DetectInputFormat(input, ndif_resources);
+    if (!detected.ok()) {
+      return detected.status();
+    }
+    format = *detected;
+  }
+  switch (format) {
+    case InputFormat::DART:
+      if (verbose) absl::PrintF("Converting DART image '%s'\n", input);
+      return UndartCommand(input, output_image, disk_copy, verbose);
+    case InputFormat::NDIF:
+      if (verbose) absl::PrintF("Converting NDIF image '%s'\n", input);
+      return NdifCommand(input, ndif_resources, output_image, disk_copy,
+                         verbose);
+    default:
+      break;
+  }
+  if (verbose) absl::PrintF("Converting raw image '%s'\n", input);
+  auto source = OpenImageSource(input);
+  if (!source.ok()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open input_image '", input, "'"));
+  }
+  const uint64_t size = (*source)->Size();
+  if (size == ImageSource::kUnknownSize) {
+    return absl::InvalidArgumentError(
+        "A raw image must be a file, to know its size before converting it");
+  }
+  DecodedImageWriter writer(output_image, disk_copy);
+  auto open_status = writer.Open(size, 0);
+  if (!open_status.ok()) {
+    return open_status;
+  }
+  auto decode_status = DecodeInto(
+      writer,
+      [&source, size](ImageSource::ChunkConsumer consume_data,
+                      ImageSource::ChunkConsumer) {
+        return (*source)->ReadChunks(0, size, consume_data);
+      });
+  if (!decode_status.ok()) {
+    return decode_status;
+  }
+  auto finish_status = writer.Finish("-not a Macintosh disk-");
+  if (!finish_status.ok()) {
+    return finish_status;
+  }
+  return size;
+}
+
+absl::Status VerifyCommand(const string_view disk_copy,
+                           const bool skip_first_tag, const bool verbose,
+                           const VerifyIndexOptions& index,
+                           CommandStats* const stats) {
+  if (disk_copy.empty()) {
+    return absl::InvalidArgumentError("Verify requires --disk_copy");
+  }
+  const bool indexable = disk_copy != kStandardStreamPath;
+  if (!indexable && (index.write || index.incremental)) {
+    return absl::InvalidArgumentError(
+        "A checksum index is kept next to a file, not standard input");
+  }
+  CommandStats unused_stats;
+  CommandStats& st = stats != nullptr ? *stats : unused_stats;
+  absl::Cleanup stop_stats = [&st] { st.Stop(); };
+  st.Enter(Phase::OPEN);
+  auto f = OpenImageSource(disk_copy);
+  if (!f.ok()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open disk_copy '", disk_copy, "'"));
+  }
+  st.Count(Phase::OPEN, 0);
+  st.Enter(Phase::HEADER);
+  auto header = DiskCopyHeader::ReadFromDisk(**f);
+  if (!header.ok()) {
+    return header.status();
+  }
+  st.Count(Phase::HEADER, DiskCopyHeader::kHeaderLength);
+  if (verbose) absl::PrintF("Read header: %v\n", *header);
+
+  // The index is current if it was written for the checksum now in the
+  // header; a patched image leaves it stale.
+  std::optional<ChecksumIndex> previous;
+  uint64_t file_size = 0;
+  int64_t mtime_ns = 0;
+  if (indexable && StatForIndex(disk_copy, file_size, mtime_ns).ok()) {
+    auto read = ChecksumIndex::Read(ChecksumIndexPath(disk_copy));
+    if (read.ok() && read->data_size == header->DataSize() &&
+        read->data_checksum == header->ExpectedDataChecksum()) {
+      previous = *std::move(read);
+    }
+  }
+  if (index.incremental && previous.has_value() &&
+      previous->file_size == file_size && previous->mtime_ns == mtime_ns) {
+    if (verbose) absl::PrintF("Unchanged since indexed; not read\n");
+    return absl::OkStatus();
+  }
+  const bool indexing = index.write || previous.has_value();
+  ChecksumIndexer indexer(header->DataSize(),
+                          previous.has_value() ? &*previous : nullptr);
+  auto observe_data = [&](const char* chunk, size_t chunk_size) {
+    return indexing ? indexer.Update(chunk, chunk_size) : absl::OkStatus();
+  };
+
+  // As DiskCopyHeader::VerifyChecksums, with the reads and the summing
+  // timed apart.
+  DiskCopyHeader::ChecksumVerifier verifier(*header, skip_first_tag);
+  st.Enter(Phase::READ);
+  auto read_status = (*f)->ReadChunks(
+      DiskCopyHeader::kHeaderLength, verifier.Remaining(),
+      [&](const char* chunk, size_t chunk_size) {
+        st.Count(Phase::READ, chunk_size);
+        st.Enter(Phase::CHECKSUM);
+        auto status = verifier.Update(chunk, chunk_size, observe_data);
+        st.Count(Phase::CHECKSUM, chunk_size);
+        st.Enter(Phase::READ);
+        return status;
+      });
+  if (!read_status.ok()) {
+    return read_status;
+  }
+  st.Stop();
+  DiskCopyHeader::ChecksumResults results = verifier.Results();
+  if (!results.data.ok() && !indexer.changed_chunks().empty()) {
+    results.data = absl::DataLossError(absl::StrCat(
+        results.data.message(), "; since indexed, ",
+        DescribeChangedChunks(indexer.changed_chunks(),
+                              ChecksumIndex::kChunkBytes),
+        " changed"));
+  }
+  if (index.write && results.Overall().ok()) {
+    ChecksumIndex written{ChecksumIndex::kChunkBytes,
+                          header->DataSize(),
+                          header->ExpectedDataChecksum(),
+                          file_size,
+                          mtime_ns,
+                          indexer.running_sums()};
+    auto write_status = written.Write(ChecksumIndexPath(disk_copy));
+    if (!write_status.ok()) {
+      return write_status;
+    }
+  }
+  if (verbose) {
+    absl::PrintF("Data checksum: %s\n",
+                 results.data.ok() ? "OK" : results.data.message());
+    if (header->TagSize() > 0) {
+      absl::PrintF("Tag checksum: %s\n",
+                   results.tag.ok() ? "OK" : results.tag.message());
+    }
+  }
+  return results.Overall();
+}
+
+absl::Status PatchCommand(const string_view disk_copy,
+                          const string_view patch_data,
+                          const uint32_t patch_sector,
+                          const string_view overlay,
+                          const bool trust_checksum, const bool verbose) {
+  if (disk_copy.empty() || patch_data.empty()) {
+    return absl::InvalidArgumentError(
+        "Patch requires --disk_copy and --patch_data");
+  }
+  std::ifstream patch_in{std::string(patch_data), std::ios::binary};
+  if (!patch_in.good()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open patch_data '", patch_data, "'"));
+  }
+  const std::vector<char> bytes((std::istreambuf_iterator<char>(patch_in)),
+                                std::istreambuf_iterator<char>());
+  if (patch_in.bad()) {
+    return absl::DataLossError(
+        absl::StrCat("Error reading patch_data '", patch_data, "'"));
+  }
+  if (uint64_t{patch_sector} * 512 > UINT32_MAX) {
+    return absl::OutOfRangeError(absl::StrFormat(
+        "Sector %d is beyond any DC42 data section", patch_sector));
+  }
+  const DataPatch patch{patch_sector * 512, bytes};
+
+  if (!overlay.empty()) {
+    if (bytes.size() % DiskCopyOverlay::kSectorSize != 0) {
+      return absl::InvalidArgumentError(
+          "An overlay is patched with whole sectors of --patch_data");
+    }
+    auto delta = DiskCopyOverlay::Open(disk_copy, overlay);
+    if (!delta.ok()) {
+      return delta.status();
+    }
+    const uint32_t count = bytes.size() / DiskCopyOverlay::kSectorSize;
+    if (verbose) {
+      absl::PrintF("Writing sectors %d-%d to overlay\n", patch_sector,
+                   uint64_t{patch_sector} + count - 1);
+    }
+    return (*delta)->WriteSectors(patch_sector, count, bytes);
+  }
+
+  auto input = OpenImageSource(disk_copy);
+  if (!input.ok()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open disk_copy '", disk_copy, "'"));
+  }
+  auto header = DiskCopyHeader::ReadFromDisk(**input);
+  if (!header.ok()) {
+    return header.status();
+  }
+  auto header_valid = header->Validate();
+  if (!header_valid.ok()) {
+    return header_valid.status();
+  }
+  // The new checksum comes from the old data, so nothing is written until
+  // it is known.
+  auto checksum =
+      header->PatchedDataChecksum(**input, {&patch, 1}, trust_checksum);
+  if (!checksum.ok()) {
+    return checksum.status();
+  }
+  input->reset();
+  if (verbose) {
+    absl::PrintF("Data checksum: %x -> %x\n", header->ExpectedDataChecksum(),
+                 *checksum);
+  }
+
+  std::ofstream output(std::string(disk_copy),
+                       std::ios::binary | std::ios::in | std::ios::out);
+  if (!output.good() ||
+      !output.seekp(DiskCopyHeader::kHeaderLength + patch.offset) ||
+      !output.write(bytes.data(), bytes.size())) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not write disk_copy '", disk_copy, "'"));
+  }
+  header->SetDataChecksum(*checksum);
+  auto status = header->WriteDataChecksumToDisk(output);
+  if (!status.ok()) {
+    return status;
+  }
+  // The patch is only applied once both the data and the checksum are out
+  // of the stream's buffer.
+  output.close();
+  if (output.fail()) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not write disk_copy '", disk_copy, "'"));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status OverlayCommand(const string_view disk_copy,
+                            const string_view overlay) {
+  if (disk_copy.empty() || overlay.empty()) {
+    return absl::InvalidArgumentError(
+        "Overlay requires --disk_copy and --overlay");
+  }
+  return DiskCopyOverlay::Create(disk_copy, overlay).status();
+}
+
+absl::StatusOr<size_t> CommitCommand(const string_view disk_copy,
+                                     const string_view overlay,
+                                     const string_view output_disk_copy,
+                                     const bool verbose) {
+  if (disk_copy.empty() || overlay.empty() || output_disk_copy.empty()) {
+    return absl::InvalidArgumentError(
+        "Commit requires --disk_copy, --overlay and --output_disk_copy");
+  }
+  if (output_disk_copy == kStandardStreamPath) {
+    return absl::InvalidArgumentError(
+        "Commit writes a file, not standard output");
+  }
+  auto delta = DiskCopyOverlay::Open(disk_copy, overlay);
+  if (!delta.ok()) {
+    return delta.status();
+  }
+  const size_t sectors = (*delta)->OverriddenSectors().size();
+  auto checksum = (*delta)->Commit(output_disk_copy);
+  if (!checksum.ok()) {
+    return checksum.status();
+  }
+  if (verbose) {
+    absl::PrintF("Data checksum: %x -> %x\n", (*delta)->BaseDataChecksum(),
+                 *checksum);
+  }
+  return sectors;
+}
+
+absl::StatusOr<size_t> ListCommand(const string_view disk_copy,
+                                   const string_view input_image) {
+  auto image = OpenSectorImage(disk_copy, input_image);
+  if (!image.ok()) {
+    return image.status();
+  }
+  auto catalog = HFSCatalog::Read(**image);
+  if (!catalog.ok()) {
+    return catalog.status();
+  }
+  for (const HFSCatalog::Entry& entry : catalog->Entries()) {
+    if (entry.directory) {
+      absl::PrintF("%-9s %10d %10s  %s\n", "folder", entry.valence, "",
+                   catalog->Path(entry));
+    } else {
+      absl::PrintF("%s %s %10d %10d  %s\n", FourCharCode(entry.type),
+                   FourCharCode(entry.creator), entry.data.logical_length,
+                   entry.resource.logical_length, catalog->Path(entry));
+    }
+  }
+  return catalog->Entries().size();
+}
+
+absl::StatusOr<VolumeUsage> UsageCommand(const string_view disk_copy,
+                                         const string_view input_image,
+                                         const bool verbose) {
+  auto image = OpenSectorImage(disk_copy, input_image);
+  if (!image.ok()) {
+    return image.status();
+  }
+  auto usage = ReadVolumeUsage(**image);
+  if (usage.ok() && verbose) {
+    absl::PrintF("%s\n", usage->DebugString());
+  }
+  return usage;
+}
+
+absl::StatusOr<SparseMode> ParseSparseMode(const string_view s) {
+  if (s == "none") {
+    return SparseMode::NONE;
+  } else if (s == "zeros") {
+    return SparseMode::ZEROS;
+  } else if (s == "unallocated") {
+    return SparseMode::UNALLOCATED;
+  }
+  return absl::InvalidArgumentError(
+      absl::StrCat("Unrecognized sparse mode `", s, "`"));
+}
+
+absl::StatusOr<InputFormat> ParseInputFormat(const string_view f) {
+  if (f == "auto") {
+    return InputFormat::AUTO;
+  } else if (f == "dart") {
+    return InputFormat::DART;
+  } else if (f == "ndif") {
+    return InputFormat::NDIF;
+  } else if (f == "raw") {
+    return InputFormat::RAW;
+  }
+  return absl::InvalidArgumentError(
+      absl::StrCat("Unrecognized input format `", f, "`"));
+}
+
+absl::StatusOr<FileFormat> ParseFileFormat(const string_view f) {
+  if (f == "data") {
+    return FileFormat::DATA;
+  } else if (f == "resource") {
+    return FileFormat::RESOURCE;
+  } else if (f == "macbinary") {
+    return FileFormat::MACBINARY;
+  } else if (f == "appledouble") {
+    return FileFormat::APPLEDOUBLE;
+  }
+  return absl::InvalidArgumentError(
+      absl::StrCat("Unrecognized file format `", f, "`"));
+}
+
+absl::StatusOr<uint64_t> ExtractFileCommand(const string_view disk_copy,
+                                            const string_view input_image,
+                                            const string_view path,
+                                            const string_view output_file,
+                                            const FileFormat format,
+                                            const bool verbose) {
+  if (path.empty() || output_file.empty()) {
+    return absl::InvalidArgumentError(
+        "Extract_file requires --path and --output_file");
+  }
+  auto image = OpenSectorImage(disk_copy, input_image);
+  if (!image.ok()) {
+    return image.status();
+  }
+  auto catalog = HFSCatalog::Read(**image);
+  if (!catalog.ok()) {
+    return catalog.status();
+  }
+  auto entry = catalog->Lookup(path);
+  if (!entry.ok()) {
+    return entry.status();
+  }
+  const HFSCatalog::Entry& file = **entry;
+  if (file.directory) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("'", catalog->Path(file), "' is a folder"));
+  }
+  const MacFileInfo info{std::string(catalog->Name(file)),
+                         file.type,
+                         file.creator,
+                         file.finder_flags,
+                         file.created,
+                         file.modified,
+                         file.data.logical_length,
+                         file.resource.logical_length};
+  if (verbose) {
+    absl::PrintF("%s: type '%s', creator '%s', %d data bytes, %d resource "
+                 "bytes\n",
+                 catalog->Path(file), FourCharCode(file.type),
+                 FourCharCode(file.creator), info.data_length,
+                 info.resource_length);
+  }
+
+  std::ofstream out(std::string(output_file), std::ios::binary);
+  if (!out.good()) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not open output_file '", output_file, "'"));
+  }
+  absl::Status status;
+  switch (format) {
+    case FileFormat::DATA:
+      status = WriteFork(*catalog, **image, file.data, out, output_file);
+      break;
+    case FileFormat::RESOURCE:
+      status = WriteFork(*catalog, **image, file.resource, out, output_file);
+      break;
+    case FileFormat::MACBINARY: {
+      const auto header = MacBinaryHeader(info);
+      if (!out.write(header.data(), header.size())) {
+        status = absl::ResourceExhaustedError(
+            absl::StrCat("Could not write '", output_file, "'"));
+        break;
+      }
+      status = WriteFork(*catalog, **image, file.data, out, output_file);
+      if (status.ok()) {
+        status = WritePadding(out, MacBinaryPadding(info.data_length),
+                              output_file);
+      }
+      if (status.ok()) {
+        status = WriteFork(*catalog, **image, file.resource, out, output_file);
+      }
+      if (status.ok()) {
+        status = WritePadding(out, MacBinaryPadding(info.resource_length),
+                              output_file);
+      }
+    } break;
+    case FileFormat::APPLEDOUBLE: {
+      status = WriteFork(*catalog, **image, file.data, out, output_file);
+      if (!status.ok()) break;
+      const std::filesystem::path data_path{std::string(output_file)};
+      const std::string header_path =
+          (data_path.parent_path() / ("._" + data_path.filename().string()))
+              .string();
+      std::ofstream header_out(header_path, std::ios::binary);
+      if (!header_out.good()) {
+        status = absl::ResourceExhaustedError(
+            absl::StrCat("Could not open '", header_path, "'"));
+        break;
+      }
+      const std::vector<char> header = AppleDoubleHeader(info);
+      if (!header_out.write(header.data(), header.size())) {
+        status = absl::ResourceExhaustedError(
+            absl::StrCat("Could not write '", header_path, "'"));
+        break;
+      }
+      status = WriteFork(*catalog, **image, file.resource, header_out,
+                         header_path);
+      if (status.ok() && !header_out.flush()) {
+        status = absl::ResourceExhaustedError(
+            absl::StrCat("Could not write '", header_path, "'"));
+      }
+    } break;
+  }
+  if (!status.ok()) {
+    return status;
+  }
+  if (!out.flush()) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not write '", output_file, "'"));
+  }
+  if (format == FileFormat::DATA) return info.data_length;
+  if (format == FileFormat::RESOURCE) return info.resource_length;
+  return uint64_t{info.data_length} + info.resource_length;
+}
+
+absl::StatusOr<FingerprintBlocks> ParseFingerprintBlocks(const string_view b) {
+  if (b == "sector") {
+    return FingerprintBlocks::SECTOR;
+  } else if (b == "allocation") {
+    return FingerprintBlocks::ALLOCATION;
+  }
+  return absl::InvalidArgumentError(
+      absl::StrCat("Unrecognized fingerprint blocks `", b, "`"));
+}
+
+absl::StatusOr<size_t> FingerprintCommand(const string_view disk_copy,
+                                          const string_view fingerprint_index,
+                                          const FingerprintBlocks blocks,
+                                          const bool verbose) {
+  if (disk_copy.empty() || fingerprint_index.empty()) {
+    return absl::InvalidArgumentError(
+        "Fingerprint requires --disk_copy and --fingerprint_index");
+  }
+  auto f = OpenImageSource(disk_copy);
+  if (!f.ok()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open disk_copy '", disk_copy, "'"));
+  }
+  auto header = DiskCopyHeader::ReadFromDisk(**f);
+  if (!header.ok()) {
+    return header.status();
+  }
+  // Sectors cover the whole data section; allocation blocks, the part of the
+  // volume that holds files, as the MDB describes it.
+  uint32_t block_size = HFSMasterDirectoryBlock::kHFSBlockSize;
+  uint64_t start = 0;
+  uint64_t end = header->DataSize();
+  if (blocks == FingerprintBlocks::ALLOCATION) {
+    using MDB = HFSMasterDirectoryBlock;
+    char scratch[MDB::kHFSBlockSize];
+    auto block = (*f)->Read(DiskCopyHeader::kHeaderLength +
+                                MDB::kMDBBlock * MDB::kHFSBlockSize,
+                            sizeof(scratch), scratch);
+    if (!block.ok()) {
+      return block.status();
+    }
+    auto mdb = HFSMasterDirectoryBlock::FromBlock(*block);
+    if (!mdb.ok()) {
+      return mdb.status();
+    }
+    auto valid = mdb->Valid();
+    if (!valid.ok()) {
+      return valid.status();
+    }
+    block_size = mdb->allocation_block_size();
+    start = uint64_t{mdb->first_allocation_block()} *
+            HFSMasterDirectoryBlock::kHFSBlockSize;
+    end = std::min<uint64_t>(
+        end, start + uint64_t{mdb->num_allocation_blocks()} * block_size);
+  }
+  BlockHasher hasher(block_size, start, end);
+  auto results = header->VerifyChecksums(
+      **f, true, [&hasher](const char* chunk, size_t chunk_size) {
+        return hasher.Update(chunk, chunk_size);
+      });
+  if (!results.ok()) {
+    return results.status();
+  }
+  if (!results->data.ok()) {
+    return results->data;
+  }
+  const ImageFingerprint fingerprint{std::string(disk_copy), block_size,
+                                     hasher.ImageHash(), hasher.Hashes()};
+  auto append_status = AppendFingerprint(fingerprint_index, fingerprint);
+  if (!append_status.ok()) {
+    return append_status;
+  }
+  if (verbose) {
+    absl::PrintF("%016x  %d blocks of %d bytes  %s\n", fingerprint.image_hash,
+                 fingerprint.block_hashes.size(), block_size, disk_copy);
+  }
+  return fingerprint.block_hashes.size();
+}
+
+absl::StatusOr<size_t> DedupeCommand(const string_view fingerprint_index) {
+  if (fingerprint_index.empty()) {
+    return absl::InvalidArgumentError("Dedupe requires --fingerprint_index");
+  }
+  auto index = FingerprintIndex::Load(fingerprint_index);
+  if (!index.ok()) {
+    return index.status();
+  }
+  const auto images = index->Images();
+  for (const std::vector<size_t>& group : index->DuplicateImages()) {
+    absl::PrintF("identical:");
+    for (const size_t i : group) absl::PrintF(" %s", images[i].path);
+    absl::PrintF("\n");
+  }
+  for (const FingerprintIndex::Image& image : images) {
+    absl::PrintF("%10d of %10d blocks shared  %s\n",
+                 index->SharedBlocks(image), image.block_count, image.path);
+  }
+  absl::PrintF("%d blocks, %d distinct\n", index->TotalBlocks(),
+               index->DistinctBlocks());
+  return images.size();
+}
@@ -0,0 +1,225 @@
+#ifndef __DISK_COPY_COMMANDS_H__
+#define __DISK_COPY_COMMANDS_H__
+
+// The commands of the disk_copy tool, callable one image at a time from the
+// command line or in bulk from `batch`. They handle the files; the image
+// format itself is in disk_copy.h, which also has in-memory equivalents
+// (EncodeDiskCopy, DecodeDiskCopy, VerifyDiskCopy).
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "command_stats.h"
+#include "volume_usage.h"
+
+enum class Command {
+  BATCH,
+  COMMIT,
+  CONVERT,
+  CREATE,
+  DEDUPE,
+  EXTRACT,
+  EXTRACT_FILE,
+  FINGERPRINT,
+  LIST,
+  NDIF,
+  OVERLAY,
+  PATCH,
+  SCAN,
+  SERVE,
+  UNDART,
+  USAGE,
+  VERIFY
+};
+
+absl::StatusOr<Command> ParseCommand(std::string_view c);
+
+// Create, extract and verify record the time, bytes and calls of each of
+// their phases in `stats`, if it is not null.
+
+// Encodes the raw HFS image `input_image` as the DC42 file `disk_copy`.
+// If `verbose`, describes the new header on standard output.
+absl::Status CreateCommand(std::string_view input_image,
+                           std::string_view disk_copy, bool verbose,
+                           CommandStats* stats = nullptr);
+
+// What `extract --sparse` leaves as holes in the raw image: nothing, the
+// all-zero sectors, or those and the sectors of the HFS allocation blocks
+// the volume bitmap marks free (see sparse_writer.h).
+enum class SparseMode { NONE, ZEROS, UNALLOCATED };
+
+absl::StatusOr<SparseMode> ParseSparseMode(std::string_view s);
+
+// Writes the data section of the DC42 file `disk_copy` to `output_image`,
+// returning the number of bytes of the image. Fails on a data checksum
+// mismatch unless `ignore_data_checksum`; if `kernel_copy`, lets the kernel
+// copy the data when possible. Unless `sparse` is NONE, writes the output
+// file with holes instead. If `verbose`, reports checksum mismatches, and
+// the bytes a sparse output left as holes, on standard error.
+absl::StatusOr<uint32_t> ExtractCommand(std::string_view disk_copy,
+                                        std::string_view output_image,
+                                        bool ignore_data_checksum,
+                                        bool kernel_copy, SparseMode sparse,
+                                        bool verbose,
+                                        CommandStats* stats = nullptr);
+
+// Decompresses the DART file `dart` in one pass, writing its data as the raw
+// image `output_image` and/or its data and tags as the DC42 file
+// `disk_copy`. With neither, only checks that the image decompresses.
+// Returns the number of data bytes. If `verbose`, describes the DART header
+// on standard output.
+absl::StatusOr<uint32_t> UndartCommand(std::string_view dart,
+                                       std::string_view output_image,
+                                       std::string_view disk_copy,
+                                       bool verbose);
+
+// As UndartCommand, for the NDIF image whose data fork is `ndif`. Its chunk
+// map comes from the resource fork in `ndif_resources` (a bare fork or an
+// AppleDouble file); if that is empty, from `ndif`/..namedfork/rsrc or
+// ._`ndif` next to it.
+absl::StatusOr<uint64_t> NdifCommand(std::string_view ndif,
+                                     std::string_view ndif_resources,
+                                     std::string_view output_image,
+                                     std::string_view disk_copy,
+                                     bool verbose);
+
+// The formats `convert` reads.
+enum class InputFormat { AUTO, DART, NDIF, RAW };
+
+absl::StatusOr<InputFormat> ParseInputFormat(std::string_view f);
+
+// Converts the image `input`, in `format`, to the DC42 file `disk_copy` and
+// (if not empty) the raw image `output_image` in one pass, with no
+// intermediate file. The source is decoded on one thread into a few bounded
+// buffers while another sums and writes the data, taking the volume name
+// from the MDB as it goes by; the DC42 header is written last. AUTO takes
+// `input` as a DART file if it starts with a valid DART header, as a raw
+// image if it holds an HFS volume, and otherwise as the data fork of an
+// NDIF image whose resources are found as for NdifCommand. Returns the
+// number of data bytes. If `verbose`, names the format and describes the
+// source header on standard output.
+absl::StatusOr<uint64_t> ConvertCommand(std::string_view input,
+                                        InputFormat format,
+                                        std::string_view ndif_resources,
+                                        std::string_view output_image,
+                                        std::string_view disk_copy,
+                                        bool verbose);
+
+// What `verify` does with the checksum index next to the image, beyond
+// using it to locate damage.
+struct VerifyIndexOptions {
+  // Write, or refresh, the index once the data checksum matches.
+  bool write = false;
+  // Pass an image without reading it if its size and modification time
+  // are those the index records. This trusts that nothing has changed the
+  // file without changing its modification time.
+  bool incremental = false;
+};
+
+// Checks the header, data checksum and tag checksum of the DC42 file
+// `disk_copy`, reading both sections once. Returns an error describing every
+// mismatched checksum. `skip_first_tag` leaves the first 12 tag bytes out of
+// the tag checksum, as Disk Copy does. If `verbose`, prints the header and
+// both checksum results on standard output.
+//
+// A current checksum index next to `disk_copy` (see checksum_index.h), if
+// there is one, is compared in the same pass, so that a data checksum
+// mismatch names the 8 KiB chunks that changed since it was written.
+absl::Status VerifyCommand(std::string_view disk_copy, bool skip_first_tag,
+                           bool verbose,
+                           const VerifyIndexOptions& index = {},
+                           CommandStats* stats = nullptr);
+
+// Writes the contents of the file `patch_data` over the data section of the
+// DC42 file `disk_copy`, starting at sector `patch_sector`, and updates the
+// data checksum in the header, reading the data once. Fails, writing
+// nothing, if the header's checksum does not match the data beforehand.
+// With `trust_checksum` that is not checked, and for a patch in the back
+// half only the data after it is read, twice (see
+// DiskCopyHeader::PatchedDataChecksum). If `verbose`, prints the old and
+// new checksums on standard output.
+//
+// With an `overlay`, writes the sectors to that copy-on-write overlay over
+// `disk_copy` instead, leaving `disk_copy` alone; `patch_data` must then be
+// whole sectors.
+absl::Status PatchCommand(std::string_view disk_copy,
+                          std::string_view patch_data, uint32_t patch_sector,
+                          std::string_view overlay, bool trust_checksum,
+                          bool verbose);
+
+// Creates the empty copy-on-write overlay `overlay` over the DC42 file
+// `disk_copy` (see disk_copy_overlay.h).
+absl::Status OverlayCommand(std::string_view disk_copy,
+                            std::string_view overlay);
+
+// Writes the DC42 file `output_disk_copy`: `disk_copy` with the sectors of
+// `overlay` in place and its data checksum updated from the changed words.
+// Returns the number of sectors committed. If `verbose`, prints the old and
+// new data checksums on standard output.
+absl::StatusOr<size_t> CommitCommand(std::string_view disk_copy,
+                                     std::string_view overlay,
+                                     std::string_view output_disk_copy,
+                                     bool verbose);
+
+// Prints the files and directories of the HFS volume in the DC42 file
+// `disk_copy`, or (if that is empty) the raw image `input_image`, one per
+// line on standard output: for files the type, creator and fork lengths,
+// for folders the number of entries, then the path. Returns the number of
+// entries listed.
+absl::StatusOr<size_t> ListCommand(std::string_view disk_copy,
+                                   std::string_view input_image);
+
+// Counts the used and free allocation blocks and the free runs of the HFS
+// volume in the DC42 file `disk_copy`, or (if that is empty) the raw image
+// `input_image`, from its volume bitmap (see volume_usage.h). Only the MDB
+// and the bitmap are read. If `verbose`, prints the statistics on standard
+// output.
+absl::StatusOr<VolumeUsage> UsageCommand(std::string_view disk_copy,
+                                         std::string_view input_image,
+                                         bool verbose);
+
+// What `extract_file` writes: one fork, or both forks and the Finder
+// information as MacBinary II or AppleDouble.
+enum class FileFormat { DATA, RESOURCE, MACBINARY, APPLEDOUBLE };
+
+absl::StatusOr<FileFormat> ParseFileFormat(std::string_view f);
+
+// Writes the file at `path` (":Folder:File") on the HFS volume in the DC42
+// file `disk_copy`, or (if that is empty) the raw image `input_image`, to
+// `output_file` in `format`; for APPLEDOUBLE, the resource fork and Finder
+// information go to "._" and the name of `output_file`, next to it. Only
+// the allocation blocks of the file's forks are read. Returns the number of
+// bytes of fork data written. If `verbose`, describes the file on standard
+// output.
+absl::StatusOr<uint64_t> ExtractFileCommand(std::string_view disk_copy,
+                                            std::string_view input_image,
+                                            std::string_view path,
+                                            std::string_view output_file,
+                                            FileFormat format, bool verbose);
+
+// What `fingerprint` hashes: each 512-byte sector of the data section, or
+// each allocation block of the HFS volume in it.
+enum class FingerprintBlocks { SECTOR, ALLOCATION };
+
+absl::StatusOr<FingerprintBlocks> ParseFingerprintBlocks(std::string_view b);
+
+// Hashes the blocks of the data section of the DC42 file `disk_copy` in the
+// same pass that verifies its checksums, and appends them to the fingerprint
+// index `fingerprint_index` (see fingerprint.h). Nothing is appended if the
+// data checksum does not match. Returns the number of blocks hashed. If
+// `verbose`, prints the image hash on standard output.
+absl::StatusOr<size_t> FingerprintCommand(std::string_view disk_copy,
+                                          std::string_view fingerprint_index,
+                                          FingerprintBlocks blocks,
+                                          bool verbose);
+
+// Prints what the fingerprint index `fingerprint_index` says about the
+// images in it: each group of identical images, the number of blocks each
+// image shares with others, and the number of distinct blocks over all of
+// them. Returns the number of images.
+absl::StatusOr<size_t> DedupeCommand(std::string_view fingerprint_index);
+
+#endif  // __DISK_COPY_COMMANDS_H__
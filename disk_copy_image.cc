@@ -0,0 +1,172 @@
+#include "disk_copy_image.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "absl/strings/str_format.h"
+#include "disk_copy.h"
+
+bool DiskCopyImage::Shard::Lookup(const uint32_t sector, char* out) {
+  absl::MutexLock lock(&mu_);
+  auto it = index_.find(sector);
+  if (it == index_.end()) return false;
+  lru_.splice(lru_.begin(), lru_, it->second);
+  memcpy(out, it->second->second.data(), kSectorSize);
+  return true;
+}
+
+void DiskCopyImage::Shard::Insert(const uint32_t sector, const char* data) {
+  if (capacity_ == 0) return;
+  absl::MutexLock lock(&mu_);
+  auto it = index_.find(sector);
+  if (it != index_.end()) {
+    // Another thread read it too; the bytes are the same.
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return;
+  }
+  if (lru_.size() >= capacity_) {
+    // Reuse the least recently used entry's storage.
+    index_.erase(lru_.back().first);
+    lru_.splice(lru_.begin(), lru_, std::prev(lru_.end()));
+    lru_.front().first = sector;
+  } else {
+    lru_.emplace_front(sector, Sector());
+  }
+  memcpy(lru_.front().second.data(), data, kSectorSize);
+  index_[sector] = lru_.begin();
+}
+
+DiskCopyImage::DiskCopyImage(std::unique_ptr<ImageSource> source,
+                             const uint64_t data_offset,
+                             const uint32_t sector_count,
+                             const Options& options)
+    : source_(std::move(source)),
+      source_is_memory_(source_->Contiguous().has_value()),
+      data_offset_(data_offset),
+      sector_count_(sector_count),
+      read_ahead_(options.read_ahead) {
+  const size_t shards = std::max<size_t>(options.shards, 1);
+  const size_t per_shard = (options.cache_sectors + shards - 1) / shards;
+  for (size_t i = 0; i < shards; ++i) {
+    shards_.push_back(std::make_unique<Shard>(per_shard));
+  }
+}
+
+// static
+absl::StatusOr<std::unique_ptr<DiskCopyImage>> DiskCopyImage::OpenDiskCopy(
+    std::unique_ptr<ImageSource> source, const Options& options) {
+  if (source->Size() == ImageSource::kUnknownSize) {
+    return absl::FailedPreconditionError(
+        "Random access needs an image of known size");
+  }
+  auto header = DiskCopyHeader::ReadFromDisk(*source);
+  if (!header.ok()) {
+    return header.status();
+  }
+  auto total_size = header->Validate();
+  if (!total_size.ok()) {
+    return total_size.status();
+  }
+  if (source->Size() < DiskCopyHeader::kHeaderLength + header->DataSize()) {
+    return absl::OutOfRangeError(absl::StrFormat(
+        "DC42 file of %d bytes is too short for %d bytes of data",
+        source->Size(), header->DataSize()));
+  }
+  return std::unique_ptr<DiskCopyImage>(
+      new DiskCopyImage(std::move(source), DiskCopyHeader::kHeaderLength,
+                        header->DataSize() / kSectorSize, options));
+}
+
+// static
+absl::StatusOr<std::unique_ptr<DiskCopyImage>> DiskCopyImage::OpenRaw(
+    std::unique_ptr<ImageSource> source, const Options& options) {
+  const uint64_t size = source->Size();
+  if (size == ImageSource::kUnknownSize) {
+    return absl::FailedPreconditionError(
+        "Random access needs an image of known size");
+  }
+  if (size / kSectorSize > UINT32_MAX) {
+    return absl::OutOfRangeError(
+        absl::StrFormat("Image of %d bytes has too many sectors", size));
+  }
+  return std::unique_ptr<DiskCopyImage>(
+      new DiskCopyImage(std::move(source), 0, size / kSectorSize, options));
+}
+
+absl::Status DiskCopyImage::Fill(const uint32_t first_sector,
+                                 const uint32_t count, const uint32_t wanted,
+                                 char* out) {
+  const uint64_t offset =
+      data_offset_ + uint64_t{first_sector} * kSectorSize;
+  const size_t length = size_t{count} * kSectorSize;
+  std::vector<char> scratch(source_is_memory_ ? 0 : length);
+  absl::StatusOr<absl::Span<const char>> bytes;
+  if (source_is_memory_) {
+    bytes = source_->Read(offset, length, nullptr);
+  } else {
+    absl::MutexLock lock(&source_mu_);
+    bytes = source_->Read(offset, length, scratch.data());
+  }
+  if (!bytes.ok()) {
+    return bytes.status();
+  }
+  ++source_reads_;
+  misses_ += wanted;
+  read_ahead_sectors_ += count - wanted;
+  memcpy(out, bytes->data(), size_t{wanted} * kSectorSize);
+  for (uint32_t i = 0; i < count; ++i) {
+    ShardFor(first_sector + i)
+        .Insert(first_sector + i, bytes->data() + size_t{i} * kSectorSize);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status DiskCopyImage::ReadSectors(const uint32_t first_sector,
+                                        const uint32_t count,
+                                        const absl::Span<char> out) {
+  if (first_sector > sector_count_ || count > sector_count_ - first_sector) {
+    return absl::OutOfRangeError(absl::StrFormat(
+        "Sectors [%d, %d) are beyond the %d sectors of the image",
+        first_sector, uint64_t{first_sector} + count, sector_count_));
+  }
+  if (out.size() < size_t{count} * kSectorSize) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "%d sectors do not fit in %d bytes", count, out.size()));
+  }
+  uint32_t s = 0;
+  while (s < count) {
+    if (ShardFor(first_sector + s)
+            .Lookup(first_sector + s, out.data() + size_t{s} * kSectorSize)) {
+      ++hits_;
+      ++s;
+      continue;
+    }
+    // Read the whole run of missing sectors, and some beyond it, at once.
+    uint32_t run = 1;
+    while (s + run < count) {
+      // Sectors known to be cached end the run; the check is repeated
+      // above, so a sector evicted in between is simply read again.
+      char probe[kSectorSize];
+      if (ShardFor(first_sector + s + run).Lookup(first_sector + s + run,
+                                                  probe)) {
+        break;
+      }
+      ++run;
+    }
+    const uint32_t start = first_sector + s;
+    const uint32_t with_read_ahead =
+        std::min<uint64_t>(uint64_t{run} + read_ahead_, sector_count_ - start);
+    auto status = Fill(start, with_read_ahead, run,
+                       out.data() + size_t{s} * kSectorSize);
+    if (!status.ok()) {
+      return status;
+    }
+    s += run;
+  }
+  return absl::OkStatus();
+}
+
+DiskCopyImage::CacheStats DiskCopyImage::Stats() const {
+  return CacheStats{hits_.load(), misses_.load(), read_ahead_sectors_.load(),
+                    source_reads_.load()};
+}
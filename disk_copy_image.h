@@ -0,0 +1,123 @@
+#ifndef __DISK_COPY_IMAGE_H__
+#define __DISK_COPY_IMAGE_H__
+
+// Random access to the 512-byte sectors of a disk image, for tools that read
+// scattered file system structures (MDB, bitmap, B-tree nodes) rather than
+// whole images.
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "image_source.h"
+
+// The sectors of a DC42 file's data section, or of a raw image, read through
+// a sharded LRU cache of sectors. On a miss, the missing run of sectors and
+// up to `read_ahead` sectors after it are read from the source at once.
+//
+// Safe to use from several threads at once, whatever the source: reads from
+// a source that is not memory-backed are serialized.
+class DiskCopyImage {
+ public:
+  static constexpr uint32_t kSectorSize = 512;
+
+  struct Options {
+    // Total number of sectors the cache holds, split evenly over the shards.
+    size_t cache_sectors = 4096;
+    // Number of independently locked parts of the cache; sector s is cached
+    // in shard s % shards.
+    size_t shards = 16;
+    // Sectors read beyond a run of misses, in the same source read.
+    uint32_t read_ahead = 16;
+  };
+
+  struct CacheStats {
+    // Sectors served from the cache, and sectors that had to be read.
+    uint64_t hits;
+    uint64_t misses;
+    // Sectors read ahead of a miss, and reads issued to the source.
+    uint64_t read_ahead;
+    uint64_t source_reads;
+  };
+
+  // The data section of the DC42 file `source`, which starts after its
+  // DiskCopyHeader::kHeaderLength-byte header. Fails if the header is
+  // invalid or the file is shorter than the header says.
+  static absl::StatusOr<std::unique_ptr<DiskCopyImage>> OpenDiskCopy(
+      std::unique_ptr<ImageSource> source, const Options& options);
+  // The whole of the raw image `source`, whose size must be known.
+  static absl::StatusOr<std::unique_ptr<DiskCopyImage>> OpenRaw(
+      std::unique_ptr<ImageSource> source, const Options& options);
+
+  uint32_t SectorCount() const { return sector_count_; }
+  // File offset of sector 0.
+  uint64_t DataOffset() const { return data_offset_; }
+
+  // Reads sectors [first_sector, first_sector + count) into `out`, which
+  // must hold count * kSectorSize bytes.
+  absl::Status ReadSectors(uint32_t first_sector, uint32_t count,
+                           absl::Span<char> out);
+
+  CacheStats Stats() const;
+
+ private:
+  using Sector = std::array<char, kSectorSize>;
+
+  // One independently locked LRU cache.
+  class Shard {
+   public:
+    explicit Shard(size_t capacity) : capacity_(capacity) {}
+
+    // Copies `sector` to `out` and marks it most recently used, if cached.
+    bool Lookup(uint32_t sector, char* out) ABSL_LOCKS_EXCLUDED(mu_);
+    // Caches a copy of `data` as `sector`, evicting the least recently used
+    // sector if the shard is full.
+    void Insert(uint32_t sector, const char* data) ABSL_LOCKS_EXCLUDED(mu_);
+
+   private:
+    const size_t capacity_;
+    absl::Mutex mu_;
+    // Most recently used first.
+    std::list<std::pair<uint32_t, Sector>> lru_ ABSL_GUARDED_BY(mu_);
+    absl::flat_hash_map<uint32_t,
+                        std::list<std::pair<uint32_t, Sector>>::iterator>
+        index_ ABSL_GUARDED_BY(mu_);
+  };
+
+  DiskCopyImage(std::unique_ptr<ImageSource> source, uint64_t data_offset,
+                uint32_t sector_count, const Options& options);
+
+  Shard& ShardFor(uint32_t sector) { return *shards_[sector % shards_.size()]; }
+
+  // Reads sectors [first_sector, first_sector + count) from the source into
+  // `out` and caches them; `wanted` of them were asked for, the rest are
+  // read ahead.
+  absl::Status Fill(uint32_t first_sector, uint32_t count, uint32_t wanted,
+                    char* out);
+
+  const std::unique_ptr<ImageSource> source_;
+  // Memory-backed sources are read without holding source_mu_.
+  const bool source_is_memory_;
+  absl::Mutex source_mu_;
+  const uint64_t data_offset_;
+  const uint32_t sector_count_;
+  const uint32_t read_ahead_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> read_ahead_sectors_{0};
+  std::atomic<uint64_t> source_reads_{0};
+};
+
+#endif  // __DISK_COPY_IMAGE_H__
@@ -0,0 +1,215 @@
+#include "disk_copy_image.h"
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "disk_copy.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "image_source.h"
+
+namespace {
+
+using ::testing::HasSubstr;
+
+constexpr uint32_t kSectors = 1600;  // An 800K disk.
+
+std::vector<char> RandomDisk() {
+  std::mt19937 rng(kSectors);
+  std::vector<char> disk(size_t{kSectors} * DiskCopyImage::kSectorSize);
+  for (char& c : disk) c = static_cast<char>(rng());
+  return disk;
+}
+
+// Wraps a source, counting the reads made through it. Not memory-backed, so
+// DiskCopyImage serializes its reads.
+class CountingSource : public ImageSource {
+ public:
+  explicit CountingSource(absl::Span<const char> bytes) : inner_(bytes) {}
+
+  uint64_t Size() const override { return inner_.Size(); }
+  absl::StatusOr<absl::Span<const char>> Read(uint64_t offset, size_t length,
+                                              char* scratch) override {
+    ++reads_;
+    auto bytes = inner_.Read(offset, length, scratch);
+    if (!bytes.ok()) return bytes;
+    if (bytes->data() != scratch) memcpy(scratch, bytes->data(), bytes->size());
+    return absl::MakeConstSpan(scratch, bytes->size());
+  }
+  absl::Status ReadChunks(uint64_t offset, uint64_t length,
+                          ChunkConsumer consume) override {
+    return inner_.ReadChunks(offset, length, consume);
+  }
+
+  int reads() const { return reads_; }
+
+ private:
+  MemoryImageSource inner_;
+  std::atomic<int> reads_{0};
+};
+
+std::vector<char> Sectors(DiskCopyImage& image, uint32_t first,
+                          uint32_t count) {
+  std::vector<char> out(size_t{count} * DiskCopyImage::kSectorSize);
+  EXPECT_TRUE(image.ReadSectors(first, count, absl::MakeSpan(out)).ok());
+  return out;
+}
+
+std::vector<char> Expected(const std::vector<char>& disk, uint32_t first,
+                           uint32_t count) {
+  auto begin = disk.begin() + size_t{first} * DiskCopyImage::kSectorSize;
+  return std::vector<char>(begin,
+                           begin + size_t{count} * DiskCopyImage::kSectorSize);
+}
+
+TEST(DiskCopyImage, RawReads) {
+  const std::vector<char> disk = RandomDisk();
+  auto image = DiskCopyImage::OpenRaw(
+      std::make_unique<MemoryImageSource>(disk), DiskCopyImage::Options());
+  ASSERT_TRUE(image.ok()) << image.status();
+  EXPECT_EQ((*image)->SectorCount(), kSectors);
+  EXPECT_EQ((*image)->DataOffset(), 0);
+  EXPECT_EQ(Sectors(**image, 0, 1), Expected(disk, 0, 1));
+  EXPECT_EQ(Sectors(**image, 37, 100), Expected(disk, 37, 100));
+  EXPECT_EQ(Sectors(**image, kSectors - 3, 3), Expected(disk, kSectors - 3, 3));
+}
+
+TEST(DiskCopyImage, DiskCopySkipsHeader) {
+  const std::vector<char> disk = RandomDisk();
+  auto header = DiskCopyHeader::CreateForHFS("Test", kSectors, 0);
+  ASSERT_TRUE(header.ok()) << header.status();
+  std::vector<char> dc42(DiskCopyHeader::kHeaderLength);
+  header->WriteToBuffer(dc42.data());
+  dc42.insert(dc42.end(), disk.begin(), disk.end());
+
+  auto image = DiskCopyImage::OpenDiskCopy(
+      std::make_unique<MemoryImageSource>(dc42), DiskCopyImage::Options());
+  ASSERT_TRUE(image.ok()) << image.status();
+  EXPECT_EQ((*image)->SectorCount(), kSectors);
+  EXPECT_EQ((*image)->DataOffset(), DiskCopyHeader::kHeaderLength);
+  EXPECT_EQ(Sectors(**image, 2, 1), Expected(disk, 2, 1));
+  EXPECT_EQ(Sectors(**image, 800, 20), Expected(disk, 800, 20));
+
+  dc42.resize(dc42.size() - 1);
+  auto truncated = DiskCopyImage::OpenDiskCopy(
+      std::make_unique<MemoryImageSource>(dc42), DiskCopyImage::Options());
+  EXPECT_EQ(truncated.status().code(), absl::StatusCode::kOutOfRange);
+}
+
+TEST(DiskCopyImage, OutOfRange) {
+  const std::vector<char> disk = RandomDisk();
+  auto image = DiskCopyImage::OpenRaw(
+      std::make_unique<MemoryImageSource>(disk), DiskCopyImage::Options());
+  ASSERT_TRUE(image.ok()) << image.status();
+  std::vector<char> out(2 * DiskCopyImage::kSectorSize);
+  auto status = (*image)->ReadSectors(kSectors - 1, 2, absl::MakeSpan(out));
+  EXPECT_EQ(status.code(), absl::StatusCode::kOutOfRange);
+  EXPECT_THAT(status.message(), HasSubstr("beyond the 1600 sectors"));
+  status = (*image)->ReadSectors(0, 3, absl::MakeSpan(out));
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST(DiskCopyImage, HitsMissesAndReadAhead) {
+  const std::vector<char> disk = RandomDisk();
+  auto source = std::make_unique<CountingSource>(disk);
+  CountingSource* counting = source.get();
+  DiskCopyImage::Options options;
+  options.read_ahead = 8;
+  auto image = DiskCopyImage::OpenRaw(std::move(source), options);
+  ASSERT_TRUE(image.ok()) << image.status();
+
+  // Sectors 10 and 11 are missed in one read, which brings in 12..19 too.
+  EXPECT_EQ(Sectors(**image, 10, 2), Expected(disk, 10, 2));
+  EXPECT_EQ(counting->reads(), 1);
+  DiskCopyImage::CacheStats stats = (*image)->Stats();
+  EXPECT_EQ(stats.hits, 0);
+  EXPECT_EQ(stats.misses, 2);
+  EXPECT_EQ(stats.read_ahead, 8);
+  EXPECT_EQ(stats.source_reads, 1);
+
+  EXPECT_EQ(Sectors(**image, 10, 10), Expected(disk, 10, 10));
+  EXPECT_EQ(counting->reads(), 1);
+  EXPECT_EQ((*image)->Stats().hits, 10);
+
+  // Read-ahead stops at the end of the image.
+  EXPECT_EQ(Sectors(**image, kSectors - 2, 1), Expected(disk, kSectors - 2, 1));
+  stats = (*image)->Stats();
+  EXPECT_EQ(stats.read_ahead, 9);
+  EXPECT_EQ(stats.source_reads, 2);
+}
+
+TEST(DiskCopyImage, EvictsLeastRecentlyUsed) {
+  const std::vector<char> disk = RandomDisk();
+  DiskCopyImage::Options options;
+  options.cache_sectors = 2;
+  options.shards = 1;
+  options.read_ahead = 0;
+  auto image = DiskCopyImage::OpenRaw(
+      std::make_unique<MemoryImageSource>(disk), options);
+  ASSERT_TRUE(image.ok()) << image.status();
+
+  Sectors(**image, 1, 1);
+  Sectors(**image, 2, 1);
+  Sectors(**image, 1, 1);  // Hit; 2 is now the least recently used.
+  Sectors(**image, 3, 1);  // Evicts 2.
+  Sectors(**image, 1, 1);  // Hit.
+  EXPECT_EQ((*image)->Stats().hits, 2);
+  EXPECT_EQ(Sectors(**image, 2, 1), Expected(disk, 2, 1));
+  EXPECT_EQ((*image)->Stats().misses, 4);
+}
+
+TEST(DiskCopyImage, NoCache) {
+  const std::vector<char> disk = RandomDisk();
+  DiskCopyImage::Options options;
+  options.cache_sectors = 0;
+  auto image = DiskCopyImage::OpenRaw(
+      std::make_unique<MemoryImageSource>(disk), options);
+  ASSERT_TRUE(image.ok()) << image.status();
+  EXPECT_EQ(Sectors(**image, 5, 3), Expected(disk, 5, 3));
+  EXPECT_EQ(Sectors(**image, 5, 3), Expected(disk, 5, 3));
+  EXPECT_EQ((*image)->Stats().hits, 0);
+  EXPECT_EQ((*image)->Stats().misses, 6);
+}
+
+TEST(DiskCopyImage, ConcurrentReaders) {
+  const std::vector<char> disk = RandomDisk();
+  DiskCopyImage::Options options;
+  options.cache_sectors = 256;  // Smaller than the disk, to force eviction.
+  auto image =
+      DiskCopyImage::OpenRaw(std::make_unique<CountingSource>(disk), options);
+  ASSERT_TRUE(image.ok()) << image.status();
+
+  constexpr int kThreads = 8;
+  constexpr int kReadsPerThread = 500;
+  std::atomic<int> mismatches{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      std::mt19937 rng(t);
+      std::vector<char> out(8 * DiskCopyImage::kSectorSize);
+      for (int i = 0; i < kReadsPerThread; ++i) {
+        const uint32_t count = 1 + rng() % 8;
+        const uint32_t first = rng() % (kSectors - count);
+        auto status =
+            (*image)->ReadSectors(first, count, absl::MakeSpan(out));
+        if (!status.ok() ||
+            memcmp(out.data(),
+                   disk.data() + size_t{first} * DiskCopyImage::kSectorSize,
+                   size_t{count} * DiskCopyImage::kSectorSize) != 0) {
+          ++mismatches;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(mismatches.load(), 0);
+  const DiskCopyImage::CacheStats stats = (*image)->Stats();
+  EXPECT_GT(stats.hits, 0);
+  EXPECT_GT(stats.misses, 0);
+}
+
+}  // namespace
@@ -8,11 +8,15 @@
 
 */
 
+#include <signal.h>
+
+#include <algorithm>
 #include <fstream>
 #include <iostream>
-#include <istream>
 #include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
@@ -20,8 +24,11 @@
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
-#include "disk_copy.h"
-#include "hfs_basic.h"
+#include "batch.h"
+#include "command_stats.h"
+#include "disk_copy_commands.h"
+#include "scan.h"
+#include "serve.h"
 
 ABSL_FLAG(bool, ignore_data_checksum, false,
           "If true, extract data from the --disk_copy file without regard for "
@@ -33,193 +40,276 @@ ABSL_FLAG(std::string, output_image, "",
           "Path name of raw HFS disk image to produce by extracting from "
           "--disk_copy.");
 ABSL_FLAG(std::string, input_image, "",
-          "Path name of raw HFS disk image to encode into --disk_copy.");
+          "Path name of raw HFS disk image to encode into --disk_copy; for "
+          "`convert`, the image to convert, in --input_format.");
+ABSL_FLAG(std::string, input_format, "auto",
+          "For `convert`: format of --input_image, one of auto (from its "
+          "contents), dart, ndif, raw.");
+ABSL_FLAG(std::string, dart, "",
+          "Path name of DART 1.5 image file to decompress with `undart`.");
+ABSL_FLAG(std::string, ndif, "",
+          "Path name of the data fork of an NDIF image file to decompress "
+          "with `ndif`.");
+ABSL_FLAG(std::string, ndif_resources, "",
+          "Resource fork of --ndif (or of an NDIF `convert` --input_image), "
+          "bare or as an AppleDouble file (default: --ndif/..namedfork/rsrc, "
+          "or ._<name> next to --ndif).");
+ABSL_FLAG(std::string, path, "",
+          "For `extract_file`: HFS path of the file, as :Folder:File or "
+          "Volume:Folder:File.");
+ABSL_FLAG(std::string, output_file, "",
+          "For `extract_file`: file to write.");
+ABSL_FLAG(std::string, file_format, "data",
+          "For `extract_file`: data, resource (a single fork), macbinary "
+          "(MacBinary II) or appledouble (--output_file holds the data fork, "
+          "._<name> next to it the resource fork and Finder info).");
+ABSL_FLAG(std::string, patch_data, "",
+          "For `patch`: file holding the new contents of the sectors.");
+ABSL_FLAG(uint32_t, patch_sector, 0,
+          "For `patch`: first sector of the data section to overwrite with "
+          "--patch_data.");
+ABSL_FLAG(bool, trust_checksum, false,
+          "For `patch`: take the header's data checksum as matching the data "
+          "without summing it, so that a patch in the back half of the image "
+          "reads only the data after it (twice).");
+ABSL_FLAG(std::string, overlay, "",
+          "For `overlay`, `commit` and `patch`: copy-on-write overlay file "
+          "over the base --disk_copy.");
+ABSL_FLAG(std::string, output_disk_copy, "",
+          "For `commit`: DC42 file to write, --disk_copy with the sectors of "
+          "--overlay in place.");
+ABSL_FLAG(std::string, fingerprint_index, "",
+          "For `fingerprint` and `dedupe`: index file of block hashes, "
+          "appended to by `fingerprint`.");
+ABSL_FLAG(std::string, fingerprint_blocks, "sector",
+          "For `fingerprint`: hash each 512-byte sector of the data section, "
+          "or each allocation block of the HFS volume in it (allocation).");
+ABSL_FLAG(bool, kernel_copy, true,
+          "If true, `extract` has the kernel copy the data section "
+          "(copy_file_range, which may share extents on btrfs/XFS) when "
+          "--disk_copy is a regular file, falling back to a buffered copy.");
 
-namespace {
+ABSL_FLAG(std::string, sparse, "none",
+          "For `extract` and `batch` extract: leave holes in --output_image "
+          "for all-zero sectors (zeros), or for those and the sectors of "
+          "free HFS allocation blocks, which then read back as zeros "
+          "(unallocated); none writes every byte.");
 
-using std::cerr;
-using std::string_view;
+ABSL_FLAG(bool, skip_first_tag_bytes, true,
+          "When verifying, leave the first 12 tag bytes (the tags of sector 0) "
+          "out of the tag checksum, as Disk Copy 4.2 does.");
+ABSL_FLAG(bool, write_index, false,
+          "For `verify` and `batch` verify: on success, write the image's "
+          "checksum index, <disk_copy>.sums, which later verifies use to "
+          "name the 8 KiB chunks that changed.");
+ABSL_FLAG(bool, incremental, false,
+          "For `verify` and `batch` verify: pass an image without reading it "
+          "if its size and modification time match its checksum index.");
+ABSL_FLAG(std::string, batch_command, "verify",
+          "Command `batch` runs on each image: create, extract, fingerprint, "
+          "usage or verify.");
+ABSL_FLAG(std::string, manifest, "",
+          "For `batch` and `scan`: file listing one image per line, as "
+          "<input> or <input><TAB><output>.");
+ABSL_FLAG(std::string, batch_dir, "",
+          "For `batch` and `scan`: directory tree searched for images ending "
+          "in --batch_suffix, instead of --manifest.");
+ABSL_FLAG(std::string, batch_suffix, ".dc42",
+          "For `batch` and `scan` with --batch_dir: file name suffix of the "
+          "images.");
+ABSL_FLAG(std::string, output_dir, "",
+          "For `batch` extract or create: directory for outputs not named in "
+          "the manifest (default: next to each input).");
+ABSL_FLAG(int, jobs, std::max(1u, std::thread::hardware_concurrency()),
+          "For `batch`, `scan` and `serve`: number of images processed "
+          "concurrently.");
+ABSL_FLAG(bool, io_uring, false,
+          "For `batch` verify on Linux: read --jobs images at a time through "
+          "io_uring, keeping --io_uring_depth large reads in flight.");
+ABSL_FLAG(uint32_t, io_uring_depth, 64,
+          "For `batch` with --io_uring: reads in flight at once.");
+ABSL_FLAG(std::string, report, "",
+          "For `batch`: file to receive the per-image status report; for "
+          "`scan`, the CSV (default: standard output).");
+ABSL_FLAG(bool, stats, false,
+          "For `create`, `extract`, `verify` and `batch`: print the wall "
+          "time, bytes, calls and MB/s of each phase on standard error.");
+ABSL_FLAG(std::string, socket, "",
+          "For `serve`: path of the Unix domain socket to listen on.");
+ABSL_FLAG(std::string, stats_json, "",
+          "For `create`, `extract`, `verify` and `batch`: file to receive the "
+          "phase stats as JSON; for `batch`, summed over the images, with "
+          "histograms over them.");
 
-enum class Command { CREATE, EXTRACT, VERIFY };
+namespace {
 
-absl::StatusOr<Command> ParseCommand(const string_view c) {
-  if (c == "create") {
-    return Command::CREATE;
-  } else if (c == "extract") {
-    return Command::EXTRACT;
-  } else if (c == "verify") {
-    return Command::VERIFY;
+bool WantStats() {
+  return absl::GetFlag(FLAGS_stats) || !absl::GetFlag(FLAGS_stats_json).empty();
+}
+
+// Prints `text` on standard error for --stats, and writes `json` to
+// --stats_json.
+absl::Status ReportStats(const std::string& text, const std::string& json) {
+  if (absl::GetFlag(FLAGS_stats)) std::cerr << text;
+  const std::string json_path = absl::GetFlag(FLAGS_stats_json);
+  if (json_path.empty()) return absl::OkStatus();
+  std::ofstream json_file(json_path);
+  if (!(json_file << json << '\n') || !json_file.flush()) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not write stats_json '", json_path, "'"));
   }
-  return absl::InvalidArgumentError(
-      absl::StrCat("Unrecognized command `", c, "`"));
+  return absl::OkStatus();
 }
 
-absl::Status CreateCommand(const string_view input_image,
-                           const string_view disk_copy) {
-  if (input_image.empty() || disk_copy.empty()) {
+// The images of --manifest or --batch_dir, with outputs for `command`.
+absl::StatusOr<std::vector<BatchEntry>> ListBatchImages(
+    const Command command) {
+  const std::string manifest = absl::GetFlag(FLAGS_manifest);
+  const std::string batch_dir = absl::GetFlag(FLAGS_batch_dir);
+  if (manifest.empty() == batch_dir.empty()) {
     return absl::InvalidArgumentError(
-        "Create requires --input_image and --disk_copy.");
-  }
-  std::ifstream input(input_image.data(), std::ios::binary);
-  if (!input.good()) {
-    return absl::NotFoundError(
-        absl::StrCat("Could not open input_image '", input_image, "'"));
-  }
-  auto hfsmdb = HFSMasterDirectoryBlock::ReadFromDisk(input);
-  if (!hfsmdb.ok()) {
-    return hfsmdb.status();
+        "Requires exactly one of --manifest and --batch_dir");
   }
-  absl::PrintF("Read HFS MDB: %v\n", *hfsmdb);
-  auto hfs_block_count = hfsmdb->Valid();
-  if (!hfs_block_count.ok()) {
-    return hfs_block_count.status();
-  }
-  auto hfs_name = hfsmdb->VolumeName();
-  if (!hfs_name.ok()) {
-    return hfs_name.status();
+  const std::string output_dir = absl::GetFlag(FLAGS_output_dir);
+  return manifest.empty()
+             ? FindBatchImages(batch_dir, absl::GetFlag(FLAGS_batch_suffix),
+                               command, output_dir)
+             : ReadBatchManifest(manifest, command, output_dir);
+}
+
+// Opens --report, or returns standard output if it is empty. `file` holds
+// the opened file.
+absl::StatusOr<std::ostream*> OpenReport(std::ofstream& file) {
+  const std::string report_path = absl::GetFlag(FLAGS_report);
+  if (report_path.empty()) return &std::cout;
+  file.open(report_path);
+  if (!file.good()) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not open report '", report_path, "'"));
   }
-  absl::PrintF("HFS volume '%s' declared to be %d disk blocks.\n", *hfs_name,
-               *hfs_block_count);
+  return &file;
+}
 
-  // Compute data checksum from HFS file.
-  input.seekg(0);
-  if (input.fail()) {
-    return absl::FailedPreconditionError("Could not seek HFS image stream.");
+absl::Status BatchCommand() {
+  auto command = ParseCommand(absl::GetFlag(FLAGS_batch_command));
+  if (!command.ok()) {
+    return command.status();
   }
-  DiskCopyChecksum sum(0);
-  // Compute the data checksum for the whole HFS data so we have it for the
-  // header; seeking back to update the checksum might save some I/O cost.
-  auto checksum_status = sum.UpdateSumFromFile(input, *hfs_block_count * 512);
-  if (!checksum_status.ok()) {
-    return checksum_status;
+  auto entries = ListBatchImages(*command);
+  if (!entries.ok()) {
+    return entries.status();
   }
-  auto dch =
-      DiskCopyHeader::CreateForHFS(*hfs_name, *hfs_block_count, sum.Sum());
-
-  std::ofstream output(disk_copy.data(), std::ios::binary);
-  if (!output.good()) {
-    return absl::ResourceExhaustedError(
-        absl::StrCat("Could not write disk_copy '", disk_copy, "'"));
+  auto fingerprint_blocks =
+      ParseFingerprintBlocks(absl::GetFlag(FLAGS_fingerprint_blocks));
+  if (!fingerprint_blocks.ok()) {
+    return fingerprint_blocks.status();
   }
-  auto header_status = dch->WriteToDisk(output);
-  if (!header_status.ok()) {
-    return header_status;
+  auto sparse = ParseSparseMode(absl::GetFlag(FLAGS_sparse));
+  if (!sparse.ok()) {
+    return sparse.status();
   }
+  BatchOptions options;
+  options.jobs = absl::GetFlag(FLAGS_jobs);
+  options.ignore_data_checksum = absl::GetFlag(FLAGS_ignore_data_checksum);
+  options.kernel_copy = absl::GetFlag(FLAGS_kernel_copy);
+  options.sparse = *sparse;
+  options.skip_first_tag = absl::GetFlag(FLAGS_skip_first_tag_bytes);
+  options.io_uring = absl::GetFlag(FLAGS_io_uring);
+  options.io_uring_depth = absl::GetFlag(FLAGS_io_uring_depth);
+  options.verify_index = {absl::GetFlag(FLAGS_write_index),
+                          absl::GetFlag(FLAGS_incremental)};
+  options.fingerprint_index = absl::GetFlag(FLAGS_fingerprint_index);
+  options.fingerprint_blocks = *fingerprint_blocks;
+  const std::vector<BatchResult> results =
+      RunBatch(*command, *entries, options);
 
-  // There has to be some way to use std::copy or whatever on
-  // streambuf_iterators, and a known number of bytes?
-  // std::istreambuf_iterator<char> input_iterator{input};
-  // std::ostreambuf_iterator<char> output_iterator{output};
-  // std::copy(input_iterator, input_iterator + (*hfs_block_count * 512),
-  // 	    output_iterator);
-  // how to error check?
-
-  input.seekg(0);
-  static constexpr size_t kBlockSize = 512;
-  char buf[kBlockSize];
-  for (uint32_t b = 0; b < *hfs_block_count; ++b) {
-    if (!input.read(buf, kBlockSize)) {
-      return absl::OutOfRangeError(
-          absl::StrFormat("Could not read block %d of HFS input", b));
-    }
-    if (!output.write(buf, kBlockSize)) {
-      return absl::ResourceExhaustedError(
-          absl::StrFormat("Could not write block %d of Disk Copy output", b));
+  std::ofstream report_file;
+  auto report = OpenReport(report_file);
+  if (!report.ok()) {
+    return report.status();
+  }
+  WriteBatchReport(results, **report);
+  if (WantStats()) {
+    BatchStats stats;
+    for (const BatchResult& r : results) stats.Add(r.stats);
+    auto stats_status = ReportStats(stats.ToText(), stats.ToJson());
+    if (!stats_status.ok()) {
+      return stats_status;
     }
   }
+  const size_t failures =
+      std::count_if(results.begin(), results.end(),
+                    [](const BatchResult& r) { return !r.status.ok(); });
+  if (failures > 0) {
+    return absl::AbortedError(absl::StrFormat("%d of %d images failed",
+                                              failures, results.size()));
+  }
   return absl::OkStatus();
 }
 
-absl::StatusOr<uint32_t> ExtractCommand(const string_view disk_copy,
-                                        const string_view output_image,
-                                        const bool ignore_data_checksum) {
-  if (disk_copy.empty() || output_image.empty()) {
-    return absl::InvalidArgumentError(
-        "Extract requires --disk_copy and --output_image");
-  }
-  std::ifstream input(disk_copy.data(), std::ios::binary);
-  if (!input.good()) {
-    return absl::NotFoundError(
-        absl::StrCat("Could not open disk_copy '", disk_copy, "'"));
-  }
-  auto header = DiskCopyHeader::ReadFromDisk(input);
-  if (!header.ok()) {
-    return header.status();
-  }
-  auto header_valid = header->Validate();
-  if (!header_valid.ok()) {
-    return header_valid;
+absl::Status ScanCommand() {
+  // Only the input paths are used, as for batch verify.
+  auto entries = ListBatchImages(Command::VERIFY);
+  if (!entries.ok()) {
+    return entries.status();
   }
-  std::ofstream output_hfs(output_image.data(), std::ios::binary);
-  if (!output_hfs.good()) {
-    return absl::ResourceExhaustedError(
-        absl::StrCat("Could not open output_image '", output_image, "'"));
-  }
-  // DiskCopy should be at the end of the header, ready to read data.
-  const uint32_t total_bytes_to_read = header->DataSize();
-  uint32_t bytes_remaining = total_bytes_to_read;
+  std::vector<std::string> paths;
+  paths.reserve(entries->size());
+  for (BatchEntry& entry : *entries) paths.push_back(std::move(entry.input));
+  const std::vector<ScanRecord> records =
+      ScanImages(paths, absl::GetFlag(FLAGS_jobs));
 
-  // Prepare to compute the Disk Copy data checksum as we read.
-  DiskCopyChecksum sum(0);
-  static constexpr uint32_t kBlockSize = 512;
-  char buf[kBlockSize];
-  while (bytes_remaining > 0) {
-    size_t read_size = std::min(bytes_remaining, kBlockSize);
-    if (!input.read(buf, read_size)) {
-      return absl::OutOfRangeError(
-          absl::StrFormat("Could not read %d bytes of Disk Copy input after %d",
-                          read_size, total_bytes_to_read - bytes_remaining));
-    }
-    bytes_remaining -= read_size;
-    // header_valid call above should mean the only possible error has
-    // already been checked (sum is computed over 16-bit words, so an odd
-    // number of bytes is an error; kBlockSize is even, so read_size will
-    // be even.
-    absl::Status sum_status = sum.UpdateSumFromBlock(buf, read_size);
-    if (!sum_status.ok()) {
-      return sum_status;
-    }
-    if (!output_hfs.write(buf, read_size)) {
-      return absl::ResourceExhaustedError(
-          absl::StrFormat("Could not write %d bytes of HFS image output at %d",
-                          read_size, total_bytes_to_read - bytes_remaining));
-    }
+  std::ofstream report_file;
+  auto report = OpenReport(report_file);
+  if (!report.ok()) {
+    return report.status();
   }
-  const uint32_t expected_data_checksum = header->ExpectedDataChecksum();
-  const uint32_t computed_data_checksum = sum.Sum();
-  if (computed_data_checksum != expected_data_checksum) {
-    std::string message =
-        absl::StrFormat("Disk Copy data checksum %x does not match header %x",
-                        computed_data_checksum, expected_data_checksum);
-    cerr << message << std::endl;
-    if (ignore_data_checksum) {
-      cerr << "Ignoring mismatch because of --ignore_data_checksum"
-           << std::endl;
-    } else {
-      return absl::FailedPreconditionError(message);
-    }
+  WriteScanCsv(records, **report);
+  if (!(*report)->flush()) {
+    return absl::ResourceExhaustedError("Could not write the scan report");
+  }
+  const size_t failures =
+      std::count_if(records.begin(), records.end(),
+                    [](const ScanRecord& r) { return !r.status.ok(); });
+  if (failures > 0) {
+    return absl::AbortedError(absl::StrFormat("%d of %d images failed",
+                                              failures, records.size()));
   }
-  return total_bytes_to_read;
+  return absl::OkStatus();
 }
 
-absl::Status VerifyCommand(const string_view disk_copy) {
-  if (disk_copy.empty()) {
-    return absl::InvalidArgumentError("Verify requires --disk_copy");
-  }
-  std::ifstream f(disk_copy.data(), std::ios::binary);
-  if (!f.good()) {
-    return absl::NotFoundError(
-        absl::StrCat("Could not open disk_copy '", disk_copy, "'"));
-  }
-  auto header = DiskCopyHeader::ReadFromDisk(f);
-  if (!header.ok()) {
-    return header.status();
+absl::Status ServeCommand() {
+  // Blocked before any thread starts, so that only the waiter below takes
+  // them.
+  sigset_t stop_signals;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+
+  auto server = ServeServer::Listen(absl::GetFlag(FLAGS_socket));
+  if (!server.ok()) {
+    return server.status();
   }
-  absl::PrintF("Read header: %v\n", *header);
-  return header->VerifyDataChecksum(f);
-  // TODO: VerifyTagChecksum if tag bytes present.
+  std::thread stopper([&stop_signals, &server]() {
+    int signal;
+    sigwait(&stop_signals, &signal);
+    (*server)->Shutdown();
+  });
+  std::cerr << "Serving on " << absl::GetFlag(FLAGS_socket) << std::endl;
+  (*server)->Run(absl::GetFlag(FLAGS_jobs));
+  // If the listener failed rather than being stopped, the waiter is still
+  // waiting; a signal already taken stays pending, blocked, until exit.
+  pthread_kill(stopper.native_handle(), SIGTERM);
+  stopper.join();
+  std::cerr << "Served " << (*server)->requests_served() << " requests."
+            << std::endl;
+  return absl::OkStatus();
 }
 
+using std::cerr;
+using std::string_view;
+
 }  // namespace
 
 int main(int argc, char* argv[]) {
@@ -230,10 +320,37 @@ int main(int argc, char* argv[]) {
       " <command>\n\n"
       "Supported commands:\n\n"
       "  `create`  : use data in --input_image argument to create --disk_copy\n"
+      "  `convert` : convert DART, NDIF or raw --input_image into --disk_copy "
+      "in one pass\n"
       "  `extract` : extract data from --disk_copy argument into "
       "--output_image\n"
+      "  `extract_file` : extract --path from the HFS volume in --disk_copy or "
+      "--input_image into --output_file\n"
+      "  `list`    : list the files and folders of the HFS volume in "
+      "--disk_copy or --input_image\n"
+      "  `usage`   : count used and free allocation blocks of the HFS volume "
+      "in --disk_copy or --input_image from its bitmap\n"
+      "  `fingerprint` : append the block hashes of --disk_copy to "
+      "--fingerprint_index\n"
+      "  `dedupe`  : report duplicate images and shared blocks in "
+      "--fingerprint_index\n"
+      "  `patch`   : write --patch_data over the sectors of --disk_copy from "
+      "--patch_sector, updating the checksum\n"
+      "  `overlay` : create an empty copy-on-write --overlay over --disk_copy\n"
+      "  `commit`  : write --disk_copy with the sectors of --overlay into "
+      "--output_disk_copy\n"
+      "  `undart`  : decompress DART image --dart into --output_image "
+      "and/or --disk_copy\n"
+      "  `ndif`    : decompress NDIF image --ndif into --output_image "
+      "and/or --disk_copy\n"
       "  `verify`  : validate basic structure and checksums for "
-      "--disk_copy\n"));
+      "--disk_copy\n"
+      "  `batch`   : run --batch_command on every image in --manifest or "
+      "--batch_dir\n"
+      "  `scan`    : write a CSV of the headers and volumes of every image in "
+      "--manifest or --batch_dir\n"
+      "  `serve`   : answer create, extract, verify and scan requests on "
+      "--socket until interrupted\n"));
 
   std::vector<char*> positional_args = absl::ParseCommandLine(argc, argv);
   const int arg_count = positional_args.size();  // includes program name
@@ -255,6 +372,9 @@ int main(int argc, char* argv[]) {
     return 1;
   }
   const bool ignore_data_checksum = absl::GetFlag(FLAGS_ignore_data_checksum);
+  // Filled in by create, extract and verify.
+  CommandStats command_stats;
+  CommandStats* const stats = WantStats() ? &command_stats : nullptr;
 
   absl::Status status;
   switch (cmd.value()) {
@@ -265,12 +385,36 @@ int main(int argc, char* argv[]) {
         break;
       }
       status = CreateCommand(absl::GetFlag(FLAGS_input_image),
-                             absl::GetFlag(FLAGS_disk_copy));
+                             absl::GetFlag(FLAGS_disk_copy), true, stats);
       break;
+    case Command::CONVERT: {
+      auto format = ParseInputFormat(absl::GetFlag(FLAGS_input_format));
+      if (!format.ok()) {
+        status = format.status();
+        break;
+      }
+      auto bytes_written = ConvertCommand(
+          absl::GetFlag(FLAGS_input_image), *format,
+          absl::GetFlag(FLAGS_ndif_resources),
+          absl::GetFlag(FLAGS_output_image), absl::GetFlag(FLAGS_disk_copy),
+          true);
+      if (bytes_written.ok()) {
+        cerr << "Converted " << *bytes_written << " bytes ("
+             << (*bytes_written / 512) << ") disk blocks." << std::endl;
+      } else {
+        status = bytes_written.status();
+      }
+    } break;
     case Command::EXTRACT: {
-      auto bytes_read = ExtractCommand(absl::GetFlag(FLAGS_disk_copy),
-                                       absl::GetFlag(FLAGS_output_image),
-                                       ignore_data_checksum);
+      auto sparse = ParseSparseMode(absl::GetFlag(FLAGS_sparse));
+      if (!sparse.ok()) {
+        status = sparse.status();
+        break;
+      }
+      auto bytes_read = ExtractCommand(
+          absl::GetFlag(FLAGS_disk_copy), absl::GetFlag(FLAGS_output_image),
+          ignore_data_checksum, absl::GetFlag(FLAGS_kernel_copy), *sparse,
+          true, stats);
       if (bytes_read.ok()) {
         cerr << "Read " << *bytes_read << " bytes (" << (*bytes_read / 512)
              << ") HFS blocks." << std::endl;
@@ -278,17 +422,140 @@ int main(int argc, char* argv[]) {
         status = bytes_read.status();
       }
     } break;
+    case Command::EXTRACT_FILE: {
+      auto format = ParseFileFormat(absl::GetFlag(FLAGS_file_format));
+      if (!format.ok()) {
+        status = format.status();
+        break;
+      }
+      auto bytes_written = ExtractFileCommand(
+          absl::GetFlag(FLAGS_disk_copy), absl::GetFlag(FLAGS_input_image),
+          absl::GetFlag(FLAGS_path), absl::GetFlag(FLAGS_output_file), *format,
+          true);
+      if (bytes_written.ok()) {
+        cerr << "Wrote " << *bytes_written << " bytes of fork data."
+             << std::endl;
+      } else {
+        status = bytes_written.status();
+      }
+    } break;
+    case Command::FINGERPRINT: {
+      auto blocks =
+          ParseFingerprintBlocks(absl::GetFlag(FLAGS_fingerprint_blocks));
+      if (!blocks.ok()) {
+        status = blocks.status();
+        break;
+      }
+      auto hashed = FingerprintCommand(absl::GetFlag(FLAGS_disk_copy),
+                                       absl::GetFlag(FLAGS_fingerprint_index),
+                                       *blocks, true);
+      if (hashed.ok()) {
+        cerr << "Hashed " << *hashed << " blocks." << std::endl;
+      } else {
+        status = hashed.status();
+      }
+    } break;
+    case Command::DEDUPE: {
+      auto images = DedupeCommand(absl::GetFlag(FLAGS_fingerprint_index));
+      if (images.ok()) {
+        cerr << "Compared " << *images << " images." << std::endl;
+      } else {
+        status = images.status();
+      }
+    } break;
+    case Command::LIST: {
+      auto entries = ListCommand(absl::GetFlag(FLAGS_disk_copy),
+                                 absl::GetFlag(FLAGS_input_image));
+      if (entries.ok()) {
+        cerr << "Listed " << *entries << " entries." << std::endl;
+      } else {
+        status = entries.status();
+      }
+    } break;
+    case Command::USAGE: {
+      auto usage = UsageCommand(absl::GetFlag(FLAGS_disk_copy),
+                                absl::GetFlag(FLAGS_input_image), true);
+      if (usage.ok()) {
+        cerr << "Counted " << usage->allocation_blocks
+             << " allocation blocks." << std::endl;
+      } else {
+        status = usage.status();
+      }
+    } break;
+    case Command::PATCH:
+      status = PatchCommand(absl::GetFlag(FLAGS_disk_copy),
+                            absl::GetFlag(FLAGS_patch_data),
+                            absl::GetFlag(FLAGS_patch_sector),
+                            absl::GetFlag(FLAGS_overlay),
+                            absl::GetFlag(FLAGS_trust_checksum), true);
+      break;
+    case Command::OVERLAY:
+      status = OverlayCommand(absl::GetFlag(FLAGS_disk_copy),
+                              absl::GetFlag(FLAGS_overlay));
+      break;
+    case Command::COMMIT: {
+      auto sectors = CommitCommand(absl::GetFlag(FLAGS_disk_copy),
+                                   absl::GetFlag(FLAGS_overlay),
+                                   absl::GetFlag(FLAGS_output_disk_copy), true);
+      if (sectors.ok()) {
+        cerr << "Committed " << *sectors << " sectors." << std::endl;
+      } else {
+        status = sectors.status();
+      }
+    } break;
+    case Command::UNDART: {
+      auto bytes_written = UndartCommand(
+          absl::GetFlag(FLAGS_dart), absl::GetFlag(FLAGS_output_image),
+          absl::GetFlag(FLAGS_disk_copy), true);
+      if (bytes_written.ok()) {
+        cerr << "Decoded " << *bytes_written << " bytes ("
+             << (*bytes_written / 512) << ") disk blocks." << std::endl;
+      } else {
+        status = bytes_written.status();
+      }
+    } break;
+    case Command::NDIF: {
+      auto bytes_written = NdifCommand(
+          absl::GetFlag(FLAGS_ndif), absl::GetFlag(FLAGS_ndif_resources),
+          absl::GetFlag(FLAGS_output_image), absl::GetFlag(FLAGS_disk_copy),
+          true);
+      if (bytes_written.ok()) {
+        cerr << "Decoded " << *bytes_written << " bytes ("
+             << (*bytes_written / 512) << ") disk blocks." << std::endl;
+      } else {
+        status = bytes_written.status();
+      }
+    } break;
     case Command::VERIFY:
       if (ignore_data_checksum) {
         status = absl::InvalidArgumentError(
             "'verify' cannot use --ignore-data-checksum");
         break;
       }
-      status = VerifyCommand(absl::GetFlag(FLAGS_disk_copy));
+      status = VerifyCommand(absl::GetFlag(FLAGS_disk_copy),
+                             absl::GetFlag(FLAGS_skip_first_tag_bytes), true,
+                             {absl::GetFlag(FLAGS_write_index),
+                              absl::GetFlag(FLAGS_incremental)},
+                             stats);
+      break;
+    case Command::BATCH:
+      status = BatchCommand();
+      break;
+    case Command::SCAN:
+      status = ScanCommand();
+      break;
+    case Command::SERVE:
+      status = ServeCommand();
       break;
     default:
       status = absl::InvalidArgumentError("unknown command");
   }
+  if (stats != nullptr && (*cmd == Command::CREATE ||
+                           *cmd == Command::EXTRACT ||
+                           *cmd == Command::VERIFY)) {
+    auto stats_status = ReportStats(stats->ToText(), stats->ToJson());
+    if (status.ok()) status = stats_status;
+  }
   if (!status.ok()) {
     cerr << status << std::endl;
     return 2;
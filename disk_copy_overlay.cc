@@ -0,0 +1,369 @@
+#include "disk_copy_overlay.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+#include <utility>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "disk_copy.h"
+#include "endian.h"
+#include "file_copy.h"
+#include "image_source.h"
+
+namespace {
+
+constexpr uint32_t kOverlayMagic = 0x44434f56;  // 'DCOV'
+constexpr uint64_t kOverlayHeaderBytes = 16;
+constexpr uint64_t kRecordBytes = 4 + DiskCopyOverlay::kSectorSize;
+// Records read at a time when opening an overlay.
+constexpr size_t kRecordsPerRead = 128;
+
+uint64_t RecordOffset(const uint32_t slot) {
+  return kOverlayHeaderBytes + slot * kRecordBytes;
+}
+
+}  // namespace
+
+DiskCopyOverlay::DiskCopyOverlay(
+    std::string base_path, const uint32_t base_checksum,
+    std::unique_ptr<DiskCopyImage> base_image, const int fd,
+    absl::flat_hash_map<uint32_t, uint32_t> slots)
+    : base_path_(std::move(base_path)),
+      base_checksum_(base_checksum),
+      base_image_(std::move(base_image)),
+      fd_(fd),
+      slots_(std::move(slots)) {}
+
+DiskCopyOverlay::~DiskCopyOverlay() { close(fd_); }
+
+// static
+absl::StatusOr<std::unique_ptr<DiskCopyImage>> DiskCopyOverlay::OpenBase(
+    const std::string_view base, const DiskCopyImage::Options& options,
+    uint32_t& checksum) {
+  if (base == kStandardStreamPath) {
+    return absl::InvalidArgumentError(
+        "An overlay needs a base file, not standard input");
+  }
+  auto source = OpenImageSource(base);
+  if (!source.ok()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open base image '", base, "'"));
+  }
+  auto header = DiskCopyHeader::ReadFromDisk(**source);
+  if (!header.ok()) {
+    return header.status();
+  }
+  checksum = header->ExpectedDataChecksum();
+  return DiskCopyImage::OpenDiskCopy(*std::move(source), options);
+}
+
+// static
+absl::StatusOr<std::unique_ptr<DiskCopyOverlay>> DiskCopyOverlay::Create(
+    const std::string_view base, const std::string_view overlay,
+    const DiskCopyImage::Options& options) {
+  uint32_t checksum;
+  auto image = OpenBase(base, options, checksum);
+  if (!image.ok()) {
+    return image.status();
+  }
+  const int fd = open(std::string(overlay).c_str(),
+                      O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    return errno == EEXIST
+               ? absl::AlreadyExistsError(
+                     absl::StrCat("Overlay '", overlay, "' already exists"))
+               : absl::ResourceExhaustedError(
+                     absl::StrCat("Could not create overlay '", overlay,
+                                  "': ", strerror(errno)));
+  }
+  char header[kOverlayHeaderBytes] = {};
+  WriteBigEndian4(kOverlayMagic, header);
+  WriteBigEndian4((*image)->SectorCount() * kSectorSize, header + 4);
+  WriteBigEndian4(checksum, header + 8);
+  auto write_status = WriteFullyAt(fd, 0, header, sizeof(header));
+  if (!write_status.ok()) {
+    close(fd);
+    unlink(std::string(overlay).c_str());
+    return write_status;
+  }
+  return std::unique_ptr<DiskCopyOverlay>(new DiskCopyOverlay(
+      std::string(base), checksum, *std::move(image), fd, {}));
+}
+
+// static
+absl::StatusOr<std::unique_ptr<DiskCopyOverlay>> DiskCopyOverlay::Open(
+    const std::string_view base, const std::string_view overlay,
+    const DiskCopyImage::Options& options) {
+  uint32_t checksum;
+  auto image = OpenBase(base, options, checksum);
+  if (!image.ok()) {
+    return image.status();
+  }
+  const int fd = open(std::string(overlay).c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open overlay '", overlay, "'"));
+  }
+  absl::Cleanup close_fd = [fd] { close(fd); };
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return absl::DataLossError(
+        absl::StrCat("Could not stat overlay '", overlay, "'"));
+  }
+  char header[kOverlayHeaderBytes];
+  auto header_read = ReadFully(fd, 0, header, sizeof(header));
+  if (!header_read.ok()) {
+    return header_read.status();
+  }
+  if (*header_read != sizeof(header) ||
+      BigEndian4(header) != kOverlayMagic) {
+    return absl::DataLossError(
+        absl::StrCat("'", overlay, "' is not an overlay"));
+  }
+  const uint32_t sector_count = (*image)->SectorCount();
+  if (BigEndian4(header + 4) != sector_count * kSectorSize ||
+      BigEndian4(header + 8) != checksum) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "Overlay '", overlay, "' was not made over '", base,
+        "' as it now is"));
+  }
+
+  // Complete records only; a partial one at the end is reused.
+  const uint64_t records = (st.st_size - kOverlayHeaderBytes) / kRecordBytes;
+  if (records > sector_count) {
+    return absl::DataLossError(absl::StrFormat(
+        "Overlay '%s' holds %d records for %d sectors", overlay, records,
+        sector_count));
+  }
+  absl::flat_hash_map<uint32_t, uint32_t> slots;
+  slots.reserve(records);
+  std::vector<char> buffer(kRecordsPerRead * kRecordBytes);
+  for (uint32_t slot = 0; slot < records;) {
+    const size_t n = std::min<uint64_t>(kRecordsPerRead, records - slot);
+    auto read = ReadFully(fd, RecordOffset(slot), buffer.data(),
+                          n * kRecordBytes);
+    if (!read.ok()) {
+      return read.status();
+    }
+    if (*read != n * kRecordBytes) {
+      return absl::DataLossError(
+          absl::StrCat("Overlay '", overlay, "' is truncated"));
+    }
+    for (size_t i = 0; i < n; ++i, ++slot) {
+      const uint32_t sector = BigEndian4(buffer.data() + i * kRecordBytes);
+      if (sector >= sector_count || !slots.emplace(sector, slot).second) {
+        return absl::DataLossError(absl::StrFormat(
+            "Overlay '%s' has a bad record for sector %d", overlay, sector));
+      }
+    }
+  }
+  std::move(close_fd).Cancel();
+  return std::unique_ptr<DiskCopyOverlay>(new DiskCopyOverlay(
+      std::string(base), checksum, *std::move(image), fd, std::move(slots)));
+}
+
+absl::Status DiskCopyOverlay::ReadSectors(const uint32_t first_sector,
+                                          const uint32_t count,
+                                          const absl::Span<char> out) {
+  if (first_sector > SectorCount() || count > SectorCount() - first_sector) {
+    return absl::OutOfRangeError(absl::StrFormat(
+        "Sectors [%d, %d) are beyond the %d sectors of the image",
+        first_sector, uint64_t{first_sector} + count, SectorCount()));
+  }
+  if (out.size() < size_t{count} * kSectorSize) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "%d sectors do not fit in %d bytes", count, out.size()));
+  }
+  absl::ReaderMutexLock lock(&mu_);
+  uint32_t s = 0;
+  while (s < count) {
+    char* const sector_out = out.data() + size_t{s} * kSectorSize;
+    auto it = slots_.find(first_sector + s);
+    if (it != slots_.end()) {
+      auto read =
+          ReadFully(fd_, RecordOffset(it->second) + 4, sector_out, kSectorSize);
+      if (!read.ok()) {
+        return read.status();
+      }
+      if (*read != kSectorSize) {
+        return absl::DataLossError(absl::StrFormat(
+            "Overlay record of sector %d is truncated", first_sector + s));
+      }
+      ++s;
+      continue;
+    }
+    // The base's sectors up to the next overridden one, in one read.
+    uint32_t run = 1;
+    while (s + run < count && !slots_.contains(first_sector + s + run)) {
+      ++run;
+    }
+    auto status = base_image_->ReadSectors(
+        first_sector + s, run,
+        absl::MakeSpan(sector_out, size_t{run} * kSectorSize));
+    if (!status.ok()) {
+      return status;
+    }
+    s += run;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status DiskCopyOverlay::WriteSectors(const uint32_t first_sector,
+                                           const uint32_t count,
+                                           const absl::Span<const char> data) {
+  if (first_sector > SectorCount() || count > SectorCount() - first_sector) {
+    return absl::OutOfRangeError(absl::StrFormat(
+        "Sectors [%d, %d) are beyond the %d sectors of the image",
+        first_sector, uint64_t{first_sector} + count, SectorCount()));
+  }
+  if (data.size() < size_t{count} * kSectorSize) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "%d bytes do not hold %d sectors", data.size(), count));
+  }
+  absl::MutexLock lock(&mu_);
+  char record[kRecordBytes];
+  for (uint32_t i = 0; i < count; ++i) {
+    const uint32_t sector = first_sector + i;
+    const char* const bytes = data.data() + size_t{i} * kSectorSize;
+    auto it = slots_.find(sector);
+    absl::Status status;
+    if (it != slots_.end()) {
+      status =
+          WriteFullyAt(fd_, RecordOffset(it->second) + 4, bytes, kSectorSize);
+    } else {
+      const uint32_t slot = slots_.size();
+      WriteBigEndian4(sector, record);
+      memcpy(record + 4, bytes, kSectorSize);
+      // The sector is only overridden once its whole record is written.
+      status = WriteFullyAt(fd_, RecordOffset(slot), record, kRecordBytes);
+      if (status.ok()) slots_.emplace(sector, slot);
+    }
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+std::vector<uint32_t> DiskCopyOverlay::OverriddenSectors() const {
+  std::vector<uint32_t> sectors;
+  {
+    absl::ReaderMutexLock lock(&mu_);
+    sectors.reserve(slots_.size());
+    for (const auto& [sector, slot] : slots_) sectors.push_back(sector);
+  }
+  std::sort(sectors.begin(), sectors.end());
+  return sectors;
+}
+
+absl::StatusOr<uint32_t> DiskCopyOverlay::Commit(
+    const std::string_view output) {
+  std::error_code ec;
+  if (output == base_path_ || std::filesystem::equivalent(
+                                  std::string(output), base_path_, ec)) {
+    return absl::InvalidArgumentError(
+        "An overlay cannot be committed over its base");
+  }
+  auto source = OpenImageSource(base_path_);
+  if (!source.ok()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open base image '", base_path_, "'"));
+  }
+  auto header = DiskCopyHeader::ReadFromDisk(**source);
+  if (!header.ok()) {
+    return header.status();
+  }
+  if (header->ExpectedDataChecksum() != base_checksum_) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("Base image '", base_path_, "' changed under overlay"));
+  }
+
+  // The overridden sectors in order, and their contents.
+  absl::ReaderMutexLock lock(&mu_);
+  std::vector<uint32_t> sectors;
+  sectors.reserve(slots_.size());
+  for (const auto& [sector, slot] : slots_) sectors.push_back(sector);
+  std::sort(sectors.begin(), sectors.end());
+  std::vector<char> bytes(sectors.size() * kSectorSize);
+  for (size_t i = 0; i < sectors.size(); ++i) {
+    auto read = ReadFully(fd_, RecordOffset(slots_.at(sectors[i])) + 4,
+                          bytes.data() + i * kSectorSize, kSectorSize);
+    if (!read.ok()) {
+      return read.status();
+    }
+    if (*read != kSectorSize) {
+      return absl::DataLossError(absl::StrFormat(
+          "Overlay record of sector %d is truncated", sectors[i]));
+    }
+  }
+
+  const int out_fd = open(std::string(output).c_str(),
+                          O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (out_fd < 0) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not open output '", output, "'"));
+  }
+  absl::Cleanup close_out = [out_fd] { close(out_fd); };
+
+  // The base is copied in one pass, with the overlay's sectors put in place
+  // and the data section summed as it goes by, so nothing is read twice.
+  const uint64_t data_start = DiskCopyHeader::kHeaderLength;
+  const uint64_t data_end = data_start + header->DataSize();
+  DiskCopyChecksum sum;
+  std::vector<char> patched;
+  size_t next = 0;
+  uint64_t position = 0;
+  auto copy_status = (*source)->ReadChunks(
+      0, (*source)->Size(), [&](const char* chunk, const size_t chunk_size) {
+        const uint64_t chunk_end = position + chunk_size;
+        const char* out = chunk;
+        // A sector may continue into the next chunk; it is only passed
+        // once its end is copied.
+        for (; next < sectors.size(); ++next) {
+          const uint64_t sector_start =
+              data_start + uint64_t{sectors[next]} * kSectorSize;
+          const uint64_t sector_end = sector_start + kSectorSize;
+          if (sector_start >= chunk_end) break;
+          if (out == chunk) {
+            patched.assign(chunk, chunk + chunk_size);
+            out = patched.data();
+          }
+          const uint64_t from = std::max(sector_start, position);
+          const uint64_t to = std::min(sector_end, chunk_end);
+          memcpy(patched.data() + (from - position),
+                 bytes.data() + next * kSectorSize + (from - sector_start),
+                 to - from);
+          if (sector_end > chunk_end) break;
+        }
+        const uint64_t sum_from = std::max(position, data_start);
+        const uint64_t sum_to = std::min(chunk_end, data_end);
+        if (sum_from < sum_to) {
+          auto sum_status = sum.UpdateSumFromBlock(
+              out + (sum_from - position), sum_to - sum_from);
+          if (!sum_status.ok()) return sum_status;
+        }
+        auto status = WriteFullyAt(out_fd, position, out, chunk_size);
+        position = chunk_end;
+        return status;
+      });
+  if (!copy_status.ok()) {
+    return copy_status;
+  }
+  header->SetDataChecksum(sum.Sum());
+  char header_bytes[DiskCopyHeader::kHeaderLength];
+  header->WriteToBuffer(header_bytes);
+  auto header_status =
+      WriteFullyAt(out_fd, 0, header_bytes, sizeof(header_bytes));
+  if (!header_status.ok()) {
+    return header_status;
+  }
+  return sum.Sum();
+}
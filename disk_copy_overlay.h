@@ -0,0 +1,106 @@
+#ifndef __DISK_COPY_OVERLAY_H__
+#define __DISK_COPY_OVERLAY_H__
+
+// A copy-on-write delta over a read-only DC42 base image, so that many
+// emulated machines can share one base and each write only its own changed
+// sectors. Creating an overlay writes a 16-byte file; Commit later folds
+// the changed sectors into a new DC42 file.
+//
+// File layout (big-endian):
+//
+// offset  size  contents
+// 0       4     'DCOV'
+// 4       4     data section size of the base
+// 8       4     data checksum in the base's header, which identifies it
+// 12      4     zero
+// 16      516*n one record per overridden sector: its number, then its
+//               512 bytes
+//
+// Records are in the order the sectors were first written; writing a
+// sector again replaces its record in place. A record cut short (by a
+// crash while it was appended) is ignored and later overwritten.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "disk_copy_image.h"
+
+// The sectors of a base DC42 file's data section, as changed by an overlay
+// file. Sectors the overlay does not hold are read from the base through a
+// DiskCopyImage; the base file is never written.
+//
+// Safe to use from several threads at once; a write excludes reads while
+// it runs.
+class DiskCopyOverlay {
+ public:
+  static constexpr uint32_t kSectorSize = DiskCopyImage::kSectorSize;
+
+  // Creates a new, empty overlay file `overlay` over the DC42 file `base`.
+  // Fails if `overlay` already exists.
+  static absl::StatusOr<std::unique_ptr<DiskCopyOverlay>> Create(
+      std::string_view base, std::string_view overlay,
+      const DiskCopyImage::Options& options = {});
+  // Opens the existing `overlay`, which must have been created over `base`
+  // as its header now stands.
+  static absl::StatusOr<std::unique_ptr<DiskCopyOverlay>> Open(
+      std::string_view base, std::string_view overlay,
+      const DiskCopyImage::Options& options = {});
+
+  DiskCopyOverlay(const DiskCopyOverlay&) = delete;
+  DiskCopyOverlay& operator=(const DiskCopyOverlay&) = delete;
+  ~DiskCopyOverlay();
+
+  uint32_t SectorCount() const { return base_image_->SectorCount(); }
+  // The data checksum in the base's header.
+  uint32_t BaseDataChecksum() const { return base_checksum_; }
+
+  // As DiskCopyImage::ReadSectors, with the overlay's sectors in place of
+  // the base's.
+  absl::Status ReadSectors(uint32_t first_sector, uint32_t count,
+                           absl::Span<char> out) ABSL_LOCKS_EXCLUDED(mu_);
+  // Writes sectors [first_sector, first_sector + count) from `data`, which
+  // must hold count * kSectorSize bytes, to the overlay file.
+  absl::Status WriteSectors(uint32_t first_sector, uint32_t count,
+                            absl::Span<const char> data)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // The sectors the overlay holds, in ascending order.
+  std::vector<uint32_t> OverriddenSectors() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Writes the DC42 file `output`: the base with the overlay's sectors in
+  // place, and its data checksum summed from the new data as it is copied,
+  // in one read of the base. The tags are the base's. Returns the new data
+  // checksum. `output` must not be the base.
+  absl::StatusOr<uint32_t> Commit(std::string_view output)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  DiskCopyOverlay(std::string base_path, uint32_t base_checksum,
+                  std::unique_ptr<DiskCopyImage> base_image, int fd,
+                  absl::flat_hash_map<uint32_t, uint32_t> slots);
+
+  // Opens `base` and returns its image, and its header's data checksum in
+  // `checksum`.
+  static absl::StatusOr<std::unique_ptr<DiskCopyImage>> OpenBase(
+      std::string_view base, const DiskCopyImage::Options& options,
+      uint32_t& checksum);
+
+  const std::string base_path_;
+  const uint32_t base_checksum_;
+  const std::unique_ptr<DiskCopyImage> base_image_;
+  const int fd_;
+  mutable absl::Mutex mu_;
+  // Sector number to its record's position in the file.
+  absl::flat_hash_map<uint32_t, uint32_t> slots_ ABSL_GUARDED_BY(mu_);
+};
+
+#endif  // __DISK_COPY_OVERLAY_H__
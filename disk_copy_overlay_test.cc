@@ -0,0 +1,140 @@
+#include "disk_copy_overlay.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "disk_copy.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test_images.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+using testing::ElementsAre;
+using testing::IsEmpty;
+
+constexpr uint32_t kSectors = 1600;
+constexpr uint32_t kSector = DiskCopyOverlay::kSectorSize;
+
+class DiskCopyOverlayTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    root_ = testing::TempDir() + "/overlay_test";
+    fs::remove_all(root_);
+    fs::create_directories(root_);
+    const std::vector<char> base =
+        TestDiskCopy(RandomHFSImage(kSectors, "Base"));
+    base_contents_.assign(base.begin(), base.end());
+    WriteFile(base_, base);
+  }
+
+  std::string Data(uint32_t sector, uint32_t count) const {
+    return base_contents_.substr(
+        DiskCopyHeader::kHeaderLength + size_t{sector} * kSector,
+        size_t{count} * kSector);
+  }
+
+  std::string Read(DiskCopyOverlay& overlay, uint32_t first, uint32_t count) {
+    std::string out(size_t{count} * kSector, 0);
+    EXPECT_TRUE(overlay.ReadSectors(first, count, absl::MakeSpan(out)).ok());
+    return out;
+  }
+
+  std::string root_;
+  std::string base_ = testing::TempDir() + "/overlay_test_base.dc42";
+  std::string overlay_path_ = testing::TempDir() + "/overlay_test/vm.dcov";
+  std::string base_contents_;
+};
+
+TEST_F(DiskCopyOverlayTest, ReadsThroughToTheBase) {
+  auto overlay = DiskCopyOverlay::Create(base_, overlay_path_);
+  ASSERT_TRUE(overlay.ok()) << overlay.status();
+  EXPECT_EQ(16, fs::file_size(overlay_path_));
+  EXPECT_EQ(kSectors, (*overlay)->SectorCount());
+  EXPECT_EQ(Data(0, kSectors), Read(**overlay, 0, kSectors));
+  EXPECT_THAT((*overlay)->OverriddenSectors(), IsEmpty());
+  EXPECT_EQ(absl::StatusCode::kAlreadyExists,
+            DiskCopyOverlay::Create(base_, overlay_path_).status().code());
+}
+
+TEST_F(DiskCopyOverlayTest, WritesGoToTheOverlayOnly) {
+  auto overlay = DiskCopyOverlay::Create(base_, overlay_path_);
+  ASSERT_TRUE(overlay.ok()) << overlay.status();
+  const std::string a(2 * kSector, 'a');
+  ASSERT_TRUE((*overlay)->WriteSectors(10, 2, a).ok());
+  const std::string b(kSector, 'b');
+  ASSERT_TRUE((*overlay)->WriteSectors(500, 1, b).ok());
+  // Rewriting a sector replaces its record.
+  const std::string c(kSector, 'c');
+  ASSERT_TRUE((*overlay)->WriteSectors(11, 1, c).ok());
+  EXPECT_EQ(16 + 3 * 516, fs::file_size(overlay_path_));
+
+  EXPECT_EQ(Data(9, 1) + a.substr(0, kSector) + c + Data(12, 1),
+            Read(**overlay, 9, 4));
+  EXPECT_EQ(b, Read(**overlay, 500, 1));
+  EXPECT_THAT((*overlay)->OverriddenSectors(), ElementsAre(10, 11, 500));
+  EXPECT_EQ(base_contents_, ReadFile(base_));
+  EXPECT_EQ(absl::StatusCode::kOutOfRange,
+            (*overlay)->WriteSectors(kSectors - 1, 2, a).code());
+
+  // A second opening sees the same sectors.
+  overlay->reset();
+  auto reopened = DiskCopyOverlay::Open(base_, overlay_path_);
+  ASSERT_TRUE(reopened.ok()) << reopened.status();
+  EXPECT_THAT((*reopened)->OverriddenSectors(), ElementsAre(10, 11, 500));
+  EXPECT_EQ(a.substr(0, kSector) + c, Read(**reopened, 10, 2));
+}
+
+TEST_F(DiskCopyOverlayTest, IgnoresAPartialRecord) {
+  {
+    auto overlay = DiskCopyOverlay::Create(base_, overlay_path_);
+    ASSERT_TRUE(overlay.ok()) << overlay.status();
+    ASSERT_TRUE((*overlay)->WriteSectors(3, 1, std::string(kSector, 'x')).ok());
+  }
+  std::ofstream(overlay_path_, std::ios::binary | std::ios::app)
+      << std::string(100, 'y');
+  auto overlay = DiskCopyOverlay::Open(base_, overlay_path_);
+  ASSERT_TRUE(overlay.ok()) << overlay.status();
+  EXPECT_THAT((*overlay)->OverriddenSectors(), ElementsAre(3));
+  ASSERT_TRUE((*overlay)->WriteSectors(4, 1, std::string(kSector, 'z')).ok());
+  EXPECT_EQ(16 + 2 * 516, fs::file_size(overlay_path_));
+}
+
+TEST_F(DiskCopyOverlayTest, RefusesAnotherBase) {
+  ASSERT_TRUE(DiskCopyOverlay::Create(base_, overlay_path_).ok());
+  std::vector<char> bytes(base_contents_.begin(), base_contents_.end());
+  const std::string sector(kSector, 'p');
+  const DataPatch patch{0, sector};
+  ASSERT_TRUE(PatchDiskCopy(absl::MakeSpan(bytes), {&patch, 1}).ok());
+  const std::string other = root_ + "/other.dc42";
+  std::ofstream(other, std::ios::binary).write(bytes.data(), bytes.size());
+  EXPECT_EQ(absl::StatusCode::kFailedPrecondition,
+            DiskCopyOverlay::Open(other, overlay_path_).status().code());
+}
+
+TEST_F(DiskCopyOverlayTest, CommitMatchesAFullChecksum) {
+  auto overlay = DiskCopyOverlay::Create(base_, overlay_path_);
+  ASSERT_TRUE(overlay.ok()) << overlay.status();
+  ASSERT_TRUE(
+      (*overlay)->WriteSectors(1000, 3, std::string(3 * kSector, 'q')).ok());
+  ASSERT_TRUE((*overlay)->WriteSectors(7, 1, std::string(kSector, 'r')).ok());
+  const std::string output = root_ + "/committed.dc42";
+  auto checksum = (*overlay)->Commit(output);
+  ASSERT_TRUE(checksum.ok()) << checksum.status();
+  EXPECT_NE((*overlay)->BaseDataChecksum(), *checksum);
+
+  const std::string committed = ReadFile(output);
+  ASSERT_EQ(base_contents_.size(), committed.size());
+  EXPECT_TRUE(VerifyDiskCopy(committed).ok());
+  EXPECT_EQ(Read(**overlay, 0, kSectors),
+            committed.substr(DiskCopyHeader::kHeaderLength));
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument,
+            (*overlay)->Commit(base_).status().code());
+  EXPECT_EQ(base_contents_, ReadFile(base_));
+}
+
+}  // namespace
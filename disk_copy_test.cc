@@ -1,7 +1,18 @@
 #include "disk_copy.h"
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
 #include "gmock/gmock.h"
+#include "endian.h"
 #include "gtest/gtest.h"
+#include "image_source.h"
+#include "test_images.h"
 
 TEST(DiskCopyChecksum, Rotate1Bit) {
   DiskCopyChecksum sum(0);
@@ -23,3 +34,509 @@ TEST(DiskCopyChecksum, Rotate1BitMoreComplex) {
   EXPECT_EQ(0x80001234, checksum);
   EXPECT_EQ(0x80001234, sum.Sum());
 }
+
+TEST(DiskCopyChecksum, BlockMatchesWordAtATime) {
+  std::mt19937 rng(42);
+  for (size_t size : {0, 2, 6, 8, 10, 14, 512, 1022, 4096 + 6}) {
+    std::vector<char> buf(size);
+    for (char& c : buf) c = static_cast<char>(rng());
+    const uint32_t initial = rng();
+    DiskCopyChecksum expected(initial);
+    for (size_t i = 0; i < size; i += 2) {
+      expected.UpdateSum(static_cast<uint8_t>(buf[i]) << 8 |
+                         static_cast<uint8_t>(buf[i + 1]));
+    }
+    DiskCopyChecksum block(initial);
+    EXPECT_TRUE(block.UpdateSumFromBlock(buf.data(), size).ok());
+    EXPECT_EQ(expected.Sum(), block.Sum()) << "size " << size;
+  }
+}
+
+TEST(DiskCopyChecksum, RevertUndoesUpdate) {
+  std::mt19937 rng(7);
+  std::vector<char> buf(1030);
+  for (char& c : buf) c = static_cast<char>(rng());
+  const uint32_t initial = rng();
+  DiskCopyChecksum sum(initial);
+  ASSERT_TRUE(sum.UpdateSumFromBlock(buf.data(), buf.size()).ok());
+  ASSERT_NE(initial, sum.Sum());
+  ASSERT_TRUE(sum.RevertSumFromBlock(buf.data() + 512, buf.size() - 512).ok());
+  DiskCopyChecksum head(initial);
+  ASSERT_TRUE(head.UpdateSumFromBlock(buf.data(), 512).ok());
+  EXPECT_EQ(head.Sum(), sum.Sum());
+  ASSERT_TRUE(sum.RevertSumFromBlock(buf.data(), 512).ok());
+  EXPECT_EQ(initial, sum.Sum());
+
+  DiskCopyChecksum word(0);
+  word.UpdateSum(0x2469);
+  EXPECT_EQ(0, word.RevertSum(0x2469));
+}
+
+TEST(DiskCopyChecksum, BlockRejectsOddSize) {
+  DiskCopyChecksum sum(0);
+  const char buf[3] = {1, 2, 3};
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument,
+            sum.UpdateSumFromBlock(buf, 3).code());
+  EXPECT_EQ(0, sum.Sum());
+}
+
+TEST(DiskCopyHeader, PatchDataChecksum) {
+  const std::string path = testing::TempDir() + "/patch_checksum.dc42";
+  auto header = DiskCopyHeader::CreateForHFS("Patched", 1600, 0);
+  ASSERT_TRUE(header.ok()) << header.status();
+  {
+    std::ofstream out(path, std::ios::binary);
+    ASSERT_TRUE(header->WriteToDisk(out).ok());
+    header->SetDataChecksum(0x12345678);
+    ASSERT_TRUE(header->WriteDataChecksumToDisk(out).ok());
+  }
+  auto source = OpenImageSource(path);
+  ASSERT_TRUE(source.ok()) << source.status();
+  EXPECT_EQ(DiskCopyHeader::kHeaderLength, (*source)->Size());
+  auto read_back = DiskCopyHeader::ReadFromDisk(**source);
+  ASSERT_TRUE(read_back.ok()) << read_back.status();
+  EXPECT_EQ(0x12345678, read_back->ExpectedDataChecksum());
+  EXPECT_EQ(1600 * 512, read_back->DataSize());
+}
+
+namespace {
+
+uint32_t SumOf(const char* bytes, size_t size) {
+  DiskCopyChecksum sum(0);
+  EXPECT_TRUE(sum.UpdateSumFromBlock(bytes, size).ok());
+  return sum.Sum();
+}
+
+// A DC42 file of `sectors` random sectors with 12 tag bytes each. The tag
+// checksum follows the Disk Copy convention of skipping sector 0's tags.
+std::vector<char> TaggedImage(uint32_t sectors) {
+  std::mt19937 rng(sectors);
+  const uint32_t data_size = sectors * 512;
+  const uint32_t tag_size = sectors * 12;
+  std::vector<char> file(DiskCopyHeader::kHeaderLength + data_size + tag_size);
+  for (size_t i = DiskCopyHeader::kHeaderLength; i < file.size(); ++i) {
+    file[i] = static_cast<char>(rng());
+  }
+  const char* data = file.data() + DiskCopyHeader::kHeaderLength;
+  file[0] = 4;
+  memcpy(file.data() + 1, "Lisa", 4);
+  WriteBigEndian4(data_size, file.data() + 64);
+  WriteBigEndian4(tag_size, file.data() + 68);
+  WriteBigEndian4(SumOf(data, data_size), file.data() + 72);
+  WriteBigEndian4(SumOf(data + data_size + 12, tag_size - 12),
+                  file.data() + 76);
+  file[80] = 1;
+  file[81] = 0x22;
+  WriteBigEndian2(0x100, file.data() + 82);
+  return file;
+}
+
+}  // namespace
+
+TEST(DiskCopyHeader, CreateForHardDisk) {
+  // An HD20's worth of blocks.
+  auto header = DiskCopyHeader::CreateForHFS("HD20", 40960, 0);
+  ASSERT_TRUE(header.ok()) << header.status();
+  EXPECT_EQ(20 * 1024 * 1024, header->DataSize());
+  EXPECT_EQ(3, header->DiskFormatCode());
+  EXPECT_EQ(0x22, header->FormatByteCode());
+  auto total_size = header->Validate();
+  ASSERT_TRUE(total_size.ok()) << total_size.status();
+  EXPECT_EQ(DiskCopyHeader::kHeaderLength + 20 * 1024 * 1024, *total_size);
+
+  // The largest data section the header can describe, with tags, makes a
+  // file of more than 4 GiB.
+  header = DiskCopyHeader::CreateForHFS("Big", UINT32_MAX / 512, 0, 4096);
+  ASSERT_TRUE(header.ok()) << header.status();
+  EXPECT_EQ(uint64_t{UINT32_MAX / 512} * 512 + 4096 +
+                DiskCopyHeader::kHeaderLength,
+            header->TotalFileSize());
+
+  EXPECT_FALSE(DiskCopyHeader::CreateForHFS("Odd", 2000, 0).ok());
+  EXPECT_FALSE(
+      DiskCopyHeader::CreateForHFS("Huge", UINT32_MAX / 512 + 1, 0).ok());
+}
+
+TEST(DiskCopyHeader, VerifyChecksumsOnePass) {
+  const std::vector<char> file = TaggedImage(800);
+  MemoryImageSource source(file);
+  auto header = DiskCopyHeader::ReadFromDisk(source);
+  ASSERT_TRUE(header.ok()) << header.status();
+  auto results = header->VerifyChecksums(source);
+  ASSERT_TRUE(results.ok()) << results.status();
+  EXPECT_TRUE(results->data.ok()) << results->data;
+  EXPECT_TRUE(results->tag.ok()) << results->tag;
+  EXPECT_TRUE(header->VerifyDataChecksum(source).ok());
+  EXPECT_TRUE(header->VerifyTagChecksum(source).ok());
+}
+
+TEST(DiskCopyHeader, VerifyChecksumsFromStream) {
+  // A stream source delivers the sections in chunks that straddle the
+  // boundary between data and tags.
+  const std::vector<char> file = TaggedImage(1600);
+  std::istringstream stream(std::string(file.data(), file.size()));
+  StreamImageSource source(stream);
+  auto header = DiskCopyHeader::ReadFromDisk(source);
+  ASSERT_TRUE(header.ok()) << header.status();
+  auto results = header->VerifyChecksums(source);
+  ASSERT_TRUE(results.ok()) << results.status();
+  EXPECT_TRUE(results->data.ok()) << results->data;
+  EXPECT_TRUE(results->tag.ok()) << results->tag;
+}
+
+TEST(DiskCopyHeader, VerifyChecksumsReportsBoth) {
+  std::vector<char> file = TaggedImage(800);
+  file[DiskCopyHeader::kHeaderLength + 100] ^= 1;
+  file[file.size() - 1] ^= 1;
+  MemoryImageSource source(file);
+  auto header = DiskCopyHeader::ReadFromDisk(source);
+  ASSERT_TRUE(header.ok()) << header.status();
+  auto results = header->VerifyChecksums(source);
+  ASSERT_TRUE(results.ok()) << results.status();
+  EXPECT_EQ(absl::StatusCode::kNotFound, results->data.code());
+  EXPECT_EQ(absl::StatusCode::kNotFound, results->tag.code());
+}
+
+TEST(DiskCopyHeader, VerifyTagChecksumFirstTagBytes) {
+  std::vector<char> file = TaggedImage(800);
+  // Sector 0's tags are not part of the conventional checksum.
+  file[DiskCopyHeader::kHeaderLength + 800 * 512] ^= 1;
+  MemoryImageSource source(file);
+  auto header = DiskCopyHeader::ReadFromDisk(source);
+  ASSERT_TRUE(header.ok()) << header.status();
+  EXPECT_TRUE(header->VerifyTagChecksum(source).ok());
+  EXPECT_FALSE(header->VerifyTagChecksum(source, false).ok());
+  auto results = header->VerifyChecksums(source, false);
+  ASSERT_TRUE(results.ok()) << results.status();
+  EXPECT_TRUE(results->data.ok());
+  EXPECT_FALSE(results->tag.ok());
+}
+
+TEST(DiskCopyHeader, VerifyTagChecksumWithoutTags) {
+  const std::vector<char> file(DiskCopyHeader::kHeaderLength);
+  MemoryImageSource source(file);
+  auto header = DiskCopyHeader::ReadFromDisk(source);
+  ASSERT_TRUE(header.ok()) << header.status();
+  // No tags: nothing to read, so even the empty image passes.
+  EXPECT_TRUE(header->VerifyTagChecksum(source).ok());
+}
+
+TEST(InMemory, EncodeDecodeRoundTrip) {
+  const std::vector<char> image = RandomHFSImage(1600, "Memory");
+  std::vector<char> disk_copy(DiskCopyHeader::kHeaderLength + image.size());
+  auto encoded = EncodeDiskCopy(image, absl::MakeSpan(disk_copy));
+  ASSERT_TRUE(encoded.ok()) << encoded.status();
+  EXPECT_EQ(disk_copy.size(), *encoded);
+  EXPECT_EQ(6, disk_copy[0]);
+  EXPECT_TRUE(VerifyDiskCopy(disk_copy).ok());
+
+  std::vector<char> decoded(image.size());
+  auto decoded_size = DecodeDiskCopy(disk_copy, absl::MakeSpan(decoded));
+  ASSERT_TRUE(decoded_size.ok()) << decoded_size.status();
+  EXPECT_EQ(image.size(), *decoded_size);
+  EXPECT_EQ(image, decoded);
+}
+
+TEST(InMemory, HardDiskRoundTrip) {
+  const std::vector<char> image = RandomHFSImage(40960, "Memory");
+  std::vector<char> disk_copy(DiskCopyHeader::kHeaderLength + image.size());
+  auto encoded = EncodeDiskCopy(image, absl::MakeSpan(disk_copy));
+  ASSERT_TRUE(encoded.ok()) << encoded.status();
+  EXPECT_EQ(disk_copy.size(), *encoded);
+  EXPECT_TRUE(VerifyDiskCopy(disk_copy).ok());
+
+  // Summed through a stream, in pipelined chunks, it still matches.
+  std::istringstream stream(std::string(disk_copy.begin(), disk_copy.end()));
+  StreamImageSource source(stream);
+  auto header = DiskCopyHeader::ReadFromDisk(source);
+  ASSERT_TRUE(header.ok()) << header.status();
+  EXPECT_TRUE(header->VerifyDataChecksum(source).ok());
+
+  std::vector<char> decoded(image.size());
+  auto decoded_size = DecodeDiskCopy(disk_copy, absl::MakeSpan(decoded));
+  ASSERT_TRUE(decoded_size.ok()) << decoded_size.status();
+  EXPECT_EQ(image, decoded);
+}
+
+TEST(InMemory, OutputTooSmall) {
+  const std::vector<char> image = RandomHFSImage(800, "Memory");
+  std::vector<char> disk_copy(image.size());
+  EXPECT_EQ(absl::StatusCode::kResourceExhausted,
+            EncodeDiskCopy(image, absl::MakeSpan(disk_copy)).status().code());
+  disk_copy.resize(DiskCopyHeader::kHeaderLength + image.size());
+  ASSERT_TRUE(EncodeDiskCopy(image, absl::MakeSpan(disk_copy)).ok());
+  std::vector<char> decoded(image.size() - 1);
+  EXPECT_EQ(absl::StatusCode::kResourceExhausted,
+            DecodeDiskCopy(disk_copy, absl::MakeSpan(decoded)).status().code());
+}
+
+TEST(InMemory, DecodeChecksumMismatch) {
+  const std::vector<char> image = RandomHFSImage(800, "Memory");
+  std::vector<char> disk_copy(DiskCopyHeader::kHeaderLength + image.size());
+  ASSERT_TRUE(EncodeDiskCopy(image, absl::MakeSpan(disk_copy)).ok());
+  disk_copy.back() ^= 1;
+  std::vector<char> decoded(image.size());
+  EXPECT_EQ(absl::StatusCode::kFailedPrecondition,
+            DecodeDiskCopy(disk_copy, absl::MakeSpan(decoded)).status().code());
+  EXPECT_FALSE(VerifyDiskCopy(disk_copy).ok());
+  auto ignored = DecodeDiskCopy(disk_copy, absl::MakeSpan(decoded), true);
+  ASSERT_TRUE(ignored.ok()) << ignored.status();
+  EXPECT_EQ(disk_copy.back(), decoded.back());
+}
+
+TEST(InMemory, DecodeTruncated) {
+  const std::vector<char> image = RandomHFSImage(800, "Memory");
+  std::vector<char> disk_copy(DiskCopyHeader::kHeaderLength + image.size());
+  ASSERT_TRUE(EncodeDiskCopy(image, absl::MakeSpan(disk_copy)).ok());
+  disk_copy.resize(disk_copy.size() - 512);
+  std::vector<char> decoded(image.size());
+  EXPECT_EQ(absl::StatusCode::kOutOfRange,
+            DecodeDiskCopy(disk_copy, absl::MakeSpan(decoded)).status().code());
+}
+
+TEST(InMemory, PatchMatchesReencoding) {
+  std::vector<char> image = RandomHFSImage(1600, "Memory");
+  std::vector<char> disk_copy(DiskCopyHeader::kHeaderLength + image.size());
+  ASSERT_TRUE(EncodeDiskCopy(image, absl::MakeSpan(disk_copy)).ok());
+
+  // New boot blocks, a patch straddling the 64k chunks the sum is unwound
+  // in, and the last sector.
+  const std::vector<char> boot(1024, 'b');
+  const std::vector<char> middle(600, 'm');
+  const std::vector<char> last(512, 'l');
+  const DataPatch patches[] = {{0, boot},
+                               {65536 - 100, middle},
+                               {1599 * 512, last}};
+  ASSERT_TRUE(PatchDiskCopy(absl::MakeSpan(disk_copy), patches).ok());
+  EXPECT_TRUE(VerifyDiskCopy(disk_copy).ok());
+
+  for (const DataPatch& patch : patches) {
+    std::copy(patch.bytes.begin(), patch.bytes.end(),
+              image.begin() + patch.offset);
+  }
+  std::vector<char> expected(disk_copy.size());
+  ASSERT_TRUE(EncodeDiskCopy(image, absl::MakeSpan(expected)).ok());
+  EXPECT_EQ(expected, disk_copy);
+}
+
+TEST(InMemory, PatchReadsNothingBeforeFirstPatch) {
+  std::vector<char> image = RandomHFSImage(800, "Memory");
+  std::vector<char> disk_copy(DiskCopyHeader::kHeaderLength + image.size());
+  ASSERT_TRUE(EncodeDiskCopy(image, absl::MakeSpan(disk_copy)).ok());
+  MemoryImageSource source(disk_copy);
+  auto header = DiskCopyHeader::ReadFromDisk(source);
+  ASSERT_TRUE(header.ok()) << header.status();
+
+  // Garbage before the patch does not change the answer.
+  const std::vector<char> sector(512, 's');
+  const DataPatch patch[] = {{799 * 512, sector}};
+  std::vector<char> damaged = disk_copy;
+  std::fill(damaged.begin() + DiskCopyHeader::kHeaderLength,
+            damaged.begin() + DiskCopyHeader::kHeaderLength + 799 * 512, 0);
+  MemoryImageSource damaged_source(damaged);
+  auto from_damaged =
+      header->PatchedDataChecksum(damaged_source, patch, true);
+  auto from_original = header->PatchedDataChecksum(source, patch, true);
+  ASSERT_TRUE(from_damaged.ok()) << from_damaged.status();
+  ASSERT_TRUE(from_original.ok()) << from_original.status();
+  EXPECT_EQ(*from_original, *from_damaged);
+}
+
+// A memory source that counts the bytes read from it.
+class CountingSource : public MemoryImageSource {
+ public:
+  explicit CountingSource(absl::Span<const char> bytes)
+      : MemoryImageSource(bytes) {}
+
+  absl::StatusOr<absl::Span<const char>> Read(uint64_t offset, size_t length,
+                                              char* scratch) override {
+    bytes_read += length;
+    return MemoryImageSource::Read(offset, length, scratch);
+  }
+  absl::Status ReadChunks(uint64_t offset, uint64_t length,
+                          ChunkConsumer consume) override {
+    bytes_read += length;
+    return MemoryImageSource::ReadChunks(offset, length, consume);
+  }
+
+  uint64_t bytes_read = 0;
+};
+
+TEST(InMemory, PatchSumsForwardOrUnwindsByPosition) {
+  const std::vector<char> image = RandomHFSImage(1600, "Memory");
+  std::vector<char> disk_copy(DiskCopyHeader::kHeaderLength + image.size());
+  ASSERT_TRUE(EncodeDiskCopy(image, absl::MakeSpan(disk_copy)).ok());
+  const std::vector<char> sector(512, 'p');
+  // The MDB, read once forward; sector 1500, unwound from the end if the
+  // header's checksum is trusted.
+  for (const uint32_t offset : {1024u, 1500u * 512}) {
+    for (const bool trusted : {false, true}) {
+      CountingSource source(disk_copy);
+      auto header = DiskCopyHeader::ReadFromDisk(source);
+      ASSERT_TRUE(header.ok()) << header.status();
+      source.bytes_read = 0;
+      const DataPatch patch[] = {{offset, sector}};
+      auto checksum = header->PatchedDataChecksum(source, patch, trusted);
+      ASSERT_TRUE(checksum.ok()) << checksum.status();
+
+      std::vector<char> patched = image;
+      std::copy(sector.begin(), sector.end(), patched.begin() + offset);
+      EXPECT_EQ(SumOf(patched.data(), patched.size()), *checksum) << offset;
+      const uint64_t rest = image.size() - offset;
+      EXPECT_EQ(trusted && offset >= image.size() / 2 ? 2 * rest
+                                                      : image.size(),
+                source.bytes_read)
+          << offset << " " << trusted;
+    }
+  }
+}
+
+TEST(InMemory, PatchRefusesADamagedImage) {
+  const std::vector<char> image = RandomHFSImage(1600, "Memory");
+  std::vector<char> disk_copy(DiskCopyHeader::kHeaderLength + image.size());
+  ASSERT_TRUE(EncodeDiskCopy(image, absl::MakeSpan(disk_copy)).ok());
+  // A byte changed since the checksum was written.
+  disk_copy[DiskCopyHeader::kHeaderLength + 100 * 512] ^= 1;
+  const std::vector<char> before = disk_copy;
+  const std::vector<char> sector(512, 'p');
+  for (const uint32_t offset : {1024u, 1500u * 512}) {
+    const DataPatch patch[] = {{offset, sector}};
+    EXPECT_EQ(absl::StatusCode::kDataLoss,
+              PatchDiskCopy(absl::MakeSpan(disk_copy), patch).code())
+        << offset;
+    EXPECT_EQ(before, disk_copy);
+  }
+}
+
+TEST(InMemory, PatchRejectsBadPatches) {
+  const std::vector<char> image = RandomHFSImage(800, "Memory");
+  std::vector<char> disk_copy(DiskCopyHeader::kHeaderLength + image.size());
+  ASSERT_TRUE(EncodeDiskCopy(image, absl::MakeSpan(disk_copy)).ok());
+  const std::vector<char> original = disk_copy;
+  const std::vector<char> bytes(512, 'x');
+  const absl::Span<const char> odd = absl::MakeConstSpan(bytes).first(3);
+
+  const DataPatch odd_offset[] = {{1, bytes}};
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument,
+            PatchDiskCopy(absl::MakeSpan(disk_copy), odd_offset).code());
+  const DataPatch odd_size[] = {{0, odd}};
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument,
+            PatchDiskCopy(absl::MakeSpan(disk_copy), odd_size).code());
+  const DataPatch overlapping[] = {{0, bytes}, {510, bytes}};
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument,
+            PatchDiskCopy(absl::MakeSpan(disk_copy), overlapping).code());
+  const DataPatch beyond[] = {{800 * 512 - 256, bytes}};
+  EXPECT_EQ(absl::StatusCode::kOutOfRange,
+            PatchDiskCopy(absl::MakeSpan(disk_copy), beyond).code());
+  EXPECT_EQ(original, disk_copy);
+}
+
+TEST(DiskCopyReader, SplitsChunksOfAnySize) {
+  const std::vector<char> file = TaggedImage(100);
+  const uint32_t data_size = 100 * 512;
+  for (const size_t chunk : {size_t{1}, size_t{7}, size_t{84}, size_t{4099},
+                             file.size()}) {
+    std::string data, tags;
+    DiskCopyReader reader(
+        [&data](const char* bytes, size_t size) {
+          data.append(bytes, size);
+          return absl::OkStatus();
+        },
+        [&tags](const char* bytes, size_t size) {
+          tags.append(bytes, size);
+          return absl::OkStatus();
+        });
+    EXPECT_EQ(DiskCopySection::HEADER, reader.section());
+    EXPECT_EQ(nullptr, reader.header());
+    for (size_t i = 0; i < file.size(); i += chunk) {
+      ASSERT_TRUE(reader
+                      .Feed(absl::MakeConstSpan(file).subspan(
+                          i, std::min(chunk, file.size() - i)))
+                      .ok())
+          << "chunk " << chunk << " at " << i;
+    }
+    EXPECT_EQ(DiskCopySection::END, reader.section());
+    ASSERT_NE(nullptr, reader.header());
+    EXPECT_EQ(data_size, reader.header()->DataSize());
+    auto results = reader.Finish();
+    ASSERT_TRUE(results.ok()) << results.status();
+    EXPECT_TRUE(results->Overall().ok()) << results->Overall();
+    EXPECT_EQ(std::string(file.data() + DiskCopyHeader::kHeaderLength,
+                          data_size),
+              data);
+    EXPECT_EQ(std::string(file.end() - 1200, file.end()), tags);
+  }
+}
+
+TEST(DiskCopyReader, ReportsDamageAndShortFiles) {
+  std::vector<char> file = TaggedImage(100);
+  file[DiskCopyHeader::kHeaderLength + 3] ^= 1;
+  auto ignore = [](const char*, size_t) { return absl::OkStatus(); };
+  DiskCopyReader reader(ignore, ignore);
+  ASSERT_TRUE(reader.Feed(absl::MakeConstSpan(file).first(1000)).ok());
+  EXPECT_EQ(DiskCopySection::DATA, reader.section());
+  EXPECT_EQ(absl::StatusCode::kDataLoss, reader.Finish().status().code());
+  ASSERT_TRUE(reader.Feed(absl::MakeConstSpan(file).subspan(1000)).ok());
+  auto results = reader.Finish();
+  ASSERT_TRUE(results.ok()) << results.status();
+  EXPECT_FALSE(results->data.ok());
+  EXPECT_TRUE(results->tag.ok());
+  EXPECT_EQ(absl::StatusCode::kOutOfRange,
+            reader.Feed(absl::MakeConstSpan(file).first(2)).code());
+
+  DiskCopyReader bad_header(ignore, ignore);
+  file[82] = 0;
+  EXPECT_FALSE(bad_header.Feed(file).ok());
+}
+
+TEST(DiskCopyWriter, MatchesEncodeDiskCopy) {
+  const std::vector<char> image = RandomHFSImage(800, "Memory");
+  std::vector<char> encoded(DiskCopyHeader::kHeaderLength + image.size());
+  ASSERT_TRUE(EncodeDiskCopy(image, absl::MakeSpan(encoded)).ok());
+  auto header = DiskCopyHeader::CreateForHFSImage(image);
+  ASSERT_TRUE(header.ok()) << header.status();
+
+  std::string written;
+  DiskCopyWriter writer(*header, [&written](const char* bytes, size_t size) {
+    written.append(bytes, size);
+    return absl::OkStatus();
+  });
+  EXPECT_EQ(DiskCopySection::DATA, writer.section());
+  for (size_t i = 0; i < image.size(); i += 1001) {
+    ASSERT_TRUE(writer
+                    .Feed(absl::MakeConstSpan(image).subspan(
+                        i, std::min<size_t>(1001, image.size() - i)))
+                    .ok());
+  }
+  EXPECT_EQ(DiskCopySection::END, writer.section());
+  EXPECT_EQ(absl::StatusCode::kOutOfRange,
+            writer.Feed(absl::MakeConstSpan(image).first(2)).code());
+  auto final_header = writer.Finish();
+  ASSERT_TRUE(final_header.ok()) << final_header.status();
+  final_header->WriteToBuffer(written.data());
+  EXPECT_EQ(std::string(encoded.begin(), encoded.end()), written);
+}
+
+TEST(DiskCopyWriter, SumsTagsAsDiskCopyDoes) {
+  const std::vector<char> file = TaggedImage(100);
+  MemoryImageSource source(file);
+  auto header = DiskCopyHeader::ReadFromDisk(source);
+  ASSERT_TRUE(header.ok()) << header.status();
+  std::string written;
+  DiskCopyWriter writer(*header, [&written](const char* bytes, size_t size) {
+    written.append(bytes, size);
+    return absl::OkStatus();
+  });
+  const auto sections =
+      absl::MakeConstSpan(file).subspan(DiskCopyHeader::kHeaderLength);
+  ASSERT_TRUE(writer.Feed(sections.first(51201)).ok());
+  EXPECT_EQ(DiskCopySection::TAGS, writer.section());
+  EXPECT_EQ(absl::StatusCode::kDataLoss, writer.Finish().status().code());
+  ASSERT_TRUE(writer.Feed(sections.subspan(51201)).ok());
+  auto final_header = writer.Finish();
+  ASSERT_TRUE(final_header.ok()) << final_header.status();
+  EXPECT_EQ(header->ExpectedDataChecksum(),
+            final_header->ExpectedDataChecksum());
+  EXPECT_EQ(header->ExpectedTagChecksum(), final_header->ExpectedTagChecksum());
+  EXPECT_EQ(std::string(file.begin(), file.end()), written);
+}
@@ -0,0 +1,112 @@
+#include "endian.h"
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+constexpr bool kHostBigEndian = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+constexpr size_t kVectorBytes = 16;
+
+// Copies `count` 16-bit words from `from` to `to`, swapping the bytes of
+// each. Neither need be aligned; they must not overlap.
+void CopySwapped2(const char* from, char* to, const size_t count) {
+  const size_t bytes = count * sizeof(uint16_t);
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + kVectorBytes <= bytes; i += kVectorBytes) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(to + i),
+                     _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + kVectorBytes <= bytes; i += kVectorBytes) {
+    vst1q_u8(reinterpret_cast<uint8_t*>(to + i),
+             vrev16q_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(from + i))));
+  }
+#endif
+  for (; i < bytes; i += sizeof(uint16_t)) {
+    uint16_t word;
+    memcpy(&word, from + i, sizeof(word));
+    word = ByteSwap2(word);
+    memcpy(to + i, &word, sizeof(word));
+  }
+}
+
+// As CopySwapped2, for 32-bit words.
+void CopySwapped4(const char* from, char* to, const size_t count) {
+  const size_t bytes = count * sizeof(uint32_t);
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + kVectorBytes <= bytes; i += kVectorBytes) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + i));
+    // Swap the halves of each word, then the bytes of each half.
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(to + i),
+                     _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + kVectorBytes <= bytes; i += kVectorBytes) {
+    vst1q_u8(reinterpret_cast<uint8_t*>(to + i),
+             vrev32q_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(from + i))));
+  }
+#endif
+  for (; i < bytes; i += sizeof(uint32_t)) {
+    uint32_t word;
+    memcpy(&word, from + i, sizeof(word));
+    word = ByteSwap4(word);
+    memcpy(to + i, &word, sizeof(word));
+  }
+}
+
+}  // namespace
+
+void ReadBigEndian2Array(const char* bytes, const absl::Span<uint16_t> out) {
+  if (out.empty()) return;
+  char* const to = reinterpret_cast<char*>(out.data());
+  if (kHostBigEndian) {
+    memcpy(to, bytes, out.size() * sizeof(uint16_t));
+  } else {
+    CopySwapped2(bytes, to, out.size());
+  }
+}
+
+void ReadBigEndian4Array(const char* bytes, const absl::Span<uint32_t> out) {
+  if (out.empty()) return;
+  char* const to = reinterpret_cast<char*>(out.data());
+  if (kHostBigEndian) {
+    memcpy(to, bytes, out.size() * sizeof(uint32_t));
+  } else {
+    CopySwapped4(bytes, to, out.size());
+  }
+}
+
+void WriteBigEndian2Array(const absl::Span<const uint16_t> values,
+                          char* bytes) {
+  if (values.empty()) return;
+  const char* const from = reinterpret_cast<const char*>(values.data());
+  if (kHostBigEndian) {
+    memcpy(bytes, from, values.size() * sizeof(uint16_t));
+  } else {
+    CopySwapped2(from, bytes, values.size());
+  }
+}
+
+void WriteBigEndian4Array(const absl::Span<const uint32_t> values,
+                          char* bytes) {
+  if (values.empty()) return;
+  const char* const from = reinterpret_cast<const char*>(values.data());
+  if (kHostBigEndian) {
+    memcpy(bytes, from, values.size() * sizeof(uint32_t));
+  } else {
+    CopySwapped4(from, bytes, values.size());
+  }
+}
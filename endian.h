@@ -1,25 +1,67 @@
+#ifndef __ENDIAN_H__
+#define __ENDIAN_H__
+
 // Construct big-endian numbers from bytes.
 //
+// The scalar functions are constexpr; compilers turn their shifts into one
+// load or store and a byte swap. The array functions convert whole runs of
+// words, for the parsers' hot paths.
 #include <cstdint>
 
-inline uint16_t BigEndian2(const char b[2]) {
-  const uint8_t* c = (const uint8_t*)b;
-  return c[0] << 8 | c[1];
+#include "absl/types/span.h"
+
+constexpr uint16_t ByteSwap2(const uint16_t value) {
+  return __builtin_bswap16(value);
+}
+
+constexpr uint32_t ByteSwap4(const uint32_t value) {
+  return __builtin_bswap32(value);
+}
+
+constexpr uint64_t ByteSwap8(const uint64_t value) {
+  return __builtin_bswap64(value);
+}
+
+constexpr uint16_t BigEndian2(const char b[2]) {
+  return static_cast<uint8_t>(b[0]) << 8 | static_cast<uint8_t>(b[1]);
 }
 
-inline uint32_t BigEndian4(const char b[4]) {
-  const uint8_t* c = (const uint8_t*)b;
-  return c[0] << 24 | c[1] << 16 | c[2] << 8 | c[3];
+constexpr uint32_t BigEndian4(const char b[4]) {
+  return uint32_t{static_cast<uint8_t>(b[0])} << 24 |
+         uint32_t{static_cast<uint8_t>(b[1])} << 16 |
+         uint32_t{static_cast<uint8_t>(b[2])} << 8 | static_cast<uint8_t>(b[3]);
 }
 
-inline void WriteBigEndian2(uint16_t value, char bytes[2]) {
+constexpr uint64_t BigEndian8(const char b[8]) {
+  return uint64_t{BigEndian4(b)} << 32 | BigEndian4(b + 4);
+}
+
+constexpr void WriteBigEndian2(const uint16_t value, char bytes[2]) {
   bytes[0] = value >> 8;
   bytes[1] = value & 0xff;
 }
 
-inline void WriteBigEndian4(uint32_t value, char bytes[4]) {
+constexpr void WriteBigEndian4(const uint32_t value, char bytes[4]) {
   bytes[0] = (value >> 24);
   bytes[1] = (value >> 16) & 0xff;
   bytes[2] = (value >> 8) & 0xff;
   bytes[3] = value & 0xff;
 }
+
+constexpr void WriteBigEndian8(const uint64_t value, char bytes[8]) {
+  WriteBigEndian4(value >> 32, bytes);
+  WriteBigEndian4(value & 0xffffffff, bytes + 4);
+}
+
+// Reads out.size() big-endian words from `bytes`, which need not be
+// aligned, into `out`, sixteen bytes at a time with SIMD where the target
+// has it (SSE2 or NEON).
+void ReadBigEndian2Array(const char* bytes, absl::Span<uint16_t> out);
+void ReadBigEndian4Array(const char* bytes, absl::Span<uint32_t> out);
+
+// Writes `values` as big-endian words to `bytes`, which need not be
+// aligned and must hold values.size() words.
+void WriteBigEndian2Array(absl::Span<const uint16_t> values, char* bytes);
+void WriteBigEndian4Array(absl::Span<const uint32_t> values, char* bytes);
+
+#endif  // __ENDIAN_H__
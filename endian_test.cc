@@ -1,5 +1,8 @@
 #include "endian.h"
 
+#include <cstring>
+#include <vector>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -24,3 +27,53 @@ TEST(Endian, FourBytes) {
   const uint32_t read_val = BigEndian4(b);
   EXPECT_EQ(val, read_val);
 }
+
+constexpr char kBytes[] = "\x81\x82\x83\x84\x85\x86\x87\x88";
+static_assert(BigEndian2(kBytes) == 0x8182);
+static_assert(BigEndian4(kBytes) == 0x81828384);
+static_assert(BigEndian8(kBytes) == 0x8182838485868788);
+static_assert(ByteSwap2(0x1234) == 0x3412);
+static_assert(ByteSwap4(0x12345678) == 0x78563412);
+static_assert(ByteSwap8(0x0102030405060708) == 0x0807060504030201);
+
+constexpr uint32_t RoundTrip4(const uint32_t value) {
+  char b[4] = {};
+  WriteBigEndian4(value, b);
+  return BigEndian4(b);
+}
+static_assert(RoundTrip4(0xdeadbeef) == 0xdeadbeef);
+
+// Bytes 1, 2, 3, ... from an odd address, so that no word is aligned.
+std::vector<char> CountingBytes(size_t size) {
+  std::vector<char> bytes(size + 1);
+  for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = i;
+  return bytes;
+}
+
+TEST(Endian, TwoByteArrays) {
+  for (const size_t count : {0, 1, 7, 8, 9, 33, 256}) {
+    const std::vector<char> bytes = CountingBytes(2 * count);
+    std::vector<uint16_t> words(count);
+    ReadBigEndian2Array(bytes.data() + 1, absl::MakeSpan(words));
+    for (size_t i = 0; i < count; ++i) {
+      ASSERT_EQ(BigEndian2(bytes.data() + 1 + 2 * i), words[i]) << count;
+    }
+    std::vector<char> written(2 * count + 1);
+    WriteBigEndian2Array(words, written.data() + 1);
+    EXPECT_EQ(0, memcmp(bytes.data() + 1, written.data() + 1, 2 * count));
+  }
+}
+
+TEST(Endian, FourByteArrays) {
+  for (const size_t count : {0, 1, 3, 4, 5, 17, 128}) {
+    const std::vector<char> bytes = CountingBytes(4 * count);
+    std::vector<uint32_t> words(count);
+    ReadBigEndian4Array(bytes.data() + 1, absl::MakeSpan(words));
+    for (size_t i = 0; i < count; ++i) {
+      ASSERT_EQ(BigEndian4(bytes.data() + 1 + 4 * i), words[i]) << count;
+    }
+    std::vector<char> written(4 * count + 1);
+    WriteBigEndian4Array(words, written.data() + 1);
+    EXPECT_EQ(0, memcmp(bytes.data() + 1, written.data() + 1, 4 * count));
+  }
+}
@@ -0,0 +1,88 @@
+#include "file_copy.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "absl/strings/str_format.h"
+
+absl::StatusOr<uint64_t> KernelCopyRange(const int in_fd,
+                                         const uint64_t in_offset,
+                                         const int out_fd,
+                                         const uint64_t out_offset,
+                                         const uint64_t length) {
+  uint64_t copied = 0;
+#ifdef __linux__
+  loff_t in_pos = in_offset;
+  loff_t out_pos = out_offset;
+  while (copied < length) {
+    const ssize_t n =
+        copy_file_range(in_fd, &in_pos, out_fd, &out_pos, length - copied, 0);
+    if (n > 0) {
+      copied += n;
+      continue;
+    }
+    if (n == 0) break;  // Unexpected end of input; let the caller report it.
+    if (errno == EINTR) continue;
+    if (errno == EIO || errno == ENOSPC || errno == EDQUOT ||
+        errno == EFBIG) {
+      return absl::ResourceExhaustedError(
+          absl::StrFormat("copy_file_range failed after %d bytes: %s", copied,
+                          strerror(errno)));
+    }
+    // ENOSYS, EXDEV, EINVAL, EOPNOTSUPP, ...: not possible for these files.
+    break;
+  }
+#endif
+  return copied;
+}
+
+absl::Status WriteFully(const int fd, const char* buf, const size_t length) {
+  size_t written = 0;
+  while (written < length) {
+    const ssize_t n = write(fd, buf + written, length - written);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return absl::ResourceExhaustedError(absl::StrFormat(
+          "Could not write %d bytes after %d: %s", length - written, written,
+          strerror(errno)));
+    }
+    written += n;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status WriteFullyAt(const int fd, const uint64_t offset,
+                          const char* const buf, const size_t length) {
+  size_t written = 0;
+  while (written < length) {
+    const ssize_t n =
+        pwrite(fd, buf + written, length - written, offset + written);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return absl::ResourceExhaustedError(absl::StrFormat(
+          "Could not write %d bytes at %d: %s", length - written,
+          offset + written, strerror(errno)));
+    }
+    written += n;
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<size_t> ReadFully(const int fd, const uint64_t offset,
+                                 char* const buf, const size_t length) {
+  size_t done = 0;
+  while (done < length) {
+    const ssize_t n = pread(fd, buf + done, length - done, offset + done);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return absl::DataLossError(absl::StrFormat(
+          "Could not read %d bytes at %d: %s", length - done, offset + done,
+          strerror(errno)));
+    }
+    if (n == 0) break;
+    done += n;
+  }
+  return done;
+}
@@ -0,0 +1,39 @@
+#ifndef __FILE_COPY_H__
+#define __FILE_COPY_H__
+
+// File-descriptor level helpers for moving image data between files.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+// Copies `length` bytes from offset `in_offset` of `in_fd` to offset
+// `out_offset` of `out_fd` inside the kernel, using copy_file_range(2). On
+// filesystems with reflink support (btrfs, XFS) the kernel may share the
+// extents instead of copying them.
+//
+// Returns the number of bytes copied. This is less than `length` if the
+// kernel cannot do the copy (no copy_file_range, files on different
+// filesystems, files that are not regular); the caller should copy the
+// remainder itself. Returns an error only for I/O failures.
+absl::StatusOr<uint64_t> KernelCopyRange(int in_fd, uint64_t in_offset,
+                                         int out_fd, uint64_t out_offset,
+                                         uint64_t length);
+
+// Writes all `length` bytes of `buf` to `fd`, retrying short writes.
+absl::Status WriteFully(int fd, const char* buf, size_t length);
+
+// As WriteFully, at `offset` of `fd` with pwrite(2), leaving the file
+// offset alone.
+absl::Status WriteFullyAt(int fd, uint64_t offset, const char* buf,
+                          size_t length);
+
+// Reads up to `length` bytes at `offset` of `fd` into `buf` with pread(2),
+// retrying short reads, and returns the number read: less than `length`
+// only at the end of the file.
+absl::StatusOr<size_t> ReadFully(int fd, uint64_t offset, char* buf,
+                                 size_t length);
+
+#endif  // __FILE_COPY_H__
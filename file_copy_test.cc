@@ -0,0 +1,73 @@
+#include "file_copy.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+TEST(FileCopy, KernelCopyRangeThenFinishByHand) {
+  const std::string in_path = testing::TempDir() + "/file_copy_in";
+  const std::string out_path = testing::TempDir() + "/file_copy_out";
+  std::string data(100000, '\0');
+  for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<char>(i % 253);
+  std::ofstream(in_path, std::ios::binary) << data;
+
+  const int in_fd = open(in_path.c_str(), O_RDONLY);
+  const int out_fd = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  ASSERT_GE(in_fd, 0);
+  ASSERT_GE(out_fd, 0);
+  const uint64_t kOffset = 84;
+  const uint64_t length = data.size() - kOffset;
+  auto copied = KernelCopyRange(in_fd, kOffset, out_fd, 0, length);
+  ASSERT_TRUE(copied.ok()) << copied.status();
+  ASSERT_LE(*copied, length);
+  // Whatever the kernel could not copy is the caller's job.
+  ASSERT_EQ(*copied, lseek(out_fd, *copied, SEEK_SET));
+  EXPECT_TRUE(WriteFully(out_fd, data.data() + kOffset + *copied,
+                         length - *copied)
+                  .ok());
+  close(in_fd);
+  close(out_fd);
+
+  std::ifstream out(out_path, std::ios::binary);
+  std::stringstream contents;
+  contents << out.rdbuf();
+  EXPECT_EQ(data.substr(kOffset), contents.str());
+}
+
+TEST(FileCopy, NotRegularFilesCopiesNothing) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  const std::string in_path = testing::TempDir() + "/file_copy_pipe_in";
+  std::ofstream(in_path, std::ios::binary) << "some bytes";
+  const int in_fd = open(in_path.c_str(), O_RDONLY);
+  auto copied = KernelCopyRange(in_fd, 0, fds[1], 0, 10);
+  EXPECT_TRUE(copied.ok()) << copied.status();
+  EXPECT_EQ(0, *copied);
+  close(in_fd);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(FileCopy, ReadFullyStopsAtEndOfFile) {
+  const std::string path = testing::TempDir() + "/file_copy_read";
+  std::ofstream(path, std::ios::binary) << "0123456789";
+  const int fd = open(path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  char buf[16] = {};
+  auto n = ReadFully(fd, 4, buf, 4);
+  ASSERT_TRUE(n.ok()) << n.status();
+  EXPECT_EQ(4, *n);
+  EXPECT_EQ("4567", std::string(buf, 4));
+  n = ReadFully(fd, 6, buf, sizeof(buf));
+  ASSERT_TRUE(n.ok()) << n.status();
+  EXPECT_EQ(4, *n);
+  EXPECT_EQ("6789", std::string(buf, 4));
+  close(fd);
+  EXPECT_FALSE(ReadFully(-1, 0, buf, 1).ok());
+}
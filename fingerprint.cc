@@ -0,0 +1,273 @@
+#include "fingerprint.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "endian.h"
+
+namespace {
+
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4F;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9;
+constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63;
+constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5;
+
+constexpr uint32_t kRecordMagic = 0x44434650;  // 'DCFP'
+constexpr size_t kRecordPrefixBytes = 8;
+
+inline uint64_t Rotl(const uint64_t x, const int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian loads, as XXH64 specifies, whatever the host.
+inline uint64_t Load8(const char* p) {
+  const uint8_t* b = reinterpret_cast<const uint8_t*>(p);
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; --i) v = v << 8 | b[i];
+  return v;
+}
+
+inline uint32_t Load4(const char* p) {
+  const uint8_t* b = reinterpret_cast<const uint8_t*>(p);
+  return uint32_t{b[0]} | uint32_t{b[1]} << 8 | uint32_t{b[2]} << 16 |
+         uint32_t{b[3]} << 24;
+}
+
+inline uint64_t Round(uint64_t acc, const uint64_t input) {
+  acc += input * kPrime2;
+  return Rotl(acc, 31) * kPrime1;
+}
+
+inline uint64_t Merge(const uint64_t acc, const uint64_t v) {
+  return (acc ^ Round(0, v)) * kPrime1 + kPrime4;
+}
+
+}  // namespace
+
+uint64_t Hash64(const absl::Span<const char> bytes, const uint64_t seed) {
+  const char* p = bytes.data();
+  const char* const end = p + bytes.size();
+  uint64_t h;
+  if (bytes.size() >= 32) {
+    uint64_t v1 = seed + kPrime1 + kPrime2;
+    uint64_t v2 = seed + kPrime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - kPrime1;
+    for (; end - p >= 32; p += 32) {
+      v1 = Round(v1, Load8(p));
+      v2 = Round(v2, Load8(p + 8));
+      v3 = Round(v3, Load8(p + 16));
+      v4 = Round(v4, Load8(p + 24));
+    }
+    h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+    h = Merge(h, v1);
+    h = Merge(h, v2);
+    h = Merge(h, v3);
+    h = Merge(h, v4);
+  } else {
+    h = seed + kPrime5;
+  }
+  h += bytes.size();
+  for (; end - p >= 8; p += 8) {
+    h ^= Round(0, Load8(p));
+    h = Rotl(h, 27) * kPrime1 + kPrime4;
+  }
+  if (end - p >= 4) {
+    h ^= uint64_t{Load4(p)} * kPrime1;
+    h = Rotl(h, 23) * kPrime2 + kPrime3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    h ^= static_cast<uint8_t>(*p) * kPrime5;
+    h = Rotl(h, 11) * kPrime1;
+  }
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+BlockHasher::BlockHasher(const uint32_t block_size, const uint64_t start,
+                         const uint64_t end)
+    : block_size_(block_size), start_(start), end_(std::max(start, end)) {
+  partial_.reserve(block_size_);
+}
+
+void BlockHasher::AddBlock(const char* block, const size_t size) {
+  hashes_.push_back(Hash64(absl::MakeConstSpan(block, size), block_size_));
+}
+
+absl::Status BlockHasher::Update(const char* chunk, size_t chunk_size) {
+  // Skip what precedes the range, and ignore what follows it.
+  if (position_ < start_) {
+    const size_t skip = std::min<uint64_t>(chunk_size, start_ - position_);
+    chunk += skip;
+    chunk_size -= skip;
+    position_ += skip;
+  }
+  chunk_size = std::min<uint64_t>(chunk_size, end_ - position_);
+  const uint64_t chunk_end = position_ + chunk_size;
+  while (chunk_size > 0) {
+    if (partial_.empty() && chunk_size >= block_size_) {
+      // Whole blocks are hashed where they are.
+      AddBlock(chunk, block_size_);
+      chunk += block_size_;
+      chunk_size -= block_size_;
+      continue;
+    }
+    const size_t n = std::min<size_t>(chunk_size,
+                                      block_size_ - partial_.size());
+    partial_.insert(partial_.end(), chunk, chunk + n);
+    chunk += n;
+    chunk_size -= n;
+    if (partial_.size() == block_size_) {
+      AddBlock(partial_.data(), partial_.size());
+      partial_.clear();
+    }
+  }
+  position_ = chunk_end;
+  if (position_ == end_ && !partial_.empty()) {
+    AddBlock(partial_.data(), partial_.size());
+    partial_.clear();
+  }
+  return absl::OkStatus();
+}
+
+uint64_t BlockHasher::ImageHash() const {
+  std::vector<char> bytes(8 * hashes_.size());
+  for (size_t i = 0; i < hashes_.size(); ++i) {
+    WriteBigEndian8(hashes_[i], bytes.data() + 8 * i);
+  }
+  return Hash64(bytes, block_size_);
+}
+
+absl::Status AppendFingerprint(const std::string_view index_path,
+                               const ImageFingerprint& fingerprint) {
+  if (fingerprint.path.size() > UINT16_MAX) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Image path of ", fingerprint.path.size(), " bytes is too long"));
+  }
+  const size_t n = fingerprint.path.size();
+  std::vector<char> record(kRecordPrefixBytes + 2 + n + 4 + 8 + 4 +
+                           8 * fingerprint.block_hashes.size());
+  char* p = record.data();
+  WriteBigEndian4(kRecordMagic, p);
+  WriteBigEndian4(record.size() - kRecordPrefixBytes, p + 4);
+  WriteBigEndian2(n, p + 8);
+  memcpy(p + 10, fingerprint.path.data(), n);
+  WriteBigEndian4(fingerprint.block_size, p + 10 + n);
+  WriteBigEndian8(fingerprint.image_hash, p + 14 + n);
+  WriteBigEndian4(fingerprint.block_hashes.size(), p + 22 + n);
+  for (size_t i = 0; i < fingerprint.block_hashes.size(); ++i) {
+    WriteBigEndian8(fingerprint.block_hashes[i], p + 26 + n + 8 * i);
+  }
+
+  const std::string path(index_path);
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    return absl::ResourceExhaustedError(absl::StrCat(
+        "Could not open fingerprint index '", path, "': ", strerror(errno)));
+  }
+  const ssize_t written = write(fd, record.data(), record.size());
+  const int write_errno = errno;
+  close(fd);
+  if (written != static_cast<ssize_t>(record.size())) {
+    return absl::ResourceExhaustedError(absl::StrCat(
+        "Could not append to fingerprint index '", path, "': ",
+        written < 0 ? strerror(write_errno) : "short write"));
+  }
+  return absl::OkStatus();
+}
+
+// static
+absl::StatusOr<FingerprintIndex> FingerprintIndex::Load(
+    const std::string_view index_path) {
+  std::ifstream in{std::string(index_path), std::ios::binary};
+  if (!in.good()) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open fingerprint index '", index_path, "'"));
+  }
+  const std::vector<char> file((std::istreambuf_iterator<char>(in)),
+                               std::istreambuf_iterator<char>());
+  if (in.bad()) {
+    return absl::DataLossError(
+        absl::StrCat("Error reading fingerprint index '", index_path, "'"));
+  }
+
+  // The offset in `file` of the latest record of each path.
+  std::map<std::string_view, size_t> latest;
+  size_t offset = 0;
+  while (file.size() - offset >= kRecordPrefixBytes) {
+    const char* p = file.data() + offset;
+    if (BigEndian4(p) != kRecordMagic) {
+      return absl::DataLossError(absl::StrFormat(
+          "Fingerprint index '%s' has no record at byte %d", index_path,
+          offset));
+    }
+    const uint32_t length = BigEndian4(p + 4);
+    if (file.size() - offset - kRecordPrefixBytes < length) break;
+    const uint16_t n = length >= 2 ? BigEndian2(p + 8) : 0;
+    // Path length, path, block size, image hash and block count, then the
+    // block hashes.
+    const uint64_t fixed = 2 + n + 16;
+    if (length < fixed || (length - fixed) % 8 != 0 ||
+        BigEndian4(p + 22 + n) != (length - fixed) / 8) {
+      return absl::DataLossError(absl::StrFormat(
+          "Fingerprint index '%s' has a malformed record at byte %d",
+          index_path, offset));
+    }
+    latest[std::string_view(p + 10, n)] = offset;
+    offset += kRecordPrefixBytes + length;
+  }
+
+  FingerprintIndex index;
+  for (const auto& [path, record_offset] : latest) {
+    const char* p = file.data() + record_offset;
+    const size_t n = path.size();
+    Image image{std::string(path), BigEndian4(p + 10 + n),
+                BigEndian8(p + 14 + n), index.blocks_.size(),
+                BigEndian4(p + 22 + n)};
+    absl::flat_hash_set<uint64_t> seen;
+    for (uint32_t b = 0; b < image.block_count; ++b) {
+      const uint64_t hash = BigEndian8(p + 26 + n + 8 * b);
+      index.blocks_.push_back(hash);
+      if (seen.insert(hash).second) ++index.images_per_block_[hash];
+    }
+    index.images_.push_back(std::move(image));
+  }
+  return index;
+}
+
+std::vector<std::vector<size_t>> FingerprintIndex::DuplicateImages() const {
+  std::map<std::pair<uint64_t, uint32_t>, std::vector<size_t>> by_contents;
+  for (size_t i = 0; i < images_.size(); ++i) {
+    by_contents[{images_[i].image_hash, images_[i].block_size}].push_back(i);
+  }
+  std::vector<std::vector<size_t>> groups;
+  for (auto& [contents, images] : by_contents) {
+    if (images.size() > 1) groups.push_back(std::move(images));
+  }
+  return groups;
+}
+
+uint32_t FingerprintIndex::SharedBlocks(const Image& image) const {
+  uint32_t shared = 0;
+  for (const uint64_t hash : Blocks(image)) {
+    auto it = images_per_block_.find(hash);
+    if (it != images_per_block_.end() && it->second > 1) ++shared;
+  }
+  return shared;
+}
@@ -0,0 +1,123 @@
+#ifndef __FINGERPRINT_H__
+#define __FINGERPRINT_H__
+
+// Content fingerprints of disk images: a hash of each fixed-size block of
+// the data section, kept in an on-disk index so that duplicate images, and
+// blocks shared between images, can be found across an archive.
+//
+// The index file is a sequence of records, appended one image at a time
+// (big-endian):
+//
+// offset  size  contents
+// 0       4     'DCFP'
+// 4       4     length of the rest of the record
+// 8       2     length of the image path
+// 10      n     image path
+// 10+n    4     block size in bytes
+// 14+n    8     image hash
+// 22+n    4     number of blocks
+// 26+n    8*k   block hashes
+//
+// A later record for the same path replaces earlier ones.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+
+// XXH64 of `bytes`: fast, and stable across runs, builds and hosts.
+uint64_t Hash64(absl::Span<const char> bytes, uint64_t seed = 0);
+
+// Hashes the consecutive blocks of part of a stream that arrives in chunks
+// of any size. Block hashes are seeded with the block size, so blocks of
+// different sizes never match.
+class BlockHasher {
+ public:
+  // Hashes the blocks of `block_size` bytes of stream offsets [start, end);
+  // a final partial block is hashed as it is.
+  BlockHasher(uint32_t block_size, uint64_t start, uint64_t end);
+
+  // Takes the next `chunk_size` bytes of the stream. Always OK; the status
+  // lets an Update call be an ImageSource::ChunkConsumer.
+  absl::Status Update(const char* chunk, size_t chunk_size);
+
+  uint32_t block_size() const { return block_size_; }
+  // The hashes of the blocks completed so far; once the stream has reached
+  // `end`, of all of them.
+  const std::vector<uint64_t>& Hashes() const { return hashes_; }
+  // Hash of the whole range, from the block hashes.
+  uint64_t ImageHash() const;
+
+ private:
+  void AddBlock(const char* block, size_t size);
+
+  const uint32_t block_size_;
+  const uint64_t start_;
+  const uint64_t end_;
+  uint64_t position_ = 0;
+  // Bytes of a block that straddles chunks.
+  std::vector<char> partial_;
+  std::vector<uint64_t> hashes_;
+};
+
+struct ImageFingerprint {
+  std::string path;
+  uint32_t block_size;
+  uint64_t image_hash;
+  std::vector<uint64_t> block_hashes;
+};
+
+// Appends `fingerprint` to the index file `index_path`, creating it if
+// need be. The record is written with a single O_APPEND write, so several
+// processes (or batch workers) may append to one index at once.
+absl::Status AppendFingerprint(std::string_view index_path,
+                               const ImageFingerprint& fingerprint);
+
+// An index file, read into memory.
+class FingerprintIndex {
+ public:
+  struct Image {
+    std::string path;
+    uint32_t block_size;
+    uint64_t image_hash;
+    // The image's hashes are blocks_[first_block, first_block + block_count)
+    // in Blocks(image).
+    uint64_t first_block;
+    uint32_t block_count;
+  };
+
+  // Reads the index file `index_path`. A truncated last record (from an
+  // interrupted append) is ignored; other damage is DataLoss.
+  static absl::StatusOr<FingerprintIndex> Load(std::string_view index_path);
+
+  // The latest fingerprint of each image, sorted by path.
+  absl::Span<const Image> Images() const { return images_; }
+  absl::Span<const uint64_t> Blocks(const Image& image) const {
+    return absl::MakeConstSpan(blocks_).subspan(image.first_block,
+                                                image.block_count);
+  }
+
+  // Groups of two or more images with identical contents, as indices into
+  // Images().
+  std::vector<std::vector<size_t>> DuplicateImages() const;
+  // The number of blocks of `image` that also occur in another image.
+  uint32_t SharedBlocks(const Image& image) const;
+  // The number of distinct blocks over all images: the size, in blocks, of
+  // a store holding each block once.
+  size_t DistinctBlocks() const { return images_per_block_.size(); }
+  size_t TotalBlocks() const { return blocks_.size(); }
+
+ private:
+  std::vector<Image> images_;
+  std::vector<uint64_t> blocks_;
+  // For each distinct block hash, the number of images containing it.
+  absl::flat_hash_map<uint64_t, uint32_t> images_per_block_;
+};
+
+#endif  // __FINGERPRINT_H__
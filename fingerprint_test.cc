@@ -0,0 +1,161 @@
+#include "fingerprint.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+std::vector<char> TestBytes(const size_t size) {
+  std::vector<char> bytes(size);
+  for (size_t i = 0; i < size; ++i) bytes[i] = (i * 31 + 7) & 0xff;
+  return bytes;
+}
+
+// Bytes with no repeating period, so that no two blocks are the same.
+std::vector<char> DistinctBytes(const size_t size) {
+  std::vector<char> bytes(size);
+  uint32_t x = 1;
+  for (char& c : bytes) {
+    x = x * 1103515245 + 12345;
+    c = x >> 16;
+  }
+  return bytes;
+}
+
+std::string TempIndex(const std::string& name) {
+  const std::string path = ::testing::TempDir() + "/" + name;
+  std::remove(path.c_str());
+  return path;
+}
+
+TEST(Fingerprint, Hash64KnownValues) {
+  EXPECT_EQ(Hash64({}), 0xef46db3751d8e999);
+  EXPECT_EQ(Hash64(std::string_view("a")), 0xd24ec4f1a98c6e5b);
+  EXPECT_EQ(Hash64(std::string_view("abc")), 0x44bc2cf5ad770999);
+  const std::vector<char> bytes = TestBytes(1000);
+  EXPECT_EQ(Hash64(bytes), 0x99594f4828043d35);
+  EXPECT_EQ(Hash64(absl::MakeConstSpan(bytes).first(512), 512),
+            0xce99f408034376fc);
+}
+
+TEST(Fingerprint, BlockHasherIgnoresChunking) {
+  const std::vector<char> bytes = TestBytes(3000);
+  // Blocks of [100, 2900): five whole blocks and one of 340 bytes.
+  BlockHasher whole(512, 100, 2900);
+  ASSERT_TRUE(whole.Update(bytes.data(), bytes.size()).ok());
+  ASSERT_EQ(whole.Hashes().size(), 6);
+  EXPECT_EQ(whole.Hashes()[0],
+            Hash64(absl::MakeConstSpan(bytes).subspan(100, 512), 512));
+  EXPECT_EQ(whole.Hashes()[5],
+            Hash64(absl::MakeConstSpan(bytes).subspan(2660, 240), 512));
+
+  for (const size_t chunk : {1, 7, 100, 511, 513, 2048}) {
+    BlockHasher hasher(512, 100, 2900);
+    for (size_t offset = 0; offset < bytes.size(); offset += chunk) {
+      const size_t n = std::min(chunk, bytes.size() - offset);
+      ASSERT_TRUE(hasher.Update(bytes.data() + offset, n).ok());
+    }
+    EXPECT_EQ(hasher.Hashes(), whole.Hashes()) << "chunk " << chunk;
+    EXPECT_EQ(hasher.ImageHash(), whole.ImageHash()) << "chunk " << chunk;
+  }
+}
+
+TEST(Fingerprint, BlockSizeSeedsHashes) {
+  const std::vector<char> bytes = TestBytes(1024);
+  BlockHasher small(512, 0, 1024);
+  BlockHasher large(1024, 0, 1024);
+  ASSERT_TRUE(small.Update(bytes.data(), bytes.size()).ok());
+  ASSERT_TRUE(large.Update(bytes.data(), bytes.size()).ok());
+  EXPECT_EQ(small.Hashes().size(), 2);
+  EXPECT_EQ(large.Hashes().size(), 1);
+  EXPECT_NE(small.ImageHash(), large.ImageHash());
+}
+
+ImageFingerprint Fingerprint(const std::string& path,
+                             const std::vector<char>& bytes) {
+  BlockHasher hasher(512, 0, bytes.size());
+  EXPECT_TRUE(hasher.Update(bytes.data(), bytes.size()).ok());
+  return ImageFingerprint{path, hasher.block_size(), hasher.ImageHash(),
+                          hasher.Hashes()};
+}
+
+TEST(Fingerprint, IndexFindsDuplicatesAndSharedBlocks) {
+  const std::string index_path = TempIndex("duplicates.dcfp");
+  const std::vector<char> a = DistinctBytes(2048);
+  std::vector<char> b = a;
+  b[1500] ^= 1;  // Only the third block differs.
+  std::vector<char> other(1024, 'x');
+
+  ASSERT_TRUE(AppendFingerprint(index_path, Fingerprint("b.img", b)).ok());
+  ASSERT_TRUE(AppendFingerprint(index_path, Fingerprint("a.img", a)).ok());
+  ASSERT_TRUE(
+      AppendFingerprint(index_path, Fingerprint("copy.img", a)).ok());
+  ASSERT_TRUE(
+      AppendFingerprint(index_path, Fingerprint("other.img", other)).ok());
+
+  auto index = FingerprintIndex::Load(index_path);
+  ASSERT_TRUE(index.ok()) << index.status();
+  ASSERT_EQ(index->Images().size(), 4);
+  EXPECT_EQ(index->Images()[0].path, "a.img");
+  EXPECT_EQ(index->Images()[1].path, "b.img");
+  EXPECT_EQ(index->Images()[2].path, "copy.img");
+  EXPECT_EQ(index->Images()[3].path, "other.img");
+
+  const auto duplicates = index->DuplicateImages();
+  ASSERT_EQ(duplicates.size(), 1);
+  EXPECT_EQ(duplicates[0], (std::vector<size_t>{0, 2}));
+
+  EXPECT_EQ(index->SharedBlocks(index->Images()[0]), 4);
+  EXPECT_EQ(index->SharedBlocks(index->Images()[1]), 3);
+  // The two blocks of "other" are the same, but in no other image.
+  EXPECT_EQ(index->SharedBlocks(index->Images()[3]), 0);
+  EXPECT_EQ(index->TotalBlocks(), 14);
+  EXPECT_EQ(index->DistinctBlocks(), 6);
+}
+
+TEST(Fingerprint, LaterRecordReplacesEarlier) {
+  const std::string index_path = TempIndex("replace.dcfp");
+  ASSERT_TRUE(
+      AppendFingerprint(index_path, Fingerprint("a.img", TestBytes(2048)))
+          .ok());
+  const ImageFingerprint latest = Fingerprint("a.img", TestBytes(512));
+  ASSERT_TRUE(AppendFingerprint(index_path, latest).ok());
+
+  auto index = FingerprintIndex::Load(index_path);
+  ASSERT_TRUE(index.ok()) << index.status();
+  ASSERT_EQ(index->Images().size(), 1);
+  EXPECT_EQ(index->Images()[0].image_hash, latest.image_hash);
+  EXPECT_EQ(index->TotalBlocks(), 1);
+}
+
+TEST(Fingerprint, TruncatedLastRecordIsIgnored) {
+  const std::string index_path = TempIndex("truncated.dcfp");
+  ASSERT_TRUE(
+      AppendFingerprint(index_path, Fingerprint("a.img", TestBytes(2048)))
+          .ok());
+  {
+    std::ofstream out(index_path, std::ios::binary | std::ios::app);
+    out.write("DCFP\0\0\1\0partial", 15);
+  }
+  auto index = FingerprintIndex::Load(index_path);
+  ASSERT_TRUE(index.ok()) << index.status();
+  EXPECT_EQ(index->Images().size(), 1);
+}
+
+TEST(Fingerprint, DamagedIndexIsDataLoss) {
+  const std::string index_path = TempIndex("damaged.dcfp");
+  {
+    std::ofstream out(index_path, std::ios::binary);
+    out << "not a fingerprint index";
+  }
+  EXPECT_EQ(FingerprintIndex::Load(index_path).status().code(),
+            absl::StatusCode::kDataLoss);
+  EXPECT_EQ(FingerprintIndex::Load(TempIndex("missing.dcfp")).status().code(),
+            absl::StatusCode::kNotFound);
+}
+
+}  // namespace
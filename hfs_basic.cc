@@ -1,10 +1,17 @@
 #include "hfs_basic.h"
 
-#include <fstream>
-
 #include "absl/strings/str_cat.h"
 #include "endian.h"
 
+HFSExtentRecord ReadExtentRecord(const char bytes[12]) {
+  HFSExtentRecord record;
+  for (int i = 0; i < 3; ++i) {
+    record[i].start_block = BigEndian2(bytes + 4 * i);
+    record[i].block_count = BigEndian2(bytes + 4 * i + 2);
+  }
+  return record;
+}
+
 HFSMasterDirectoryBlock::HFSMasterDirectoryBlock(
     const char mdb_bytes[kMDBBytes]) {
   signature_ = BigEndian2(mdb_bytes);
@@ -22,22 +29,35 @@ HFSMasterDirectoryBlock::HFSMasterDirectoryBlock(
   num_free_allocation_blocks_ = BigEndian2(mdb_bytes + 34);
   volume_name_length_ = mdb_bytes[36];
   memcpy(volume_name_bytes_, mdb_bytes + 37, kMaxVolumeNameLength);
+  file_count_ = BigEndian4(mdb_bytes + 84);
+  directory_count_ = BigEndian4(mdb_bytes + 88);
+  extents_file_size_ = BigEndian4(mdb_bytes + 130);
+  extents_file_extents_ = ReadExtentRecord(mdb_bytes + 134);
+  catalog_file_size_ = BigEndian4(mdb_bytes + 146);
+  catalog_file_extents_ = ReadExtentRecord(mdb_bytes + 150);
 }
 
 // static
-absl::StatusOr<HFSMasterDirectoryBlock> HFSMasterDirectoryBlock::ReadFromDisk(
-    std::ifstream& s) {
-  s.seekg(kMDBOffset);
-  if (s.fail()) {
+absl::StatusOr<HFSMasterDirectoryBlock> HFSMasterDirectoryBlock::FromBlock(
+    const absl::Span<const char> block) {
+  if (block.size() < kMDBBytes) {
     return absl::OutOfRangeError(
-        "Could not seek to HFS Master Directory Block");
+        absl::StrCat("MDB block has ", block.size(), " bytes, not ",
+                     kMDBBytes));
   }
-  char mdb_bytes[kMDBBytes];
-  if (!s.read(mdb_bytes, kMDBBytes)) {
+  return HFSMasterDirectoryBlock(block.data());
+}
+
+// static
+absl::StatusOr<HFSMasterDirectoryBlock> HFSMasterDirectoryBlock::ReadFromDisk(
+    ImageSource& s) {
+  char scratch[kMDBBytes];
+  auto mdb_bytes = s.Read(kMDBOffset, kMDBBytes, scratch);
+  if (!mdb_bytes.ok()) {
     return absl::OutOfRangeError(
         absl::StrCat("Could not read ", kMDBBytes, " bytes"));
   }
-  return HFSMasterDirectoryBlock(mdb_bytes);
+  return HFSMasterDirectoryBlock(mdb_bytes->data());
 }
 
 absl::StatusOr<std::string> HFSMasterDirectoryBlock::VolumeName() const {
@@ -1,12 +1,29 @@
+#ifndef __HFS_BASIC_H__
+#define __HFS_BASIC_H__
+
 // Very basic support for HFS floppy volumes.
-// disk_copy needs to extract the volume name from an HFS volume, but not
-// much else.
+// disk_copy needs to extract the volume name from an HFS volume, and the
+// extents of its B-tree files (see hfs_catalog.h), but not much else.
 
+#include <array>
 #include <cstdint>
 #include <string>
 
 #include "absl/status/statusor.h"
 #include "absl/strings/str_format.h"
+#include "absl/types/span.h"
+#include "image_source.h"
+
+// A run of allocation blocks. Extent records hold three, ending early at
+// the first with a zero count.
+struct HFSExtent {
+  uint16_t start_block;
+  uint16_t block_count;
+};
+using HFSExtentRecord = std::array<HFSExtent, 3>;
+
+// Parses a 12-byte big-endian extent record.
+HFSExtentRecord ReadExtentRecord(const char bytes[12]);
 
 class HFSMasterDirectoryBlock {
  public:
@@ -18,10 +35,19 @@ class HFSMasterDirectoryBlock {
   // Human readable description.
   std::string DebugString() const;
 
-  // Read MDB from a (binary-format) file stream; assumes the stream contains
-  // a raw image, seeks to the first MDB offset at byte offset 1024 (logical
-  // block 2)
-  static absl::StatusOr<HFSMasterDirectoryBlock> ReadFromDisk(std::ifstream& s);
+  // Bytes at the start of a raw image needed to read the MDB (logical blocks
+  // 0 through 2).
+  static constexpr size_t kPrefixBytes = 3 * 512;
+
+  // Read MDB from an image source; assumes the source contains a raw image,
+  // and reads from the first MDB offset at byte offset 1024 (logical block 2)
+  static absl::StatusOr<HFSMasterDirectoryBlock> ReadFromDisk(ImageSource& s);
+
+  // Logical block holding the MDB.
+  static constexpr uint32_t kMDBBlock = 2;
+  // Parse the MDB from the contents of logical block kMDBBlock.
+  static absl::StatusOr<HFSMasterDirectoryBlock> FromBlock(
+      absl::Span<const char> block);
 
   // Returns an error if the volume name cannot be extracted (has invalid
   // length). Should also check Valid() before relying on this.
@@ -31,9 +57,31 @@ class HFSMasterDirectoryBlock {
   // blocks if valid.
   absl::StatusOr<uint64_t> Valid() const;
 
+  static constexpr uint16_t kHFSBlockSize = 512;  // bytes
+
+  uint16_t num_allocation_blocks() const { return num_allocation_blocks_; }
+  uint32_t allocation_block_size() const { return allocation_block_size_; }
+  // Logical block of allocation block 0.
+  uint16_t first_allocation_block() const { return first_allocation_block_; }
+  // Logical block of the first volume bitmap block.
+  uint16_t volume_bitmap_block() const { return volume_bitmap_block_; }
+  uint16_t num_free_allocation_blocks() const {
+    return num_free_allocation_blocks_;
+  }
+  uint32_t file_count() const { return file_count_; }
+  uint32_t directory_count() const { return directory_count_; }
+  // Sizes in bytes and first extents of the B-tree files.
+  uint32_t extents_file_size() const { return extents_file_size_; }
+  const HFSExtentRecord& extents_file_extents() const {
+    return extents_file_extents_;
+  }
+  uint32_t catalog_file_size() const { return catalog_file_size_; }
+  const HFSExtentRecord& catalog_file_extents() const {
+    return catalog_file_extents_;
+  }
+
  private:
   static constexpr uint16_t kMDBBytes = 512;
-  static constexpr uint16_t kHFSBlockSize = 512;  // bytes
   static constexpr uint16_t kHFSSignature = 0x4244;
   static constexpr size_t kMaxVolumeNameLength = 27;
   // Start of MDB from start of image.
@@ -57,5 +105,13 @@ class HFSMasterDirectoryBlock {
   uint16_t num_free_allocation_blocks_;
   size_t volume_name_length_;
   char volume_name_bytes_[kMaxVolumeNameLength];
-  // Don't care about the rest.
+  uint32_t file_count_;
+  uint32_t directory_count_;
+  uint32_t extents_file_size_;
+  HFSExtentRecord extents_file_extents_;
+  uint32_t catalog_file_size_;
+  HFSExtentRecord catalog_file_extents_;
+  // Don't care about the rest (backup date, Finder info, volume cache sizes).
 };
+
+#endif  // __HFS_BASIC_H__
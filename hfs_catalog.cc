@@ -0,0 +1,472 @@
+#include "hfs_catalog.h"
+
+#include <algorithm>
+#include <array>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "endian.h"
+
+namespace {
+
+constexpr uint32_t kNodeSize = 512;
+constexpr size_t kNodeDescriptorBytes = 14;
+
+constexpr int8_t kLeafNode = -1;
+constexpr int8_t kHeaderNode = 1;
+
+// Catalog leaf record types.
+constexpr uint8_t kDirectoryRecord = 1;
+constexpr uint8_t kFileRecord = 2;
+
+constexpr size_t kDirectoryRecordBytes = 70;
+constexpr size_t kFileRecordBytes = 102;
+constexpr size_t kMaxNameLength = 31;
+
+// Sectors read at a time by ReadFork.
+constexpr uint32_t kForkReadSectors = 64;
+
+// Extents overflow fork types.
+constexpr uint8_t kDataFork = 0x00;
+constexpr uint8_t kResourceFork = 0xff;
+
+absl::Status Malformed(const std::string_view tree, const uint32_t node,
+                       const std::string_view what) {
+  return absl::DataLossError(
+      absl::StrFormat("%s B-tree node %d: %s", tree, node, what));
+}
+
+// One node of a B-tree file.
+class Node {
+ public:
+  absl::Span<char> Bytes() { return absl::MakeSpan(bytes_); }
+
+  uint32_t Forward() const { return BigEndian4(bytes_.data()); }
+  int8_t Type() const { return static_cast<int8_t>(bytes_[8]); }
+  uint16_t RecordCount() const { return BigEndian2(bytes_.data() + 10); }
+
+  // Checks that the record offsets are in order and inside the node.
+  bool Valid() const {
+    const size_t records = RecordCount();
+    if (kNodeDescriptorBytes + 2 * (records + 1) > kNodeSize) return false;
+    const size_t limit = kNodeSize - 2 * (records + 1);
+    // The offsets are stored last first, at the end of the node.
+    std::array<uint16_t, kNodeSize / 2> offsets;
+    ReadBigEndian2Array(bytes_.data() + limit,
+                        absl::MakeSpan(offsets.data(), records + 1));
+    size_t previous = kNodeDescriptorBytes;
+    // Offset `records` is that of the free space, which ends the last record.
+    for (size_t r = 0; r <= records; ++r) {
+      const size_t offset = offsets[records - r];
+      if (offset < previous || offset > limit) return false;
+      if (r > 0 && offset == previous) return false;
+      previous = offset;
+    }
+    return true;
+  }
+
+  // Record `r`, which must be < RecordCount() of a Valid() node.
+  absl::Span<const char> Record(const size_t r) const {
+    return absl::MakeConstSpan(bytes_).subspan(Offset(r),
+                                               Offset(r + 1) - Offset(r));
+  }
+
+ private:
+  size_t Offset(const size_t r) const {
+    return BigEndian2(bytes_.data() + kNodeSize - 2 * (r + 1));
+  }
+
+  std::array<char, kNodeSize> bytes_;
+};
+
+// The data of a leaf record, after its key (a length byte, then that many
+// bytes, padded to an even length).
+absl::Span<const char> RecordData(const absl::Span<const char> record) {
+  const size_t key_bytes = (static_cast<uint8_t>(record[0]) + 2) & ~size_t{1};
+  if (key_bytes >= record.size()) return absl::Span<const char>();
+  return record.subspan(key_bytes);
+}
+
+// A B-tree file: nodes in the allocation blocks of its extents.
+class BTreeFile {
+ public:
+  BTreeFile(std::string_view name, DiskCopyImage& image,
+            const HFSMasterDirectoryBlock& mdb, uint32_t size,
+            std::vector<HFSExtent> extents)
+      : name_(name),
+        image_(image),
+        mdb_(mdb),
+        node_count_(size / kNodeSize),
+        extents_(std::move(extents)) {}
+
+  std::string_view name() const { return name_; }
+  uint32_t NodeCount() const { return node_count_; }
+
+  // Reads and checks node `n`.
+  absl::Status ReadNode(const uint32_t n, Node& node) {
+    if (n >= node_count_) {
+      return Malformed(name_, n, absl::StrCat("beyond the ", node_count_,
+                                              " nodes of the file"));
+    }
+    const uint32_t sectors_per_block =
+        mdb_.allocation_block_size() / kNodeSize;
+    uint64_t block = n / sectors_per_block;
+    for (const HFSExtent& extent : extents_) {
+      if (block >= extent.block_count) {
+        block -= extent.block_count;
+        continue;
+      }
+      const uint64_t sector =
+          mdb_.first_allocation_block() +
+          (extent.start_block + block) * sectors_per_block +
+          n % sectors_per_block;
+      if (sector >= image_.SectorCount()) break;
+      auto status = image_.ReadSectors(sector, 1, node.Bytes());
+      if (!status.ok()) {
+        return status;
+      }
+      if (!node.Valid()) {
+        return Malformed(name_, n, "bad record offsets");
+      }
+      return absl::OkStatus();
+    }
+    return Malformed(name_, n, "not in the file's extents");
+  }
+
+  // Calls `visit` on each leaf record, in key order.
+  template <typename Visitor>
+  absl::Status ForEachLeafRecord(Visitor visit) {
+    if (node_count_ == 0 || mdb_.allocation_block_size() == 0) {
+      return absl::DataLossError(absl::StrCat(name_, " B-tree file is empty"));
+    }
+    Node node;
+    auto status = ReadNode(0, node);
+    if (!status.ok()) {
+      return status;
+    }
+    if (node.Type() != kHeaderNode || node.RecordCount() < 1 ||
+        node.Record(0).size() < 14) {
+      return Malformed(name_, 0, "not a header node");
+    }
+    uint32_t n = BigEndian4(node.Record(0).data() + 10);
+    // Following the forward links visits each leaf once, unless they loop.
+    std::vector<bool> visited(node_count_);
+    while (n != 0) {
+      if (n < node_count_ && visited[n]) {
+        return Malformed(name_, n, "leaf links form a cycle");
+      }
+      status = ReadNode(n, node);
+      if (!status.ok()) {
+        return status;
+      }
+      if (node.Type() != kLeafNode) {
+        return Malformed(name_, n, "not a leaf node");
+      }
+      visited[n] = true;
+      for (size_t r = 0; r < node.RecordCount(); ++r) {
+        status = visit(n, node.Record(r));
+        if (!status.ok()) {
+          return status;
+        }
+      }
+      n = node.Forward();
+    }
+    return absl::OkStatus();
+  }
+
+ private:
+  const std::string_view name_;
+  DiskCopyImage& image_;
+  const HFSMasterDirectoryBlock& mdb_;
+  const uint32_t node_count_;
+  const std::vector<HFSExtent> extents_;
+};
+
+// Appends the extents of `record` before the first empty one.
+void AppendExtents(const HFSExtentRecord& record,
+                   std::vector<HFSExtent>& extents) {
+  for (const HFSExtent& extent : record) {
+    if (extent.block_count == 0) break;
+    extents.push_back(extent);
+  }
+}
+
+uint64_t ForkKey(const uint8_t fork_type, const uint32_t file_id) {
+  return uint64_t{fork_type} << 32 | file_id;
+}
+
+}  // namespace
+
+// static
+absl::StatusOr<HFSCatalog> HFSCatalog::Read(DiskCopyImage& image) {
+  char block[DiskCopyImage::kSectorSize];
+  auto status = image.ReadSectors(HFSMasterDirectoryBlock::kMDBBlock, 1,
+                                  absl::MakeSpan(block));
+  if (!status.ok()) {
+    return status;
+  }
+  auto mdb = HFSMasterDirectoryBlock::FromBlock(block);
+  if (!mdb.ok()) {
+    return mdb.status();
+  }
+  auto volume_blocks = mdb->Valid();
+  if (!volume_blocks.ok()) {
+    return volume_blocks.status();
+  }
+  HFSCatalog catalog(*mdb);
+
+  // Overflow extents, by fork, in order. The extents file's own extents are
+  // all in the MDB.
+  absl::flat_hash_map<uint64_t, std::vector<HFSExtent>> overflow;
+  std::vector<HFSExtent> extents_file_extents;
+  AppendExtents(mdb->extents_file_extents(), extents_file_extents);
+  BTreeFile extents_file("Extents", image, catalog.mdb_,
+                         mdb->extents_file_size(),
+                         std::move(extents_file_extents));
+  status = extents_file.ForEachLeafRecord(
+      [&](const uint32_t n, const absl::Span<const char> record) {
+        // Key: length (7), fork type, file number, first allocation block of
+        // the fork that the extents continue from.
+        if (record.size() < 8 + 12 || record[0] != 7) {
+          return Malformed(extents_file.name(), n, "bad extent record");
+        }
+        const uint8_t fork_type = record[1];
+        const uint32_t file_id = BigEndian4(record.data() + 2);
+        AppendExtents(ReadExtentRecord(record.data() + 8),
+                      overflow[ForkKey(fork_type, file_id)]);
+        return absl::OkStatus();
+      });
+  if (!status.ok()) {
+    return status;
+  }
+
+  std::vector<HFSExtent> catalog_file_extents;
+  AppendExtents(mdb->catalog_file_extents(), catalog_file_extents);
+  if (auto it = overflow.find(ForkKey(kDataFork, kCatalogFileId));
+      it != overflow.end()) {
+    catalog_file_extents.insert(catalog_file_extents.end(), it->second.begin(),
+                                it->second.end());
+  }
+  BTreeFile catalog_file("Catalog", image, catalog.mdb_,
+                         mdb->catalog_file_size(),
+                         std::move(catalog_file_extents));
+
+  absl::flat_hash_map<std::string, uint32_t> interned;
+  const auto intern = [&](const std::string_view name) {
+    auto [it, inserted] =
+        interned.try_emplace(std::string(name), catalog.names_.size());
+    if (inserted) catalog.names_.append(name.data(), name.size());
+    return it->second;
+  };
+  const auto fork = [&](const char* bytes, const HFSExtentRecord& first,
+                        const uint8_t fork_type, const uint32_t file_id) {
+    Fork f{BigEndian4(bytes), BigEndian4(bytes + 4),
+           static_cast<uint32_t>(catalog.extents_.size()), 0};
+    AppendExtents(first, catalog.extents_);
+    if (auto it = overflow.find(ForkKey(fork_type, file_id));
+        it != overflow.end()) {
+      catalog.extents_.insert(catalog.extents_.end(), it->second.begin(),
+                              it->second.end());
+    }
+    f.extent_count = catalog.extents_.size() - f.first_extent;
+    return f;
+  };
+
+  status = catalog_file.ForEachLeafRecord(
+      [&](const uint32_t n, const absl::Span<const char> record) {
+        // Key: length, reserved byte, parent ID, name (a Pascal string).
+        if (record.size() < 7 || static_cast<uint8_t>(record[0]) < 6) {
+          return Malformed(catalog_file.name(), n, "bad catalog key");
+        }
+        const uint32_t parent_id = BigEndian4(record.data() + 2);
+        const size_t name_length = static_cast<uint8_t>(record[6]);
+        if (name_length > kMaxNameLength ||
+            7 + name_length > size_t{1} + static_cast<uint8_t>(record[0])) {
+          return Malformed(catalog_file.name(), n, "bad name length");
+        }
+        const absl::Span<const char> data = RecordData(record);
+        if (data.empty()) {
+          return Malformed(catalog_file.name(), n, "record has no data");
+        }
+        const uint8_t type = data[0];
+        if (type != kDirectoryRecord && type != kFileRecord) {
+          // Thread records map IDs back to names; the index has no need.
+          return absl::OkStatus();
+        }
+        if (!catalog.entries_.empty() &&
+            parent_id < catalog.entries_.back().parent_id) {
+          return Malformed(catalog_file.name(), n, "records out of order");
+        }
+        Entry entry = {};
+        entry.parent_id = parent_id;
+        entry.name_offset =
+            intern(std::string_view(record.data() + 7, name_length));
+        entry.name_length = name_length;
+        if (type == kDirectoryRecord) {
+          if (data.size() < kDirectoryRecordBytes) {
+            return Malformed(catalog_file.name(), n, "short directory record");
+          }
+          entry.directory = true;
+          entry.valence = BigEndian2(data.data() + 4);
+          entry.id = BigEndian4(data.data() + 6);
+          entry.created = BigEndian4(data.data() + 10);
+          entry.modified = BigEndian4(data.data() + 14);
+          // Finder DInfo: rectangle, then flags.
+          entry.finder_flags = BigEndian2(data.data() + 22 + 8);
+          catalog.directories_.emplace_back(entry.id, catalog.entries_.size());
+        } else {
+          if (data.size() < kFileRecordBytes) {
+            return Malformed(catalog_file.name(), n, "short file record");
+          }
+          // Finder FInfo: type, creator, flags.
+          entry.type = BigEndian4(data.data() + 4);
+          entry.creator = BigEndian4(data.data() + 8);
+          entry.finder_flags = BigEndian2(data.data() + 12);
+          entry.id = BigEndian4(data.data() + 20);
+          entry.created = BigEndian4(data.data() + 44);
+          entry.modified = BigEndian4(data.data() + 48);
+          entry.data = fork(data.data() + 26,
+                            ReadExtentRecord(data.data() + 74), kDataFork,
+                            entry.id);
+          entry.resource = fork(data.data() + 36,
+                                ReadExtentRecord(data.data() + 86),
+                                kResourceFork, entry.id);
+        }
+        catalog.entries_.push_back(entry);
+        return absl::OkStatus();
+      });
+  if (!status.ok()) {
+    return status;
+  }
+  std::sort(catalog.directories_.begin(), catalog.directories_.end());
+  return catalog;
+}
+
+absl::Span<const HFSCatalog::Entry> HFSCatalog::Children(
+    const uint32_t directory_id) const {
+  auto first = std::lower_bound(
+      entries_.begin(), entries_.end(), directory_id,
+      [](const Entry& e, uint32_t id) { return e.parent_id < id; });
+  auto last = std::upper_bound(
+      first, entries_.end(), directory_id,
+      [](uint32_t id, const Entry& e) { return id < e.parent_id; });
+  return absl::MakeConstSpan(entries_).subspan(first - entries_.begin(),
+                                               last - first);
+}
+
+const HFSCatalog::Entry* HFSCatalog::Directory(const uint32_t id) const {
+  auto it = std::lower_bound(
+      directories_.begin(), directories_.end(), id,
+      [](const std::pair<uint32_t, uint32_t>& d, uint32_t id) {
+        return d.first < id;
+      });
+  if (it == directories_.end() || it->first != id) return nullptr;
+  return &entries_[it->second];
+}
+
+std::string HFSCatalog::Path(const Entry& entry) const {
+  std::vector<const Entry*> chain;
+  const Entry* e = &entry;
+  // A directory cannot be nested deeper than there are directories; that
+  // bound stops a malformed catalog from looping.
+  while (e != nullptr && e->parent_id != kRootParentId &&
+         chain.size() <= directories_.size()) {
+    chain.push_back(e);
+    e = Directory(e->parent_id);
+  }
+  if (chain.empty()) return ":";
+  std::string path;
+  for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+    absl::StrAppend(&path, ":", Name(**it));
+  }
+  return path;
+}
+
+absl::StatusOr<const HFSCatalog::Entry*> HFSCatalog::Lookup(
+    const std::string_view path) const {
+  const absl::Span<const Entry> roots = Children(kRootParentId);
+  if (roots.empty()) {
+    return absl::NotFoundError("Catalog has no root directory");
+  }
+  const Entry* entry = &roots[0];
+  std::vector<std::string_view> names = absl::StrSplit(path, ':');
+  if (names.size() < 2) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Path '", path, "' should be :Folder:File or Volume:Folder:File"));
+  }
+  if (!names[0].empty() && !absl::EqualsIgnoreCase(names[0], Name(*entry))) {
+    return absl::NotFoundError(absl::StrCat("Volume is '", Name(*entry),
+                                            "', not '", names[0], "'"));
+  }
+  // A trailing colon names a folder, as in "Volume:" or ":Folder:".
+  if (names.back().empty()) names.pop_back();
+  for (size_t i = 1; i < names.size(); ++i) {
+    if (!entry->directory) {
+      return absl::NotFoundError(
+          absl::StrCat("'", Path(*entry), "' is not a folder"));
+    }
+    const absl::Span<const Entry> children = Children(entry->id);
+    auto it = std::find_if(
+        children.begin(), children.end(), [&](const Entry& child) {
+          return absl::EqualsIgnoreCase(Name(child), names[i]);
+        });
+    if (it == children.end()) {
+      return absl::NotFoundError(absl::StrCat("No '", names[i], "' in '",
+                                              Path(*entry), "'"));
+    }
+    entry = &*it;
+  }
+  return entry;
+}
+
+absl::Status HFSCatalog::ReadFork(DiskCopyImage& image, const Fork& fork,
+                                  ImageSource::ChunkConsumer consume) const {
+  const uint32_t sectors_per_block =
+      mdb_.allocation_block_size() / DiskCopyImage::kSectorSize;
+  uint64_t remaining = fork.logical_length;
+  std::vector<char> buffer(
+      std::min<uint64_t>(kForkReadSectors,
+                         (remaining + DiskCopyImage::kSectorSize - 1) /
+                             DiskCopyImage::kSectorSize) *
+      DiskCopyImage::kSectorSize);
+  for (const HFSExtent& extent : Extents(fork)) {
+    uint64_t sector = mdb_.first_allocation_block() +
+                      uint64_t{extent.start_block} * sectors_per_block;
+    uint64_t sectors = uint64_t{extent.block_count} * sectors_per_block;
+    while (sectors > 0 && remaining > 0) {
+      const uint32_t count = std::min<uint64_t>(
+          {sectors, kForkReadSectors,
+           (remaining + DiskCopyImage::kSectorSize - 1) /
+               DiskCopyImage::kSectorSize});
+      if (sector + count > image.SectorCount()) {
+        return absl::DataLossError(absl::StrFormat(
+            "Fork extent at sector %d is beyond the %d sectors of the image",
+            sector, image.SectorCount()));
+      }
+      auto status =
+          image.ReadSectors(sector, count, absl::MakeSpan(buffer));
+      if (!status.ok()) {
+        return status;
+      }
+      const size_t bytes = std::min<uint64_t>(
+          remaining, uint64_t{count} * DiskCopyImage::kSectorSize);
+      status = consume(buffer.data(), bytes);
+      if (!status.ok()) {
+        return status;
+      }
+      remaining -= bytes;
+      sector += count;
+      sectors -= count;
+    }
+  }
+  if (remaining > 0) {
+    return absl::DataLossError(absl::StrFormat(
+        "Fork of %d bytes has extents for only %d of them",
+        fork.logical_length, fork.logical_length - remaining));
+  }
+  return absl::OkStatus();
+}
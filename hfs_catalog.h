@@ -0,0 +1,128 @@
+#ifndef __HFS_CATALOG_H__
+#define __HFS_CATALOG_H__
+
+// The catalog of an HFS volume: every file and directory, with its fork
+// extents, read from the catalog B-tree (and the extents overflow B-tree)
+// without mounting the volume.
+//
+// Both B-trees are files of 512-byte nodes. Each node starts with a 14-byte
+// descriptor (big-endian):
+//
+// offset  size  contents
+// 0       4     next node at this level (0 = none)
+// 4       4     previous node at this level
+// 8       1     type: -1 = leaf, 0 = index, 1 = header, 2 = map
+// 9       1     height
+// 10      2     number of records
+// 12      2     reserved
+//
+// and ends with the offsets of its records, last record first, preceded by
+// the offset of its free space. Node 0 is the header node, whose first
+// record gives the first leaf node; the leaves, in key order, hold the
+// records.
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "disk_copy_image.h"
+#include "hfs_basic.h"
+#include "image_source.h"
+
+class HFSCatalog {
+ public:
+  // Parent ID of the root directory, and the root directory's ID.
+  static constexpr uint32_t kRootParentId = 1;
+  static constexpr uint32_t kRootDirectoryId = 2;
+  // File numbers of the B-tree files themselves.
+  static constexpr uint32_t kExtentsFileId = 3;
+  static constexpr uint32_t kCatalogFileId = 4;
+
+  // A data or resource fork. Its extents, including those in the extents
+  // overflow file, are Extents(fork).
+  struct Fork {
+    uint32_t logical_length;
+    uint32_t physical_length;
+    uint32_t first_extent;
+    uint32_t extent_count;
+  };
+
+  struct Entry {
+    // Directory ID or file number, and the ID of the containing directory.
+    uint32_t id;
+    uint32_t parent_id;
+    // The name is name_length bytes at name_offset in the name pool; use
+    // Name(entry).
+    uint32_t name_offset;
+    uint8_t name_length;
+    bool directory;
+    uint16_t finder_flags;
+    // File type and creator; zero for directories.
+    uint32_t type;
+    uint32_t creator;
+    // Seconds since 1904.
+    uint32_t created;
+    uint32_t modified;
+    // Number of entries in a directory; zero for files.
+    uint32_t valence;
+    // Empty for directories.
+    Fork data;
+    Fork resource;
+  };
+
+  // Reads the catalog of the HFS volume in `image` in one pass over the
+  // leaf nodes of its catalog B-tree. Fails with DataLossError if either
+  // B-tree is malformed.
+  static absl::StatusOr<HFSCatalog> Read(DiskCopyImage& image);
+
+  const HFSMasterDirectoryBlock& Volume() const { return mdb_; }
+
+  // Every file and directory, in catalog order: by parent ID, then by name.
+  absl::Span<const Entry> Entries() const { return entries_; }
+  // The entries of the directory `directory_id`.
+  absl::Span<const Entry> Children(uint32_t directory_id) const;
+  // The directory with ID `id`, or nullptr.
+  const Entry* Directory(uint32_t id) const;
+
+  // The name of `entry`, in Mac Roman.
+  std::string_view Name(const Entry& entry) const {
+    return std::string_view(names_.data() + entry.name_offset,
+                            entry.name_length);
+  }
+  // The path of `entry` from the root directory, as ":Folder:File"; the
+  // root directory itself is ":".
+  std::string Path(const Entry& entry) const;
+  absl::Span<const HFSExtent> Extents(const Fork& fork) const {
+    return absl::MakeConstSpan(extents_).subspan(fork.first_extent,
+                                                 fork.extent_count);
+  }
+
+  // The file or directory at `path`: ":Folder:File" from the root
+  // directory, or "Volume:Folder:File" naming the volume first. Names are
+  // compared ignoring (ASCII) case, as HFS does. Returns NotFound if there
+  // is no such entry.
+  absl::StatusOr<const Entry*> Lookup(std::string_view path) const;
+
+  // Passes the logical_length bytes of `fork`, in order, to `consume`,
+  // reading from `image` only the allocation blocks of its extents.
+  absl::Status ReadFork(DiskCopyImage& image, const Fork& fork,
+                        ImageSource::ChunkConsumer consume) const;
+
+ private:
+  explicit HFSCatalog(const HFSMasterDirectoryBlock& mdb) : mdb_(mdb) {}
+
+  HFSMasterDirectoryBlock mdb_;
+  std::vector<Entry> entries_;
+  // Names, each stored once however many entries have it.
+  std::string names_;
+  // The extents of all forks, each fork's contiguous.
+  std::vector<HFSExtent> extents_;
+  // (directory ID, index in entries_), sorted by ID.
+  std::vector<std::pair<uint32_t, uint32_t>> directories_;
+};
+
+#endif  // __HFS_CATALOG_H__
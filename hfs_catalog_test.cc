@@ -0,0 +1,350 @@
+#include "hfs_catalog.h"
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "disk_copy_image.h"
+#include "endian.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "image_source.h"
+#include "test_images.h"
+
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::HasSubstr;
+
+constexpr uint32_t kSectors = 1600;
+constexpr uint16_t kFirstAllocationBlock = 4;  // As WriteTestMDB has it.
+constexpr uint32_t kStartOffset = kFirstAllocationBlock * 512;
+
+// A B-tree node of `type` holding `records`.
+std::vector<char> MakeNode(int8_t type, uint32_t forward,
+                           const std::vector<std::string>& records) {
+  std::vector<char> node(512, 0);
+  WriteBigEndian4(forward, node.data());
+  node[8] = type;
+  node[9] = type == -1 ? 1 : 0;
+  WriteBigEndian2(records.size(), node.data() + 10);
+  size_t offset = 14;
+  for (size_t r = 0; r <= records.size(); ++r) {
+    WriteBigEndian2(offset, node.data() + 512 - 2 * (r + 1));
+    if (r == records.size()) break;
+    memcpy(node.data() + offset, records[r].data(), records[r].size());
+    offset += records[r].size();
+  }
+  return node;
+}
+
+std::string Big2(uint16_t v) {
+  std::string s(2, 0);
+  WriteBigEndian2(v, s.data());
+  return s;
+}
+
+std::string Big4(uint32_t v) {
+  std::string s(4, 0);
+  WriteBigEndian4(v, s.data());
+  return s;
+}
+
+std::string HeaderRecord(uint32_t first_leaf, uint32_t last_leaf,
+                         uint32_t nodes) {
+  std::string r = Big2(1) + Big4(first_leaf) + Big4(0) + Big4(first_leaf) +
+                  Big4(last_leaf) + Big2(512) + Big2(37) + Big4(nodes) +
+                  Big4(0);
+  r.resize(106, 0);
+  return r;
+}
+
+// A catalog key, padded to an even length.
+std::string CatalogKey(uint32_t parent, const std::string& name) {
+  std::string key(1, 0);
+  key += std::string(1, 0) + Big4(parent) + std::string(1, name.size()) + name;
+  key[0] = key.size() - 1;
+  if (key.size() % 2) key += std::string(1, 0);
+  return key;
+}
+
+std::string DirectoryRecord(uint32_t parent, const std::string& name,
+                            uint32_t id, uint16_t valence) {
+  std::string data(70, 0);
+  data[0] = 1;
+  WriteBigEndian2(valence, data.data() + 4);
+  WriteBigEndian4(id, data.data() + 6);
+  return CatalogKey(parent, name) + data;
+}
+
+std::string ThreadRecord(uint32_t id, uint32_t parent,
+                         const std::string& name) {
+  std::string data(46, 0);
+  data[0] = 3;
+  WriteBigEndian4(parent, data.data() + 10);
+  data[14] = name.size();
+  memcpy(data.data() + 15, name.data(), name.size());
+  return CatalogKey(id, "") + data;
+}
+
+std::string FileRecord(uint32_t parent, const std::string& name, uint32_t id,
+                       uint32_t data_length, const std::vector<HFSExtent>& ext,
+                       uint32_t resource_length) {
+  std::string data(102, 0);
+  data[0] = 2;
+  memcpy(data.data() + 4, "TEXTttxt", 8);
+  WriteBigEndian4(id, data.data() + 20);
+  WriteBigEndian4(data_length, data.data() + 26);
+  WriteBigEndian4(resource_length, data.data() + 36);
+  for (size_t i = 0; i < ext.size(); ++i) {
+    WriteBigEndian2(ext[i].start_block, data.data() + 74 + 4 * i);
+    WriteBigEndian2(ext[i].block_count, data.data() + 76 + 4 * i);
+  }
+  return CatalogKey(parent, name) + data;
+}
+
+std::string ExtentRecord(uint8_t fork, uint32_t file_id, uint16_t start,
+                         HFSExtent extent) {
+  std::string r = std::string(1, 7) + std::string(1, fork) + Big4(file_id) +
+                  Big2(start) + Big2(extent.start_block) +
+                  Big2(extent.block_count);
+  r.resize(20, 0);
+  return r;
+}
+
+// An 800K HFS volume with 512-byte allocation blocks. The extents file is
+// allocation blocks 0-1; the catalog is blocks 2-3 and, through the
+// extents file, block 10.
+class TestVolume {
+ public:
+  TestVolume() : disk_(TestHFSImage(kSectors, 0, "Test")) {
+    char* mdb = disk_.data() + 1024;
+    WriteBigEndian2(3, mdb + 14);                 // bitmap block
+    WriteBigEndian4(2 * 512, mdb + 130);          // extents file size
+    WriteBigEndian2(0, mdb + 134);
+    WriteBigEndian2(2, mdb + 136);
+    WriteBigEndian4(3 * 512, mdb + 146);          // catalog file size
+    WriteBigEndian2(2, mdb + 150);
+    WriteBigEndian2(2, mdb + 152);
+
+    PutBlock(0, MakeNode(1, 0, {HeaderRecord(1, 1, 2)}));
+    PutBlock(1, MakeNode(-1, 0,
+                         {ExtentRecord(0x00, 4, 2, {10, 1}),
+                          ExtentRecord(0x00, 21, 3, {200, 2})}));
+    PutBlock(2, MakeNode(1, 0, {HeaderRecord(1, 2, 3)}));
+    PutBlock(3, MakeNode(-1, 2,
+                         {DirectoryRecord(1, "Test", 2, 2),
+                          ThreadRecord(2, 1, "Test"),
+                          DirectoryRecord(2, "Folder", 16, 2),
+                          FileRecord(2, "ReadMe", 17, 100, {{20, 1}}, 0),
+                          ThreadRecord(16, 2, "Folder")}));
+    PutBlock(10, MakeNode(-1, 0,
+                          {FileRecord(16, "Big", 21, 2500,
+                                      {{30, 1}, {40, 1}, {50, 1}}, 300),
+                           FileRecord(16, "ReadMe", 18, 7, {{60, 1}}, 0)}));
+    // Big's data fork: blocks 30, 40 and 50, then 200 and 201 through the
+    // extents file.
+    for (size_t i = 0; i < 2500; ++i) {
+      const uint16_t blocks[] = {30, 40, 50, 200, 201};
+      Block(blocks[i / 512])[i % 512] = static_cast<char>(i * 7);
+    }
+    memcpy(Block(60), "Second\n", 7);
+  }
+
+  void PutBlock(uint16_t block, const std::vector<char>& node) {
+    memcpy(disk_.data() + kStartOffset + block * 512, node.data(), 512);
+  }
+  char* Block(uint16_t block) {
+    return disk_.data() + kStartOffset + block * 512;
+  }
+
+  std::unique_ptr<DiskCopyImage> Image() const {
+    auto image = DiskCopyImage::OpenRaw(
+        std::make_unique<MemoryImageSource>(disk_), DiskCopyImage::Options());
+    EXPECT_TRUE(image.ok()) << image.status();
+    return std::move(*image);
+  }
+
+ private:
+  std::vector<char> disk_;
+};
+
+TEST(HFSCatalog, ReadsEntriesInOnePass) {
+  TestVolume volume;
+  auto image = volume.Image();
+  auto catalog = HFSCatalog::Read(*image);
+  ASSERT_TRUE(catalog.ok()) << catalog.status();
+
+  std::vector<std::string> paths;
+  for (const auto& entry : catalog->Entries()) {
+    paths.push_back(catalog->Path(entry));
+  }
+  EXPECT_THAT(paths, ElementsAre(":", ":Folder", ":ReadMe", ":Folder:Big",
+                                 ":Folder:ReadMe"));
+  // Thread records are not entries.
+  EXPECT_EQ(catalog->Entries().size(), 5);
+
+  const HFSCatalog::Entry* folder = catalog->Directory(16);
+  ASSERT_NE(folder, nullptr);
+  EXPECT_TRUE(folder->directory);
+  EXPECT_EQ(folder->valence, 2);
+  EXPECT_EQ(catalog->Name(*folder), "Folder");
+  EXPECT_EQ(catalog->Directory(17), nullptr);  // A file.
+
+  auto children = catalog->Children(16);
+  ASSERT_EQ(children.size(), 2);
+  EXPECT_EQ(catalog->Name(children[0]), "Big");
+  EXPECT_EQ(children[0].type, 0x54455854);  // 'TEXT'
+  EXPECT_EQ(children[0].creator, 0x74747874);  // 'ttxt'
+  EXPECT_EQ(children[0].data.logical_length, 2500);
+  EXPECT_EQ(children[0].resource.logical_length, 300);
+  EXPECT_EQ(catalog->Children(2).size(), 2);
+  EXPECT_TRUE(catalog->Children(99).empty());
+}
+
+TEST(HFSCatalog, InternsNames) {
+  TestVolume volume;
+  auto image = volume.Image();
+  auto catalog = HFSCatalog::Read(*image);
+  ASSERT_TRUE(catalog.ok()) << catalog.status();
+  const auto& entries = catalog->Entries();
+  ASSERT_EQ(entries.size(), 5);
+  EXPECT_EQ(catalog->Name(entries[2]), "ReadMe");
+  EXPECT_EQ(catalog->Name(entries[4]), "ReadMe");
+  EXPECT_EQ(entries[2].name_offset, entries[4].name_offset);
+}
+
+TEST(HFSCatalog, OverflowExtents) {
+  TestVolume volume;
+  auto image = volume.Image();
+  auto catalog = HFSCatalog::Read(*image);
+  ASSERT_TRUE(catalog.ok()) << catalog.status();
+  const HFSCatalog::Entry& big = catalog->Children(16)[0];
+  std::vector<uint16_t> starts;
+  for (const HFSExtent& extent : catalog->Extents(big.data)) {
+    starts.push_back(extent.start_block);
+  }
+  EXPECT_THAT(starts, ElementsAre(30, 40, 50, 200));
+  EXPECT_TRUE(catalog->Extents(big.resource).empty());
+}
+
+TEST(HFSCatalog, NotHFS) {
+  std::vector<char> disk(size_t{kSectors} * 512, 0);
+  auto image = DiskCopyImage::OpenRaw(
+      std::make_unique<MemoryImageSource>(disk), DiskCopyImage::Options());
+  ASSERT_TRUE(image.ok()) << image.status();
+  EXPECT_EQ(HFSCatalog::Read(**image).status().code(),
+            absl::StatusCode::kFailedPrecondition);
+}
+
+TEST(HFSCatalog, LeafCycle) {
+  TestVolume volume;
+  // The second catalog leaf links back to the first.
+  WriteBigEndian4(1, volume.Block(10));
+  auto image = volume.Image();
+  auto catalog = HFSCatalog::Read(*image);
+  EXPECT_EQ(catalog.status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_THAT(catalog.status().message(), HasSubstr("cycle"));
+}
+
+TEST(HFSCatalog, BadRecordOffsets) {
+  TestVolume volume;
+  WriteBigEndian2(600, volume.Block(3) + 512 - 4);
+  auto image = volume.Image();
+  auto catalog = HFSCatalog::Read(*image);
+  EXPECT_EQ(catalog.status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_THAT(catalog.status().message(),
+              HasSubstr("Catalog B-tree node 1: bad record offsets"));
+}
+
+TEST(HFSCatalog, NodeOutsideExtents) {
+  TestVolume volume;
+  // Without its overflow extent, the catalog's node 2 has nowhere to be.
+  volume.PutBlock(1, MakeNode(-1, 0, {}));
+  auto image = volume.Image();
+  auto catalog = HFSCatalog::Read(*image);
+  EXPECT_EQ(catalog.status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_THAT(catalog.status().message(),
+              HasSubstr("node 2: not in the file's extents"));
+}
+
+TEST(HFSCatalog, Lookup) {
+  TestVolume volume;
+  auto image = volume.Image();
+  auto catalog = HFSCatalog::Read(*image);
+  ASSERT_TRUE(catalog.ok()) << catalog.status();
+
+  for (const char* path : {":Folder:ReadMe", "Test:Folder:ReadMe",
+                           ":folder:README", "test:Folder:ReadMe"}) {
+    auto entry = catalog->Lookup(path);
+    ASSERT_TRUE(entry.ok()) << path << ": " << entry.status();
+    EXPECT_EQ((*entry)->id, 18) << path;
+  }
+  auto folder = catalog->Lookup(":Folder:");
+  ASSERT_TRUE(folder.ok()) << folder.status();
+  EXPECT_EQ((*folder)->id, 16);
+  auto root = catalog->Lookup("Test:");
+  ASSERT_TRUE(root.ok()) << root.status();
+  EXPECT_EQ((*root)->id, HFSCatalog::kRootDirectoryId);
+
+  EXPECT_EQ(catalog->Lookup(":Folder:Missing").status().code(),
+            absl::StatusCode::kNotFound);
+  EXPECT_EQ(catalog->Lookup("Other:ReadMe").status().code(),
+            absl::StatusCode::kNotFound);
+  EXPECT_THAT(catalog->Lookup(":ReadMe:Inside").status().message(),
+              HasSubstr("':ReadMe' is not a folder"));
+  EXPECT_EQ(catalog->Lookup("ReadMe").status().code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(HFSCatalog, ReadForkReadsOnlyItsExtents) {
+  TestVolume volume;
+  auto image = volume.Image();
+  auto catalog = HFSCatalog::Read(*image);
+  ASSERT_TRUE(catalog.ok()) << catalog.status();
+  auto big = catalog->Lookup(":Folder:Big");
+  ASSERT_TRUE(big.ok()) << big.status();
+
+  std::string data;
+  const auto append = [&data](const char* chunk, size_t chunk_size) {
+    data.append(chunk, chunk_size);
+    return absl::OkStatus();
+  };
+  ASSERT_TRUE(catalog->ReadFork(*image, (*big)->data, append).ok());
+  ASSERT_EQ(data.size(), 2500);
+  for (size_t i = 0; i < data.size(); ++i) {
+    ASSERT_EQ(data[i], static_cast<char>(i * 7)) << i;
+  }
+
+  data.clear();
+  auto second = catalog->Lookup(":Folder:ReadMe");
+  ASSERT_TRUE(second.ok()) << second.status();
+  ASSERT_TRUE(catalog->ReadFork(*image, (*second)->data, append).ok());
+  EXPECT_EQ(data, "Second\n");
+  data.clear();
+  ASSERT_TRUE(catalog->ReadFork(*image, (*second)->resource, append).ok());
+  EXPECT_EQ(data, "");
+}
+
+TEST(HFSCatalog, ReadForkShortExtents) {
+  TestVolume volume;
+  // Claim more data than the single block of extents holds.
+  volume.PutBlock(
+      10, MakeNode(-1, 0,
+                   {FileRecord(16, "Big", 21, 2500,
+                               {{30, 1}, {40, 1}, {50, 1}}, 300),
+                    FileRecord(16, "ReadMe", 18, 700, {{60, 1}}, 0)}));
+  auto image = volume.Image();
+  auto catalog = HFSCatalog::Read(*image);
+  ASSERT_TRUE(catalog.ok()) << catalog.status();
+  auto file = catalog->Lookup(":Folder:ReadMe");
+  ASSERT_TRUE(file.ok()) << file.status();
+  auto status = catalog->ReadFork(
+      *image, (*file)->data,
+      [](const char*, size_t) { return absl::OkStatus(); });
+  EXPECT_EQ(status.code(), absl::StatusCode::kDataLoss);
+  EXPECT_THAT(status.message(), HasSubstr("only 512 of them"));
+}
+
+}  // namespace
@@ -0,0 +1,191 @@
+#include "image_source.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "chunk_reader.h"
+
+absl::Status ImageSource::CheckRange(const uint64_t offset,
+                                     const uint64_t length) const {
+  const uint64_t size = Size();
+  if (offset > size || length > size - offset) {
+    return absl::OutOfRangeError(
+        absl::StrFormat("Range of %d bytes at %d is beyond image size %d",
+                        length, offset, size));
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<absl::Span<const char>> MemoryImageSource::Read(
+    const uint64_t offset, const size_t length, char* /*scratch*/) {
+  auto range_status = CheckRange(offset, length);
+  if (!range_status.ok()) {
+    return range_status;
+  }
+  return bytes_.subspan(offset, length);
+}
+
+absl::Status MemoryImageSource::ReadChunks(const uint64_t offset,
+                                           const uint64_t length,
+                                           ChunkConsumer consume) {
+  auto range_status = CheckRange(offset, length);
+  if (!range_status.ok()) {
+    return range_status;
+  }
+  if (length == 0) return absl::OkStatus();
+  return consume(bytes_.data() + offset, length);
+}
+
+// static
+absl::StatusOr<std::unique_ptr<MappedImageSource>> MappedImageSource::Open(
+    const absl::string_view path) {
+  const std::string path_string(path);
+  const int fd = open(path_string.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return absl::NotFoundError(absl::StrCat("Could not open '", path,
+                                            "': ", strerror(errno)));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return absl::FailedPreconditionError(
+        absl::StrCat("'", path, "' is not a regular file"));
+  }
+  const size_t size = st.st_size;
+  void* mapping = nullptr;
+  if (size > 0) {
+    mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      const int mmap_errno = errno;
+      close(fd);
+      return absl::FailedPreconditionError(absl::StrCat(
+          "Could not map '", path, "': ", strerror(mmap_errno)));
+    }
+    // Checksums and copies walk the image from start to end.
+    madvise(mapping, size, MADV_SEQUENTIAL);
+  }
+  // The mapping remains valid after the descriptor is closed.
+  close(fd);
+  return std::unique_ptr<MappedImageSource>(
+      new MappedImageSource(mapping, size));
+}
+
+MappedImageSource::MappedImageSource(void* mapping, const size_t size)
+    : mapping_(mapping) {
+  bytes_ = absl::MakeConstSpan(static_cast<const char*>(mapping), size);
+}
+
+MappedImageSource::~MappedImageSource() {
+  if (mapping_ != nullptr) munmap(mapping_, bytes_.size());
+}
+
+StreamImageSource::StreamImageSource(std::istream& s)
+    : s_(s), size_(kUnknownSize), seekable_(false), position_(0) {
+  const std::streampos start = s_.tellg();
+  if (start != std::streampos(-1)) {
+    s_.seekg(0, std::ios::end);
+    const std::streamoff end = s_.tellg();
+    if (!s_.fail() && end >= 0) {
+      size_ = end;
+      seekable_ = true;
+    }
+    s_.clear();
+    s_.seekg(start);
+    position_ = static_cast<std::streamoff>(start);
+  }
+  s_.clear();
+}
+
+StreamImageSource::StreamImageSource(std::unique_ptr<std::istream> s)
+    : StreamImageSource(*s) {
+  owned_stream_ = std::move(s);
+}
+
+absl::Status StreamImageSource::Seek(const uint64_t offset) {
+  if (offset == position_) return absl::OkStatus();
+  if (seekable_) {
+    s_.clear();
+    s_.seekg(offset);
+    if (s_.fail()) {
+      return absl::OutOfRangeError(
+          absl::StrFormat("Could not seek to %d bytes", offset));
+    }
+    position_ = offset;
+    return absl::OkStatus();
+  }
+  if (offset < position_) {
+    return absl::FailedPreconditionError(absl::StrFormat(
+        "Cannot seek back to %d in a stream already at %d", offset,
+        position_));
+  }
+  s_.ignore(offset - position_);
+  if (s_.fail()) {
+    return absl::OutOfRangeError(
+        absl::StrFormat("Could not skip to %d bytes", offset));
+  }
+  position_ = offset;
+  return absl::OkStatus();
+}
+
+absl::StatusOr<absl::Span<const char>> StreamImageSource::Read(
+    const uint64_t offset, const size_t length, char* scratch) {
+  auto range_status = CheckRange(offset, length);
+  if (!range_status.ok()) {
+    return range_status;
+  }
+  auto seek_status = Seek(offset);
+  if (!seek_status.ok()) {
+    return seek_status;
+  }
+  const bool read_ok = static_cast<bool>(s_.read(scratch, length));
+  position_ += s_.gcount();
+  if (!read_ok) {
+    return absl::OutOfRangeError(
+        absl::StrFormat("Could not read %d bytes at %d", length, offset));
+  }
+  return absl::MakeConstSpan(scratch, length);
+}
+
+absl::Status StreamImageSource::ReadChunks(const uint64_t offset,
+                                           const uint64_t length,
+                                           ChunkConsumer consume) {
+  auto range_status = CheckRange(offset, length);
+  if (!range_status.ok()) {
+    return range_status;
+  }
+  auto seek_status = Seek(offset);
+  if (!seek_status.ok()) {
+    return seek_status;
+  }
+  // Whatever happens, the stream position is no longer known to be offset.
+  position_ = kUnknownSize;
+  auto status = ReadChunksPipelined(s_, length, consume);
+  if (status.ok()) position_ = offset + length;
+  return status;
+}
+
+absl::StatusOr<std::unique_ptr<ImageSource>> OpenImageSource(
+    const absl::string_view path) {
+  if (path == kStandardStreamPath) {
+    return std::make_unique<StreamImageSource>(std::cin);
+  }
+  auto mapped = MappedImageSource::Open(path);
+  if (mapped.ok()) {
+    return std::move(*mapped);
+  }
+  auto stream = std::make_unique<std::ifstream>(std::string(path),
+                                                std::ios::binary);
+  if (!stream->good()) {
+    return absl::NotFoundError(absl::StrCat("Could not open '", path, "'"));
+  }
+  return std::make_unique<StreamImageSource>(std::move(stream));
+}
@@ -0,0 +1,138 @@
+#ifndef __IMAGE_SOURCE_H__
+#define __IMAGE_SOURCE_H__
+
+// Read-only access to the bytes of a disk image file (DC42 or raw), either
+// directly from memory (a mapped file or a caller's buffer) or by copying
+// from a stream.
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+class ImageSource {
+ public:
+  using ChunkConsumer =
+      absl::FunctionRef<absl::Status(const char* chunk, size_t chunk_size)>;
+
+  // Size() of a source whose length cannot be determined in advance (a pipe);
+  // reads past its actual end fail when the read is attempted.
+  static constexpr uint64_t kUnknownSize = ~uint64_t{0};
+
+  virtual ~ImageSource() = default;
+
+  // Size of the image in bytes, or kUnknownSize.
+  virtual uint64_t Size() const = 0;
+
+  // Returns a view of `length` bytes starting at `offset`. Memory-backed
+  // sources return a view of their own memory and ignore `scratch`; others
+  // copy into `scratch`, which must hold at least `length` bytes, and return
+  // a view of it. Returns an error if the range extends beyond Size().
+  virtual absl::StatusOr<absl::Span<const char>> Read(uint64_t offset,
+                                                      size_t length,
+                                                      char* scratch) = 0;
+
+  // Calls `consume` on consecutive chunks of [offset, offset + length), in
+  // order, returning the first error. Memory-backed sources pass their own
+  // memory without copying; stream sources read ahead on a second thread.
+  virtual absl::Status ReadChunks(uint64_t offset, uint64_t length,
+                                  ChunkConsumer consume) = 0;
+
+  // The whole image as contiguous memory, if the source is memory-backed.
+  virtual std::optional<absl::Span<const char>> Contiguous() const {
+    return std::nullopt;
+  }
+
+ protected:
+  // Returns an error unless [offset, offset + length) lies within Size().
+  absl::Status CheckRange(uint64_t offset, uint64_t length) const;
+};
+
+// An image held in memory owned by the caller, which must outlive the
+// source. Safe to read from several threads at once.
+class MemoryImageSource : public ImageSource {
+ public:
+  explicit MemoryImageSource(absl::Span<const char> bytes) : bytes_(bytes) {}
+
+  uint64_t Size() const override { return bytes_.size(); }
+  absl::StatusOr<absl::Span<const char>> Read(uint64_t offset, size_t length,
+                                              char* scratch) override;
+  absl::Status ReadChunks(uint64_t offset, uint64_t length,
+                          ChunkConsumer consume) override;
+  std::optional<absl::Span<const char>> Contiguous() const override {
+    return bytes_;
+  }
+
+ protected:
+  MemoryImageSource() = default;
+
+  absl::Span<const char> bytes_;
+};
+
+// A read-only memory mapping of an image file. Safe to read from several
+// threads at once.
+class MappedImageSource : public MemoryImageSource {
+ public:
+  // Maps the file at `path`; returns an error if it cannot be opened or
+  // mapped (for example, because it is a pipe).
+  static absl::StatusOr<std::unique_ptr<MappedImageSource>> Open(
+      absl::string_view path);
+
+  MappedImageSource(const MappedImageSource&) = delete;
+  MappedImageSource& operator=(const MappedImageSource&) = delete;
+  ~MappedImageSource() override;
+
+ private:
+  MappedImageSource(void* mapping, size_t size);
+
+  void* mapping_;
+};
+
+// An image read through a std::istream, which must outlive the source. Not
+// safe for concurrent use.
+//
+// If the stream cannot seek (a pipe), Size() is kUnknownSize and reads must
+// be in increasing offset order; bytes skipped over are read and discarded.
+class StreamImageSource : public ImageSource {
+ public:
+  // Determines the stream size by seeking to its end, if possible.
+  explicit StreamImageSource(std::istream& s);
+  // As above, but the source owns the stream.
+  explicit StreamImageSource(std::unique_ptr<std::istream> s);
+
+  uint64_t Size() const override { return size_; }
+  absl::StatusOr<absl::Span<const char>> Read(uint64_t offset, size_t length,
+                                              char* scratch) override;
+  absl::Status ReadChunks(uint64_t offset, uint64_t length,
+                          ChunkConsumer consume) override;
+
+ private:
+  absl::Status Seek(uint64_t offset);
+
+  std::unique_ptr<std::istream> owned_stream_;
+  std::istream& s_;
+  uint64_t size_;
+  bool seekable_;
+  // Offset of the next byte the stream will deliver.
+  uint64_t position_;
+};
+
+// The path that names standard input (or, for commands' outputs, standard
+// output), so that images can be piped through.
+inline constexpr absl::string_view kStandardStreamPath = "-";
+
+// Opens the image file at `path`, mapping it into memory if possible and
+// otherwise reading it as a stream. kStandardStreamPath reads standard
+// input, which may be a pipe.
+absl::StatusOr<std::unique_ptr<ImageSource>> OpenImageSource(
+    absl::string_view path);
+
+#endif  // __IMAGE_SOURCE_H__
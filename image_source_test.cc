@@ -0,0 +1,76 @@
+#include "image_source.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+const std::string kBytes = "0123456789abcdefghij";
+
+// Collects ReadChunks output for comparison.
+std::string ReadAllChunks(ImageSource& s, uint64_t offset, uint64_t length) {
+  std::string result;
+  auto status = s.ReadChunks(offset, length, [&](const char* c, size_t n) {
+    result.append(c, n);
+    return absl::OkStatus();
+  });
+  EXPECT_TRUE(status.ok()) << status;
+  return result;
+}
+
+void CheckSource(ImageSource& s) {
+  EXPECT_EQ(kBytes.size(), s.Size());
+  char scratch[8];
+  auto view = s.Read(4, 6, scratch);
+  ASSERT_TRUE(view.ok()) << view.status();
+  EXPECT_EQ("456789", std::string(view->data(), view->size()));
+  EXPECT_EQ(absl::StatusCode::kOutOfRange,
+            s.Read(16, 5, scratch).status().code());
+  EXPECT_EQ("abcdefghij", ReadAllChunks(s, 10, 10));
+  EXPECT_EQ(absl::StatusCode::kOutOfRange,
+            s.ReadChunks(10, 11, [](const char*, size_t) {
+               return absl::OkStatus();
+             }).code());
+}
+
+}  // namespace
+
+TEST(ImageSource, Memory) {
+  MemoryImageSource s(kBytes);
+  CheckSource(s);
+  ASSERT_TRUE(s.Contiguous().has_value());
+  EXPECT_EQ(kBytes.data(), s.Contiguous()->data());
+}
+
+TEST(ImageSource, Stream) {
+  std::istringstream in(kBytes);
+  StreamImageSource s(in);
+  CheckSource(s);
+  EXPECT_FALSE(s.Contiguous().has_value());
+}
+
+TEST(ImageSource, MappedFile) {
+  const std::string path = testing::TempDir() + "/image_source_test.img";
+  std::ofstream(path, std::ios::binary) << kBytes;
+  auto s = MappedImageSource::Open(path);
+  ASSERT_TRUE(s.ok()) << s.status();
+  CheckSource(**s);
+
+  auto opened = OpenImageSource(path);
+  ASSERT_TRUE(opened.ok()) << opened.status();
+  EXPECT_TRUE((*opened)->Contiguous().has_value());
+}
+
+TEST(ImageSource, MissingFile) {
+  EXPECT_FALSE(OpenImageSource(testing::TempDir() + "/no/such/file").ok());
+}
+
+TEST(ImageSource, StandardInput) {
+  auto opened = OpenImageSource(kStandardStreamPath);
+  ASSERT_TRUE(opened.ok()) << opened.status();
+  EXPECT_FALSE((*opened)->Contiguous().has_value());
+}
@@ -0,0 +1,349 @@
+#include "lzhuf.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "absl/strings/str_format.h"
+
+namespace {
+
+constexpr int kWindowSize = 4096;  // N
+constexpr int kMaxMatch = 60;      // F
+// Matches no longer than this are sent as literals.
+constexpr int kThreshold = 2;
+// Literal bytes, then match lengths kThreshold + 1 through kMaxMatch.
+constexpr int kSymbols = 256 - kThreshold + kMaxMatch;
+// Size of the tree; node kRoot is the root, nodes kTableSize and up are
+// leaves.
+constexpr int kTableSize = kSymbols * 2 - 1;
+constexpr int kRoot = kTableSize - 1;
+constexpr uint16_t kMaxFrequency = 0x8000;
+
+// The upper 6 bits of a match position are sent with a fixed prefix code of
+// 3 to 8 bits, the lower 6 bits verbatim. Indexed by the next 8 bits of
+// input, the high bits they start and the length of that code.
+struct PositionCode {
+  uint8_t high[256];
+  uint8_t length[256];
+  // Indexed by the high 6 bits: the code, left-justified in a byte, and its
+  // length.
+  uint8_t code[64];
+  uint8_t code_length[64];
+
+  constexpr PositionCode() : high(), length(), code(), code_length() {
+    // Number of 8-bit prefixes each code length covers, and the number of
+    // codes of that length.
+    constexpr int kLengths[6][2] = {{3, 1}, {4, 3}, {5, 8},
+                                    {6, 12}, {7, 24}, {8, 16}};
+    int prefix = 0;
+    int h = 0;
+    for (const auto& [bits, count] : kLengths) {
+      const int span = 1 << (8 - bits);
+      for (int c = 0; c < count; ++c, ++h) {
+        code[h] = prefix;
+        code_length[h] = bits;
+        for (int i = 0; i < span; ++i, ++prefix) {
+          high[prefix] = h;
+          length[prefix] = bits;
+        }
+      }
+    }
+  }
+};
+
+constexpr PositionCode kPositionCode;
+
+// The window starts as spaces, except for the kMaxMatch bytes about to be
+// written (zeros, as in the original's static buffer).
+void InitWindow(char window[kWindowSize]) {
+  memset(window, ' ', kWindowSize - kMaxMatch);
+  memset(window + kWindowSize - kMaxMatch, 0, kMaxMatch);
+}
+
+// The adaptive Huffman tree over kSymbols symbols. Children of a node are
+// adjacent, so a node's code is the path of (index & 1) bits from the root.
+class AdaptiveHuffman {
+ public:
+  AdaptiveHuffman() {
+    for (int i = 0; i < kSymbols; ++i) {
+      frequency_[i] = 1;
+      child_[i] = i + kTableSize;
+      parent_[i + kTableSize] = i;
+    }
+    for (int i = 0, j = kSymbols; j <= kRoot; i += 2, ++j) {
+      frequency_[j] = frequency_[i] + frequency_[i + 1];
+      child_[j] = i;
+      parent_[i] = parent_[i + 1] = j;
+    }
+    frequency_[kTableSize] = 0xffff;  // sentinel for Update
+    parent_[kRoot] = 0;
+  }
+
+  // Walks from the root, taking one bit from `next_bit` per level.
+  template <typename NextBit>
+  int Decode(NextBit next_bit) {
+    int c = child_[kRoot];
+    while (c < kTableSize) {
+      c = child_[c + next_bit()];
+    }
+    c -= kTableSize;
+    Update(c);
+    return c;
+  }
+
+  // Calls `put_bit` on the code for `symbol`, root first.
+  template <typename PutBit>
+  void Encode(const int symbol, PutBit put_bit) {
+    // Codes are at most kSymbols bits long, but are collected leaf first.
+    bool path[kSymbols];
+    int length = 0;
+    for (int k = parent_[symbol + kTableSize]; k != kRoot; k = parent_[k]) {
+      path[length++] = k & 1;
+    }
+    // The edge into the root's children is the last one collected.
+    while (length > 0) put_bit(path[--length]);
+    Update(symbol);
+  }
+
+ private:
+  // Halves the frequencies and rebuilds the tree.
+  void Rebuild() {
+    int j = 0;
+    for (int i = 0; i < kTableSize; ++i) {
+      if (child_[i] >= kTableSize) {
+        frequency_[j] = (frequency_[i] + 1) / 2;
+        child_[j] = child_[i];
+        ++j;
+      }
+    }
+    for (int i = 0, j = kSymbols; j < kTableSize; i += 2, ++j) {
+      const uint16_t f = frequency_[i] + frequency_[i + 1];
+      frequency_[j] = f;
+      int k = j - 1;
+      while (f < frequency_[k]) --k;
+      ++k;
+      const size_t moved = j - k;
+      memmove(&frequency_[k + 1], &frequency_[k],
+              moved * sizeof(frequency_[0]));
+      frequency_[k] = f;
+      memmove(&child_[k + 1], &child_[k], moved * sizeof(child_[0]));
+      child_[k] = i;
+    }
+    for (int i = 0; i < kTableSize; ++i) {
+      const int k = child_[i];
+      if (k >= kTableSize) {
+        parent_[k] = i;
+      } else {
+        parent_[k] = parent_[k + 1] = i;
+      }
+    }
+  }
+
+  // Counts one more `symbol`, keeping frequencies in increasing order.
+  void Update(const int symbol) {
+    if (frequency_[kRoot] == kMaxFrequency) Rebuild();
+    int c = parent_[symbol + kTableSize];
+    do {
+      const uint16_t k = ++frequency_[c];
+      int l = c + 1;
+      if (k > frequency_[l]) {
+        while (k > frequency_[++l]) {
+        }
+        --l;
+        frequency_[c] = frequency_[l];
+        frequency_[l] = k;
+
+        const int i = child_[c];
+        parent_[i] = l;
+        if (i < kTableSize) parent_[i + 1] = l;
+
+        const int j = child_[l];
+        child_[l] = i;
+        parent_[j] = c;
+        if (j < kTableSize) parent_[j + 1] = c;
+        child_[c] = j;
+
+        c = l;
+      }
+    } while ((c = parent_[c]) != 0);
+  }
+
+  uint16_t frequency_[kTableSize + 1];
+  // Parents of nodes, then of leaves (at kTableSize + symbol).
+  int parent_[kTableSize + kSymbols];
+  // Left child of each node; leaves are kTableSize + symbol.
+  int child_[kTableSize];
+};
+
+// MSB-first bit reader. Like the original, it reads zeros past the end of
+// its input; `overrun` counts how many bytes it made up.
+class BitReader {
+ public:
+  explicit BitReader(absl::Span<const char> in) : in_(in) {}
+
+  int Bit() {
+    Fill();
+    const int bit = buffer_ >> 15;
+    buffer_ <<= 1;
+    --buffered_;
+    return bit;
+  }
+
+  int Byte() {
+    Fill();
+    const int byte = buffer_ >> 8;
+    buffer_ <<= 8;
+    buffered_ -= 8;
+    return byte;
+  }
+
+  size_t overrun() const { return overrun_; }
+
+ private:
+  void Fill() {
+    while (buffered_ <= 8) {
+      uint8_t byte = 0;
+      if (next_ < in_.size()) {
+        byte = in_[next_++];
+      } else {
+        ++overrun_;
+      }
+      buffer_ |= byte << (8 - buffered_);
+      buffered_ += 8;
+    }
+  }
+
+  absl::Span<const char> in_;
+  size_t next_ = 0;
+  size_t overrun_ = 0;
+  uint16_t buffer_ = 0;
+  int buffered_ = 0;
+};
+
+class BitWriter {
+ public:
+  explicit BitWriter(std::vector<char>& out) : out_(out) {}
+  ~BitWriter() {
+    if (count_ > 0) out_.push_back(static_cast<char>(byte_ << (8 - count_)));
+  }
+
+  void Bit(const bool bit) {
+    byte_ = byte_ << 1 | bit;
+    if (++count_ == 8) {
+      out_.push_back(static_cast<char>(byte_));
+      byte_ = 0;
+      count_ = 0;
+    }
+  }
+
+  // The low `count` bits of `value`, most significant first.
+  void Bits(const unsigned value, int count) {
+    while (count-- > 0) Bit((value >> count) & 1);
+  }
+
+ private:
+  std::vector<char>& out_;
+  uint8_t byte_ = 0;
+  int count_ = 0;
+};
+
+}  // namespace
+
+absl::Status LzhufDecode(const absl::Span<const char> in,
+                         const absl::Span<char> out) {
+  AdaptiveHuffman huffman;
+  BitReader bits(in);
+  char window[kWindowSize];
+  InitWindow(window);
+  int r = kWindowSize - kMaxMatch;
+  size_t count = 0;
+  while (count < out.size()) {
+    const int c = huffman.Decode([&bits] { return bits.Bit(); });
+    if (c < 256) {
+      out[count++] = window[r] = static_cast<char>(c);
+      r = (r + 1) & (kWindowSize - 1);
+    } else {
+      int prefix = bits.Byte();
+      const int high = kPositionCode.high[prefix];
+      for (int j = kPositionCode.length[prefix] - 2; j > 0; --j) {
+        prefix = (prefix << 1) | bits.Bit();
+      }
+      const int position = high << 6 | (prefix & 0x3f);
+      const int start = (r - position - 1) & (kWindowSize - 1);
+      const size_t length = c - 255 + kThreshold;
+      if (length > out.size() - count) {
+        return absl::DataLossError(absl::StrFormat(
+            "LZH match of %d bytes runs past the end of the %d byte output",
+            length, out.size()));
+      }
+      for (size_t k = 0; k < length; ++k) {
+        out[count++] = window[r] = window[(start + k) & (kWindowSize - 1)];
+        r = (r + 1) & (kWindowSize - 1);
+      }
+    }
+    // The reader looks ahead up to two bytes; more than that means the
+    // input ran out.
+    if (bits.overrun() > 2) {
+      return absl::DataLossError(absl::StrFormat(
+          "LZH input of %d bytes ended after %d of %d output bytes",
+          in.size(), count, out.size()));
+    }
+  }
+  return absl::OkStatus();
+}
+
+std::vector<char> LzhufEncode(const absl::Span<const char> in) {
+  std::vector<char> out;
+  {
+    AdaptiveHuffman huffman;
+    BitWriter bits(out);
+    auto put_bit = [&bits](bool bit) { bits.Bit(bit); };
+    char window[kWindowSize];
+    InitWindow(window);
+    int r = kWindowSize - kMaxMatch;
+    // The decoder's window: positions from r onward that a match overwrites
+    // as it is copied hold the bytes being copied.
+    auto window_byte = [&](const size_t p, const int at, const int k) {
+      const int ahead = (at - r) & (kWindowSize - 1);
+      return ahead < k ? in[p + ahead] : window[at];
+    };
+    for (size_t p = 0; p < in.size();) {
+      const int max_length = std::min<size_t>(kMaxMatch, in.size() - p);
+      int best_length = 0;
+      int best_start = 0;
+      for (int distance = 1;
+           distance < kWindowSize && best_length < max_length; ++distance) {
+        const int start = (r - distance) & (kWindowSize - 1);
+        int length = 0;
+        while (length < max_length &&
+               window_byte(p, (start + length) & (kWindowSize - 1), length) ==
+                   in[p + length]) {
+          ++length;
+        }
+        if (length > best_length) {
+          best_length = length;
+          best_start = start;
+        }
+      }
+      int length = 1;
+      if (best_length > kThreshold) {
+        length = best_length;
+        huffman.Encode(255 - kThreshold + length, put_bit);
+        const int position = (r - best_start - 1) & (kWindowSize - 1);
+        const int high = position >> 6;
+        const int code_length = kPositionCode.code_length[high];
+        bits.Bits(kPositionCode.code[high] >> (8 - code_length), code_length);
+        bits.Bits(position & 0x3f, 6);
+      } else {
+        huffman.Encode(static_cast<uint8_t>(in[p]), put_bit);
+      }
+      for (int k = 0; k < length; ++k) {
+        window[r] = in[p + k];
+        r = (r + 1) & (kWindowSize - 1);
+      }
+      p += length;
+    }
+  }
+  return out;
+}
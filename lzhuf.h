@@ -0,0 +1,25 @@
+#ifndef __LZHUF_H__
+#define __LZHUF_H__
+
+// LZHUF, the LZSS plus adaptive Huffman coder of Haruyasu Yoshizaki and
+// Haruhiko Okumura (1988), with its original parameters: a 4096-byte window
+// initially filled with spaces, matches of 3 to 60 bytes. DART's "best"
+// compression is LZHUF applied to each block separately.
+
+#include <cstddef>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/types/span.h"
+
+// Decodes the LZHUF stream `in` until exactly out.size() bytes have been
+// written to `out`. Returns an error if `in` runs out first. Uses a fixed
+// amount of memory and no allocation.
+absl::Status LzhufDecode(absl::Span<const char> in, absl::Span<char> out);
+
+// Encodes `in` as an LZHUF stream that LzhufDecode(…, in.size()) decodes.
+// A straightforward greedy encoder, for producing test data and small
+// images; it is not tuned for speed.
+std::vector<char> LzhufEncode(absl::Span<const char> in);
+
+#endif  // __LZHUF_H__
@@ -0,0 +1,60 @@
+#include "lzhuf.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+void ExpectRoundTrip(const std::vector<char>& in) {
+  const std::vector<char> encoded = LzhufEncode(in);
+  std::vector<char> decoded(in.size());
+  auto status = LzhufDecode(encoded, absl::MakeSpan(decoded));
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(in, decoded);
+}
+
+TEST(Lzhuf, RoundTripText) {
+  const std::string text =
+      "It was the best of times, it was the worst of times, it was the age "
+      "of wisdom, it was the age of foolishness...";
+  ExpectRoundTrip(std::vector<char>(text.begin(), text.end()));
+}
+
+TEST(Lzhuf, RoundTripRandom) {
+  std::mt19937 rng(7);
+  std::vector<char> in(20960);
+  for (char& c : in) c = static_cast<char>(rng());
+  ExpectRoundTrip(in);
+}
+
+TEST(Lzhuf, RoundTripDiskLike) {
+  // Mostly zeros with some repeated structure, like a freshly formatted
+  // disk; long enough for the frequencies to be rescaled.
+  std::mt19937 rng(11);
+  std::vector<char> in(200000, 0);
+  for (size_t i = 0; i < in.size(); i += 512) {
+    for (size_t j = 0; j < 16; ++j) in[i + j] = static_cast<char>(rng() % 4);
+  }
+  const std::vector<char> encoded = LzhufEncode(in);
+  EXPECT_LT(encoded.size(), in.size() / 10);
+  std::vector<char> decoded(in.size());
+  ASSERT_TRUE(LzhufDecode(encoded, absl::MakeSpan(decoded)).ok());
+  EXPECT_EQ(in, decoded);
+}
+
+TEST(Lzhuf, TruncatedInput) {
+  std::mt19937 rng(3);
+  std::vector<char> in(4096);
+  for (char& c : in) c = static_cast<char>(rng());
+  std::vector<char> encoded = LzhufEncode(in);
+  encoded.resize(encoded.size() / 2);
+  std::vector<char> decoded(in.size());
+  EXPECT_EQ(absl::StatusCode::kDataLoss,
+            LzhufDecode(encoded, absl::MakeSpan(decoded)).code());
+}
+
+}  // namespace
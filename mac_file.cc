@@ -0,0 +1,92 @@
+#include "mac_file.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "endian.h"
+
+namespace {
+
+constexpr size_t kMaxMacBinaryName = 63;
+constexpr uint8_t kMacBinaryIIVersion = 129;
+
+constexpr uint32_t kAppleDoubleMagic = 0x00051607;
+constexpr uint32_t kAppleDoubleVersion = 0x00020000;
+constexpr uint32_t kDatesEntry = 8;
+constexpr uint32_t kFinderInfoEntry = 9;
+constexpr uint32_t kResourceForkEntry = 2;
+constexpr size_t kDatesBytes = 16;
+constexpr size_t kFinderInfoBytes = 32;
+
+// AppleDouble dates count seconds from 2000 rather than 1904.
+constexpr uint32_t kSeconds1904To2000 = 3029529600u;
+constexpr uint32_t kUnknownDate = 0x80000000u;
+
+}  // namespace
+
+uint16_t MacBinaryCrc(const absl::Span<const char> bytes) {
+  uint16_t crc = 0;
+  for (const char c : bytes) {
+    crc ^= static_cast<uint8_t>(c) << 8;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+std::array<char, kMacBinaryHeaderBytes> MacBinaryHeader(
+    const MacFileInfo& info) {
+  std::array<char, kMacBinaryHeaderBytes> header = {};
+  const size_t name_length = std::min(info.name.size(), kMaxMacBinaryName);
+  header[1] = name_length;
+  memcpy(header.data() + 2, info.name.data(), name_length);
+  WriteBigEndian4(info.type, header.data() + 65);
+  WriteBigEndian4(info.creator, header.data() + 69);
+  // MacBinary I had room for only the high byte of the Finder flags.
+  header[73] = info.finder_flags >> 8;
+  WriteBigEndian4(info.data_length, header.data() + 83);
+  WriteBigEndian4(info.resource_length, header.data() + 87);
+  WriteBigEndian4(info.created, header.data() + 91);
+  WriteBigEndian4(info.modified, header.data() + 95);
+  header[101] = info.finder_flags & 0xff;
+  header[122] = kMacBinaryIIVersion;
+  header[123] = kMacBinaryIIVersion;
+  WriteBigEndian2(MacBinaryCrc(absl::MakeConstSpan(header.data(), 124)),
+                  header.data() + 124);
+  return header;
+}
+
+std::vector<char> AppleDoubleHeader(const MacFileInfo& info) {
+  constexpr size_t kEntries = 3;
+  constexpr size_t kDatesOffset = 26 + 12 * kEntries;
+  constexpr size_t kFinderInfoOffset = kDatesOffset + kDatesBytes;
+  constexpr size_t kResourceOffset = kFinderInfoOffset + kFinderInfoBytes;
+  std::vector<char> header(kResourceOffset, 0);
+  WriteBigEndian4(kAppleDoubleMagic, header.data());
+  WriteBigEndian4(kAppleDoubleVersion, header.data() + 4);
+  WriteBigEndian2(kEntries, header.data() + 24);
+  const uint32_t entries[kEntries][3] = {
+      {kDatesEntry, kDatesOffset, kDatesBytes},
+      {kFinderInfoEntry, kFinderInfoOffset, kFinderInfoBytes},
+      {kResourceForkEntry, kResourceOffset, info.resource_length}};
+  for (size_t e = 0; e < kEntries; ++e) {
+    for (size_t field = 0; field < 3; ++field) {
+      WriteBigEndian4(entries[e][field],
+                      header.data() + 26 + 12 * e + 4 * field);
+    }
+  }
+  // Creation, modification, backup and access dates.
+  char* dates = header.data() + kDatesOffset;
+  WriteBigEndian4(info.created - kSeconds1904To2000, dates);
+  WriteBigEndian4(info.modified - kSeconds1904To2000, dates + 4);
+  WriteBigEndian4(kUnknownDate, dates + 8);
+  WriteBigEndian4(info.modified - kSeconds1904To2000, dates + 12);
+  // FInfo: type, creator, flags; the location and folder are left zero, as
+  // is the extended FXInfo.
+  char* finder_info = header.data() + kFinderInfoOffset;
+  WriteBigEndian4(info.type, finder_info);
+  WriteBigEndian4(info.creator, finder_info + 4);
+  WriteBigEndian2(info.finder_flags, finder_info + 8);
+  return header;
+}
@@ -0,0 +1,56 @@
+#ifndef __MAC_FILE_H__
+#define __MAC_FILE_H__
+
+// Headers that carry a classic Mac OS file's two forks and Finder
+// information to other file systems:
+//
+// MacBinary II: a 128-byte header, then the data fork and the resource
+// fork, each padded with zeros to a multiple of 128 bytes.
+//
+// AppleDouble (version 2): the data fork is stored as an ordinary file, and
+// a companion "._name" file holds this header followed by the resource
+// fork.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/types/span.h"
+
+struct MacFileInfo {
+  // In Mac Roman, at most 63 bytes for MacBinary.
+  std::string name;
+  uint32_t type;
+  uint32_t creator;
+  uint16_t finder_flags;
+  // Seconds since 1904, as kept by HFS.
+  uint32_t created;
+  uint32_t modified;
+  uint32_t data_length;
+  uint32_t resource_length;
+};
+
+constexpr size_t kMacBinaryHeaderBytes = 128;
+
+// The MacBinary II header for `info`.
+std::array<char, kMacBinaryHeaderBytes> MacBinaryHeader(
+    const MacFileInfo& info);
+
+// Zero bytes to follow a MacBinary fork of `length` bytes.
+inline size_t MacBinaryPadding(const uint32_t length) {
+  return (kMacBinaryHeaderBytes - length % kMacBinaryHeaderBytes) %
+         kMacBinaryHeaderBytes;
+}
+
+// The CRC-16 (CCITT polynomial, zero initial value) that MacBinary II
+// stores over the first 124 header bytes.
+uint16_t MacBinaryCrc(absl::Span<const char> bytes);
+
+// The AppleDouble header for `info`, with file dates and Finder info
+// entries and a resource fork entry that runs from the end of the header
+// for info.resource_length bytes.
+std::vector<char> AppleDoubleHeader(const MacFileInfo& info);
+
+#endif  // __MAC_FILE_H__
@@ -0,0 +1,82 @@
+#include "mac_file.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "endian.h"
+#include "gtest/gtest.h"
+#include "resource_fork.h"
+
+namespace {
+
+MacFileInfo TestInfo() {
+  return MacFileInfo{"ReadMe", ResourceType("TEXT"), ResourceType("ttxt"),
+                     0x0120,   0xb0000000,           0xb0001000,
+                     1000,     300};
+}
+
+TEST(MacFile, Crc) {
+  // The CRC-16/XMODEM check value.
+  const std::string check = "123456789";
+  EXPECT_EQ(MacBinaryCrc(check), 0x31c3);
+  EXPECT_EQ(MacBinaryCrc({}), 0);
+}
+
+TEST(MacFile, MacBinaryHeader) {
+  const auto header = MacBinaryHeader(TestInfo());
+  EXPECT_EQ(header[0], 0);
+  EXPECT_EQ(header[1], 6);
+  EXPECT_EQ(std::string(header.data() + 2, 6), "ReadMe");
+  EXPECT_EQ(BigEndian4(header.data() + 65), ResourceType("TEXT"));
+  EXPECT_EQ(BigEndian4(header.data() + 69), ResourceType("ttxt"));
+  EXPECT_EQ(header[73], 0x01);
+  EXPECT_EQ(header[101], 0x20);
+  EXPECT_EQ(BigEndian4(header.data() + 83), 1000);
+  EXPECT_EQ(BigEndian4(header.data() + 87), 300);
+  EXPECT_EQ(BigEndian4(header.data() + 91), 0xb0000000);
+  EXPECT_EQ(BigEndian4(header.data() + 95), 0xb0001000);
+  EXPECT_EQ(static_cast<uint8_t>(header[122]), 129);
+  EXPECT_EQ(BigEndian2(header.data() + 124),
+            MacBinaryCrc(absl::MakeConstSpan(header.data(), 124)));
+}
+
+TEST(MacFile, MacBinaryPadding) {
+  EXPECT_EQ(MacBinaryPadding(0), 0);
+  EXPECT_EQ(MacBinaryPadding(1), 127);
+  EXPECT_EQ(MacBinaryPadding(128), 0);
+  EXPECT_EQ(MacBinaryPadding(1000), 24);
+}
+
+TEST(MacFile, AppleDoubleHoldsResourceFork) {
+  MacFileInfo info = TestInfo();
+  const std::string resources = "resource fork bytes";
+  info.resource_length = resources.size();
+  std::vector<char> file = AppleDoubleHeader(info);
+  file.insert(file.end(), resources.begin(), resources.end());
+
+  auto fork = ResourceForkOf(file);
+  ASSERT_TRUE(fork.ok()) << fork.status();
+  EXPECT_EQ(std::string(fork->data(), fork->size()), resources);
+}
+
+TEST(MacFile, AppleDoubleFinderInfo) {
+  const std::vector<char> header = AppleDoubleHeader(TestInfo());
+  ASSERT_GE(header.size(), 26);
+  EXPECT_EQ(BigEndian4(header.data()), 0x00051607);
+  const uint16_t entries = BigEndian2(header.data() + 24);
+  bool found = false;
+  for (uint16_t e = 0; e < entries; ++e) {
+    const char* entry = header.data() + 26 + 12 * e;
+    if (BigEndian4(entry) != 9) continue;
+    const char* finder_info = header.data() + BigEndian4(entry + 4);
+    EXPECT_EQ(BigEndian4(entry + 8), 32);
+    EXPECT_EQ(BigEndian4(finder_info), ResourceType("TEXT"));
+    EXPECT_EQ(BigEndian4(finder_info + 4), ResourceType("ttxt"));
+    EXPECT_EQ(BigEndian2(finder_info + 8), 0x0120);
+    found = true;
+  }
+  EXPECT_TRUE(found);
+}
+
+}  // namespace
@@ -0,0 +1,88 @@
+#include "mfs_tags.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "endian.h"
+
+const MfsFork* MfsTags::FindFork(const uint32_t file_number,
+                                 const bool resource_fork) const {
+  auto it = std::lower_bound(
+      forks.begin(), forks.end(), std::make_tuple(file_number, resource_fork),
+      [](const MfsFork& fork, const std::tuple<uint32_t, bool>& key) {
+        return std::make_tuple(fork.file_number, fork.resource_fork) < key;
+      });
+  if (it == forks.end() || it->file_number != file_number ||
+      it->resource_fork != resource_fork) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+absl::StatusOr<MfsTags> DecodeMfsTags(const absl::Span<const char> tags) {
+  if (tags.size() % kMfsTagBytes != 0) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "Tag section of %d bytes is not a whole number of %d-byte tags",
+        tags.size(), kMfsTagBytes));
+  }
+  const size_t n = tags.size() / kMfsTagBytes;
+  MfsTags decoded;
+  MfsTagColumns& columns = decoded.columns;
+  columns.file_number.resize(n);
+  columns.flags.resize(n);
+  columns.logical_block.resize(n);
+  columns.modification_time.resize(n);
+  columns.usable.resize(n);
+
+  // Each tag is three words; every column is filled from them without
+  // branches, so the loop has no dependence from one tag to the next.
+  uint32_t* const file_number = columns.file_number.data();
+  uint16_t* const flags = columns.flags.data();
+  uint16_t* const logical_block = columns.logical_block.data();
+  uint32_t* const modification_time = columns.modification_time.data();
+  uint8_t* const usable = columns.usable.data();
+  const char* p = tags.data();
+  for (size_t i = 0; i < n; ++i, p += kMfsTagBytes) {
+    const uint32_t file = BigEndian4(p);
+    const uint32_t flags_and_block = BigEndian4(p + 4);
+    const uint32_t time = BigEndian4(p + 8);
+    file_number[i] = file;
+    flags[i] = flags_and_block >> 16;
+    logical_block[i] = flags_and_block & 0xffff;
+    modification_time[i] = time;
+    // A fork cannot have more blocks than the disk has sectors.
+    usable[i] = ((file | flags_and_block | time) & kMfsTagTrashed) == 0 &&
+                ((flags_and_block >> 16) & kMfsTagInvalid) == 0 &&
+                file != 0 && (flags_and_block & 0xffff) < n;
+  }
+
+  // Then one pass over the columns places each usable sector at its
+  // logical block in its fork.
+  absl::flat_hash_map<uint64_t, size_t> fork_index;
+  for (size_t i = 0; i < n; ++i) {
+    if (!usable[i]) continue;
+    const bool resource_fork = (flags[i] & kMfsTagResourceFork) != 0;
+    auto [it, inserted] = fork_index.try_emplace(
+        uint64_t{file_number[i]} << 1 | resource_fork, decoded.forks.size());
+    if (inserted) {
+      decoded.forks.push_back(MfsFork{file_number[i], resource_fork, {}});
+    }
+    std::vector<uint32_t>& sectors = decoded.forks[it->second].sectors;
+    const uint16_t block = logical_block[i];
+    if (block >= sectors.size()) sectors.resize(block + 1, MfsFork::kMissing);
+    uint32_t& sector = sectors[block];
+    if (sector == MfsFork::kMissing ||
+        modification_time[i] > modification_time[sector]) {
+      sector = i;
+    }
+  }
+  std::sort(decoded.forks.begin(), decoded.forks.end(),
+            [](const MfsFork& a, const MfsFork& b) {
+              return std::make_tuple(a.file_number, a.resource_fork) <
+                     std::make_tuple(b.file_number, b.resource_fork);
+            });
+  return decoded;
+}
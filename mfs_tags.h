@@ -0,0 +1,66 @@
+#ifndef __MFS_TAGS_H__
+#define __MFS_TAGS_H__
+
+// The 12-byte sector tags of an MFS disk (the DC42 tag section; see the
+// tag layout in disk_copy.h), decoded in bulk, for rebuilding files from a
+// disk whose directory is damaged: every sector of a file carries the
+// file's number, its fork and its logical block within the fork.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+
+inline constexpr size_t kMfsTagBytes = 12;
+
+// Bits of a tag's flags.
+inline constexpr uint16_t kMfsTagInvalid = 0x0020;
+inline constexpr uint16_t kMfsTagUserFile = 0x0100;
+inline constexpr uint16_t kMfsTagResourceFork = 0x0200;
+// Set in any of a tag's three 32-bit words, marks the whole tag as trashed.
+inline constexpr uint32_t kMfsTagTrashed = 0x00400000;
+
+// The tags of a disk, one column per field, indexed by sector.
+struct MfsTagColumns {
+  std::vector<uint32_t> file_number;
+  std::vector<uint16_t> flags;
+  std::vector<uint16_t> logical_block;
+  // Seconds since 1904-01-01.
+  std::vector<uint32_t> modification_time;
+  // 0 for a tag that is trashed, marked invalid, or names no file (file
+  // number 0) or a block beyond any fork on the disk; 1 otherwise.
+  std::vector<uint8_t> usable;
+
+  size_t size() const { return file_number.size(); }
+};
+
+// The sectors of one fork of one file, by logical block.
+struct MfsFork {
+  // Entry of a logical block that no usable tag claims.
+  static constexpr uint32_t kMissing = ~uint32_t{0};
+
+  uint32_t file_number;
+  bool resource_fork;
+  // sectors[b] is the sector holding logical block b, or kMissing. Where
+  // several sectors claim one block, the most recently modified wins (the
+  // first, on a tie).
+  std::vector<uint32_t> sectors;
+};
+
+struct MfsTags {
+  MfsTagColumns columns;
+  // Every fork with a usable tag, ordered by file number, data fork first.
+  std::vector<MfsFork> forks;
+
+  // The fork, or null if no usable tag names it.
+  const MfsFork* FindFork(uint32_t file_number, bool resource_fork) const;
+};
+
+// Decodes the tag section `tags`, 12 bytes per sector, into columns, and
+// indexes the usable sectors by file, fork and logical block in one more
+// pass over the columns. Fails unless `tags` is a whole number of tags.
+absl::StatusOr<MfsTags> DecodeMfsTags(absl::Span<const char> tags);
+
+#endif  // __MFS_TAGS_H__
@@ -0,0 +1,109 @@
+#include "mfs_tags.h"
+
+#include <string>
+#include <vector>
+
+#include "endian.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using testing::ElementsAre;
+
+constexpr uint32_t kMissing = MfsFork::kMissing;
+
+struct Tag {
+  uint32_t file_number;
+  uint16_t flags;
+  uint16_t logical_block;
+  uint32_t modification_time;
+};
+
+std::string EncodeTags(const std::vector<Tag>& tags) {
+  std::string bytes(tags.size() * kMfsTagBytes, 0);
+  char* p = bytes.data();
+  for (const Tag& tag : tags) {
+    WriteBigEndian4(tag.file_number, p);
+    WriteBigEndian2(tag.flags, p + 4);
+    WriteBigEndian2(tag.logical_block, p + 6);
+    WriteBigEndian4(tag.modification_time, p + 8);
+    p += kMfsTagBytes;
+  }
+  return bytes;
+}
+
+constexpr uint16_t kData = kMfsTagUserFile;
+constexpr uint16_t kResource = kMfsTagUserFile | kMfsTagResourceFork;
+
+TEST(MfsTagsTest, DecodesColumns) {
+  const std::string bytes = EncodeTags({{0x01020304, kResource, 2, 0xa0b0c0d0},
+                                        {7, kData, 0, 100},
+                                        {0, 0, 0, 0}});
+  auto tags = DecodeMfsTags({bytes.data(), bytes.size()});
+  ASSERT_TRUE(tags.ok()) << tags.status();
+  const MfsTagColumns& columns = tags->columns;
+  ASSERT_EQ(3, columns.size());
+  EXPECT_THAT(columns.file_number, ElementsAre(0x01020304, 7, 0));
+  EXPECT_THAT(columns.flags, ElementsAre(kResource, kData, 0));
+  EXPECT_THAT(columns.logical_block, ElementsAre(2, 0, 0));
+  EXPECT_THAT(columns.modification_time, ElementsAre(0xa0b0c0d0, 100, 0));
+  EXPECT_THAT(columns.usable, ElementsAre(1, 1, 0));
+}
+
+TEST(MfsTagsTest, ExcludesUnusableTags) {
+  const std::string bytes = EncodeTags({
+      {1, kData, 0, 10},
+      {1, kData | kMfsTagInvalid, 1, 10},
+      {1, kData, 2, kMfsTagTrashed},
+      {kMfsTagTrashed | 1, kData, 3, 10},
+      {1, kData, 6, 10},  // Beyond the six sectors of the disk.
+      {1, kData, 5, 10},
+  });
+  auto tags = DecodeMfsTags({bytes.data(), bytes.size()});
+  ASSERT_TRUE(tags.ok()) << tags.status();
+  EXPECT_THAT(tags->columns.usable, ElementsAre(1, 0, 0, 0, 0, 1));
+  ASSERT_EQ(1, tags->forks.size());
+  EXPECT_THAT(tags->forks[0].sectors,
+              ElementsAre(0, kMissing, kMissing, kMissing, kMissing, 5));
+}
+
+TEST(MfsTagsTest, IndexesForksInOrder) {
+  const std::string bytes = EncodeTags({
+      {9, kResource, 1, 50},
+      {3, kData, 1, 50},
+      {9, kResource, 0, 50},
+      {3, kData, 0, 50},
+      {9, kData, 0, 50},
+      {3, kData, 1, 60},  // Newer than sector 1.
+      {3, kData, 0, 50},  // As new as sector 3, which stays.
+  });
+  auto tags = DecodeMfsTags({bytes.data(), bytes.size()});
+  ASSERT_TRUE(tags.ok()) << tags.status();
+  ASSERT_EQ(3, tags->forks.size());
+  EXPECT_EQ(3, tags->forks[0].file_number);
+  EXPECT_FALSE(tags->forks[0].resource_fork);
+  EXPECT_THAT(tags->forks[0].sectors, ElementsAre(3, 5));
+  EXPECT_EQ(9, tags->forks[1].file_number);
+  EXPECT_FALSE(tags->forks[1].resource_fork);
+  EXPECT_THAT(tags->forks[1].sectors, ElementsAre(4));
+  EXPECT_TRUE(tags->forks[2].resource_fork);
+  EXPECT_THAT(tags->forks[2].sectors, ElementsAre(2, 0));
+
+  EXPECT_EQ(&tags->forks[2], tags->FindFork(9, true));
+  EXPECT_EQ(&tags->forks[0], tags->FindFork(3, false));
+  EXPECT_EQ(nullptr, tags->FindFork(3, true));
+  EXPECT_EQ(nullptr, tags->FindFork(4, false));
+}
+
+TEST(MfsTagsTest, RejectsAPartialTag) {
+  const std::string bytes(13, 0);
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument,
+            DecodeMfsTags({bytes.data(), bytes.size()}).status().code());
+  auto empty = DecodeMfsTags({});
+  ASSERT_TRUE(empty.ok()) << empty.status();
+  EXPECT_EQ(0, empty->columns.size());
+  EXPECT_TRUE(empty->forks.empty());
+}
+
+}  // namespace
@@ -0,0 +1,301 @@
+#include "ndif.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "absl/strings/str_format.h"
+#include "endian.h"
+#include "lzhuf.h"
+
+namespace {
+
+constexpr size_t kBcemHeaderBytes = 128;
+constexpr size_t kChunkEntryBytes = 12;
+
+constexpr uint8_t kZeroChunk = 0x00;
+constexpr uint8_t kRawChunk = 0x02;
+constexpr uint8_t kLzhChunk = 0x82;
+constexpr uint8_t kAdcChunk = 0x83;
+constexpr uint8_t kEndOfMap = 0xff;
+
+}  // namespace
+
+absl::Status AdcDecode(const absl::Span<const char> in,
+                       const absl::Span<char> out) {
+  size_t i = 0;
+  size_t o = 0;
+  while (o < out.size()) {
+    if (i >= in.size()) {
+      return absl::DataLossError(absl::StrFormat(
+          "ADC input of %d bytes ended after %d of %d output bytes",
+          in.size(), o, out.size()));
+    }
+    const uint8_t code = in[i];
+    if (code & 0x80) {
+      // Literal run of 1 to 128 bytes.
+      const size_t length = (code & 0x7f) + 1;
+      if (length > in.size() - i - 1 || length > out.size() - o) {
+        return absl::DataLossError(absl::StrFormat(
+            "ADC literal of %d bytes at input byte %d overruns", length, i));
+      }
+      memcpy(out.data() + o, in.data() + i + 1, length);
+      i += 1 + length;
+      o += length;
+      continue;
+    }
+    // A copy from earlier output: 3 to 18 bytes from up to 1 KiB back (two
+    // byte code), or 4 to 67 bytes from up to 64 KiB back (three bytes).
+    size_t length;
+    size_t distance;
+    if (code & 0x40) {
+      if (in.size() - i < 3) break;
+      length = (code & 0x3f) + 4;
+      distance = BigEndian2(in.data() + i + 1) + 1;
+      i += 3;
+    } else {
+      if (in.size() - i < 2) break;
+      length = ((code >> 2) & 0x0f) + 3;
+      distance = ((code & 0x03) << 8 | static_cast<uint8_t>(in[i + 1])) + 1;
+      i += 2;
+    }
+    if (distance > o || length > out.size() - o) {
+      return absl::DataLossError(absl::StrFormat(
+          "ADC copy of %d bytes from %d back at output byte %d is out of "
+          "range",
+          length, distance, o));
+    }
+    // Copies may overlap their own output, so go a byte at a time.
+    for (size_t k = 0; k < length; ++k, ++o) out[o] = out[o - distance];
+  }
+  if (o < out.size()) {
+    return absl::DataLossError(absl::StrFormat(
+        "ADC input of %d bytes ends inside a copy code", in.size()));
+  }
+  return absl::OkStatus();
+}
+
+// static
+absl::StatusOr<std::unique_ptr<NdifImageSource>> NdifImageSource::Open(
+    std::unique_ptr<ImageSource> data_fork, const absl::Span<const char> bcem) {
+  if (bcem.size() < kBcemHeaderBytes) {
+    return absl::DataLossError(absl::StrFormat(
+        "'bcem' resource of %d bytes is shorter than its header",
+        bcem.size()));
+  }
+  const size_t name_length = std::min<uint8_t>(bcem[2], 63);
+  std::string name(bcem.data() + 3, name_length);
+  const uint32_t sector_count = BigEndian4(bcem.data() + 68);
+  const uint32_t entries = BigEndian4(bcem.data() + 124);
+  if ((bcem.size() - kBcemHeaderBytes) / kChunkEntryBytes < entries) {
+    return absl::DataLossError(absl::StrFormat(
+        "'bcem' resource of %d bytes cannot hold %d chunk entries",
+        bcem.size(), entries));
+  }
+  // Each entry's chunk ends where the next entry starts; an end-of-map
+  // entry (or, failing that, the sector count) ends the last chunk.
+  std::vector<Chunk> chunks;
+  uint32_t end_sector = sector_count;
+  for (uint32_t e = 0; e < entries; ++e) {
+    const char* entry = bcem.data() + kBcemHeaderBytes + kChunkEntryBytes * e;
+    const uint32_t first_sector = BigEndian4(entry) >> 8;
+    const uint8_t type = entry[3];
+    const uint32_t previous_first =
+        chunks.empty() ? 0 : chunks.back().first_sector;
+    if (first_sector < previous_first || (e == 0 && first_sector != 0)) {
+      return absl::DataLossError(absl::StrFormat(
+          "Chunk %d starts at sector %d, out of order", e, first_sector));
+    }
+    if (type == kEndOfMap) {
+      end_sector = first_sector;
+      break;
+    }
+    if (type != kZeroChunk && type != kRawChunk && type != kLzhChunk &&
+        type != kAdcChunk) {
+      return absl::UnimplementedError(
+          absl::StrFormat("Chunk %d has unsupported type 0x%02x", e, type));
+    }
+    chunks.push_back(Chunk{first_sector, 0, type, BigEndian4(entry + 8),
+                           BigEndian4(entry + 4)});
+  }
+  if (end_sector != sector_count ||
+      (!chunks.empty() && end_sector < chunks.back().first_sector)) {
+    return absl::DataLossError(absl::StrFormat(
+        "Chunk map ends at sector %d of %d", end_sector, sector_count));
+  }
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    const uint32_t next =
+        c + 1 < chunks.size() ? chunks[c + 1].first_sector : end_sector;
+    chunks[c].sector_count = next - chunks[c].first_sector;
+  }
+  // Entries that cover no sectors are never read.
+  chunks.erase(
+      std::remove_if(chunks.begin(), chunks.end(),
+                     [](const Chunk& c) { return c.sector_count == 0; }),
+      chunks.end());
+  if (chunks.empty() && sector_count > 0) {
+    return absl::DataLossError(absl::StrFormat(
+        "Chunk map has no chunks for %d sectors", sector_count));
+  }
+  // Stored data is read before it is decoded, into the caller's buffer for
+  // a raw chunk and into one of stored_length bytes otherwise, so both are
+  // bounded here: by the data fork, or for a fork of unknown size (a pipe),
+  // by twice what the chunk decodes to.
+  const uint64_t fork_size = data_fork->Size();
+  for (const Chunk& c : chunks) {
+    if (c.type == kZeroChunk) continue;
+    const uint64_t decoded = uint64_t{c.sector_count} * kSectorSize;
+    if (c.type == kRawChunk && c.stored_length != decoded) {
+      return absl::DataLossError(absl::StrFormat(
+          "Raw chunk at sector %d stores %d bytes for %d sectors",
+          c.first_sector, c.stored_length, c.sector_count));
+    }
+    const uint64_t stored_end = uint64_t{c.stored_offset} + c.stored_length;
+    const bool too_long = fork_size != ImageSource::kUnknownSize
+                              ? stored_end > fork_size
+                              : c.stored_length > 2 * decoded + 1024;
+    if (too_long) {
+      return absl::DataLossError(absl::StrFormat(
+          "Chunk at sector %d stores %d bytes at %d, beyond the %d-byte data "
+          "fork or its %d decoded bytes",
+          c.first_sector, c.stored_length, c.stored_offset, fork_size,
+          decoded));
+    }
+  }
+  return std::unique_ptr<NdifImageSource>(new NdifImageSource(
+      std::move(data_fork), std::move(name), sector_count, std::move(chunks)));
+}
+
+size_t NdifImageSource::ChunkIndex(const uint32_t sector) const {
+  auto it = std::upper_bound(
+      chunks_.begin(), chunks_.end(), sector,
+      [](uint32_t s, const Chunk& c) { return s < c.first_sector; });
+  return (it - chunks_.begin()) - 1;
+}
+
+absl::Status NdifImageSource::DecodeChunk(const Chunk& chunk,
+                                          const absl::Span<char> out) {
+  if (chunk.type == kZeroChunk) {
+    memset(out.data(), 0, out.size());
+    return absl::OkStatus();
+  }
+  // Also checked by Open; a raw chunk is read straight into `out`.
+  if (chunk.type == kRawChunk && chunk.stored_length != out.size()) {
+    return absl::DataLossError(absl::StrFormat(
+        "Raw chunk at sector %d stores %d bytes for %d sectors",
+        chunk.first_sector, chunk.stored_length, chunk.sector_count));
+  }
+  std::vector<char> stored_scratch(chunk.type == kRawChunk
+                                       ? 0
+                                       : chunk.stored_length);
+  auto stored = data_fork_->Read(
+      chunk.stored_offset, chunk.stored_length,
+      chunk.type == kRawChunk ? out.data() : stored_scratch.data());
+  if (!stored.ok()) {
+    return stored.status();
+  }
+  absl::Status status;
+  switch (chunk.type) {
+    case kRawChunk:
+      if (stored->size() != out.size()) {
+        return absl::DataLossError(absl::StrFormat(
+            "Raw chunk at sector %d stores %d bytes for %d sectors",
+            chunk.first_sector, stored->size(), chunk.sector_count));
+      }
+      if (stored->data() != out.data()) {
+        memcpy(out.data(), stored->data(), out.size());
+      }
+      break;
+    case kAdcChunk:
+      status = AdcDecode(*stored, out);
+      break;
+    case kLzhChunk:
+      status = LzhufDecode(*stored, out);
+      break;
+  }
+  if (!status.ok()) {
+    return absl::DataLossError(absl::StrFormat(
+        "Chunk at sector %d: %s", chunk.first_sector, status.message()));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status NdifImageSource::ReadChunks(const uint64_t offset,
+                                         const uint64_t length,
+                                         ChunkConsumer consume) {
+  auto range_status = CheckRange(offset, length);
+  if (!range_status.ok()) {
+    return range_status;
+  }
+  const uint64_t end = offset + length;
+  std::vector<char> decoded;
+  const size_t first_chunk =
+      length == 0 ? chunks_.size() : ChunkIndex(offset / kSectorSize);
+  for (size_t c = first_chunk; c < chunks_.size(); ++c) {
+    const Chunk& chunk = chunks_[c];
+    const uint64_t chunk_start = uint64_t{chunk.first_sector} * kSectorSize;
+    if (chunk_start >= end) break;
+    const uint64_t chunk_size = uint64_t{chunk.sector_count} * kSectorSize;
+    decoded.resize(chunk_size);
+    auto status = DecodeChunk(chunk, absl::MakeSpan(decoded));
+    if (!status.ok()) {
+      return status;
+    }
+    const uint64_t from = std::max(offset, chunk_start);
+    const uint64_t to = std::min(end, chunk_start + chunk_size);
+    status = consume(decoded.data() + (from - chunk_start), to - from);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<absl::Span<const char>> NdifImageSource::Read(
+    const uint64_t offset, const size_t length, char* scratch) {
+  auto range_status = CheckRange(offset, length);
+  if (!range_status.ok()) {
+    return range_status;
+  }
+  const uint64_t end = offset + length;
+  std::vector<char> partial;
+  const size_t first_chunk =
+      length == 0 ? chunks_.size() : ChunkIndex(offset / kSectorSize);
+  for (size_t c = first_chunk; c < chunks_.size(); ++c) {
+    const Chunk& chunk = chunks_[c];
+    const uint64_t chunk_start = uint64_t{chunk.first_sector} * kSectorSize;
+    if (chunk_start >= end) break;
+    const uint64_t chunk_end =
+        chunk_start + uint64_t{chunk.sector_count} * kSectorSize;
+    const uint64_t from = std::max(offset, chunk_start);
+    const uint64_t to = std::min(end, chunk_end);
+    absl::Status status;
+    if (from == chunk_start && to == chunk_end) {
+      // The whole chunk is wanted: decode it in place.
+      status = DecodeChunk(
+          chunk, absl::MakeSpan(scratch + (from - offset), to - from));
+    } else {
+      partial.resize(chunk_end - chunk_start);
+      status = DecodeChunk(chunk, absl::MakeSpan(partial));
+      if (status.ok()) {
+        memcpy(scratch + (from - offset), partial.data() + (from - chunk_start),
+               to - from);
+      }
+    }
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::MakeConstSpan(scratch, length);
+}
+
+absl::Status NdifImageSource::ReadSectors(const uint32_t first_sector,
+                                          const uint32_t count,
+                                          const absl::Span<char> out) {
+  const uint64_t length = uint64_t{count} * kSectorSize;
+  if (out.size() < length) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "%d sectors do not fit in %d bytes", count, out.size()));
+  }
+  auto read = Read(uint64_t{first_sector} * kSectorSize, length, out.data());
+  return read.status();
+}
@@ -0,0 +1,101 @@
+#ifndef __NDIF_H__
+#define __NDIF_H__
+
+// Disk Copy 6 "New Disk Image Format" (NDIF) images.
+//
+// The data fork holds the disk in chunks, each stored raw, compressed, or
+// not at all (all zeros). The chunk map is the 'bcem' resource in the
+// resource fork (big-endian):
+//
+// offset  size  contents
+// 0       2     version
+// 2       64    image name (Pascal string)
+// 68      4     number of 512-byte sectors
+// 124     4     number of chunk entries
+// 128     12*n  chunk entries:
+//                 3  first sector of the chunk
+//                 1  type: 0 = zeros, 2 = raw, 0x82 = LZH, 0x83 = ADC,
+//                    0xff = end of map
+//                 4  offset of the stored chunk in the data fork
+//                 4  length of the stored chunk
+//
+// A chunk runs from its first sector to the next entry's first sector.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "image_source.h"
+
+// The decompressed disk of an NDIF image, read on demand: a read
+// decompresses only the chunks it touches. The chunk map is parsed once,
+// when the image is opened.
+//
+// Safe to read from several threads at once if the data fork source is
+// (mapped and in-memory sources are); decompressing separate ranges from
+// separate threads decompresses their chunks in parallel.
+class NdifImageSource : public ImageSource {
+ public:
+  static constexpr uint32_t kSectorSize = 512;
+
+  // One entry of the chunk index.
+  struct Chunk {
+    uint32_t first_sector;
+    uint32_t sector_count;
+    uint8_t type;
+    uint32_t stored_length;
+    uint64_t stored_offset;
+  };
+
+  // Parses the 'bcem' resource `bcem` describing the data fork
+  // `data_fork`.
+  static absl::StatusOr<std::unique_ptr<NdifImageSource>> Open(
+      std::unique_ptr<ImageSource> data_fork, absl::Span<const char> bcem);
+
+  // Size of the decompressed disk.
+  uint64_t Size() const override {
+    return uint64_t{sector_count_} * kSectorSize;
+  }
+  absl::StatusOr<absl::Span<const char>> Read(uint64_t offset, size_t length,
+                                              char* scratch) override;
+  absl::Status ReadChunks(uint64_t offset, uint64_t length,
+                          ChunkConsumer consume) override;
+
+  // Reads sectors [first_sector, first_sector + count) into `out`, which
+  // must hold count * kSectorSize bytes.
+  absl::Status ReadSectors(uint32_t first_sector, uint32_t count,
+                           absl::Span<char> out);
+
+  const std::string& Name() const { return name_; }
+  uint32_t SectorCount() const { return sector_count_; }
+  const std::vector<Chunk>& Chunks() const { return chunks_; }
+
+ private:
+  NdifImageSource(std::unique_ptr<ImageSource> data_fork, std::string name,
+                  uint32_t sector_count, std::vector<Chunk> chunks)
+      : data_fork_(std::move(data_fork)),
+        name_(std::move(name)),
+        sector_count_(sector_count),
+        chunks_(std::move(chunks)) {}
+
+  // Index in chunks_ of the chunk holding `sector`.
+  size_t ChunkIndex(uint32_t sector) const;
+  // Decompresses all of `chunk` into `out`.
+  absl::Status DecodeChunk(const Chunk& chunk, absl::Span<char> out);
+
+  std::unique_ptr<ImageSource> data_fork_;
+  std::string name_;
+  uint32_t sector_count_;
+  // Sorted by first_sector, covering the whole disk without gaps.
+  std::vector<Chunk> chunks_;
+};
+
+// Decodes Apple Data Compression (ADC, chunk type 0x83) from `in` until
+// exactly out.size() bytes have been written to `out`.
+absl::Status AdcDecode(absl::Span<const char> in, absl::Span<char> out);
+
+#endif  // __NDIF_H__
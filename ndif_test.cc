@@ -0,0 +1,252 @@
+#include "ndif.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "endian.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "image_source.h"
+#include "lzhuf.h"
+
+namespace {
+
+// ADC compression of `in`: runs of a repeated byte as copies from one byte
+// back, everything else as literals.
+std::vector<char> AdcEncode(const std::vector<char>& in) {
+  std::vector<char> out;
+  for (size_t i = 0; i < in.size();) {
+    size_t run = 1;
+    while (i + run < in.size() && run < 68 && in[i + run] == in[i]) ++run;
+    if (run >= 5) {
+      // One literal, then a three-byte copy of the rest from 1 back.
+      out.push_back(static_cast<char>(0x80));
+      out.push_back(in[i]);
+      const size_t copy = run - 1;
+      out.push_back(static_cast<char>(0x40 | (copy - 4)));
+      out.push_back(0);
+      out.push_back(0);
+      i += run;
+      continue;
+    }
+    const size_t literal = std::min<size_t>(run, 128);
+    out.push_back(static_cast<char>(0x80 | (literal - 1)));
+    out.insert(out.end(), in.begin() + i, in.begin() + i + literal);
+    i += literal;
+  }
+  return out;
+}
+
+struct TestChunk {
+  uint8_t type;
+  uint32_t sectors;
+};
+
+// An NDIF image: its 'bcem' resource and data fork, and the disk they
+// decode to.
+struct TestImage {
+  std::vector<char> bcem;
+  std::vector<char> data_fork;
+  std::vector<char> disk;
+};
+
+TestImage MakeImage(const std::vector<TestChunk>& chunks) {
+  std::mt19937 rng(chunks.size());
+  TestImage image;
+  image.bcem.assign(128, 0);
+  image.bcem[2] = 4;
+  memcpy(image.bcem.data() + 3, "Test", 4);
+  uint32_t sector = 0;
+  for (const TestChunk& c : chunks) {
+    std::vector<char> disk(c.sectors * 512, 0);
+    if (c.type != 0) {
+      // Compressible: random bytes in runs.
+      for (size_t i = 0; i < disk.size();) {
+        const char b = static_cast<char>(rng() % 8);
+        const size_t run = std::min<size_t>(1 + rng() % 40, disk.size() - i);
+        std::fill_n(disk.begin() + i, run, b);
+        i += run;
+      }
+    }
+    std::vector<char> stored;
+    if (c.type == 0x02) stored = disk;
+    if (c.type == 0x83) stored = AdcEncode(disk);
+    if (c.type == 0x82) stored = LzhufEncode(disk);
+    char entry[12];
+    WriteBigEndian4(sector << 8 | c.type, entry);
+    WriteBigEndian4(image.data_fork.size(), entry + 4);
+    WriteBigEndian4(stored.size(), entry + 8);
+    image.bcem.insert(image.bcem.end(), entry, entry + 12);
+    image.data_fork.insert(image.data_fork.end(), stored.begin(),
+                           stored.end());
+    image.disk.insert(image.disk.end(), disk.begin(), disk.end());
+    sector += c.sectors;
+  }
+  char end[12] = {};
+  WriteBigEndian4(sector << 8 | 0xff, end);
+  image.bcem.insert(image.bcem.end(), end, end + 12);
+  WriteBigEndian4(sector, image.bcem.data() + 68);
+  WriteBigEndian4(chunks.size() + 1, image.bcem.data() + 124);
+  return image;
+}
+
+std::unique_ptr<NdifImageSource> Open(const TestImage& image) {
+  auto source = NdifImageSource::Open(
+      std::make_unique<MemoryImageSource>(image.data_fork), image.bcem);
+  EXPECT_TRUE(source.ok()) << source.status();
+  return source.ok() ? std::move(*source) : nullptr;
+}
+
+const std::vector<TestChunk> kMixed = {
+    {0x02, 20}, {0x00, 13}, {0x83, 40}, {0x82, 20}, {0x02, 7}, {0x83, 1}};
+
+TEST(Ndif, ChunkIndex) {
+  const TestImage image = MakeImage(kMixed);
+  auto source = Open(image);
+  ASSERT_NE(nullptr, source);
+  EXPECT_EQ("Test", source->Name());
+  EXPECT_EQ(101, source->SectorCount());
+  ASSERT_EQ(6, source->Chunks().size());
+  EXPECT_EQ(33, source->Chunks()[2].first_sector);
+  EXPECT_EQ(40, source->Chunks()[2].sector_count);
+}
+
+TEST(Ndif, ReadChunksWholeImage) {
+  const TestImage image = MakeImage(kMixed);
+  auto source = Open(image);
+  ASSERT_NE(nullptr, source);
+  std::vector<char> decoded;
+  auto status = source->ReadChunks(
+      0, source->Size(), [&decoded](const char* chunk, size_t size) {
+        decoded.insert(decoded.end(), chunk, chunk + size);
+        return absl::OkStatus();
+      });
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(image.disk, decoded);
+}
+
+TEST(Ndif, ReadRanges) {
+  const TestImage image = MakeImage(kMixed);
+  auto source = Open(image);
+  ASSERT_NE(nullptr, source);
+  std::mt19937 rng(5);
+  std::vector<char> scratch(image.disk.size());
+  for (int i = 0; i < 200; ++i) {
+    const uint64_t offset = rng() % image.disk.size();
+    const size_t length = rng() % (image.disk.size() - offset + 1);
+    auto read = source->Read(offset, length, scratch.data());
+    ASSERT_TRUE(read.ok()) << read.status();
+    ASSERT_TRUE(std::equal(read->begin(), read->end(),
+                           image.disk.begin() + offset))
+        << length << " bytes at " << offset;
+  }
+  std::vector<char> sectors(3 * 512);
+  ASSERT_TRUE(source->ReadSectors(32, 3, absl::MakeSpan(sectors)).ok());
+  EXPECT_TRUE(std::equal(sectors.begin(), sectors.end(),
+                         image.disk.begin() + 32 * 512));
+  EXPECT_FALSE(source->ReadSectors(100, 2, absl::MakeSpan(sectors)).ok());
+}
+
+TEST(Ndif, ConcurrentReads) {
+  const TestImage image = MakeImage(kMixed);
+  auto source = Open(image);
+  ASSERT_NE(nullptr, source);
+  std::vector<std::thread> threads;
+  std::vector<bool> matched(4);
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      std::vector<char> scratch(image.disk.size());
+      bool ok = true;
+      for (uint32_t s = t; s < source->SectorCount(); s += 4) {
+        auto read = source->Read(s * 512, 512, scratch.data());
+        ok = ok && read.ok() &&
+             std::equal(read->begin(), read->end(),
+                        image.disk.begin() + s * 512);
+      }
+      matched[t] = ok;
+    });
+  }
+  for (auto& t : threads) t.join();
+  EXPECT_THAT(matched, testing::Each(true));
+}
+
+TEST(Ndif, UnsupportedChunkType) {
+  TestImage image = MakeImage(kMixed);
+  image.bcem[128 + 3] = 0x80;  // KenCode
+  EXPECT_EQ(absl::StatusCode::kUnimplemented,
+            NdifImageSource::Open(
+                std::make_unique<MemoryImageSource>(image.data_fork),
+                image.bcem)
+                .status()
+                .code());
+}
+
+TEST(Ndif, MapDoesNotCoverDisk) {
+  TestImage image = MakeImage(kMixed);
+  WriteBigEndian4(200, image.bcem.data() + 68);
+  EXPECT_FALSE(NdifImageSource::Open(
+                   std::make_unique<MemoryImageSource>(image.data_fork),
+                   image.bcem)
+                   .ok());
+}
+
+TEST(Ndif, EmptyMapForSectors) {
+  TestImage image = MakeImage({});
+  WriteBigEndian4(8, image.bcem.data() + 68);
+  WriteBigEndian4(0, image.bcem.data() + 124);
+  EXPECT_EQ(absl::StatusCode::kDataLoss,
+            NdifImageSource::Open(
+                std::make_unique<MemoryImageSource>(image.data_fork),
+                image.bcem)
+                .status()
+                .code());
+}
+
+TEST(Ndif, StoredDataOutOfBounds) {
+  // A raw chunk storing more bytes than its sectors hold.
+  TestImage image = MakeImage({{0x02, 4}, {0x83, 4}});
+  WriteBigEndian4(4 * 512 + 1, image.bcem.data() + 128 + 8);
+  EXPECT_EQ(absl::StatusCode::kDataLoss,
+            NdifImageSource::Open(
+                std::make_unique<MemoryImageSource>(image.data_fork),
+                image.bcem)
+                .status()
+                .code());
+  // A compressed chunk stored past the end of the data fork.
+  image = MakeImage({{0x02, 4}, {0x83, 4}});
+  WriteBigEndian4(0xffffff00, image.bcem.data() + 140 + 8);
+  EXPECT_EQ(absl::StatusCode::kDataLoss,
+            NdifImageSource::Open(
+                std::make_unique<MemoryImageSource>(image.data_fork),
+                image.bcem)
+                .status()
+                .code());
+}
+
+TEST(Ndif, CorruptChunk) {
+  TestImage image = MakeImage({{0x83, 4}});
+  // Start with a copy, with nothing before it to copy from.
+  image.data_fork[0] = 0x40;
+  auto source = Open(image);
+  ASSERT_NE(nullptr, source);
+  std::vector<char> out(4 * 512);
+  EXPECT_EQ(absl::StatusCode::kDataLoss,
+            source->ReadSectors(0, 4, absl::MakeSpan(out)).code());
+}
+
+TEST(Adc, TwoByteCopy) {
+  // "abc", then copy 3 bytes from 3 back, twice overlapped: 6 bytes.
+  const char in[] = {static_cast<char>(0x82), 'a', 'b', 'c',
+                     static_cast<char>(0x0c), 0x02};
+  std::vector<char> out(9);
+  ASSERT_TRUE(AdcDecode(absl::MakeConstSpan(in, sizeof(in)),
+                        absl::MakeSpan(out))
+                  .ok());
+  EXPECT_EQ("abcabcabc", std::string(out.begin(), out.end()));
+}
+
+}  // namespace
@@ -0,0 +1,110 @@
+#include "resource_fork.h"
+
+#include "absl/strings/str_format.h"
+#include "endian.h"
+
+namespace {
+
+constexpr uint32_t kAppleSingleMagic = 0x00051600;
+constexpr uint32_t kAppleDoubleMagic = 0x00051607;
+constexpr uint32_t kResourceForkEntry = 2;
+
+// Offsets into the resource fork header and map.
+constexpr size_t kForkHeaderBytes = 16;
+constexpr size_t kMapTypeListOffset = 24;
+constexpr size_t kTypeEntryBytes = 8;
+constexpr size_t kReferenceEntryBytes = 12;
+
+absl::Status Malformed(const absl::string_view what) {
+  return absl::DataLossError(
+      absl::StrFormat("Malformed resource fork: %s", what));
+}
+
+bool InRange(const absl::Span<const char> s, const uint64_t offset,
+             const uint64_t length) {
+  return offset <= s.size() && length <= s.size() - offset;
+}
+
+}  // namespace
+
+absl::StatusOr<absl::Span<const char>> ResourceForkOf(
+    const absl::Span<const char> file) {
+  if (file.size() < 26) return file;
+  const uint32_t magic = BigEndian4(file.data());
+  if (magic != kAppleSingleMagic && magic != kAppleDoubleMagic) return file;
+  // Magic, version, 16 filler bytes, then a count of 12-byte entries.
+  const uint16_t entries = BigEndian2(file.data() + 24);
+  if (!InRange(file, 26, uint64_t{12} * entries)) {
+    return absl::DataLossError("AppleDouble entry list is truncated");
+  }
+  for (uint16_t i = 0; i < entries; ++i) {
+    const char* entry = file.data() + 26 + 12 * i;
+    if (BigEndian4(entry) != kResourceForkEntry) continue;
+    const uint32_t offset = BigEndian4(entry + 4);
+    const uint32_t length = BigEndian4(entry + 8);
+    if (!InRange(file, offset, length)) {
+      return absl::DataLossError("AppleDouble resource fork is truncated");
+    }
+    return file.subspan(offset, length);
+  }
+  return absl::Span<const char>();
+}
+
+absl::StatusOr<absl::Span<const char>> FindResource(
+    const absl::Span<const char> fork, const uint32_t type) {
+  if (fork.size() < kForkHeaderBytes) {
+    return absl::NotFoundError("Resource fork is empty");
+  }
+  const uint32_t data_offset = BigEndian4(fork.data());
+  const uint32_t map_offset = BigEndian4(fork.data() + 4);
+  const uint32_t data_length = BigEndian4(fork.data() + 8);
+  const uint32_t map_length = BigEndian4(fork.data() + 12);
+  if (!InRange(fork, data_offset, data_length) ||
+      !InRange(fork, map_offset, map_length) ||
+      map_length < kMapTypeListOffset + 4) {
+    return Malformed("header");
+  }
+  const absl::Span<const char> map = fork.subspan(map_offset, map_length);
+  const absl::Span<const char> data = fork.subspan(data_offset, data_length);
+  const uint16_t type_list = BigEndian2(map.data() + kMapTypeListOffset);
+  if (!InRange(map, type_list, 2)) return Malformed("type list");
+  // Counts in the map are stored minus one; 0xffff means none.
+  const int types =
+      static_cast<uint16_t>(BigEndian2(map.data() + type_list) + 1);
+  if (!InRange(map, type_list + 2, uint64_t{kTypeEntryBytes} * types)) {
+    return Malformed("type list");
+  }
+  for (int t = 0; t < types; ++t) {
+    const char* entry = map.data() + type_list + 2 + kTypeEntryBytes * t;
+    if (BigEndian4(entry) != type) continue;
+    const int count = static_cast<uint16_t>(BigEndian2(entry + 4) + 1);
+    // Reference lists are relative to the type list.
+    const uint64_t references = uint64_t{type_list} + BigEndian2(entry + 6);
+    if (!InRange(map, references, uint64_t{kReferenceEntryBytes} * count)) {
+      return Malformed("reference list");
+    }
+    const char* best = nullptr;
+    for (int r = 0; r < count; ++r) {
+      const char* reference =
+          map.data() + references + kReferenceEntryBytes * r;
+      if (best == nullptr || static_cast<int16_t>(BigEndian2(reference)) <
+                                 static_cast<int16_t>(BigEndian2(best))) {
+        best = reference;
+      }
+    }
+    if (best == nullptr) break;
+    // Attributes byte, then a 3-byte offset into the resource data, where
+    // each resource is a 4-byte length followed by its bytes.
+    const uint32_t offset = BigEndian4(best + 4) & 0xffffff;
+    if (!InRange(data, offset, 4)) return Malformed("resource offset");
+    const uint32_t length = BigEndian4(data.data() + offset);
+    if (!InRange(data, uint64_t{offset} + 4, length)) {
+      return Malformed("resource length");
+    }
+    return data.subspan(offset + 4, length);
+  }
+  return absl::NotFoundError(absl::StrFormat(
+      "No '%c%c%c%c' resource", static_cast<char>(type >> 24),
+      static_cast<char>(type >> 16), static_cast<char>(type >> 8),
+      static_cast<char>(type)));
+}
@@ -0,0 +1,33 @@
+#ifndef __RESOURCE_FORK_H__
+#define __RESOURCE_FORK_H__
+
+// Reading resources from a classic Mac OS resource fork, as held on other
+// file systems: the bare fork (e.g. macOS's file/..namedfork/rsrc) or an
+// AppleDouble header file (the "._file" written by macOS and netatalk).
+
+#include <cstdint>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+
+// Four-character resource type, e.g. ResourceType("bcem").
+constexpr uint32_t ResourceType(const char (&code)[5]) {
+  return static_cast<uint32_t>(static_cast<uint8_t>(code[0])) << 24 |
+         static_cast<uint32_t>(static_cast<uint8_t>(code[1])) << 16 |
+         static_cast<uint32_t>(static_cast<uint8_t>(code[2])) << 8 |
+         static_cast<uint32_t>(static_cast<uint8_t>(code[3]));
+}
+
+// If `file` is an AppleDouble (or AppleSingle) file, returns its resource
+// fork entry, which is empty if it has none; otherwise returns `file`
+// itself, taken to be a bare resource fork.
+absl::StatusOr<absl::Span<const char>> ResourceForkOf(
+    absl::Span<const char> file);
+
+// Returns the data of the resource of type `type` with the lowest ID in the
+// resource fork `fork` (a view into `fork`). Returns NotFound if there is
+// none, and an error if the fork is malformed.
+absl::StatusOr<absl::Span<const char>> FindResource(
+    absl::Span<const char> fork, uint32_t type);
+
+#endif  // __RESOURCE_FORK_H__
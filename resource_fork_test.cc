@@ -0,0 +1,123 @@
+#include "resource_fork.h"
+
+#include <string>
+#include <vector>
+
+#include "endian.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+struct TestResource {
+  uint32_t type;
+  int16_t id;
+  std::string data;
+};
+
+// A resource fork holding `resources`, which must be grouped by type.
+std::vector<char> ResourceFork(const std::vector<TestResource>& resources) {
+  std::vector<char> data;
+  std::vector<uint32_t> data_offsets;
+  for (const TestResource& r : resources) {
+    data_offsets.push_back(data.size());
+    char length[4];
+    WriteBigEndian4(r.data.size(), length);
+    data.insert(data.end(), length, length + 4);
+    data.insert(data.end(), r.data.begin(), r.data.end());
+  }
+  std::vector<uint32_t> types;
+  for (const TestResource& r : resources) {
+    if (types.empty() || types.back() != r.type) types.push_back(r.type);
+  }
+  // Map: 16-byte header copy, handle, file ref, attributes, type list
+  // offset, name list offset; then the type list and reference lists.
+  std::vector<char> map(28, 0);
+  WriteBigEndian2(28, map.data() + 24);
+  const size_t type_list = map.size();
+  map.resize(type_list + 2 + 8 * types.size());
+  WriteBigEndian2(types.size() - 1, map.data() + type_list);
+  size_t r = 0;
+  for (size_t t = 0; t < types.size(); ++t) {
+    char* entry = map.data() + type_list + 2 + 8 * t;
+    const size_t first = r;
+    while (r < resources.size() && resources[r].type == types[t]) ++r;
+    WriteBigEndian4(types[t], entry);
+    WriteBigEndian2(r - first - 1, entry + 4);
+    WriteBigEndian2(map.size() - type_list, entry + 6);
+    for (size_t i = first; i < r; ++i) {
+      char reference[12] = {};
+      WriteBigEndian2(resources[i].id, reference);
+      WriteBigEndian2(0xffff, reference + 2);
+      WriteBigEndian4(data_offsets[i], reference + 4);
+      map.insert(map.end(), reference, reference + 12);
+    }
+  }
+  std::vector<char> fork(256, 0);
+  WriteBigEndian4(256, fork.data());
+  WriteBigEndian4(256 + data.size(), fork.data() + 4);
+  WriteBigEndian4(data.size(), fork.data() + 8);
+  WriteBigEndian4(map.size(), fork.data() + 12);
+  fork.insert(fork.end(), data.begin(), data.end());
+  fork.insert(fork.end(), map.begin(), map.end());
+  return fork;
+}
+
+std::string AsString(absl::Span<const char> s) {
+  return std::string(s.data(), s.size());
+}
+
+TEST(ResourceFork, FindsLowestId) {
+  const std::vector<char> fork =
+      ResourceFork({{ResourceType("STR "), 128, "string"},
+                    {ResourceType("bcem"), 129, "second"},
+                    {ResourceType("bcem"), 128, "first"}});
+  auto bcem = FindResource(fork, ResourceType("bcem"));
+  ASSERT_TRUE(bcem.ok()) << bcem.status();
+  EXPECT_EQ("first", AsString(*bcem));
+  auto str = FindResource(fork, ResourceType("STR "));
+  ASSERT_TRUE(str.ok()) << str.status();
+  EXPECT_EQ("string", AsString(*str));
+  EXPECT_EQ(absl::StatusCode::kNotFound,
+            FindResource(fork, ResourceType("vers")).status().code());
+}
+
+TEST(ResourceFork, AppleDouble) {
+  const std::vector<char> fork =
+      ResourceFork({{ResourceType("bcem"), 128, "map"}});
+  // Header with two entries: Finder info (9), then the resource fork (2).
+  std::vector<char> file(26 + 2 * 12 + 32, 0);
+  WriteBigEndian4(0x00051607, file.data());
+  WriteBigEndian4(0x00020000, file.data() + 4);
+  WriteBigEndian2(2, file.data() + 24);
+  WriteBigEndian4(9, file.data() + 26);
+  WriteBigEndian4(26 + 24, file.data() + 30);
+  WriteBigEndian4(32, file.data() + 34);
+  WriteBigEndian4(2, file.data() + 38);
+  WriteBigEndian4(file.size(), file.data() + 42);
+  WriteBigEndian4(fork.size(), file.data() + 46);
+  file.insert(file.end(), fork.begin(), fork.end());
+
+  auto found = ResourceForkOf(file);
+  ASSERT_TRUE(found.ok()) << found.status();
+  EXPECT_EQ(fork.size(), found->size());
+  auto bcem = FindResource(*found, ResourceType("bcem"));
+  ASSERT_TRUE(bcem.ok()) << bcem.status();
+  EXPECT_EQ("map", AsString(*bcem));
+
+  // A bare fork is its own resource fork.
+  auto bare = ResourceForkOf(fork);
+  ASSERT_TRUE(bare.ok());
+  EXPECT_EQ(fork.data(), bare->data());
+}
+
+TEST(ResourceFork, Malformed) {
+  std::vector<char> fork = ResourceFork({{ResourceType("bcem"), 128, "x"}});
+  WriteBigEndian4(fork.size(), fork.data() + 4);  // map beyond the end
+  EXPECT_EQ(absl::StatusCode::kDataLoss,
+            FindResource(fork, ResourceType("bcem")).status().code());
+  EXPECT_EQ(absl::StatusCode::kNotFound,
+            FindResource({}, ResourceType("bcem")).status().code());
+}
+
+}  // namespace
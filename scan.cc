@@ -0,0 +1,143 @@
+#include "scan.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/types/span.h"
+#include "file_copy.h"
+#include "image_source.h"
+
+namespace {
+
+// `field` quoted if it holds a comma, quote or line break.
+std::string CsvField(const absl::string_view field) {
+  if (field.find_first_of(",\"\r\n") == absl::string_view::npos) {
+    return std::string(field);
+  }
+  std::string quoted = "\"";
+  for (const char c : field) {
+    if (c == '"') quoted += '"';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+}  // namespace
+
+ScanRecord ScanImage(const std::string& path) {
+  ScanRecord record;
+  record.path = path;
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    record.status =
+        absl::NotFoundError(absl::StrCat("Could not open '", path, "'"));
+    return record;
+  }
+  absl::Cleanup close_fd = [fd] { close(fd); };
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    record.status =
+        absl::NotFoundError(absl::StrCat("Could not stat '", path, "'"));
+    return record;
+  }
+  record.file_size = st.st_size;
+
+  char bytes[kScanBytes];
+  auto read = ReadFully(fd, 0, bytes, sizeof(bytes));
+  if (!read.ok()) {
+    record.status = read.status();
+    return record;
+  }
+  MemoryImageSource source(absl::MakeConstSpan(bytes, *read));
+  auto header = DiskCopyHeader::ReadFromDisk(source);
+  if (!header.ok()) {
+    record.status = header.status();
+    return record;
+  }
+  record.header = *header;
+  auto expected_size = header->Validate();
+  if (!expected_size.ok()) {
+    record.status = expected_size.status();
+  } else if (*expected_size != *record.file_size) {
+    record.status = absl::DataLossError(
+        absl::StrFormat("File is %d bytes; the header describes %d",
+                        *record.file_size, *expected_size));
+  }
+  // The MDB is logical block 2 of the data section.
+  const size_t mdb_offset = DiskCopyHeader::kHeaderLength +
+                            HFSMasterDirectoryBlock::kMDBBlock *
+                                HFSMasterDirectoryBlock::kHFSBlockSize;
+  if (*read >= kScanBytes) {
+    auto mdb = HFSMasterDirectoryBlock::FromBlock(
+        absl::MakeConstSpan(bytes + mdb_offset, kScanBytes - mdb_offset));
+    if (mdb.ok() && mdb->Valid().ok()) record.mdb = *mdb;
+  }
+  return record;
+}
+
+std::vector<ScanRecord> ScanImages(const std::vector<std::string>& paths,
+                                   const int jobs) {
+  std::vector<ScanRecord> records(paths.size());
+  if (paths.empty()) return records;
+  std::atomic<size_t> next{0};
+  auto worker = [&]() {
+    for (size_t i = next++; i < paths.size(); i = next++) {
+      records[i] = ScanImage(paths[i]);
+    }
+  };
+  const size_t threads =
+      std::clamp<size_t>(std::max(jobs, 1), 1, paths.size());
+  std::vector<std::thread> workers;
+  for (size_t j = 1; j < threads; ++j) workers.emplace_back(worker);
+  worker();
+  for (auto& w : workers) w.join();
+  return records;
+}
+
+void WriteScanCsv(const std::vector<ScanRecord>& records, std::ostream& out) {
+  out << "path,status,file_size,expected_size,name,data_size,tag_size,"
+         "data_checksum,tag_checksum,disk_format,format_byte,volume_name,"
+         "volume_blocks,files,folders,error\n";
+  for (const ScanRecord& r : records) WriteScanCsvRow(r, out);
+}
+
+void WriteScanCsvRow(const ScanRecord& r, std::ostream& out) {
+  std::vector<std::string> fields;
+  fields.push_back(CsvField(r.path));
+  fields.push_back(r.status.ok() ? "OK"
+                                 : absl::StatusCodeToString(r.status.code()));
+  fields.push_back(r.file_size ? absl::StrCat(*r.file_size) : "");
+  if (r.header.has_value()) {
+    const DiskCopyHeader& h = *r.header;
+    fields.push_back(absl::StrCat(h.TotalFileSize()));
+    fields.push_back(CsvField(h.Name()));
+    fields.push_back(absl::StrCat(h.DataSize()));
+    fields.push_back(absl::StrCat(h.TagSize()));
+    fields.push_back(absl::StrFormat("%08x", h.ExpectedDataChecksum()));
+    fields.push_back(absl::StrFormat("%08x", h.ExpectedTagChecksum()));
+    fields.push_back(absl::StrFormat("%d", h.DiskFormatCode()));
+    fields.push_back(absl::StrFormat("0x%02x", h.FormatByteCode()));
+  } else {
+    fields.resize(fields.size() + 8);
+  }
+  if (r.mdb.has_value()) {
+    auto name = r.mdb->VolumeName();
+    fields.push_back(name.ok() ? CsvField(*name) : "");
+    fields.push_back(absl::StrCat(*r.mdb->Valid()));
+    fields.push_back(absl::StrCat(r.mdb->file_count()));
+    fields.push_back(absl::StrCat(r.mdb->directory_count()));
+  } else {
+    fields.resize(fields.size() + 4);
+  }
+  fields.push_back(CsvField(r.status.message()));
+  out << absl::StrJoin(fields, ",") << '\n';
+}
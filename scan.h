@@ -0,0 +1,57 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+// A census of many DC42 files from their headers alone: the header fields,
+// whether the file is as long as the header says, and the HFS volume
+// described by the MDB. Each image costs one small read, never its data
+// section, so an archive of a million images is scanned in minutes.
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "disk_copy.h"
+#include "hfs_basic.h"
+
+struct ScanRecord {
+  std::string path;
+  // OK, or why the file is not a sound DC42 file: it cannot be read, its
+  // header does not validate, or its size differs from the header's.
+  absl::Status status;
+  // The file size from stat(), if the file could be opened.
+  std::optional<uint64_t> file_size;
+  // The header, if the file holds one.
+  std::optional<DiskCopyHeader> header;
+  // The MDB, if the data section starts with an HFS volume.
+  std::optional<HFSMasterDirectoryBlock> mdb;
+};
+
+// Bytes of a DC42 file read by a scan: the header and the data section
+// through the MDB (logical block 2), in one read.
+inline constexpr size_t kScanBytes =
+    DiskCopyHeader::kHeaderLength + HFSMasterDirectoryBlock::kPrefixBytes;
+
+// Scans the DC42 file at `path`.
+ScanRecord ScanImage(const std::string& path);
+
+// Scans each of `paths` with `jobs` threads, returning the records in the
+// order of `paths`. Opening and stat() dominate the cost of a scan, so the
+// threads are what let the file system work on many images at once.
+std::vector<ScanRecord> ScanImages(const std::vector<std::string>& paths,
+                                   int jobs);
+
+// Writes `records` as CSV (RFC 4180, with a header line): path, status
+// ("OK" or the status code name), file_size, expected_size, name,
+// data_size, tag_size, data_checksum, tag_checksum (8 hex digits),
+// disk_format, format_byte, volume_name, volume_blocks, files, folders,
+// error. Fields that are unknown for a record are empty.
+void WriteScanCsv(const std::vector<ScanRecord>& records, std::ostream& out);
+
+// Writes the CSV line of one record, as WriteScanCsv does, without the
+// header line.
+void WriteScanCsvRow(const ScanRecord& record, std::ostream& out);
+
+#endif  // __SCAN_H__
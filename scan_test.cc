@@ -0,0 +1,108 @@
+#include "scan.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_split.h"
+#include "disk_copy.h"
+#include "endian.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test_images.h"
+
+namespace {
+
+using testing::HasSubstr;
+
+// Writes a DC42 file of an 800k HFS volume named `name` to `path`, `extra`
+// bytes longer than its header says.
+void WriteDiskCopy(const std::string& path, const std::string& name,
+                   const size_t extra = 0) {
+  std::vector<char> image = TestHFSImage(1600, 'x', name);
+  char* mdb = image.data() + 1024;
+  WriteBigEndian4(12, mdb + 84);  // files
+  WriteBigEndian4(3, mdb + 88);   // folders
+  std::vector<char> disk_copy = TestDiskCopy(image);
+  disk_copy.resize(disk_copy.size() + extra);
+  WriteFile(path, disk_copy);
+}
+
+TEST(Scan, ReadsHeaderAndVolume) {
+  const std::string path = testing::TempDir() + "/scan_good.dc42";
+  WriteDiskCopy(path, "Games");
+  const ScanRecord r = ScanImage(path);
+  EXPECT_TRUE(r.status.ok()) << r.status;
+  EXPECT_EQ(path, r.path);
+  EXPECT_EQ(84 + 1600 * 512, r.file_size);
+  ASSERT_TRUE(r.header.has_value());
+  EXPECT_EQ("Games", r.header->Name());
+  EXPECT_EQ(1600 * 512, r.header->DataSize());
+  EXPECT_EQ(1, r.header->DiskFormatCode());
+  ASSERT_TRUE(r.mdb.has_value());
+  EXPECT_EQ("Games", *r.mdb->VolumeName());
+  EXPECT_EQ(12, r.mdb->file_count());
+  EXPECT_EQ(3, r.mdb->directory_count());
+}
+
+TEST(Scan, ReportsEachProblem) {
+  const std::string dir = testing::TempDir();
+  WriteDiskCopy(dir + "/scan_long.dc42", "Long", 512);
+  std::ofstream(dir + "/scan_short.dc42") << "DC42";
+  {
+    // A valid header over a data section that is not HFS.
+    std::vector<char> disk_copy(84 + 1600 * 512);
+    auto header = DiskCopyHeader::CreateForHFS("Blank", 1600, 0);
+    ASSERT_TRUE(header.ok()) << header.status();
+    header->WriteToBuffer(disk_copy.data());
+    std::ofstream(dir + "/scan_blank.dc42", std::ios::binary)
+        .write(disk_copy.data(), disk_copy.size());
+  }
+  const std::vector<ScanRecord> records =
+      ScanImages({dir + "/scan_long.dc42", dir + "/scan_short.dc42",
+                  dir + "/scan_missing.dc42", dir + "/scan_blank.dc42"},
+                 3);
+  ASSERT_EQ(4, records.size());
+
+  EXPECT_EQ(absl::StatusCode::kDataLoss, records[0].status.code());
+  EXPECT_THAT(records[0].status.message(),
+              HasSubstr("819796 bytes; the header describes 819284"));
+  EXPECT_TRUE(records[0].mdb.has_value());
+
+  EXPECT_EQ(absl::StatusCode::kOutOfRange, records[1].status.code());
+  EXPECT_EQ(4, records[1].file_size);
+  EXPECT_FALSE(records[1].header.has_value());
+
+  EXPECT_EQ(absl::StatusCode::kNotFound, records[2].status.code());
+  EXPECT_FALSE(records[2].file_size.has_value());
+
+  EXPECT_TRUE(records[3].status.ok()) << records[3].status;
+  EXPECT_EQ("Blank", records[3].header->Name());
+  EXPECT_FALSE(records[3].mdb.has_value());
+}
+
+TEST(Scan, WritesCsv) {
+  const std::string path = testing::TempDir() + "/scan,csv.dc42";
+  WriteDiskCopy(path, "A \"quoted\" name");
+  std::ostringstream csv;
+  WriteScanCsv({ScanImage(path), ScanImage(path + ".missing")}, csv);
+  const std::vector<std::string> lines = absl::StrSplit(csv.str(), '\n');
+  ASSERT_EQ(4, lines.size());
+  EXPECT_EQ(
+      "path,status,file_size,expected_size,name,data_size,tag_size,"
+      "data_checksum,tag_checksum,disk_format,format_byte,volume_name,"
+      "volume_blocks,files,folders,error",
+      lines[0]);
+  EXPECT_THAT(lines[1], testing::StartsWith("\"" + path + "\",OK,819284,"
+                                            "819284,\"A \"\"quoted\"\" "
+                                            "name\",819200,0,"));
+  EXPECT_THAT(lines[1], testing::EndsWith(",1,0x22,\"A \"\"quoted\"\" "
+                                          "name\",1600,12,3,"));
+  EXPECT_THAT(lines[2], testing::StartsWith("\"" + path +
+                                            ".missing\",NOT_FOUND,,,,,,,,,,,"
+                                            ",,,\"Could not open"));
+  EXPECT_EQ("", lines[3]);
+}
+
+}  // namespace
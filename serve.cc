@@ -0,0 +1,442 @@
+#include "serve.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "endian.h"
+#include "image_source.h"
+#include "scan.h"
+
+namespace {
+
+constexpr size_t kLengthBytes = 4;
+
+void AppendBigEndian2(const uint16_t value, std::string& out) {
+  char bytes[2];
+  WriteBigEndian2(value, bytes);
+  out.append(bytes, 2);
+}
+
+void AppendBigEndian4(const uint32_t value, std::string& out) {
+  char bytes[4];
+  WriteBigEndian4(value, bytes);
+  out.append(bytes, 4);
+}
+
+// Reserves the length of a frame at the end of `frame`; FinishFrame fills
+// it in once the payload has been appended.
+size_t StartFrame(std::string& frame) {
+  const size_t start = frame.size();
+  frame.append(kLengthBytes, '\0');
+  return start;
+}
+
+void FinishFrame(const size_t start, std::string& frame) {
+  WriteBigEndian4(frame.size() - start - kLengthBytes, frame.data() + start);
+}
+
+// Reads the fields of a payload in order, failing once it runs out.
+class PayloadReader {
+ public:
+  explicit PayloadReader(const std::string_view payload) : rest_(payload) {}
+
+  absl::StatusOr<uint8_t> Byte() {
+    auto bytes = Take(1);
+    if (!bytes.ok()) return bytes.status();
+    return static_cast<uint8_t>((*bytes)[0]);
+  }
+  // A string after a length of `length_bytes` (2 or 4).
+  absl::StatusOr<std::string_view> String(const size_t length_bytes) {
+    auto length_field = Take(length_bytes);
+    if (!length_field.ok()) return length_field.status();
+    const uint32_t length = length_bytes == 2
+                                ? BigEndian2(length_field->data())
+                                : BigEndian4(length_field->data());
+    return Take(length);
+  }
+  std::string_view Rest() const { return rest_; }
+
+ private:
+  absl::StatusOr<std::string_view> Take(const size_t n) {
+    if (rest_.size() < n) {
+      return absl::InvalidArgumentError(absl::StrFormat(
+          "Payload ends %d bytes short of a field", n - rest_.size()));
+    }
+    const std::string_view taken = rest_.substr(0, n);
+    rest_.remove_prefix(n);
+    return taken;
+  }
+
+  std::string_view rest_;
+};
+
+#ifdef __linux__
+// No SIGPIPE if the other side has gone; the error is enough.
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+// Sockets are made with SO_NOSIGPIPE instead, where there is one.
+constexpr int kSendFlags = 0;
+
+// Marks a new socket close-on-exec, and asks it not to raise SIGPIPE.
+int ConfigureSocket(const int fd) {
+  if (fd < 0) return fd;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+  const int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+  return fd;
+}
+#endif  // __linux__
+
+// A new close-on-exec Unix stream socket, or -1 with errno set.
+int UnixSocket() {
+#ifdef __linux__
+  return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+  return ConfigureSocket(socket(AF_UNIX, SOCK_STREAM, 0));
+#endif
+}
+
+// Accepts a connection on `listen_fd` as a close-on-exec socket, or
+// returns -1 with errno set.
+int AcceptConnection(const int listen_fd) {
+#ifdef __linux__
+  return accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+#else
+  return ConfigureSocket(accept(listen_fd, nullptr, nullptr));
+#endif
+}
+
+absl::Status SendAll(const int fd, const std::string& bytes) {
+  size_t sent = 0;
+  while (sent < bytes.size()) {
+    const ssize_t n =
+        send(fd, bytes.data() + sent, bytes.size() - sent, kSendFlags);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      return absl::UnavailableError(
+          absl::StrCat("Could not send: ", strerror(errno)));
+    }
+    sent += n;
+  }
+  return absl::OkStatus();
+}
+
+// Reads exactly `length` bytes into `buf`. Returns false if the connection
+// was closed before the first of them.
+absl::StatusOr<bool> ReceiveAll(const int fd, char* buf, const size_t length) {
+  size_t received = 0;
+  while (received < length) {
+    const ssize_t n = recv(fd, buf + received, length - received, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      return absl::UnavailableError(
+          absl::StrCat("Could not receive: ", strerror(errno)));
+    }
+    if (n == 0) {
+      if (received == 0) return false;
+      return absl::UnavailableError(absl::StrFormat(
+          "Connection closed %d bytes into a %d byte read", received, length));
+    }
+    received += n;
+  }
+  return true;
+}
+
+// Reads the next frame's payload into `payload`, reusing its memory.
+// Returns false if the connection was closed between frames.
+absl::StatusOr<bool> ReceiveFrame(const int fd, std::string& payload) {
+  char length_bytes[kLengthBytes];
+  auto more = ReceiveAll(fd, length_bytes, kLengthBytes);
+  if (!more.ok() || !*more) return more;
+  const uint32_t length = BigEndian4(length_bytes);
+  if (length > kMaxServeFrame) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "Frame of %d bytes is larger than the %d allowed", length,
+        kMaxServeFrame));
+  }
+  payload.resize(length);
+  more = ReceiveAll(fd, payload.data(), length);
+  if (!more.ok()) return more;
+  if (!*more && length > 0) {
+    return absl::UnavailableError("Connection closed before a payload");
+  }
+  return true;
+}
+
+absl::StatusOr<sockaddr_un> SocketAddress(const std::string_view path) {
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "Socket path '%s' must be 1 to %d bytes", path,
+        sizeof(address.sun_path) - 1));
+  }
+  memcpy(address.sun_path, path.data(), path.size());
+  return address;
+}
+
+}  // namespace
+
+void AppendServeRequest(const ServeRequest& request, std::string& frame) {
+  const size_t start = StartFrame(frame);
+  frame += static_cast<char>(request.op);
+  uint8_t flags = static_cast<uint8_t>(request.sparse) << 4;
+  if (request.ignore_data_checksum) flags |= kServeIgnoreDataChecksum;
+  if (!request.kernel_copy) flags |= kServeNoKernelCopy;
+  if (!request.skip_first_tag) flags |= kServeSumFirstTag;
+  frame += static_cast<char>(flags);
+  for (const std::string* path : {&request.input, &request.output}) {
+    AppendBigEndian2(path->size(), frame);
+    frame += *path;
+  }
+  FinishFrame(start, frame);
+}
+
+void AppendServeResponse(const ServeResponse& response, std::string& frame) {
+  const size_t start = StartFrame(frame);
+  frame += static_cast<char>(response.status.code());
+  const std::string_view message = response.status.message();
+  AppendBigEndian4(message.size(), frame);
+  frame.append(message.data(), message.size());
+  frame += response.body;
+  FinishFrame(start, frame);
+}
+
+absl::StatusOr<ServeRequest> ParseServeRequest(const std::string_view payload) {
+  PayloadReader reader(payload);
+  auto op = reader.Byte();
+  if (!op.ok()) return op.status();
+  if (*op < static_cast<uint8_t>(ServeOp::CREATE) ||
+      *op > static_cast<uint8_t>(ServeOp::SCAN)) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("Unrecognized operation %d", *op));
+  }
+  auto flags = reader.Byte();
+  if (!flags.ok()) return flags.status();
+  if ((*flags >> 4) > static_cast<uint8_t>(SparseMode::UNALLOCATED)) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("Unrecognized sparse mode %d", *flags >> 4));
+  }
+  auto input = reader.String(2);
+  if (!input.ok()) return input.status();
+  auto output = reader.String(2);
+  if (!output.ok()) return output.status();
+  if (!reader.Rest().empty()) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "%d bytes after the end of the request", reader.Rest().size()));
+  }
+  ServeRequest request;
+  request.op = static_cast<ServeOp>(*op);
+  request.input = std::string(*input);
+  request.output = std::string(*output);
+  request.ignore_data_checksum = *flags & kServeIgnoreDataChecksum;
+  request.kernel_copy = !(*flags & kServeNoKernelCopy);
+  request.skip_first_tag = !(*flags & kServeSumFirstTag);
+  request.sparse = static_cast<SparseMode>(*flags >> 4);
+  return request;
+}
+
+absl::StatusOr<ServeResponse> ParseServeResponse(
+    const std::string_view payload) {
+  PayloadReader reader(payload);
+  auto code = reader.Byte();
+  if (!code.ok()) return code.status();
+  auto message = reader.String(4);
+  if (!message.ok()) return message.status();
+  ServeResponse response;
+  response.status =
+      absl::Status(static_cast<absl::StatusCode>(*code), *message);
+  response.body = std::string(reader.Rest());
+  return response;
+}
+
+ServeResponse HandleServeRequest(const ServeRequest& request) {
+  ServeResponse response;
+  if (request.input == kStandardStreamPath ||
+      request.output == kStandardStreamPath) {
+    response.status = absl::InvalidArgumentError(
+        "The server cannot use standard input or output");
+    return response;
+  }
+  switch (request.op) {
+    case ServeOp::CREATE:
+      response.status = CreateCommand(request.input, request.output, false);
+      break;
+    case ServeOp::EXTRACT: {
+      auto size = ExtractCommand(request.input, request.output,
+                                 request.ignore_data_checksum,
+                                 request.kernel_copy, request.sparse, false);
+      response.status = size.status();
+      if (size.ok()) AppendBigEndian4(*size, response.body);
+    } break;
+    case ServeOp::VERIFY:
+      response.status =
+          VerifyCommand(request.input, request.skip_first_tag, false);
+      break;
+    case ServeOp::SCAN: {
+      const ScanRecord record = ScanImage(request.input);
+      response.status = record.status;
+      std::ostringstream row;
+      WriteScanCsvRow(record, row);
+      response.body = row.str();
+    } break;
+  }
+  return response;
+}
+
+// static
+absl::StatusOr<std::unique_ptr<ServeServer>> ServeServer::Listen(
+    const std::string_view socket_path) {
+  auto address = SocketAddress(socket_path);
+  if (!address.ok()) return address.status();
+  const std::string path(socket_path);
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      return absl::AlreadyExistsError(
+          absl::StrCat("'", path, "' exists and is not a socket"));
+    }
+    unlink(path.c_str());
+  }
+  const int fd = UnixSocket();
+  if (fd < 0) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not create a socket: ", strerror(errno)));
+  }
+  if (bind(fd, reinterpret_cast<const sockaddr*>(&*address),
+           sizeof(*address)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    const int error = errno;
+    close(fd);
+    return absl::ResourceExhaustedError(absl::StrCat(
+        "Could not listen on '", path, "': ", strerror(error)));
+  }
+  return std::unique_ptr<ServeServer>(new ServeServer(fd, path));
+}
+
+ServeServer::ServeServer(const int listen_fd, std::string socket_path)
+    : listen_fd_(listen_fd), socket_path_(std::move(socket_path)) {}
+
+ServeServer::~ServeServer() {
+  close(listen_fd_);
+  unlink(socket_path_.c_str());
+}
+
+void ServeServer::Run(const int jobs) {
+  auto worker = [this]() {
+    // Kept across connections, so a warm worker allocates nothing for a
+    // request.
+    std::string payload;
+    std::string frame;
+    while (!stopping_) {
+      const int fd = AcceptConnection(listen_fd_);
+      if (fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        break;  // Shut down, or the listener is unusable.
+      }
+      {
+        absl::MutexLock lock(&mu_);
+        if (stopping_) {
+          close(fd);
+          break;
+        }
+        connections_.insert(fd);
+      }
+      ServeConnection(fd, payload, frame);
+      absl::MutexLock lock(&mu_);
+      connections_.erase(fd);
+      close(fd);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int j = 1; j < jobs; ++j) workers.emplace_back(worker);
+  worker();
+  for (auto& w : workers) w.join();
+}
+
+void ServeServer::Shutdown() {
+  absl::MutexLock lock(&mu_);
+  stopping_ = true;
+  // Wakes the threads waiting in accept(), and ends each connection at its
+  // next read.
+  shutdown(listen_fd_, SHUT_RDWR);
+  for (const int fd : connections_) shutdown(fd, SHUT_RD);
+}
+
+void ServeServer::ServeConnection(const int fd, std::string& payload,
+                                  std::string& frame) {
+  while (true) {
+    auto more = ReceiveFrame(fd, payload);
+    ServeResponse response;
+    if (!more.ok()) {
+      // The stream cannot be followed past a bad frame; say why and close.
+      response.status = more.status();
+    } else if (!*more) {
+      return;
+    } else {
+      auto request = ParseServeRequest(payload);
+      if (request.ok()) {
+        response = HandleServeRequest(*request);
+        ++requests_served_;
+      } else {
+        response.status = request.status();
+      }
+    }
+    frame.clear();
+    AppendServeResponse(response, frame);
+    if (!SendAll(fd, frame).ok() || !more.ok()) return;
+  }
+}
+
+// static
+absl::StatusOr<std::unique_ptr<ServeClient>> ServeClient::Connect(
+    const std::string_view socket_path) {
+  auto address = SocketAddress(socket_path);
+  if (!address.ok()) return address.status();
+  const int fd = UnixSocket();
+  if (fd < 0) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Could not create a socket: ", strerror(errno)));
+  }
+  if (connect(fd, reinterpret_cast<const sockaddr*>(&*address),
+              sizeof(*address)) != 0) {
+    const int error = errno;
+    close(fd);
+    return absl::UnavailableError(absl::StrCat(
+        "Could not connect to '", socket_path, "': ", strerror(error)));
+  }
+  return std::unique_ptr<ServeClient>(new ServeClient(fd));
+}
+
+ServeClient::~ServeClient() { close(fd_); }
+
+absl::StatusOr<ServeResponse> ServeClient::Call(const ServeRequest& request) {
+  if (request.input.size() > UINT16_MAX || request.output.size() > UINT16_MAX) {
+    return absl::InvalidArgumentError("Paths are limited to 65535 bytes");
+  }
+  frame_.clear();
+  AppendServeRequest(request, frame_);
+  auto sent = SendAll(fd_, frame_);
+  if (!sent.ok()) return sent;
+  auto received = ReceiveFrame(fd_, payload_);
+  if (!received.ok()) return received.status();
+  if (!*received) {
+    return absl::UnavailableError("The server closed the connection");
+  }
+  return ParseServeResponse(payload_);
+}
@@ -0,0 +1,141 @@
+#ifndef __SERVE_H__
+#define __SERVE_H__
+
+// A long-running disk_copy process answering create, extract, verify and
+// scan requests over a Unix domain socket, for callers (such as CI hooks)
+// that would otherwise start the tool, and parse its flags, once per image.
+//
+// Each request and each response is a frame: a 4-byte length, then that
+// many bytes of payload. A connection carries any number of requests, each
+// answered in turn, until the client closes it. All integers are
+// big-endian.
+//
+// A request payload is
+//   1 byte   operation (ServeOp)
+//   1 byte   flags (the kServe... bits below)
+//   2 bytes  length of the input path, then the path
+//   2 bytes  length of the output path, then the path
+// The paths are as for BatchEntry: create reads the raw image `input` and
+// writes the DC42 file `output`; extract the other way around; verify and
+// scan read the DC42 file `input` and ignore `output`.
+//
+// A response payload is
+//   1 byte   absl::StatusCode of the result
+//   4 bytes  length of the status message, then the message
+//   the rest: for a successful extract, the 4-byte image size; for scan,
+//            the CSV line of the image (see WriteScanCsvRow), whatever the
+//            status; otherwise nothing.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "disk_copy_commands.h"
+
+enum class ServeOp : uint8_t { CREATE = 1, EXTRACT = 2, VERIFY = 3, SCAN = 4 };
+
+// Request flag bits. Bits 4 and 5 hold the SparseMode of an extract.
+inline constexpr uint8_t kServeIgnoreDataChecksum = 0x01;
+inline constexpr uint8_t kServeNoKernelCopy = 0x02;
+inline constexpr uint8_t kServeSumFirstTag = 0x04;
+
+// The largest payload either side accepts.
+inline constexpr size_t kMaxServeFrame = 1 << 20;
+
+struct ServeRequest {
+  ServeOp op = ServeOp::VERIFY;
+  std::string input;
+  std::string output;
+  // As for ExtractCommand and VerifyCommand.
+  bool ignore_data_checksum = false;
+  bool kernel_copy = true;
+  SparseMode sparse = SparseMode::NONE;
+  bool skip_first_tag = true;
+};
+
+struct ServeResponse {
+  absl::Status status;
+  std::string body;
+};
+
+// Append the whole frame (length and payload) to `frame`.
+void AppendServeRequest(const ServeRequest& request, std::string& frame);
+void AppendServeResponse(const ServeResponse& response, std::string& frame);
+
+// Parse a payload, without its length. Return an error if it is malformed.
+absl::StatusOr<ServeRequest> ParseServeRequest(std::string_view payload);
+absl::StatusOr<ServeResponse> ParseServeResponse(std::string_view payload);
+
+// Runs `request` through the same functions as the command line (without
+// their verbose output). Standard input and output are the server's, so
+// kStandardStreamPath is refused.
+ServeResponse HandleServeRequest(const ServeRequest& request);
+
+class ServeServer {
+ public:
+  // Listens on a new socket at `socket_path`, replacing a socket left there
+  // by an earlier server (but no other kind of file).
+  static absl::StatusOr<std::unique_ptr<ServeServer>> Listen(
+      std::string_view socket_path);
+
+  ServeServer(const ServeServer&) = delete;
+  ServeServer& operator=(const ServeServer&) = delete;
+  // Closes the socket and removes its file.
+  ~ServeServer();
+
+  // Serves connections on `jobs` threads, each taking one connection at a
+  // time and keeping its buffers from one request to the next, until
+  // Shutdown. Returns once every thread has finished.
+  void Run(int jobs);
+  // Stops accepting connections and ends the open ones after the request
+  // each is running, if any. May be called from any thread, before or
+  // during Run.
+  void Shutdown();
+
+  uint64_t requests_served() const { return requests_served_; }
+
+ private:
+  ServeServer(int listen_fd, std::string socket_path);
+
+  // Answers requests on `fd` until the client closes it or Shutdown.
+  void ServeConnection(int fd, std::string& payload, std::string& frame);
+
+  const int listen_fd_;
+  const std::string socket_path_;
+  std::atomic<bool> stopping_{false};
+  std::atomic<uint64_t> requests_served_{0};
+  absl::Mutex mu_;
+  absl::flat_hash_set<int> connections_ ABSL_GUARDED_BY(mu_);
+};
+
+// A connection to a ServeServer, for one thread at a time.
+class ServeClient {
+ public:
+  static absl::StatusOr<std::unique_ptr<ServeClient>> Connect(
+      std::string_view socket_path);
+
+  ServeClient(const ServeClient&) = delete;
+  ServeClient& operator=(const ServeClient&) = delete;
+  ~ServeClient();
+
+  // Sends `request` and waits for its response. An error is a failure to
+  // talk to the server; the result of the request is in the response.
+  absl::StatusOr<ServeResponse> Call(const ServeRequest& request);
+
+ private:
+  explicit ServeClient(int fd) : fd_(fd) {}
+
+  const int fd_;
+  std::string frame_;
+  std::string payload_;
+};
+
+#endif  // __SERVE_H__
@@ -0,0 +1,193 @@
+#include "serve.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include "endian.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test_images.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+using testing::HasSubstr;
+using testing::StartsWith;
+
+// The payload of the single frame in `frame`.
+std::string Payload(const std::string& frame) {
+  EXPECT_EQ(frame.size() - 4, BigEndian4(frame.data()));
+  return frame.substr(4);
+}
+
+// A request with the default options.
+ServeRequest Request(const ServeOp op, const std::string& input,
+                     const std::string& output = "") {
+  ServeRequest request;
+  request.op = op;
+  request.input = input;
+  request.output = output;
+  return request;
+}
+
+TEST(ServeProtocol, RequestRoundTrip) {
+  ServeRequest request;
+  request.op = ServeOp::EXTRACT;
+  request.input = "in.dc42";
+  request.output = "out.img";
+  request.ignore_data_checksum = true;
+  request.kernel_copy = false;
+  request.sparse = SparseMode::UNALLOCATED;
+  request.skip_first_tag = false;
+  std::string frame;
+  AppendServeRequest(request, frame);
+  // Length, operation, flags, then each path after its length.
+  EXPECT_EQ(4 + 2 + 2 + 7 + 2 + 7, frame.size());
+  EXPECT_EQ(0x27, static_cast<uint8_t>(frame[5]));
+
+  auto parsed = ParseServeRequest(Payload(frame));
+  ASSERT_TRUE(parsed.ok()) << parsed.status();
+  EXPECT_EQ(ServeOp::EXTRACT, parsed->op);
+  EXPECT_EQ("in.dc42", parsed->input);
+  EXPECT_EQ("out.img", parsed->output);
+  EXPECT_TRUE(parsed->ignore_data_checksum);
+  EXPECT_FALSE(parsed->kernel_copy);
+  EXPECT_EQ(SparseMode::UNALLOCATED, parsed->sparse);
+  EXPECT_FALSE(parsed->skip_first_tag);
+}
+
+TEST(ServeProtocol, ResponseRoundTrip) {
+  std::string frame;
+  AppendServeResponse({absl::DataLossError("bad sum"), "body"}, frame);
+  auto parsed = ParseServeResponse(Payload(frame));
+  ASSERT_TRUE(parsed.ok()) << parsed.status();
+  EXPECT_EQ(absl::DataLossError("bad sum"), parsed->status);
+  EXPECT_EQ("body", parsed->body);
+}
+
+TEST(ServeProtocol, RejectsMalformedRequests) {
+  std::string frame;
+  AppendServeRequest(ServeRequest{}, frame);
+  const std::string payload = Payload(frame);
+  EXPECT_FALSE(ParseServeRequest("").ok());
+  EXPECT_FALSE(ParseServeRequest(payload.substr(0, payload.size() - 1)).ok());
+  EXPECT_FALSE(ParseServeRequest(payload + "x").ok());
+  std::string bad_op = payload;
+  bad_op[0] = 9;
+  EXPECT_FALSE(ParseServeRequest(bad_op).ok());
+  std::string bad_sparse = payload;
+  bad_sparse[1] = 0x30;
+  EXPECT_FALSE(ParseServeRequest(bad_sparse).ok());
+}
+
+class ServeTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    root_ = testing::TempDir() + "/serve_test";
+    fs::remove_all(root_);
+    fs::create_directories(root_);
+    WriteFile(root_ + "/a.img", TestHFSImage(1600, 'h', "Serve"));
+    socket_path_ = root_ + "/serve.sock";
+    auto server = ServeServer::Listen(socket_path_);
+    ASSERT_TRUE(server.ok()) << server.status();
+    server_ = *std::move(server);
+    runner_ = std::thread([this] { server_->Run(2); });
+  }
+
+  void TearDown() override {
+    server_->Shutdown();
+    runner_.join();
+  }
+
+  std::string root_;
+  std::string socket_path_;
+  std::unique_ptr<ServeServer> server_;
+  std::thread runner_;
+};
+
+TEST_F(ServeTest, RunsCommandsOnOneConnection) {
+  auto client = ServeClient::Connect(socket_path_);
+  ASSERT_TRUE(client.ok()) << client.status();
+
+  const ServeRequest create =
+      Request(ServeOp::CREATE, root_ + "/a.img", root_ + "/a.dc42");
+  auto response = (*client)->Call(create);
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_TRUE(response->status.ok()) << response->status;
+
+  response = (*client)->Call(Request(ServeOp::VERIFY, root_ + "/a.dc42"));
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_TRUE(response->status.ok()) << response->status;
+  EXPECT_EQ("", response->body);
+
+  response = (*client)->Call(Request(ServeOp::SCAN, root_ + "/a.dc42"));
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_TRUE(response->status.ok()) << response->status;
+  EXPECT_THAT(response->body, StartsWith(root_ + "/a.dc42,OK,819284,"));
+
+  const ServeRequest extract =
+      Request(ServeOp::EXTRACT, root_ + "/a.dc42", root_ + "/b.img");
+  response = (*client)->Call(extract);
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_TRUE(response->status.ok()) << response->status;
+  ASSERT_EQ(4, response->body.size());
+  EXPECT_EQ(1600 * 512, BigEndian4(response->body.data()));
+  EXPECT_EQ(ReadFile(root_ + "/a.img"), ReadFile(root_ + "/b.img"));
+  EXPECT_EQ(4, server_->requests_served());
+}
+
+TEST_F(ServeTest, ErrorsKeepTheConnection) {
+  auto client = ServeClient::Connect(socket_path_);
+  ASSERT_TRUE(client.ok()) << client.status();
+  auto response =
+      (*client)->Call(Request(ServeOp::VERIFY, root_ + "/missing.dc42"));
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_EQ(absl::StatusCode::kNotFound, response->status.code());
+
+  response = (*client)->Call(Request(ServeOp::EXTRACT, root_ + "/a.dc42", "-"));
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument, response->status.code());
+  EXPECT_THAT(response->status.message(), HasSubstr("standard"));
+
+  // A failed scan still describes the image.
+  response = (*client)->Call(Request(ServeOp::SCAN, root_ + "/a.img"));
+  ASSERT_TRUE(response.ok()) << response.status();
+  EXPECT_FALSE(response->status.ok());
+  EXPECT_THAT(response->body, StartsWith(root_ + "/a.img,"));
+}
+
+TEST_F(ServeTest, ServesConnectionsConcurrently) {
+  // The first connection stays open and idle while the second is served.
+  auto idle = ServeClient::Connect(socket_path_);
+  ASSERT_TRUE(idle.ok()) << idle.status();
+  auto client = ServeClient::Connect(socket_path_);
+  ASSERT_TRUE(client.ok()) << client.status();
+  auto response = (*client)->Call(Request(ServeOp::SCAN, root_ + "/a.img"));
+  ASSERT_TRUE(response.ok()) << response.status();
+}
+
+TEST(ServeServer, ReplacesOnlyASocket) {
+  const std::string path = testing::TempDir() + "/serve_replace.sock";
+  fs::remove(path);
+  {
+    auto first = ServeServer::Listen(path);
+    ASSERT_TRUE(first.ok()) << first.status();
+    // A socket left by a server that did not clean up.
+    ASSERT_EQ(0, rename(path.c_str(), (path + ".old").c_str()));
+  }
+  ASSERT_EQ(0, rename((path + ".old").c_str(), path.c_str()));
+  auto second = ServeServer::Listen(path);
+  ASSERT_TRUE(second.ok()) << second.status();
+  second->reset();
+  EXPECT_FALSE(fs::exists(path));
+
+  std::ofstream(path) << "not a socket";
+  auto third = ServeServer::Listen(path);
+  EXPECT_EQ(absl::StatusCode::kAlreadyExists, third.status().code());
+  EXPECT_TRUE(fs::exists(path));
+}
+
+}  // namespace
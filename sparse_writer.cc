@@ -0,0 +1,135 @@
+#include "sparse_writer.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "absl/strings/str_format.h"
+#include "absl/types/span.h"
+#include "file_copy.h"
+
+namespace {
+
+constexpr char kZeroSector[512] = {};
+
+}  // namespace
+
+SparseImageWriter::SparseImageWriter(const int fd, const bool skip_unallocated)
+    : fd_(fd), skip_unallocated_(skip_unallocated) {
+  partial_.reserve(kSectorSize);
+}
+
+absl::Status SparseImageWriter::Write(const char* chunk, size_t chunk_size) {
+  if (!partial_.empty()) {
+    const size_t n = std::min(chunk_size, kSectorSize - partial_.size());
+    partial_.insert(partial_.end(), chunk, chunk + n);
+    chunk += n;
+    chunk_size -= n;
+    if (partial_.size() < kSectorSize) return absl::OkStatus();
+    auto status = WriteSectors(partial_.data(), kSectorSize);
+    partial_.clear();
+    if (!status.ok()) return status;
+  }
+  const size_t whole = chunk_size - chunk_size % kSectorSize;
+  auto status = WriteSectors(chunk, whole);
+  partial_.assign(chunk + whole, chunk + chunk_size);
+  return status;
+}
+
+absl::Status SparseImageWriter::WriteSectors(const char* bytes,
+                                             const size_t size) {
+  // Consecutive sectors that are not holes go out in one write.
+  auto write_run = [&](const size_t begin, const size_t end) {
+    if (begin == end) return absl::OkStatus();
+    if (seek_needed_) {
+      if (lseek(fd_, position_ + begin, SEEK_SET) < 0) {
+        return absl::ResourceExhaustedError(absl::StrFormat(
+            "Could not seek output to %d: %s", position_ + begin,
+            strerror(errno)));
+      }
+      seek_needed_ = false;
+    }
+    bytes_written_ += end - begin;
+    return WriteFully(fd_, bytes + begin, end - begin);
+  };
+  size_t run_start = 0;
+  for (size_t offset = 0; offset < size; offset += kSectorSize) {
+    const uint64_t sector = (position_ + offset) / kSectorSize;
+    Observe(sector, bytes + offset);
+    if (!IsHole(sector, bytes + offset)) continue;
+    auto status = write_run(run_start, offset);
+    if (!status.ok()) return status;
+    run_start = offset + kSectorSize;
+    seek_needed_ = true;
+  }
+  auto status = write_run(run_start, size);
+  position_ += size;
+  return status;
+}
+
+void SparseImageWriter::Observe(const uint64_t sector, const char* bytes) {
+  if (!skip_unallocated_) return;
+  if (sector == HFSMasterDirectoryBlock::kMDBBlock) {
+    auto mdb = HFSMasterDirectoryBlock::FromBlock(
+        absl::MakeConstSpan(bytes, kSectorSize));
+    if (!mdb.ok() || !mdb->Valid().ok() ||
+        mdb->allocation_block_size() < kSectorSize) {
+      return;
+    }
+    // The decision for each allocation block is made as it goes by, so the
+    // whole bitmap must come before the first of them, as it does on every
+    // volume Apple's software formats.
+    const uint64_t bitmap_sectors =
+        (mdb->num_allocation_blocks() + 8 * kSectorSize - 1) /
+        (8 * kSectorSize);
+    if (mdb->volume_bitmap_block() <= sector ||
+        mdb->volume_bitmap_block() + bitmap_sectors >
+            mdb->first_allocation_block()) {
+      return;
+    }
+    mdb_ = *mdb;
+    bitmap_.reserve(bitmap_sectors * kSectorSize);
+  } else if (mdb_.has_value() && sector >= mdb_->volume_bitmap_block() &&
+             sector < mdb_->first_allocation_block() &&
+             bitmap_.size() * 8 < mdb_->num_allocation_blocks()) {
+    bitmap_.insert(bitmap_.end(), bytes, bytes + kSectorSize);
+  }
+}
+
+bool SparseImageWriter::IsHole(const uint64_t sector, const char* bytes) {
+  if (memcmp(bytes, kZeroSector, kSectorSize) == 0) return true;
+  if (!mdb_.has_value() || sector < mdb_->first_allocation_block()) {
+    return false;
+  }
+  const uint64_t block = (sector - mdb_->first_allocation_block()) /
+                         (mdb_->allocation_block_size() / kSectorSize);
+  if (block >= mdb_->num_allocation_blocks() || block / 8 >= bitmap_.size()) {
+    return false;
+  }
+  // The most significant bit of the first byte is allocation block 0; set
+  // bits are in use.
+  return (bitmap_[block / 8] & (0x80 >> (block % 8))) == 0;
+}
+
+absl::Status SparseImageWriter::Finish() {
+  const size_t tail = partial_.size();
+  if (tail > 0 && memcmp(partial_.data(), kZeroSector, tail) != 0) {
+    if (seek_needed_ && lseek(fd_, position_, SEEK_SET) < 0) {
+      return absl::ResourceExhaustedError(absl::StrFormat(
+          "Could not seek output to %d: %s", position_, strerror(errno)));
+    }
+    seek_needed_ = false;
+    bytes_written_ += tail;
+    auto status = WriteFully(fd_, partial_.data(), tail);
+    if (!status.ok()) return status;
+  }
+  position_ += tail;
+  partial_.clear();
+  if (ftruncate(fd_, position_) != 0) {
+    return absl::ResourceExhaustedError(absl::StrFormat(
+        "Could not set output length to %d: %s", position_, strerror(errno)));
+  }
+  return absl::OkStatus();
+}
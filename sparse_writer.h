@@ -0,0 +1,62 @@
+#ifndef __SPARSE_WRITER_H__
+#define __SPARSE_WRITER_H__
+
+// Writing a raw disk image to a file with holes where the image holds
+// nothing: all-zero sectors and, optionally, the sectors of HFS allocation
+// blocks that the volume bitmap marks free. Most floppy images are largely
+// empty, so the output takes a fraction of its size on disk and the write
+// moves a fraction of its bytes.
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "hfs_basic.h"
+
+class SparseImageWriter {
+ public:
+  // Writes to `fd`, which must be an empty regular file (freshly created or
+  // truncated, so that its holes read as zeros). If `skip_unallocated`, the
+  // sectors of free allocation blocks are left as holes too, so they read
+  // back as zeros whatever the image held there; this takes an HFS volume,
+  // and otherwise only zero sectors are skipped.
+  SparseImageWriter(int fd, bool skip_unallocated);
+
+  // Takes the next `chunk_size` bytes of the image, of any size.
+  absl::Status Write(const char* chunk, size_t chunk_size);
+  // Writes any partial last sector and sets the file length, so that a hole
+  // at the end still counts. Call once, after the last Write.
+  absl::Status Finish();
+
+  // Bytes taken by Write.
+  uint64_t size() const { return position_ + partial_.size(); }
+  // Bytes actually written to the file; the rest are holes.
+  uint64_t bytes_written() const { return bytes_written_; }
+
+ private:
+  static constexpr size_t kSectorSize = 512;
+
+  // Whether the whole sector `sector`, holding `bytes`, can be a hole.
+  bool IsHole(uint64_t sector, const char* bytes);
+  // Looks for the MDB and volume bitmap among the sectors passing through.
+  void Observe(uint64_t sector, const char* bytes);
+  // Writes or skips the whole sectors in `bytes`, at position_.
+  absl::Status WriteSectors(const char* bytes, size_t size);
+
+  const int fd_;
+  const bool skip_unallocated_;
+  // Offset in the image, and in the file, of the next whole sector.
+  uint64_t position_ = 0;
+  // Whether the file position is not at position_, after a hole.
+  bool seek_needed_ = false;
+  uint64_t bytes_written_ = 0;
+  // The start of a sector split across chunks.
+  std::vector<char> partial_;
+  // The volume, once its MDB has gone by, and as much of its bitmap as has.
+  std::optional<HFSMasterDirectoryBlock> mdb_;
+  std::vector<uint8_t> bitmap_;
+};
+
+#endif  // __SPARSE_WRITER_H__
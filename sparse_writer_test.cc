@@ -0,0 +1,99 @@
+#include "sparse_writer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "endian.h"
+#include "gtest/gtest.h"
+#include "test_images.h"
+
+namespace {
+
+constexpr size_t kSectors = 1600;
+
+// An 800k HFS image of one-sector allocation blocks from sector 4, of which
+// only blocks 0 to 9 are in use. Every sector holds data, except sectors
+// 100 to 109 (free blocks 96 to 105), which are zeros, and the last sector,
+// which is zeros up to its last byte.
+std::vector<char> TestImage() {
+  std::vector<char> image(kSectors * 512);
+  for (size_t i = 0; i < image.size(); ++i) image[i] = 'a' + i % 26;
+  std::fill(image.begin() + 100 * 512, image.begin() + 110 * 512, '\0');
+  std::fill(image.end() - 512, image.end() - 1, '\0');
+  char* mdb = image.data() + 2 * 512;
+  WriteTestMDB(mdb, kSectors - 6, "");
+  WriteBigEndian2(3, mdb + 14);  // volume bitmap block
+  char* bitmap = image.data() + 3 * 512;
+  memset(bitmap, 0, 512);
+  bitmap[0] = '\xff';  // blocks 0 to 7
+  bitmap[1] = '\xc0';  // blocks 8 and 9
+  return image;
+}
+
+// Writes `image` through a SparseImageWriter in chunks of `chunk_size`,
+// returning the bytes it wrote.
+uint64_t WriteSparse(const std::string& path, const std::vector<char>& image,
+                     const bool skip_unallocated, const size_t chunk_size) {
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  EXPECT_GE(fd, 0);
+  SparseImageWriter writer(fd, skip_unallocated);
+  for (size_t offset = 0; offset < image.size(); offset += chunk_size) {
+    const size_t n = std::min(chunk_size, image.size() - offset);
+    EXPECT_TRUE(writer.Write(image.data() + offset, n).ok());
+  }
+  EXPECT_TRUE(writer.Finish().ok());
+  EXPECT_EQ(image.size(), writer.size());
+  close(fd);
+  return writer.bytes_written();
+}
+
+TEST(SparseImageWriter, SkipsZeroSectors) {
+  const std::vector<char> image = TestImage();
+  const std::string path = testing::TempDir() + "/sparse_zeros.img";
+  for (const size_t chunk : {512, 1000, 65536, 819200}) {
+    const uint64_t written = WriteSparse(path, image, false, chunk);
+    EXPECT_EQ(std::string(image.begin(), image.end()), ReadFile(path))
+        << "chunk " << chunk;
+    // The last sector is not all zeros, so only the ten are holes.
+    EXPECT_EQ(image.size() - 10 * 512, written) << "chunk " << chunk;
+  }
+}
+
+TEST(SparseImageWriter, SkipsUnallocatedBlocks) {
+  const std::vector<char> image = TestImage();
+  const std::string path = testing::TempDir() + "/sparse_unallocated.img";
+  std::vector<char> expected = image;
+  // Allocation blocks 10 on, from sector 14 to the two reserved sectors at
+  // the end, read back as zeros.
+  std::fill(expected.begin() + 14 * 512, expected.end() - 2 * 512, '\0');
+  for (const size_t chunk : {512, 1000, 819200}) {
+    const uint64_t written = WriteSparse(path, image, true, chunk);
+    EXPECT_EQ(std::string(expected.begin(), expected.end()), ReadFile(path))
+        << "chunk " << chunk;
+    EXPECT_EQ(16 * 512, written) << "chunk " << chunk;
+  }
+}
+
+TEST(SparseImageWriter, NotHFSSkipsOnlyZeros) {
+  std::vector<char> image = TestImage();
+  image[2 * 512] = 'X';  // No longer an MDB.
+  const std::string path = testing::TempDir() + "/sparse_not_hfs.img";
+  const uint64_t written = WriteSparse(path, image, true, 4096);
+  EXPECT_EQ(std::string(image.begin(), image.end()), ReadFile(path));
+  EXPECT_EQ(image.size() - 10 * 512, written);
+}
+
+TEST(SparseImageWriter, TrailingHoleSetsLength) {
+  std::vector<char> image(3 * 512 + 100, '\0');
+  image[0] = 1;
+  const std::string path = testing::TempDir() + "/sparse_tail.img";
+  EXPECT_EQ(512, WriteSparse(path, image, false, 700));
+  EXPECT_EQ(std::string(image.begin(), image.end()), ReadFile(path));
+}
+
+}  // namespace
@@ -0,0 +1,56 @@
+#include "test_images.h"
+
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#include "disk_copy.h"
+#include "endian.h"
+#include "gtest/gtest.h"
+
+void WriteTestMDB(char* const mdb, const uint16_t allocation_blocks,
+                  const std::string_view name) {
+  memset(mdb, 0, 512);
+  WriteBigEndian2(0x4244, mdb);                  // signature
+  WriteBigEndian2(allocation_blocks, mdb + 18);  // allocation blocks
+  WriteBigEndian4(512, mdb + 20);                // allocation block size
+  WriteBigEndian2(4, mdb + 28);                  // first allocation block
+  mdb[36] = name.size();
+  memcpy(mdb + 37, name.data(), name.size());
+}
+
+std::vector<char> TestHFSImage(const uint32_t sectors, const char fill,
+                               const std::string_view name) {
+  std::vector<char> image(size_t{sectors} * 512, fill);
+  WriteTestMDB(&image.at(1024), sectors - 6, name);
+  return image;
+}
+
+std::vector<char> RandomHFSImage(const uint32_t sectors,
+                                 const std::string_view name) {
+  std::mt19937 rng(sectors);
+  std::vector<char> image(size_t{sectors} * 512);
+  for (char& c : image) c = static_cast<char>(rng());
+  WriteTestMDB(&image.at(1024), sectors - 6, name);
+  return image;
+}
+
+std::vector<char> TestDiskCopy(const absl::Span<const char> image) {
+  std::vector<char> disk_copy(DiskCopyHeader::kHeaderLength + image.size());
+  auto size = EncodeDiskCopy(image, absl::MakeSpan(disk_copy));
+  EXPECT_TRUE(size.ok()) << size.status();
+  if (size.ok()) disk_copy.resize(*size);
+  return disk_copy;
+}
+
+void WriteFile(const std::string& path, const absl::Span<const char> bytes) {
+  std::ofstream(path, std::ios::binary).write(bytes.data(), bytes.size());
+}
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  std::stringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
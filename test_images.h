@@ -0,0 +1,35 @@
+#ifndef __TEST_IMAGES_H__
+#define __TEST_IMAGES_H__
+
+// Fixtures shared by the tests: small HFS images with just enough of a
+// master directory block for the commands that read one, and the files
+// holding them.
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/types/span.h"
+
+// Writes over the 512 bytes at `mdb` an MDB of the signature,
+// `allocation_blocks` allocation blocks of 512 bytes from sector 4, and the
+// volume name `name`; everything else is zero, for the test to fill in.
+void WriteTestMDB(char* mdb, uint16_t allocation_blocks,
+                  std::string_view name);
+
+// A raw HFS image of `sectors` 512-byte sectors of `fill`, with a
+// WriteTestMDB MDB in sector 2 for `sectors` - 6 allocation blocks.
+std::vector<char> TestHFSImage(uint32_t sectors, char fill,
+                               std::string_view name);
+// As TestHFSImage, but of random bytes, the same for the same `sectors`.
+std::vector<char> RandomHFSImage(uint32_t sectors, std::string_view name);
+
+// `image` encoded as a DC42 file. Fails the test if it cannot be.
+std::vector<char> TestDiskCopy(absl::Span<const char> image);
+
+void WriteFile(const std::string& path, absl::Span<const char> bytes);
+// The contents of the file `path`, or "" if it cannot be read.
+std::string ReadFile(const std::string& path);
+
+#endif  // __TEST_IMAGES_H__
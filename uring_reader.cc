@@ -0,0 +1,330 @@
+#include "uring_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+
+#include "absl/strings/str_format.h"
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+// The kernel reads the submission tail and writes the completion tail
+// concurrently with us; these order our accesses to the shared rings.
+inline unsigned LoadAcquire(const unsigned* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+inline void StoreRelease(unsigned* p, const unsigned v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+void* Offset(void* base, const size_t offset) {
+  return static_cast<char*>(base) + offset;
+}
+
+}  // namespace
+
+struct UringReader::Ring {
+  ~Ring() {
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_bytes);
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+      munmap(cq_ring, cq_ring_bytes);
+    }
+    if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_bytes);
+    if (fd >= 0) close(fd);
+  }
+
+  char* Buffer(const unsigned slot) {
+    return buffers.data() + size_t{slot} * read_bytes;
+  }
+
+  int fd = -1;
+  void* sq_ring = MAP_FAILED;
+  size_t sq_ring_bytes = 0;
+  void* cq_ring = MAP_FAILED;
+  size_t cq_ring_bytes = 0;
+  io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+  size_t sqes_bytes = 0;
+
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned* sq_array;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  io_uring_cqe* cqes;
+
+  // One buffer per submission queue entry, so every read can be in flight.
+  unsigned slots;
+  size_t read_bytes;
+  std::vector<char> buffers;
+  // Whether `buffers` are registered (for IORING_OP_READ_FIXED); otherwise
+  // reads go through IORING_OP_READV with these.
+  bool registered = false;
+  std::vector<iovec> iovecs;
+  // Set if the ring can no longer be trusted (reads may still be in flight).
+  absl::Status broken;
+};
+
+// static
+absl::StatusOr<std::unique_ptr<UringReader>> UringReader::Create(
+    const Options& options) {
+  auto ring = std::make_unique<Ring>();
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = syscall(__NR_io_uring_setup, std::max(options.queue_depth, 1u),
+                     &params);
+  if (ring->fd < 0) {
+    return absl::UnimplementedError(
+        absl::StrFormat("io_uring_setup: %s", strerror(errno)));
+  }
+  ring->sq_ring_bytes =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_bytes =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    ring->sq_ring_bytes = ring->cq_ring_bytes =
+        std::max(ring->sq_ring_bytes, ring->cq_ring_bytes);
+  }
+  ring->sq_ring = mmap(nullptr, ring->sq_ring_bytes, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED) {
+    return absl::UnimplementedError(
+        absl::StrFormat("io_uring submission ring: %s", strerror(errno)));
+  }
+  ring->cq_ring =
+      single_mmap ? ring->sq_ring
+                  : mmap(nullptr, ring->cq_ring_bytes, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_CQ_RING);
+  if (ring->cq_ring == MAP_FAILED) {
+    return absl::UnimplementedError(
+        absl::StrFormat("io_uring completion ring: %s", strerror(errno)));
+  }
+  ring->sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+  ring->sqes = static_cast<io_uring_sqe*>(
+      mmap(nullptr, ring->sqes_bytes, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES));
+  if (ring->sqes == MAP_FAILED) {
+    return absl::UnimplementedError(
+        absl::StrFormat("io_uring submission entries: %s", strerror(errno)));
+  }
+  ring->sq_head = static_cast<unsigned*>(
+      Offset(ring->sq_ring, params.sq_off.head));
+  ring->sq_tail = static_cast<unsigned*>(
+      Offset(ring->sq_ring, params.sq_off.tail));
+  ring->sq_mask =
+      *static_cast<unsigned*>(Offset(ring->sq_ring, params.sq_off.ring_mask));
+  ring->sq_array = static_cast<unsigned*>(
+      Offset(ring->sq_ring, params.sq_off.array));
+  ring->cq_head = static_cast<unsigned*>(
+      Offset(ring->cq_ring, params.cq_off.head));
+  ring->cq_tail = static_cast<unsigned*>(
+      Offset(ring->cq_ring, params.cq_off.tail));
+  ring->cq_mask =
+      *static_cast<unsigned*>(Offset(ring->cq_ring, params.cq_off.ring_mask));
+  ring->cqes = static_cast<io_uring_cqe*>(
+      Offset(ring->cq_ring, params.cq_off.cqes));
+
+  ring->slots = params.sq_entries;
+  ring->read_bytes = std::max<size_t>(2, (options.read_bytes + 1) & ~size_t{1});
+  ring->buffers.resize(size_t{ring->slots} * ring->read_bytes);
+  ring->iovecs.resize(ring->slots);
+  for (unsigned i = 0; i < ring->slots; ++i) {
+    ring->iovecs[i] = iovec{ring->Buffer(i), ring->read_bytes};
+  }
+  // Registration pins the buffers, which RLIMIT_MEMLOCK may not allow; the
+  // reads then work the same, with the kernel mapping each buffer per read.
+  ring->registered =
+      syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS,
+              ring->iovecs.data(), ring->slots) == 0;
+  return std::unique_ptr<UringReader>(new UringReader(std::move(ring)));
+}
+
+std::vector<absl::Status> UringReader::Read(
+    const absl::Span<const Range> ranges, const Consumer consume) {
+  Ring& ring = *ring_;
+  std::vector<absl::Status> statuses(ranges.size(), ring.broken);
+  if (!ring.broken.ok()) return statuses;
+
+  struct RangeState {
+    // Offsets within the range of the next read to submit, and of the next
+    // byte to consume.
+    uint64_t next_read = 0;
+    uint64_t next_consume = 0;
+    // Completed reads waiting for an earlier one: offset to buffer slot.
+    std::map<uint64_t, unsigned> done;
+  };
+  struct Slot {
+    size_t range;
+    uint64_t offset;
+    size_t length;
+    size_t filled;
+  };
+  std::vector<RangeState> states(ranges.size());
+  std::vector<Slot> slots(ring.slots);
+  std::vector<unsigned> free_slots;
+  for (unsigned i = ring.slots; i > 0; --i) free_slots.push_back(i - 1);
+
+  unsigned unsubmitted = 0;
+  unsigned in_flight = 0;
+  // Queues the read that fills the rest of `slot`.
+  auto queue_read = [&](const unsigned slot) {
+    const Slot& s = slots[slot];
+    const unsigned tail = *ring.sq_tail;
+    const unsigned index = tail & ring.sq_mask;
+    io_uring_sqe* sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = ranges[s.range].fd;
+    sqe->off = ranges[s.range].offset + s.offset + s.filled;
+    sqe->user_data = slot;
+    char* target = ring.Buffer(slot) + s.filled;
+    const size_t length = s.length - s.filled;
+    if (ring.registered) {
+      sqe->opcode = IORING_OP_READ_FIXED;
+      sqe->addr = reinterpret_cast<uint64_t>(target);
+      sqe->len = length;
+      sqe->buf_index = slot;
+    } else {
+      ring.iovecs[slot] = iovec{target, length};
+      sqe->opcode = IORING_OP_READV;
+      sqe->addr = reinterpret_cast<uint64_t>(&ring.iovecs[slot]);
+      sqe->len = 1;
+    }
+    ring.sq_array[index] = index;
+    StoreRelease(ring.sq_tail, tail + 1);
+    ++unsubmitted;
+  };
+  auto fail_range = [&](const size_t r, absl::Status status) {
+    statuses[r] = std::move(status);
+    for (const auto& [offset, slot] : states[r].done) {
+      free_slots.push_back(slot);
+    }
+    states[r].done.clear();
+  };
+
+  size_t cursor = 0;
+  while (true) {
+    // Start a read for each range in turn while there are free buffers.
+    for (size_t idle = 0; !free_slots.empty() && idle < ranges.size();) {
+      const size_t r = cursor;
+      cursor = (cursor + 1) % ranges.size();
+      RangeState& state = states[r];
+      if (!statuses[r].ok() || state.next_read >= ranges[r].length) {
+        ++idle;
+        continue;
+      }
+      idle = 0;
+      const unsigned slot = free_slots.back();
+      free_slots.pop_back();
+      const size_t length =
+          std::min<uint64_t>(ring.read_bytes,
+                             ranges[r].length - state.next_read);
+      slots[slot] = Slot{r, state.next_read, length, 0};
+      state.next_read += length;
+      queue_read(slot);
+    }
+    if (unsubmitted == 0 && in_flight == 0) break;
+
+    const int submitted = syscall(__NR_io_uring_enter, ring.fd, unsubmitted,
+                                  1, IORING_ENTER_GETEVENTS, nullptr, 0);
+    if (submitted < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+      ring.broken = absl::InternalError(
+          absl::StrFormat("io_uring_enter: %s", strerror(errno)));
+      for (size_t r = 0; r < ranges.size(); ++r) {
+        if (statuses[r].ok()) statuses[r] = ring.broken;
+      }
+      return statuses;
+    }
+    unsubmitted -= submitted;
+    in_flight += submitted;
+
+    for (unsigned head = *ring.cq_head; head != LoadAcquire(ring.cq_tail);
+         ++head) {
+      const io_uring_cqe& cqe = ring.cqes[head & ring.cq_mask];
+      const unsigned slot = cqe.user_data;
+      const int result = cqe.res;
+      StoreRelease(ring.cq_head, head + 1);
+      --in_flight;
+      Slot& s = slots[slot];
+      const Range& range = ranges[s.range];
+      if (!statuses[s.range].ok()) {
+        free_slots.push_back(slot);
+        continue;
+      }
+      if (result == -EINTR || result == -EAGAIN) {
+        queue_read(slot);
+        continue;
+      }
+      if (result <= 0) {
+        free_slots.push_back(slot);
+        const uint64_t at = range.offset + s.offset + s.filled;
+        fail_range(s.range,
+                   result == 0
+                       ? absl::OutOfRangeError(absl::StrFormat(
+                             "Could not read %d bytes at %d: end of file",
+                             s.length - s.filled, at))
+                       : absl::DataLossError(absl::StrFormat(
+                             "Could not read %d bytes at %d: %s",
+                             s.length - s.filled, at, strerror(-result))));
+        continue;
+      }
+      s.filled += result;
+      if (s.filled < s.length) {
+        queue_read(slot);
+        continue;
+      }
+      // Consume this range's completed chunks that are now in order.
+      RangeState& state = states[s.range];
+      state.done.emplace(s.offset, slot);
+      while (!state.done.empty() &&
+             state.done.begin()->first == state.next_consume) {
+        const unsigned ready = state.done.begin()->second;
+        state.done.erase(state.done.begin());
+        auto status =
+            consume(slots[ready].range, ring.Buffer(ready),
+                    slots[ready].length);
+        state.next_consume += slots[ready].length;
+        free_slots.push_back(ready);
+        if (!status.ok()) {
+          fail_range(slots[ready].range, std::move(status));
+          break;
+        }
+      }
+    }
+  }
+  return statuses;
+}
+
+#else  // !__linux__
+
+struct UringReader::Ring {};
+
+// static
+absl::StatusOr<std::unique_ptr<UringReader>> UringReader::Create(
+    const Options&) {
+  return absl::UnimplementedError("io_uring is only available on Linux");
+}
+
+std::vector<absl::Status> UringReader::Read(
+    const absl::Span<const Range> ranges, const Consumer) {
+  return std::vector<absl::Status>(
+      ranges.size(), absl::UnimplementedError("io_uring is not available"));
+}
+
+#endif  // __linux__
+
+UringReader::UringReader(std::unique_ptr<Ring> ring) : ring_(std::move(ring)) {}
+
+UringReader::~UringReader() = default;
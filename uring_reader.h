@@ -0,0 +1,68 @@
+#ifndef __URING_READER_H__
+#define __URING_READER_H__
+
+// Reading byte ranges of many files at once through Linux io_uring, with
+// dozens of large reads in flight across all of them. One synchronous read
+// at a time leaves a spinning disk idle between requests; with many
+// outstanding, the kernel and the drive can order them by position. The
+// ring is driven with the raw system calls, so only the kernel headers are
+// needed.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+
+class UringReader {
+ public:
+  struct Options {
+    // Reads in flight at once, over all files. Each has its own buffer,
+    // registered with the kernel when the memory lock limit allows.
+    unsigned queue_depth = 64;
+    // Bytes per read, rounded up to even; every chunk of a range but the
+    // last is this size.
+    size_t read_bytes = 256 * 1024;
+  };
+
+  // A byte range of an open file.
+  struct Range {
+    int fd;
+    uint64_t offset;
+    uint64_t length;
+  };
+
+  using Consumer = absl::FunctionRef<absl::Status(
+      size_t range, const char* chunk, size_t chunk_size)>;
+
+  // Sets up a ring and its buffers. Returns UnimplementedError where
+  // io_uring is unavailable (not Linux, a kernel older than 5.1, or disabled
+  // by sysctl or a seccomp filter), so that callers can read another way.
+  static absl::StatusOr<std::unique_ptr<UringReader>> Create(
+      const Options& options);
+
+  UringReader(const UringReader&) = delete;
+  UringReader& operator=(const UringReader&) = delete;
+  ~UringReader();
+
+  // Reads all of `ranges`, calling consume(i, chunk, chunk_size) on the
+  // calling thread with the chunks of ranges[i] in order; chunks of
+  // different ranges interleave as their reads complete. Returns a status
+  // per range: OK, the first read error, or the first error from `consume`,
+  // after which that range is not consumed further. Not thread-safe.
+  std::vector<absl::Status> Read(absl::Span<const Range> ranges,
+                                 Consumer consume);
+
+ private:
+  struct Ring;
+
+  explicit UringReader(std::unique_ptr<Ring> ring);
+
+  std::unique_ptr<Ring> ring_;
+};
+
+#endif  // __URING_READER_H__
@@ -0,0 +1,118 @@
+#include "uring_reader.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+class UringReaderTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    UringReader::Options options;
+    options.queue_depth = 8;
+    options.read_bytes = 4096;
+    auto reader = UringReader::Create(options);
+    if (!reader.ok()) {
+      ASSERT_EQ(absl::StatusCode::kUnimplemented, reader.status().code());
+      GTEST_SKIP() << reader.status();
+    }
+    reader_ = std::move(*reader);
+  }
+
+  void TearDown() override {
+    for (const int fd : fds_) close(fd);
+  }
+
+  // Writes a file of `size` bytes, different for each `seed`, and opens it.
+  int OpenFile(const int seed, const size_t size, std::string* contents) {
+    contents->resize(size);
+    for (size_t i = 0; i < size; ++i) {
+      (*contents)[i] = static_cast<char>(i * (2 * seed + 1) + i / 4096);
+    }
+    const std::string path = testing::TempDir() + "/uring_reader_test_" +
+                             std::to_string(seed);
+    std::ofstream(path, std::ios::binary) << *contents;
+    const int fd = open(path.c_str(), O_RDONLY);
+    EXPECT_GE(fd, 0);
+    fds_.push_back(fd);
+    return fd;
+  }
+
+  std::unique_ptr<UringReader> reader_;
+  std::vector<int> fds_;
+};
+
+TEST_F(UringReaderTest, ReadsRangesInOrder) {
+  // More ranges than reads in flight, of sizes that are not a whole number
+  // of reads, with one empty.
+  std::vector<std::string> contents(12);
+  std::vector<UringReader::Range> ranges;
+  for (int i = 0; i < 12; ++i) {
+    const int fd = OpenFile(i, 1000 + 5000 * i, &contents[i]);
+    ranges.push_back(UringReader::Range{fd, 10, contents[i].size() - 10});
+  }
+  ranges[0].length = 0;
+  contents[0].resize(10);
+  std::vector<std::string> read(ranges.size());
+  std::vector<size_t> chunk_sizes;
+  const auto statuses = reader_->Read(
+      ranges, [&](size_t range, const char* chunk, size_t chunk_size) {
+        read[range].append(chunk, chunk_size);
+        chunk_sizes.push_back(chunk_size);
+        return absl::OkStatus();
+      });
+  ASSERT_EQ(ranges.size(), statuses.size());
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    EXPECT_TRUE(statuses[i].ok()) << i << ": " << statuses[i];
+    EXPECT_EQ(contents[i].substr(10), read[i]) << i;
+  }
+  for (const size_t size : chunk_sizes) EXPECT_LE(size, 4096);
+
+  // The reader can be used again.
+  read.assign(ranges.size(), "");
+  for (const auto& status : reader_->Read(
+           ranges, [&](size_t range, const char* chunk, size_t chunk_size) {
+             read[range].append(chunk, chunk_size);
+             return absl::OkStatus();
+           })) {
+    EXPECT_TRUE(status.ok()) << status;
+  }
+  EXPECT_EQ(contents[11].substr(10), read[11]);
+}
+
+TEST_F(UringReaderTest, ErrorsStayWithTheirRange) {
+  std::string a, b, c;
+  const int fd_a = OpenFile(1, 50000, &a);
+  const int fd_b = OpenFile(2, 50000, &b);
+  const int fd_c = OpenFile(3, 50000, &c);
+  const UringReader::Range ranges[] = {
+      {fd_a, 0, a.size()},
+      {fd_b, 0, b.size() + 100},  // Past the end of the file.
+      {-1, 0, 100},               // Not a file.
+      {fd_c, 0, c.size()},
+  };
+  std::string read_a, read_c;
+  size_t chunks_of_c = 0;
+  const auto statuses = reader_->Read(
+      ranges, [&](size_t range, const char* chunk, size_t chunk_size) {
+        if (range == 0) read_a.append(chunk, chunk_size);
+        if (range == 3 && ++chunks_of_c == 2) {
+          return absl::CancelledError("enough");
+        }
+        return absl::OkStatus();
+      });
+  EXPECT_TRUE(statuses[0].ok()) << statuses[0];
+  EXPECT_EQ(a, read_a);
+  EXPECT_EQ(absl::StatusCode::kOutOfRange, statuses[1].code());
+  EXPECT_EQ(absl::StatusCode::kDataLoss, statuses[2].code());
+  EXPECT_EQ(absl::StatusCode::kCancelled, statuses[3].code());
+  EXPECT_EQ(2, chunks_of_c);
+}
+
+}  // namespace
@@ -0,0 +1,176 @@
+#include "volume_usage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "endian.h"
+#include "hfs_basic.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+constexpr uint32_t kSectorSize = DiskCopyImage::kSectorSize;
+constexpr uint32_t kBlocksPerBitmapSector = 8 * kSectorSize;
+
+int PopCount8(const uint8_t byte) { return __builtin_popcount(byte); }
+
+}  // namespace
+
+double VolumeUsage::FreeFragmentation() const {
+  if (free_blocks == 0) return 0;
+  return 1 - static_cast<double>(largest_free_run) / free_blocks;
+}
+
+std::string VolumeUsage::DebugString() const {
+  return absl::StrFormat(
+      "used %d of %d blocks of %d bytes; free %d (MDB %d) in %d runs, "
+      "largest %d, fragmentation %.3f",
+      used_blocks, allocation_blocks, allocation_block_size, free_blocks,
+      mdb_free_blocks, free_runs, largest_free_run, FreeFragmentation());
+}
+
+uint64_t CountSetBits(const absl::Span<const char> bytes) {
+  const char* const p = bytes.data();
+  uint64_t count = 0;
+  size_t i = 0;
+#if defined(__SSE2__)
+  // Bits summed within each byte by halves, then the bytes of each half
+  // summed by _mm_sad_epu8.
+  const __m128i m1 = _mm_set1_epi8(0x55);
+  const __m128i m2 = _mm_set1_epi8(0x33);
+  const __m128i m4 = _mm_set1_epi8(0x0f);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i total = zero;
+  for (; i + 16 <= bytes.size(); i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi16(v, 1), m1));
+    v = _mm_add_epi8(_mm_and_si128(v, m2),
+                     _mm_and_si128(_mm_srli_epi16(v, 2), m2));
+    v = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi16(v, 4)), m4);
+    total = _mm_add_epi64(total, _mm_sad_epu8(v, zero));
+  }
+  uint64_t halves[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(halves), total);
+  count = halves[0] + halves[1];
+#elif defined(__ARM_NEON)
+  uint64x2_t total = vdupq_n_u64(0);
+  for (; i + 16 <= bytes.size(); i += 16) {
+    const uint8x16_t counts =
+        vcntq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(p + i)));
+    total = vpadalq_u32(total, vpaddlq_u16(vpaddlq_u8(counts)));
+  }
+  count = vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+#endif
+  for (; i < bytes.size(); ++i) count += PopCount8(p[i]);
+  return count;
+}
+
+absl::StatusOr<VolumeUsage> CountVolumeUsage(
+    const absl::Span<const char> bitmap, const uint32_t allocation_blocks) {
+  const size_t whole_bytes = allocation_blocks / 8;
+  const uint32_t extra_bits = allocation_blocks % 8;
+  const size_t bitmap_bytes = whole_bytes + (extra_bits != 0);
+  if (bitmap.size() < bitmap_bytes) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "Volume bitmap of %d bytes cannot hold %d allocation blocks",
+        bitmap.size(), allocation_blocks));
+  }
+  VolumeUsage usage;
+  usage.allocation_blocks = allocation_blocks;
+  uint64_t used = CountSetBits(bitmap.subspan(0, whole_bytes));
+  if (extra_bits != 0) {
+    used += PopCount8(static_cast<uint8_t>(bitmap[whole_bytes]) >>
+                      (8 - extra_bits));
+  }
+  usage.used_blocks = used;
+  usage.free_blocks = allocation_blocks - used;
+
+  // Free runs, 64 blocks at a time: `free` has a bit set for each free
+  // block of the word, block order from the most significant bit.
+  std::vector<char> words((bitmap_bytes + 7) & ~size_t{7});
+  if (bitmap_bytes != 0) memcpy(words.data(), bitmap.data(), bitmap_bytes);
+  // Free blocks at the end of the words so far.
+  uint32_t run = 0;
+  for (size_t w = 0; w < words.size(); w += 8) {
+    uint64_t free = ~BigEndian8(words.data() + w);
+    const uint64_t blocks_left = allocation_blocks - uint64_t{w} * 8;
+    if (blocks_left < 64) free &= ~uint64_t{0} << (64 - blocks_left);
+    if (free == 0) {
+      run = 0;
+      continue;
+    }
+    // A run starts at each free block whose predecessor is in use.
+    const uint64_t previous_free = free >> 1 | uint64_t{run > 0} << 63;
+    usage.free_runs += __builtin_popcountll(free & ~previous_free);
+    if (free == ~uint64_t{0}) {
+      run += 64;
+      usage.largest_free_run = std::max(usage.largest_free_run, run);
+      continue;
+    }
+    // The run continuing from the last word ends where the first block in
+    // use is; the one ending this word continues into the next.
+    const int leading = __builtin_clzll(~free);
+    const int trailing = __builtin_ctzll(~free);
+    usage.largest_free_run = std::max<uint32_t>(usage.largest_free_run,
+                                                run + leading);
+    // The longest run between them: each step shortens every run by one.
+    uint64_t inner = free & (~uint64_t{0} >> leading) &
+                     (~uint64_t{0} << trailing);
+    uint32_t inner_run = 0;
+    for (; inner != 0; inner &= inner << 1) ++inner_run;
+    usage.largest_free_run = std::max(usage.largest_free_run, inner_run);
+    run = trailing;
+  }
+  usage.largest_free_run = std::max(usage.largest_free_run, run);
+  return usage;
+}
+
+absl::StatusOr<VolumeUsage> ReadVolumeUsage(DiskCopyImage& image) {
+  char block[kSectorSize];
+  auto status = image.ReadSectors(HFSMasterDirectoryBlock::kMDBBlock, 1,
+                                  absl::MakeSpan(block));
+  if (!status.ok()) {
+    return status;
+  }
+  auto mdb = HFSMasterDirectoryBlock::FromBlock(block);
+  if (!mdb.ok()) {
+    return mdb.status();
+  }
+  auto volume_blocks = mdb->Valid();
+  if (!volume_blocks.ok()) {
+    return volume_blocks.status();
+  }
+  const uint32_t blocks = mdb->num_allocation_blocks();
+  const uint32_t bitmap_sectors =
+      (blocks + kBlocksPerBitmapSector - 1) / kBlocksPerBitmapSector;
+  if (uint64_t{mdb->volume_bitmap_block()} + bitmap_sectors >
+      image.SectorCount()) {
+    return absl::DataLossError(absl::StrFormat(
+        "Volume bitmap of %d sectors at sector %d is beyond the %d sectors "
+        "of the image",
+        bitmap_sectors, mdb->volume_bitmap_block(), image.SectorCount()));
+  }
+  std::vector<char> bitmap(size_t{bitmap_sectors} * kSectorSize);
+  if (bitmap_sectors > 0) {
+    status = image.ReadSectors(mdb->volume_bitmap_block(), bitmap_sectors,
+                               absl::MakeSpan(bitmap));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  auto usage = CountVolumeUsage(bitmap, blocks);
+  if (!usage.ok()) {
+    return usage.status();
+  }
+  usage->allocation_block_size = mdb->allocation_block_size();
+  usage->mdb_free_blocks = mdb->num_free_allocation_blocks();
+  return usage;
+}
@@ -0,0 +1,54 @@
+#ifndef __VOLUME_USAGE_H__
+#define __VOLUME_USAGE_H__
+
+// Allocation statistics of an HFS volume, counted from its volume bitmap
+// rather than taken from the free block count in the MDB, which is not
+// always kept up to date. For capacity planning over an archive, and for
+// deciding which images are worth deduplicating.
+
+#include <cstdint>
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "disk_copy_image.h"
+
+struct VolumeUsage {
+  uint32_t allocation_blocks = 0;
+  // Bytes per allocation block.
+  uint32_t allocation_block_size = 0;
+  uint32_t used_blocks = 0;
+  uint32_t free_blocks = 0;
+  // The free block count the MDB records.
+  uint32_t mdb_free_blocks = 0;
+  // Runs of consecutive free blocks, and the length of the longest.
+  uint32_t free_runs = 0;
+  uint32_t largest_free_run = 0;
+
+  // The fraction of the free blocks outside the largest free run: 0 if the
+  // free space is one run (or there is none), nearer 1 the more it is
+  // scattered.
+  double FreeFragmentation() const;
+
+  // One line, e.g. "used 120 of 1594 blocks of 512 bytes; free 1474 (MDB
+  // 1474) in 3 runs, largest 1400, fragmentation 0.050".
+  std::string DebugString() const;
+};
+
+// The number of set bits in `bytes`, counted sixteen bytes at a time with
+// SIMD where the target has it (SSE2 or NEON).
+uint64_t CountSetBits(absl::Span<const char> bytes);
+
+// The statistics of the first `allocation_blocks` bits of the volume bitmap
+// `bitmap`, whose first byte's most significant bit is allocation block 0,
+// and whose set bits are blocks in use. Fails if `bitmap` is shorter. Sets
+// neither allocation_block_size nor mdb_free_blocks.
+absl::StatusOr<VolumeUsage> CountVolumeUsage(absl::Span<const char> bitmap,
+                                             uint32_t allocation_blocks);
+
+// Reads the MDB of the HFS volume in `image`, then its volume bitmap from
+// the MDB's volume_bitmap_block(), and counts its usage. Reads nothing
+// else.
+absl::StatusOr<VolumeUsage> ReadVolumeUsage(DiskCopyImage& image);
+
+#endif  // __VOLUME_USAGE_H__
@@ -0,0 +1,129 @@
+#include "volume_usage.h"
+
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "disk_copy_image.h"
+#include "endian.h"
+#include "gtest/gtest.h"
+#include "image_source.h"
+#include "test_images.h"
+
+namespace {
+
+// A bitmap with the blocks of `used` (one character per block, 'x' for in
+// use) set, padded with set bits to a whole sector.
+std::vector<char> Bitmap(const std::string& used) {
+  std::vector<char> bitmap(512, static_cast<char>(0xff));
+  memset(bitmap.data(), 0, (used.size() + 7) / 8);
+  for (size_t b = 0; b < used.size(); ++b) {
+    if (used[b] == 'x') bitmap[b / 8] |= 0x80 >> (b % 8);
+  }
+  return bitmap;
+}
+
+TEST(VolumeUsageTest, CountSetBits) {
+  std::mt19937 rng(7);
+  for (const size_t size : {0, 1, 15, 16, 17, 100, 512, 8191}) {
+    std::vector<char> bytes(size);
+    uint64_t expected = 0;
+    for (char& c : bytes) {
+      c = static_cast<char>(rng());
+      for (int bit = 0; bit < 8; ++bit) expected += (c >> bit) & 1;
+    }
+    EXPECT_EQ(expected, CountSetBits(bytes)) << size;
+  }
+}
+
+TEST(VolumeUsageTest, CountsUsedAndFree) {
+  const std::string used = "xxxx..x.........xx" + std::string(70, '.') + "x";
+  auto usage = CountVolumeUsage(Bitmap(used), used.size());
+  ASSERT_TRUE(usage.ok()) << usage.status();
+  EXPECT_EQ(used.size(), usage->allocation_blocks);
+  EXPECT_EQ(8, usage->used_blocks);
+  EXPECT_EQ(used.size() - 8, usage->free_blocks);
+  EXPECT_EQ(3, usage->free_runs);
+  EXPECT_EQ(70, usage->largest_free_run);
+  EXPECT_NEAR(1 - 70.0 / 81, usage->FreeFragmentation(), 1e-9);
+}
+
+TEST(VolumeUsageTest, RunsCrossWords) {
+  // A free run from block 60 to 200, across three words, beside runs that
+  // end a word and start the next.
+  std::string used(300, 'x');
+  for (int b = 60; b < 200; ++b) used[b] = '.';
+  used[255] = '.';
+  used[256] = '.';
+  used[299] = '.';
+  auto usage = CountVolumeUsage(Bitmap(used), used.size());
+  ASSERT_TRUE(usage.ok()) << usage.status();
+  EXPECT_EQ(143, usage->free_blocks);
+  EXPECT_EQ(3, usage->free_runs);
+  EXPECT_EQ(140, usage->largest_free_run);
+}
+
+TEST(VolumeUsageTest, IgnoresBitsPastTheLastBlock) {
+  // The padding of Bitmap() is in use; clear it, which must not count.
+  std::vector<char> bitmap = Bitmap(std::string(13, '.'));
+  memset(bitmap.data() + 1, 0, bitmap.size() - 1);
+  auto usage = CountVolumeUsage(bitmap, 13);
+  ASSERT_TRUE(usage.ok()) << usage.status();
+  EXPECT_EQ(0, usage->used_blocks);
+  EXPECT_EQ(13, usage->free_blocks);
+  EXPECT_EQ(1, usage->free_runs);
+  EXPECT_EQ(13, usage->largest_free_run);
+  EXPECT_EQ(0, usage->FreeFragmentation());
+
+  usage = CountVolumeUsage(Bitmap(std::string(13, 'x')), 13);
+  ASSERT_TRUE(usage.ok()) << usage.status();
+  EXPECT_EQ(13, usage->used_blocks);
+  EXPECT_EQ(0, usage->free_runs);
+  EXPECT_EQ(0, usage->largest_free_run);
+  EXPECT_EQ(0, usage->FreeFragmentation());
+
+  EXPECT_EQ(absl::StatusCode::kInvalidArgument,
+            CountVolumeUsage(std::vector<char>(2), 17).status().code());
+}
+
+TEST(VolumeUsageTest, ReadsTheBitmapOfAnImage) {
+  // An 800K volume: 1594 blocks, bitmap at logical block 3, claiming more
+  // free blocks than the bitmap has.
+  std::vector<char> disk = TestHFSImage(1600, 0, "");
+  char* mdb = disk.data() + 1024;
+  WriteBigEndian2(3, mdb + 14);     // volume bitmap block
+  WriteBigEndian2(1594, mdb + 34);  // free allocation blocks
+  std::string used(1594, '.');
+  for (int b = 0; b < 10; ++b) used[b] = 'x';
+  used[800] = 'x';
+  const std::vector<char> bitmap = Bitmap(used);
+  memcpy(disk.data() + 3 * 512, bitmap.data(), bitmap.size());
+
+  auto image = DiskCopyImage::OpenRaw(
+      std::make_unique<MemoryImageSource>(disk), DiskCopyImage::Options());
+  ASSERT_TRUE(image.ok()) << image.status();
+  auto usage = ReadVolumeUsage(**image);
+  ASSERT_TRUE(usage.ok()) << usage.status();
+  EXPECT_EQ(1594, usage->allocation_blocks);
+  EXPECT_EQ(512, usage->allocation_block_size);
+  EXPECT_EQ(11, usage->used_blocks);
+  EXPECT_EQ(1583, usage->free_blocks);
+  EXPECT_EQ(1594, usage->mdb_free_blocks);
+  EXPECT_EQ(2, usage->free_runs);
+  EXPECT_EQ(793, usage->largest_free_run);
+  EXPECT_EQ(
+      "used 11 of 1594 blocks of 512 bytes; free 1583 (MDB 1594) in 2 runs, "
+      "largest 793, fragmentation 0.499",
+      usage->DebugString());
+
+  WriteBigEndian2(1600, mdb + 14);
+  image = DiskCopyImage::OpenRaw(std::make_unique<MemoryImageSource>(disk),
+                                 DiskCopyImage::Options());
+  ASSERT_TRUE(image.ok()) << image.status();
+  EXPECT_EQ(absl::StatusCode::kDataLoss,
+            ReadVolumeUsage(**image).status().code());
+}
+
+}  // namespace